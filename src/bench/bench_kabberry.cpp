@@ -0,0 +1,28 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/quark.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "pubkey.h"
+#include "random.h"
+#include "util.h"
+
+int main(int argc, char** argv)
+{
+    SHA256AutoDetect();
+    QuarkAutoDetect();
+    RandomInit();
+    ECC_Start();
+    ECCVerifyHandle verifyHandle;
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+
+    benchmark::BenchRunner::RunAll();
+
+    ECC_Stop();
+}
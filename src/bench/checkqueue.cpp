@@ -0,0 +1,79 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "checkqueue.h"
+
+#include <cassert>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+//! Checks per simulated block
+static const unsigned int BLOCK_CHECKS = 5000;
+//! Checks the master adds at once, as ConnectBlock does per transaction
+static const unsigned int ADD_BATCH = 100;
+
+/** Burns about as many cycles as a cheap script check. */
+struct BenchCheck {
+    unsigned int nWork;
+
+    BenchCheck(unsigned int nWorkIn = 200) : nWork(nWorkIn) {}
+
+    bool operator()()
+    {
+        volatile unsigned int x = 0;
+        for (unsigned int i = 0; i < nWork; i++)
+            x = x + i;
+        return true;
+    }
+
+    void swap(BenchCheck& check)
+    {
+        std::swap(nWork, check.nWork);
+    }
+};
+
+/** One block's worth of checks per iteration, on nThreads threads including the master. */
+static void RunCheckQueue(benchmark::State& state, int nThreads)
+{
+    CCheckQueue<BenchCheck> queue(128);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<BenchCheck>::Thread, &queue));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<BenchCheck> control(&queue);
+        std::vector<BenchCheck> vChecks;
+        for (unsigned int i = 0; i < BLOCK_CHECKS; i++) {
+            vChecks.push_back(BenchCheck());
+            if (vChecks.size() == ADD_BATCH) {
+                control.Add(vChecks);
+                vChecks.clear();
+            }
+        }
+        control.Add(vChecks);
+        bool fOk = control.Wait();
+        assert(fOk);
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+static void CheckQueue1Thread(benchmark::State& state) { RunCheckQueue(state, 1); }
+static void CheckQueue2Threads(benchmark::State& state) { RunCheckQueue(state, 2); }
+static void CheckQueue4Threads(benchmark::State& state) { RunCheckQueue(state, 4); }
+static void CheckQueue8Threads(benchmark::State& state) { RunCheckQueue(state, 8); }
+static void CheckQueue16Threads(benchmark::State& state) { RunCheckQueue(state, 16); }
+static void CheckQueue32Threads(benchmark::State& state) { RunCheckQueue(state, 32); }
+
+BENCHMARK(CheckQueue1Thread);
+BENCHMARK(CheckQueue2Threads);
+BENCHMARK(CheckQueue4Threads);
+BENCHMARK(CheckQueue8Threads);
+BENCHMARK(CheckQueue16Threads);
+BENCHMARK(CheckQueue32Threads);
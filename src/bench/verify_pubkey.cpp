@@ -0,0 +1,72 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "key.h"
+#include "pubkey.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <cassert>
+#include <vector>
+
+namespace
+{
+struct Sig {
+    CPubKey pubkey;
+    uint256 hash;
+    std::vector<unsigned char> vchSig;
+};
+
+/** A mix of recurring and one-off keys, the way block and masternode traffic looks. */
+std::vector<Sig> MakeSignatures()
+{
+    const int nHotKeys = 32;
+    const int nSigs = 1000;
+    std::vector<CKey> vHot(nHotKeys);
+    for (CKey& key : vHot)
+        key.MakeNewKey(true);
+
+    std::vector<Sig> vSigs(nSigs);
+    for (Sig& sig : vSigs) {
+        // Three out of four signatures come from a recurring key.
+        CKey key;
+        if (GetRand(4) != 0)
+            key = vHot[GetRand(nHotKeys)];
+        else
+            key.MakeNewKey(true);
+        sig.pubkey = key.GetPubKey();
+        sig.hash = GetRandHash();
+        bool fSigned = key.Sign(sig.hash, sig.vchSig);
+        assert(fSigned);
+    }
+    return vSigs;
+}
+} // anon namespace
+
+static void VerifyPubKey(benchmark::State& state)
+{
+    const std::vector<Sig> vSigs = MakeSignatures();
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const Sig& sig = vSigs[i++ % vSigs.size()];
+        bool fOk = sig.pubkey.Verify(sig.hash, sig.vchSig);
+        assert(fOk);
+    }
+}
+
+static void VerifyPubKeyCached(benchmark::State& state)
+{
+    const std::vector<Sig> vSigs = MakeSignatures();
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const Sig& sig = vSigs[i++ % vSigs.size()];
+        bool fOk = sig.pubkey.VerifyCached(sig.hash, sig.vchSig);
+        assert(fOk);
+    }
+}
+
+BENCHMARK(VerifyPubKey);
+BENCHMARK(VerifyPubKeyCached);
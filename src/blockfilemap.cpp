@@ -0,0 +1,88 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap(const_cast<char*>(pData), nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CMappedFile::Open(const boost::filesystem::path& path)
+{
+#ifdef WIN32
+    // Not implemented; callers fall back to reading through the file.
+    return nullptr;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps its own reference to the file.
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrintf("Unable to map %s\n", path.string());
+        return nullptr;
+    }
+    return std::shared_ptr<const CMappedFile>(new CMappedFile(static_cast<const char*>(p), st.st_size));
+#endif
+}
+
+void CBlockFileMapper::SetMaxFiles(size_t nMaxFilesIn)
+{
+    LOCK(cs);
+    nMaxFiles = nMaxFilesIn;
+    while (lru.size() > nMaxFiles) {
+        mapFiles.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+std::shared_ptr<const CMappedFile> CBlockFileMapper::Get(int nFile, const boost::filesystem::path& path)
+{
+    LOCK(cs);
+    if (nMaxFiles == 0)
+        return nullptr;
+
+    std::map<int, MappedList::iterator>::iterator it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->second;
+    }
+
+    std::shared_ptr<const CMappedFile> mapping = CMappedFile::Open(path);
+    if (!mapping)
+        return nullptr;
+    lru.push_front(std::make_pair(nFile, mapping));
+    mapFiles[nFile] = lru.begin();
+    if (lru.size() > nMaxFiles) {
+        mapFiles.erase(lru.back().first);
+        lru.pop_back();
+    }
+    return mapping;
+}
+
+void CBlockFileMapper::Forget(int nFile)
+{
+    LOCK(cs);
+    std::map<int, MappedList::iterator>::iterator it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        lru.erase(it->second);
+        mapFiles.erase(it);
+    }
+}
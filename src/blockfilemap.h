@@ -0,0 +1,119 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** A read-only mapping of a whole file; unmapped when the last reference goes away. */
+class CMappedFile
+{
+private:
+    const char* pData;
+    size_t nSize;
+
+    CMappedFile(const char* pDataIn, size_t nSizeIn) : pData(pDataIn), nSize(nSizeIn) {}
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    ~CMappedFile();
+
+    //! Map path, or return null if it cannot be mapped (or mapping is unsupported).
+    static std::shared_ptr<const CMappedFile> Open(const boost::filesystem::path& path);
+
+    const char* data() const { return pData; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Keeps the most recently used block files mapped. Only files that are no
+ * longer appended to may be handed to it, as a mapping does not grow with
+ * its file. Mappings in use by a reader stay valid after eviction.
+ */
+class CBlockFileMapper
+{
+private:
+    typedef std::list<std::pair<int, std::shared_ptr<const CMappedFile> > > MappedList;
+
+    CCriticalSection cs;
+    size_t nMaxFiles;
+    //! most recently used first
+    MappedList lru;
+    std::map<int, MappedList::iterator> mapFiles;
+
+public:
+    explicit CBlockFileMapper(size_t nMaxFilesIn = 0) : nMaxFiles(nMaxFilesIn) {}
+
+    //! Change how many files are kept mapped, 0 disables mapping.
+    void SetMaxFiles(size_t nMaxFilesIn);
+
+    //! Return the mapping of file nFile at path, mapping it if needed; null if disabled or on failure.
+    std::shared_ptr<const CMappedFile> Get(int nFile, const boost::filesystem::path& path);
+
+    //! Drop the mapping of nFile, e.g. before the file is rewritten or deleted.
+    void Forget(int nFile);
+};
+
+/**
+ * The serialized bytes of a block as stored on disk. They point either into
+ * a mapped block file, which is kept alive as long as this object, or into
+ * a private copy read from the file.
+ */
+class CRawBlockData
+{
+private:
+    std::shared_ptr<const CMappedFile> mapping;
+    std::vector<char> vBuffer;
+    const char* pBegin;
+    size_t nSize;
+
+public:
+    CRawBlockData() : pBegin(NULL), nSize(0) {}
+
+    void SetMapped(const std::shared_ptr<const CMappedFile>& mappingIn, size_t nOffset, size_t nSizeIn)
+    {
+        vBuffer.clear();
+        mapping = mappingIn;
+        pBegin = mapping->data() + nOffset;
+        nSize = nSizeIn;
+    }
+
+    //! Make room for a private copy of nSizeIn bytes and return where to put them.
+    char* SetBuffer(size_t nSizeIn)
+    {
+        mapping.reset();
+        vBuffer.resize(nSizeIn);
+        pBegin = vBuffer.data();
+        nSize = nSizeIn;
+        return vBuffer.data();
+    }
+
+    bool IsMapped() const { return mapping != nullptr; }
+    const char* data() const { return pBegin; }
+    size_t size() const { return nSize; }
+
+    //! Serializes as the block itself, which is stored the way it is sent.
+    unsigned int GetSerializeSize(int, int = 0) const
+    {
+        return nSize;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int, int = 0) const
+    {
+        s.write(pBegin, nSize);
+    }
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
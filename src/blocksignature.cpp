@@ -95,5 +95,5 @@ bool CheckBlockSignature(const CBlock& block)
     if (!pubkey.IsValid())
         return error("%s: invalid pubkey %s", __func__, HexStr(pubkey));
 
-    return pubkey.Verify(block.GetHash(), block.vchBlockSig);
+    return pubkey.VerifyCached(block.GetHash(), block.vchBlockSig);
 }
@@ -7,6 +7,8 @@
 
 #include "chain.h"
 
+#include "memusage.h"
+
 
 /**
  * CChain implementation
@@ -80,4 +82,31 @@ uint256 CBlockIndex::GetBlockTrust() const
         uint256 bnPoWTrust = ((~uint256(0) >> 20) / (bnTarget + 1));
         return bnPoWTrust > 1 ? bnPoWTrust : 1;
     }
-}
\ No newline at end of file
+}
+CBlockIndex* CBlockIndexArena::Allocate()
+{
+    if (nUsedInChunk == nChunkEntries) {
+        vChunks.push_back(static_cast<CBlockIndex*>(::operator new(nChunkEntries * sizeof(CBlockIndex))));
+        nUsedInChunk = 0;
+    }
+    nEntries++;
+    return vChunks.back() + nUsedInChunk++;
+}
+
+void CBlockIndexArena::Clear()
+{
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        size_t nUsed = (i + 1 == vChunks.size()) ? nUsedInChunk : nChunkEntries;
+        for (size_t j = 0; j < nUsed; j++)
+            vChunks[i][j].~CBlockIndex();
+        ::operator delete(vChunks[i]);
+    }
+    std::vector<CBlockIndex*>().swap(vChunks);
+    nUsedInChunk = nChunkEntries;
+    nEntries = 0;
+}
+
+size_t CBlockIndexArena::DynamicMemoryUsage() const
+{
+    return vChunks.size() * memusage::MallocUsage(nChunkEntries * sizeof(CBlockIndex)) + memusage::DynamicUsage(vChunks);
+}
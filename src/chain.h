@@ -20,6 +20,9 @@
 #include "util.h"
 #include "libzerocoin/Denominations.h"
 
+#include <array>
+#include <new>
+#include <stdexcept>
 #include <vector>
 
 class CBlockFileInfo
@@ -120,6 +123,11 @@ struct CDiskBlockPos {
         nPos = 0;
     }
     bool IsNull() const { return (nFile == -1); }
+
+    std::string ToString() const
+    {
+        return strprintf("CDiskBlockPos(nFile=%i, nPos=%i)", nFile, nPos);
+    }
 };
 
 enum BlockStatus {
@@ -161,6 +169,88 @@ enum BlockStatus {
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 };
 
+/**
+ * Running count of minted zerocoins per denomination, one slot for each
+ * entry of libzerocoin::zerocoinDenomList. Stored inline so that a block
+ * index entry needs no heap allocation for it; serializes exactly like the
+ * std::map<CoinDenomination, int64_t> it replaces.
+ */
+class CZerocoinSupply
+{
+private:
+    std::array<int64_t, 8> vSupply;
+
+    static int Index(libzerocoin::CoinDenomination denom)
+    {
+        switch (denom) {
+        case libzerocoin::ZQ_ONE: return 0;
+        case libzerocoin::ZQ_FIVE: return 1;
+        case libzerocoin::ZQ_TEN: return 2;
+        case libzerocoin::ZQ_FIFTY: return 3;
+        case libzerocoin::ZQ_ONE_HUNDRED: return 4;
+        case libzerocoin::ZQ_FIVE_HUNDRED: return 5;
+        case libzerocoin::ZQ_ONE_THOUSAND: return 6;
+        case libzerocoin::ZQ_FIVE_THOUSAND: return 7;
+        default: return -1;
+        }
+    }
+
+public:
+    CZerocoinSupply() { SetNull(); }
+
+    void SetNull() { vSupply.fill(0); }
+
+    //! Like std::map::at, throws std::out_of_range for an invalid denomination.
+    int64_t& at(libzerocoin::CoinDenomination denom)
+    {
+        int i = Index(denom);
+        if (i < 0)
+            throw std::out_of_range("CZerocoinSupply::at() : invalid denomination");
+        return vSupply[i];
+    }
+
+    const int64_t& at(libzerocoin::CoinDenomination denom) const
+    {
+        return const_cast<CZerocoinSupply*>(this)->at(denom);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(vSupply.size()) +
+               vSupply.size() * (sizeof(libzerocoin::CoinDenomination) + sizeof(int64_t));
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, vSupply.size());
+        for (auto denom : libzerocoin::zerocoinDenomList) {
+            ::Serialize(s, denom, nType, nVersion);
+            ::Serialize(s, vSupply[Index(denom)], nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        // Denominations missing from the record count as 0, unknown ones are dropped.
+        SetNull();
+        unsigned int nSize = ReadCompactSize(s);
+        for (unsigned int i = 0; i < nSize; i++) {
+            libzerocoin::CoinDenomination denom;
+            int64_t nAmount;
+            ::Unserialize(s, denom, nType, nVersion);
+            ::Unserialize(s, nAmount, nType, nVersion);
+            int nIndex = Index(denom);
+            if (nIndex >= 0)
+                vSupply[nIndex] = nAmount;
+        }
+    }
+
+    bool operator==(const CZerocoinSupply& other) const { return vSupply == other.vSupply; }
+    bool operator!=(const CZerocoinSupply& other) const { return vSupply != other.vSupply; }
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -181,9 +271,6 @@ public:
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
-    //ppcoin: trust score of block chain
-    uint256 bnChainTrust;
-
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
@@ -242,7 +329,7 @@ public:
     uint32_t nSequenceId;
 
     //! zerocoin specific fields
-    std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
+    CZerocoinSupply mapZerocoinSupply;
     std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
 
     void SetNull()
@@ -276,9 +363,7 @@ public:
         nNonce = 0;
         nAccumulatorCheckpoint = 0;
         // Start supply of each denomination with 0s
-        for (auto& denom : libzerocoin::zerocoinDenomList) {
-            mapZerocoinSupply.insert(std::make_pair(denom, 0));
-        }
+        mapZerocoinSupply.SetNull();
         vMintDenominationsInBlock.clear();
     }
 
@@ -512,6 +597,39 @@ public:
     const CBlockIndex* GetAncestor(int height) const;
 };
 
+/**
+ * Allocates block index entries back to back in large chunks instead of one
+ * heap block each. Entries live until Clear(); the block index never frees
+ * individual entries. Not thread safe, callers hold cs_main.
+ */
+class CBlockIndexArena
+{
+private:
+    std::vector<CBlockIndex*> vChunks;
+    size_t nChunkEntries;
+    size_t nUsedInChunk;
+    size_t nEntries;
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    CBlockIndexArena& operator=(const CBlockIndexArena&);
+
+    CBlockIndex* Allocate();
+
+public:
+    explicit CBlockIndexArena(size_t nChunkEntriesIn = 16384)
+        : nChunkEntries(nChunkEntriesIn), nUsedInChunk(nChunkEntriesIn), nEntries(0) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    CBlockIndex* New() { return new (Allocate()) CBlockIndex(); }
+    CBlockIndex* New(const CBlock& block) { return new (Allocate()) CBlockIndex(block); }
+
+    //! Destroy all entries; pointers handed out before become invalid.
+    void Clear();
+
+    size_t Size() const { return nEntries; }
+    size_t DynamicMemoryUsage() const;
+};
+
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
 {
@@ -585,7 +703,7 @@ public:
 
     }
 
-    uint256 GetBlockHash() const
+    CBlockHeader GetBlockHeader() const
     {
         CBlockHeader block;
         block.nVersion = nVersion;
@@ -595,7 +713,12 @@ public:
         block.nBits = nBits;
         block.nNonce = nNonce;
         block.nAccumulatorCheckpoint = nAccumulatorCheckpoint;
-        return block.GetHash();
+        return block;
+    }
+
+    uint256 GetBlockHash() const
+    {
+        return GetBlockHeader().GetHash();
     }
 
 
@@ -1,4 +1,5 @@
 // Copyright (c) 2012-2014 The Bitcoin developers
+// Copyright (c) 2020 The Kabberry developers
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -6,6 +7,9 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -15,21 +19,45 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
-  *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
-  */
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool, and a swap().
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done.
+ *
+ * Every worker owns a deque. Each batch the master adds goes to the next
+ * deque in turn, workers take from the back of their own deque and steal
+ * from the front of the others' when it runs dry, so the only lock a check
+ * normally passes through is its own deque's, which is rarely contended.
+ * The shared mutex is only taken to put idle threads to sleep and wake
+ * them. Once a check fails, the remaining checks are discarded unrun.
+ */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! A worker's own checks, padded so neighbouring deques don't share a cache line.
+    struct WorkerQueue {
+        boost::mutex mutex;
+        std::deque<T> checks;
+        char padding[64];
+    };
+
+    //! Per-worker deques; slot 0 belongs to the master.
+    const unsigned int nSlots;
+    std::unique_ptr<WorkerQueue[]> slots;
+
+    //! Next slot handed to a worker thread.
+    std::atomic<unsigned int> nNextSlot;
+
+    //! Next slot a batch is added to.
+    unsigned int nAddSlot;
+
+    //! Mutex protecting the sleep/wake-up protocol below.
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -38,122 +66,154 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
-
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Number of checks sitting in deques, not yet taken by a worker.
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are not anymore in queue, but still in
+     * This includes elements that are not anymore in a deque, but still in
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
+
+    //! The number of threads asleep waiting for work.
+    std::atomic<int> nIdle;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
     //! The maximum number of elements to be processed in one batch
-    unsigned int nBatchSize;
+    const unsigned int nBatchSize;
+
+    /** Move up to half of the checks in slot (at most nBatchSize) into vChecks. */
+    bool Take(unsigned int nSlot, bool fOwn, std::vector<T>& vChecks)
+    {
+        WorkerQueue& q = slots[nSlot];
+        boost::unique_lock<boost::mutex> lock(q.mutex);
+        if (q.checks.empty())
+            return false;
+        const unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)(q.checks.size() + 1) / 2));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // The owner works from the back, thieves from the front, so they
+            // mostly touch different ends.
+            if (fOwn) {
+                vChecks[i].swap(q.checks.back());
+                q.checks.pop_back();
+            } else {
+                vChecks[i].swap(q.checks.front());
+                q.checks.pop_front();
+            }
+        }
+        nQueued -= nNow;
+        return true;
+    }
+
+    /** Fill vChecks from our own deque, or steal from the others. */
+    bool Find(unsigned int nSlot, std::vector<T>& vChecks)
+    {
+        if (Take(nSlot, true, vChecks))
+            return true;
+        for (unsigned int i = 1; i < nSlots && nQueued > 0; i++) {
+            if (Take((nSlot + i) % nSlots, false, vChecks))
+                return true;
+        }
+        return false;
+    }
 
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int nSlot, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+            if (Find(nSlot, vChecks)) {
+                // Once something failed the rest is only drained, not run.
+                bool fOk = fAllOk;
+                for (T& check : vChecks) {
+                    if (!fOk)
+                        break;
+                    fOk = check();
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                if (!fOk)
+                    fAllOk = false;
+                const unsigned int nNow = vChecks.size();
+                vChecks.clear();
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master he can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                while (nQueued == 0 && nTodo > 0)
+                    condMaster.wait(lock);
+                if (nTodo == 0) {
+                    // return the current status, and reset it for new work later
+                    return fAllOk.exchange(true);
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+            } else {
+                nIdle++;
+                while (nQueued == 0)
+                    condWorker.wait(lock); // wait
+                nIdle--;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
 public:
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue with room for nSlotsIn threads (including the master)
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nSlotsIn = 64) : nSlots(std::max(1U, nSlotsIn)), slots(new WorkerQueue[nSlots]), nNextSlot(1), nAddSlot(0), nQueued(0), nTodo(0), nIdle(0), fAllOk(true), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        // Threads beyond nSlots share a deque, which stays correct.
+        Loop(nNextSlot++ % nSlots);
     }
 
     //! Wait until execution finishes, and return whether all evaluations where successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+        if (!fAllOk) {
+            // A check already failed, the result cannot change anymore.
+            vChecks.clear();
+            return;
+        }
+        // Spread batches over the deques of the threads that exist.
+        const unsigned int nUsed = std::min(nSlots, nNextSlot.load());
+        WorkerQueue& q = slots[nAddSlot++ % nUsed];
+        {
+            // Count the checks before they become visible, so a thief can
+            // never finish them before they are accounted for.
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            nTodo += vChecks.size();
+            nQueued += vChecks.size();
+            for (T& check : vChecks) {
+                q.checks.push_back(T());
+                check.swap(q.checks.back());
+            }
+        }
+        // Sleepers check nQueued after announcing themselves in nIdle, so
+        // either they see the new work or we see them.
+        if (nIdle > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
     }
 
     ~CCheckQueue()
@@ -163,11 +223,11 @@ public:
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo == 0 && nQueued == 0 && fAllOk == true);
     }
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -4,6 +4,7 @@
 
 #include "merkle.h"
 #include "hash.h"
+#include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
 /*     WARNING! If you're reading this because you're learning about crypto
@@ -38,104 +39,80 @@
        root.
 */
 
-/* This implements a constant-space merkle root/path calculator, limited to 2^32 leaves. */
-static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot, bool* pmutated, uint32_t branchpos, std::vector<uint256>* pbranch) {
-    if (pbranch) pbranch->clear();
-    if (leaves.size() == 0) {
-        if (pmutated) *pmutated = false;
-        if (proot) *proot = uint256();
-        return;
+CMerkleTree::CMerkleTree() : nLeaves(0), fMutated(false) {}
+
+CMerkleTree::CMerkleTree(const std::vector<uint256>& leaves) : nLeaves(leaves.size()), fMutated(false)
+{
+    if (leaves.empty()) return;
+
+    // Size the buffer up front so that no level causes a reallocation.
+    size_t total = 0;
+    for (size_t width = leaves.size(); width > 1; width = (width + 1) / 2) {
+        total += width + (width & 1);
     }
-    bool mutated = false;
-    // count is the number of leaves processed so far.
-    uint32_t count = 0;
-    // inner is an array of eagerly computed subtree hashes, indexed by tree
-    // level (0 being the leaves).
-    // For example, when count is 25 (11001 in binary), inner[4] is the hash of
-    // the first 16 leaves, inner[3] of the next 8 leaves, and inner[0] equal to
-    // the last leaf. The other inner entries are undefined.
-    uint256 inner[32];
-    // Which position in inner is a hash that depends on the matching leaf.
-    int matchlevel = -1;
-    // First process all leaves into 'inner' values.
-    while (count < leaves.size()) {
-        uint256 h = leaves[count];
-        bool matchh = count == branchpos;
-        count++;
-        int level;
-        // For each of the lower bits in count that are 0, do 1 step. Each
-        // corresponds to an inner value that existed before processing the
-        // current leaf, and each needs a hash to combine it.
-        for (level = 0; !(count & (((uint32_t)1) << level)); level++) {
-            if (pbranch) {
-                if (matchh) {
-                    pbranch->push_back(inner[level]);
-                } else if (matchlevel == level) {
-                    pbranch->push_back(h);
-                    matchh = true;
-                }
-            }
-            mutated |= (inner[level] == h);
-            CHash256().Write(inner[level].begin(), 32).Write(h.begin(), 32).Finalize(h.begin());
+    vNodes.reserve(total + 1);
+    vNodes.assign(leaves.begin(), leaves.end());
+    vLevel.push_back(0);
+
+    size_t offset = 0;
+    size_t width = leaves.size();
+    while (width > 1) {
+        for (size_t pos = 0; pos + 1 < width; pos += 2) {
+            if (vNodes[offset + pos] == vNodes[offset + pos + 1]) fMutated = true;
         }
-        // Store the resulting hash at inner position level.
-        inner[level] = h;
-        if (matchh) {
-            matchlevel = level;
+        if (width & 1) {
+            vNodes.push_back(vNodes.back());
+            width++;
         }
+        size_t next = vNodes.size();
+        vNodes.resize(next + width / 2);
+        SHA256D64(vNodes[next].begin(), vNodes[offset].begin(), width / 2);
+        vLevel.push_back(next);
+        offset = next;
+        width /= 2;
     }
-    // Do a final 'sweep' over the rightmost branch of the tree to process
-    // odd levels, and reduce everything to a single top value.
-    // Level is the level (counted from the bottom) up to which we've sweeped.
-    int level = 0;
-    // As long as bit number level in count is zero, skip it. It means there
-    // is nothing left at this level.
-    while (!(count & (((uint32_t)1) << level))) {
-        level++;
+}
+
+uint256 CMerkleTree::GetRoot() const
+{
+    if (vNodes.empty()) return uint256();
+    return vNodes.back();
+}
+
+std::vector<uint256> CMerkleTree::GetBranch(uint32_t position) const
+{
+    std::vector<uint256> ret;
+    if (position >= nLeaves) return ret;
+    ret.reserve(GetHeight());
+    for (int height = 0; height < GetHeight(); height++) {
+        ret.push_back(GetHash(height, position ^ 1));
+        position >>= 1;
     }
-    uint256 h = inner[level];
-    bool matchh = matchlevel == level;
-    while (count != (((uint32_t)1) << level)) {
-        // If we reach this point, h is an inner value that is not the top.
-        // We combine it with itself (Bitcoin's special rule for odd levels in
-        // the tree) to produce a higher level one.
-        if (pbranch && matchh) {
-            pbranch->push_back(h);
-        }
-        CHash256().Write(h.begin(), 32).Write(h.begin(), 32).Finalize(h.begin());
-        // Increment count to the value it would have if two entries at this
-        // level had existed.
-        count += (((uint32_t)1) << level);
-        level++;
-        // And propagate the result upwards accordingly.
-        while (!(count & (((uint32_t)1) << level))) {
-            if (pbranch) {
-                if (matchh) {
-                    pbranch->push_back(inner[level]);
-                } else if (matchlevel == level) {
-                    pbranch->push_back(h);
-                    matchh = true;
-                }
+    return ret;
+}
+
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated) {
+    // Level by level, so that each level is one batch of 64-byte double-SHA256s.
+    bool mutation = false;
+    while (hashes.size() > 1) {
+        if (mutated) {
+            for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                if (hashes[pos] == hashes[pos + 1]) mutation = true;
             }
-            CHash256().Write(inner[level].begin(), 32).Write(h.begin(), 32).Finalize(h.begin());
-            level++;
         }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        SHA256D64(hashes[0].begin(), hashes[0].begin(), hashes.size() / 2);
+        hashes.resize(hashes.size() / 2);
     }
-    // Return result.
-    if (pmutated) *pmutated = mutated;
-    if (proot) *proot = h;
-}
-
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated) {
-    uint256 hash;
-    MerkleComputation(leaves, &hash, mutated, -1, NULL);
-    return hash;
+    if (mutated) *mutated = mutation;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
 }
 
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position) {
-    std::vector<uint256> ret;
-    MerkleComputation(leaves, NULL, NULL, position, &ret);
-    return ret;
+    return CMerkleTree(leaves).GetBranch(position);
 }
 
 uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint256>& vMerkleBranch, uint32_t nIndex) {
@@ -151,22 +128,27 @@ uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint2
     return hash;
 }
 
-uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
+std::vector<uint256> BlockMerkleLeaves(const CBlock& block)
 {
     std::vector<uint256> leaves;
     leaves.resize(block.vtx.size());
     for (size_t s = 0; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s].GetHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return leaves;
+}
+
+uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
+{
+    return ComputeMerkleRoot(BlockMerkleLeaves(block), mutated);
 }
 
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
 {
-    std::vector<uint256> leaves;
-    leaves.resize(block.vtx.size());
-    for (size_t s = 0; s < block.vtx.size(); s++) {
-        leaves[s] = block.vtx[s].GetHash();
-    }
-    return ComputeMerkleBranch(leaves, position);
-}
\ No newline at end of file
+    return BlockMerkleTree(block).GetBranch(position);
+}
+
+CMerkleTree BlockMerkleTree(const CBlock& block)
+{
+    return CMerkleTree(BlockMerkleLeaves(block));
+}
@@ -12,10 +12,57 @@
 #include "primitives/block.h"
 #include "uint256.h"
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated = NULL);
+/**
+ * A fully computed merkle tree, kept so that the root, branches and partial
+ * trees of one block can be derived without hashing it again.
+ *
+ * All levels are stored bottom-up in a single buffer, and each level is
+ * hashed with one SHA256D64 call. A level of odd width is stored with its
+ * last node duplicated, so the sibling of node (height, pos) is always at
+ * pos ^ 1 on the same level.
+ */
+class CMerkleTree
+{
+public:
+    CMerkleTree();
+    explicit CMerkleTree(const std::vector<uint256>& leaves);
+
+    /** Number of leaves (transactions). */
+    unsigned int GetLeafCount() const { return nLeaves; }
+
+    /** Number of levels above the leaves; the root is at this height. */
+    int GetHeight() const { return vLevel.empty() ? 0 : vLevel.size() - 1; }
+
+    /** Number of nodes at a given height, not counting the duplicate. */
+    unsigned int GetWidth(int height) const { return (nLeaves + (1 << height) - 1) >> height; }
+
+    /** Hash of node pos at a given height (0 being the leaves). */
+    const uint256& GetHash(int height, unsigned int pos) const { return vNodes[vLevel[height] + pos]; }
+
+    /** The merkle root, or 0 for an empty tree. */
+    uint256 GetRoot() const;
+
+    /** Whether two identical hashes were combined (CVE-2012-2459). */
+    bool IsMutated() const { return fMutated; }
+
+    /** The merkle branch of a leaf, verifiable with ComputeMerkleRootFromBranch. */
+    std::vector<uint256> GetBranch(uint32_t position) const;
+
+private:
+    unsigned int nLeaves;
+    bool fMutated;
+    std::vector<uint256> vNodes;
+    //! offset of each level in vNodes
+    std::vector<size_t> vLevel;
+};
+
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated = NULL);
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position);
 uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint256>& branch, uint32_t position);
 
+/* The hashes of the transactions in a block, i.e. the leaves of its merkle tree. */
+std::vector<uint256> BlockMerkleLeaves(const CBlock& block);
+
 /*
  * Compute the Merkle root of the transactions in a block.
  * *mutated is set to true if a duplicated subtree was found.
@@ -29,4 +76,11 @@ uint256 BlockMerkleRoot(const CBlock& block, bool* mutated = NULL);
  */
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position);
 
+/*
+ * Compute the whole merkle tree of the transactions in a block. Callers that
+ * derive several branches or partial trees from one block keep it and pass it
+ * on, rather than calling this again.
+ */
+CMerkleTree BlockMerkleTree(const CBlock& block);
+
 #endif
\ No newline at end of file
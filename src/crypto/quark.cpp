@@ -0,0 +1,311 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/kabberry-config.h"
+#endif
+
+#include "crypto/quark.h"
+
+#include "crypto/sph_blake.h"
+#include "crypto/sph_bmw.h"
+#include "crypto/sph_groestl.h"
+#include "crypto/sph_jh.h"
+#include "crypto/sph_keccak.h"
+#include "crypto/sph_skein.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+typedef void (*QuarkBlakeFn)(unsigned char* const* out, const unsigned char* const* in, size_t len);
+typedef void (*QuarkStageFn)(unsigned char* const* out, const unsigned char* const* in);
+
+/** Lane-parallel stages built with -msse4.1 (2 messages per call). */
+namespace quark_sse41
+{
+void Blake512(unsigned char* const* out, const unsigned char* const* in, size_t len);
+void Bmw512(unsigned char* const* out, const unsigned char* const* in);
+void Jh512(unsigned char* const* out, const unsigned char* const* in);
+void Keccak512(unsigned char* const* out, const unsigned char* const* in);
+void Skein512(unsigned char* const* out, const unsigned char* const* in);
+}
+
+/** Lane-parallel stages built with -mavx2 (4 messages per call). */
+namespace quark_avx2
+{
+void Blake512(unsigned char* const* out, const unsigned char* const* in, size_t len);
+void Bmw512(unsigned char* const* out, const unsigned char* const* in);
+void Jh512(unsigned char* const* out, const unsigned char* const* in);
+void Keccak512(unsigned char* const* out, const unsigned char* const* in);
+void Skein512(unsigned char* const* out, const unsigned char* const* in);
+}
+
+namespace
+{
+/** The sph reference code, one message per call. */
+namespace quark_scalar
+{
+void Blake512(unsigned char* const* out, const unsigned char* const* in, size_t len)
+{
+    sph_blake512_context ctx;
+    sph_blake512_init(&ctx);
+    sph_blake512(&ctx, in[0], len);
+    sph_blake512_close(&ctx, out[0]);
+}
+
+void Bmw512(unsigned char* const* out, const unsigned char* const* in)
+{
+    sph_bmw512_context ctx;
+    sph_bmw512_init(&ctx);
+    sph_bmw512(&ctx, in[0], 64);
+    sph_bmw512_close(&ctx, out[0]);
+}
+
+void Groestl512(unsigned char* const* out, const unsigned char* const* in)
+{
+    sph_groestl512_context ctx;
+    sph_groestl512_init(&ctx);
+    sph_groestl512(&ctx, in[0], 64);
+    sph_groestl512_close(&ctx, out[0]);
+}
+
+void Jh512(unsigned char* const* out, const unsigned char* const* in)
+{
+    sph_jh512_context ctx;
+    sph_jh512_init(&ctx);
+    sph_jh512(&ctx, in[0], 64);
+    sph_jh512_close(&ctx, out[0]);
+}
+
+void Keccak512(unsigned char* const* out, const unsigned char* const* in)
+{
+    sph_keccak512_context ctx;
+    sph_keccak512_init(&ctx);
+    sph_keccak512(&ctx, in[0], 64);
+    sph_keccak512_close(&ctx, out[0]);
+}
+
+void Skein512(unsigned char* const* out, const unsigned char* const* in)
+{
+    sph_skein512_context ctx;
+    sph_skein512_init(&ctx);
+    sph_skein512(&ctx, in[0], 64);
+    sph_skein512_close(&ctx, out[0]);
+}
+} // namespace quark_scalar
+
+struct QuarkEngine {
+    const char* name;
+    int lanes;
+    QuarkBlakeFn blake;
+    QuarkStageFn bmw;
+    QuarkStageFn jh;
+    QuarkStageFn keccak;
+    QuarkStageFn skein;
+};
+
+const QuarkEngine QUARK_SCALAR = {"standard", 1, quark_scalar::Blake512, quark_scalar::Bmw512,
+    quark_scalar::Jh512, quark_scalar::Keccak512, quark_scalar::Skein512};
+
+#if defined(ENABLE_SSE41)
+const QuarkEngine QUARK_SSE41 = {"sse41(2way)", 2, quark_sse41::Blake512, quark_sse41::Bmw512,
+    quark_sse41::Jh512, quark_sse41::Keccak512, quark_sse41::Skein512};
+#endif
+
+#if defined(ENABLE_AVX2)
+const QuarkEngine QUARK_AVX2 = {"avx2(4way)", 4, quark_avx2::Blake512, quark_avx2::Bmw512,
+    quark_avx2::Jh512, quark_avx2::Keccak512, quark_avx2::Skein512};
+#endif
+
+const QuarkEngine* engine = &QUARK_SCALAR;
+
+/** Largest number of lanes of any implementation. */
+const int MAX_LANES = 4;
+
+/** The largest input the lane-parallel BLAKE-512 handles (one block). */
+const size_t MAX_BLAKE_LEN = 111;
+
+/** Messages hashed per pass; keeps the chained 64-byte states in L1. */
+const size_t CHUNK = 64;
+
+/** Slot of the Quark state of every message in a chunk. */
+struct QuarkChunk {
+    unsigned char state[CHUNK][64];
+    size_t count;
+
+    /** Indices of the messages taking the first / second branch of a split. */
+    size_t taken[CHUNK];
+    size_t other[CHUNK];
+    size_t ntaken;
+    size_t nother;
+
+    /** Messages with bit 3 of the current state set take the first branch. */
+    void Split()
+    {
+        ntaken = nother = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (state[i][0] & 8)
+                taken[ntaken++] = i;
+            else
+                other[nother++] = i;
+        }
+    }
+};
+
+/** Apply `fn` in place to the listed states, `lanes` at a time. Missing lanes
+ *  of the last call are pointed at scratch buffers. */
+void RunLanes(QuarkChunk& chunk, const size_t* idx, size_t count, int lanes, QuarkStageFn fn)
+{
+    unsigned char scratch[MAX_LANES][64];
+    unsigned char* ptr[MAX_LANES];
+    memset(scratch, 0, sizeof(scratch));
+    for (size_t i = 0; i < count; i += lanes) {
+        for (int l = 0; l < lanes; l++)
+            ptr[l] = i + l < count ? chunk.state[idx[i + l]] : scratch[l];
+        fn(ptr, ptr);
+    }
+}
+
+/** BLAKE-512 over 64-byte states, used by the second BLAKE/BMW branch. */
+void RunBlakeLanes(QuarkChunk& chunk, const size_t* idx, size_t count, int lanes, QuarkBlakeFn fn)
+{
+    unsigned char scratch[MAX_LANES][64];
+    unsigned char* ptr[MAX_LANES];
+    memset(scratch, 0, sizeof(scratch));
+    for (size_t i = 0; i < count; i += lanes) {
+        for (int l = 0; l < lanes; l++)
+            ptr[l] = i + l < count ? chunk.state[idx[i + l]] : scratch[l];
+        fn(ptr, ptr, 64);
+    }
+}
+
+void QuarkHashChunk(const QuarkEngine& e, QuarkChunk& chunk, unsigned char* out, const unsigned char* in, size_t len)
+{
+    size_t all[CHUNK];
+    for (size_t i = 0; i < chunk.count; i++)
+        all[i] = i;
+
+    // blake512 of the message itself.
+    if (len <= MAX_BLAKE_LEN) {
+        static const unsigned char blank[MAX_LANES][MAX_BLAKE_LEN] = {};
+        const unsigned char* src[MAX_LANES];
+        unsigned char scratch[MAX_LANES][64];
+        unsigned char* dst[MAX_LANES];
+        for (size_t i = 0; i < chunk.count; i += e.lanes) {
+            for (int l = 0; l < e.lanes; l++) {
+                const bool used = i + l < chunk.count;
+                src[l] = used ? in + (i + l) * len : blank[l];
+                dst[l] = used ? chunk.state[i + l] : scratch[l];
+            }
+            e.blake(dst, src, len);
+        }
+    } else {
+        for (size_t i = 0; i < chunk.count; i++) {
+            const unsigned char* src = in + i * len;
+            unsigned char* dst = chunk.state[i];
+            quark_scalar::Blake512(&dst, &src, len);
+        }
+    }
+
+    RunLanes(chunk, all, chunk.count, e.lanes, e.bmw);
+
+    chunk.Split();
+    RunLanes(chunk, chunk.taken, chunk.ntaken, 1, quark_scalar::Groestl512);
+    RunLanes(chunk, chunk.other, chunk.nother, e.lanes, e.skein);
+
+    RunLanes(chunk, all, chunk.count, 1, quark_scalar::Groestl512);
+    RunLanes(chunk, all, chunk.count, e.lanes, e.jh);
+
+    chunk.Split();
+    RunBlakeLanes(chunk, chunk.taken, chunk.ntaken, e.lanes, e.blake);
+    RunLanes(chunk, chunk.other, chunk.nother, e.lanes, e.bmw);
+
+    RunLanes(chunk, all, chunk.count, e.lanes, e.keccak);
+    RunLanes(chunk, all, chunk.count, e.lanes, e.skein);
+
+    chunk.Split();
+    RunLanes(chunk, chunk.taken, chunk.ntaken, e.lanes, e.keccak);
+    RunLanes(chunk, chunk.other, chunk.nother, e.lanes, e.jh);
+
+    for (size_t i = 0; i < chunk.count; i++)
+        memcpy(out + i * QUARK_OUTPUT_SIZE, chunk.state[i], QUARK_OUTPUT_SIZE);
+}
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+}
+
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+} // namespace
+
+std::string QuarkAutoDetect()
+{
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, eax, ebx, ecx, edx);
+    const uint32_t max_leaf = eax;
+    cpuid(1, 0, eax, ebx, ecx, edx);
+    const bool have_sse41 = (ecx >> 19) & 1;
+    const bool have_xsave = (ecx >> 27) & 1;
+    const bool have_avx = have_xsave && ((ecx >> 28) & 1) && AVXEnabled();
+    bool have_avx2 = false;
+    if (max_leaf >= 7) {
+        cpuid(7, 0, eax, ebx, ecx, edx);
+        have_avx2 = have_avx && ((ebx >> 5) & 1);
+    }
+
+#if defined(ENABLE_AVX2)
+    if (have_avx2) {
+        engine = &QUARK_AVX2;
+        return engine->name;
+    }
+#endif
+#if defined(ENABLE_SSE41)
+    if (have_sse41) {
+        engine = &QUARK_SSE41;
+        return engine->name;
+    }
+#endif
+    (void)have_sse41;
+    (void)have_avx2;
+#endif
+
+    engine = &QUARK_SCALAR;
+    return engine->name;
+}
+
+std::string QuarkImplementation()
+{
+    return engine->name;
+}
+
+int QuarkLanes()
+{
+    return engine->lanes;
+}
+
+void QuarkHashBatch(unsigned char* out, const unsigned char* in, size_t len, size_t blocks)
+{
+    const QuarkEngine& e = *engine;
+    QuarkChunk chunk;
+    while (blocks) {
+        chunk.count = blocks < CHUNK ? blocks : CHUNK;
+        QuarkHashChunk(e, chunk, out, in, len);
+        out += chunk.count * QUARK_OUTPUT_SIZE;
+        in += chunk.count * len;
+        blocks -= chunk.count;
+    }
+}
@@ -0,0 +1,33 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_QUARK_H
+#define BITCOIN_CRYPTO_QUARK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** Size of a Quark digest: the first 256 bits of the final 512-bit hash. */
+static const size_t QUARK_OUTPUT_SIZE = 32;
+
+/** Autodetect the best available Quark implementation.
+ *  Returns the name of the implementation. */
+std::string QuarkAutoDetect();
+
+/** Name of the Quark implementation in use. */
+std::string QuarkImplementation();
+
+/** Number of messages the selected implementation hashes in parallel. */
+int QuarkLanes();
+
+/** Compute the Quark hash of `blocks` messages of `len` bytes each.
+ *
+ *  The messages are stored back to back in `in`; the 32-byte digests are
+ *  written back to back to `out`. Every digest equals HashQuark() of the
+ *  corresponding message.
+ */
+void QuarkHashBatch(unsigned char* out, const unsigned char* in, size_t len, size_t blocks);
+
+#endif // BITCOIN_CRYPTO_QUARK_H
@@ -0,0 +1,661 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_QUARK_LANES_H
+#define BITCOIN_CRYPTO_QUARK_LANES_H
+
+/**
+ * Lane-parallel versions of the 512-bit primitives chained by Quark.
+ *
+ * Every function hashes N independent messages at once. Word i of all N
+ * messages lives in one GCC vector of N uint64_t, so the instruction set is
+ * chosen by the compiler flags of the translation unit that includes this
+ * header (see quark_sse41.cpp and quark_avx2.cpp).
+ *
+ * Only the message sizes Quark needs are supported: 64-byte chained digests,
+ * and for BLAKE-512 any input that fits a single block (at most 111 bytes),
+ * which covers the 80-byte block header. Groestl-512 is table driven and does
+ * not vectorize; it stays on the scalar sph code.
+ */
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+namespace quark_lanes
+{
+/** Maximum input size handled by Blake512(). */
+static const size_t BLAKE512_MAX_SINGLE_BLOCK = 111;
+
+template <typename V>
+struct Lanes {
+    static const int N = sizeof(V) / sizeof(uint64_t);
+};
+
+template <typename V>
+ALWAYS_INLINE V Splat(uint64_t x)
+{
+    V v;
+    for (int i = 0; i < Lanes<V>::N; i++)
+        v[i] = x;
+    return v;
+}
+
+template <int n, typename V>
+ALWAYS_INLINE V Rotl(V x)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+template <int n, typename V>
+ALWAYS_INLINE V Rotr(V x)
+{
+    return (x >> n) | (x << (64 - n));
+}
+
+template <typename V>
+ALWAYS_INLINE V RotlVar(V x, int n)
+{
+    return n == 0 ? x : ((x << n) | (x >> (64 - n)));
+}
+
+template <typename V>
+ALWAYS_INLINE V LoadLE(const unsigned char* const* in, size_t offset)
+{
+    V v;
+    for (int i = 0; i < Lanes<V>::N; i++)
+        v[i] = ReadLE64(in[i] + offset);
+    return v;
+}
+
+template <typename V>
+ALWAYS_INLINE void StoreLE(unsigned char* const* out, size_t offset, const V& v)
+{
+    for (int i = 0; i < Lanes<V>::N; i++)
+        WriteLE64(out[i] + offset, v[i]);
+}
+
+/* ----------- BLAKE-512 ----------------------------------------------------- */
+
+namespace blake
+{
+static const uint64_t IV[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL, 0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL};
+
+static const uint64_t CB[16] = {
+    0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+    0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL, 0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL,
+    0x9216D5D98979FB1BULL, 0xD1310BA698DFB5ACULL, 0x2FFD72DBD01ADFB7ULL, 0xB8E1AFED6A267E96ULL,
+    0xBA7C9045F12C7F99ULL, 0x24A19947B3916CF7ULL, 0x0801F2E2858EFC16ULL, 0x636920D871574E69ULL};
+
+static const unsigned char SIGMA[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0}};
+
+template <typename V>
+ALWAYS_INLINE void G(const V* M, const unsigned char* s, int i, V& a, V& b, V& c, V& d)
+{
+    const int x = s[2 * i], y = s[2 * i + 1];
+    a = a + b + (M[x] ^ Splat<V>(CB[y]));
+    d = Rotr<32>(d ^ a);
+    c = c + d;
+    b = Rotr<25>(b ^ c);
+    a = a + b + (M[y] ^ Splat<V>(CB[x]));
+    d = Rotr<16>(d ^ a);
+    c = c + d;
+    b = Rotr<11>(b ^ c);
+}
+} // namespace blake
+
+/** BLAKE-512 of N messages of `len` (<= 111) bytes each; 64-byte digests. */
+template <typename V>
+void Blake512(unsigned char* const* out, const unsigned char* const* in, size_t len)
+{
+    const int N = Lanes<V>::N;
+    V M[16];
+    for (int i = 0; i < N; i++) {
+        unsigned char block[128];
+        memcpy(block, in[i], len);
+        block[len] = 0x80;
+        memset(block + len + 1, 0, 127 - len);
+        block[111] |= 1;
+        WriteBE64(block + 120, (uint64_t)len << 3);
+        for (int w = 0; w < 16; w++)
+            M[w][i] = ReadBE64(block + 8 * w);
+    }
+
+    V v[16];
+    for (int w = 0; w < 8; w++)
+        v[w] = Splat<V>(blake::IV[w]);
+    for (int w = 0; w < 4; w++)
+        v[8 + w] = Splat<V>(blake::CB[w]);
+    v[12] = Splat<V>(((uint64_t)len << 3) ^ blake::CB[4]);
+    v[13] = Splat<V>(((uint64_t)len << 3) ^ blake::CB[5]);
+    v[14] = Splat<V>(blake::CB[6]);
+    v[15] = Splat<V>(blake::CB[7]);
+
+    for (int r = 0; r < 16; r++) {
+        const unsigned char* s = blake::SIGMA[r % 10];
+        blake::G(M, s, 0, v[0], v[4], v[8], v[12]);
+        blake::G(M, s, 1, v[1], v[5], v[9], v[13]);
+        blake::G(M, s, 2, v[2], v[6], v[10], v[14]);
+        blake::G(M, s, 3, v[3], v[7], v[11], v[15]);
+        blake::G(M, s, 4, v[0], v[5], v[10], v[15]);
+        blake::G(M, s, 5, v[1], v[6], v[11], v[12]);
+        blake::G(M, s, 6, v[2], v[7], v[8], v[13]);
+        blake::G(M, s, 7, v[3], v[4], v[9], v[14]);
+    }
+
+    for (int w = 0; w < 8; w++) {
+        V h = Splat<V>(blake::IV[w]) ^ v[w] ^ v[w + 8];
+        for (int i = 0; i < N; i++)
+            WriteBE64(out[i] + 8 * w, h[i]);
+    }
+}
+
+/* ----------- BMW-512 ------------------------------------------------------- */
+
+namespace bmw
+{
+static const uint64_t IV[16] = {
+    0x8081828384858687ULL, 0x88898A8B8C8D8E8FULL, 0x9091929394959697ULL, 0x98999A9B9C9D9E9FULL,
+    0xA0A1A2A3A4A5A6A7ULL, 0xA8A9AAABACADAEAFULL, 0xB0B1B2B3B4B5B6B7ULL, 0xB8B9BABBBCBDBEBFULL,
+    0xC0C1C2C3C4C5C6C7ULL, 0xC8C9CACBCCCDCECFULL, 0xD0D1D2D3D4D5D6D7ULL, 0xD8D9DADBDCDDDEDFULL,
+    0xE0E1E2E3E4E5E6E7ULL, 0xE8E9EAEBECEDEEEFULL, 0xF0F1F2F3F4F5F6F7ULL, 0xF8F9FAFBFCFDFEFFULL};
+
+static const uint64_t FINAL[16] = {
+    0xaaaaaaaaaaaaaaa0ULL, 0xaaaaaaaaaaaaaaa1ULL, 0xaaaaaaaaaaaaaaa2ULL, 0xaaaaaaaaaaaaaaa3ULL,
+    0xaaaaaaaaaaaaaaa4ULL, 0xaaaaaaaaaaaaaaa5ULL, 0xaaaaaaaaaaaaaaa6ULL, 0xaaaaaaaaaaaaaaa7ULL,
+    0xaaaaaaaaaaaaaaa8ULL, 0xaaaaaaaaaaaaaaa9ULL, 0xaaaaaaaaaaaaaaaaULL, 0xaaaaaaaaaaaaaaabULL,
+    0xaaaaaaaaaaaaaaacULL, 0xaaaaaaaaaaaaaaadULL, 0xaaaaaaaaaaaaaaaeULL, 0xaaaaaaaaaaaaaaafULL};
+
+/** Operand indices of the W_j sums; W_j = +-(M[k] ^ H[k]) over the five k. */
+static const unsigned char WIDX[16][5] = {
+    {5, 7, 10, 13, 14}, {6, 8, 11, 14, 15}, {0, 7, 9, 12, 15}, {0, 1, 8, 10, 13},
+    {1, 2, 9, 11, 14}, {3, 2, 10, 12, 15}, {4, 0, 3, 11, 13}, {1, 4, 5, 12, 14},
+    {2, 5, 6, 13, 15}, {0, 3, 6, 7, 14}, {8, 1, 4, 7, 15}, {8, 0, 2, 5, 9},
+    {1, 3, 6, 9, 10}, {2, 4, 7, 10, 11}, {3, 5, 8, 11, 12}, {12, 4, 6, 9, 13}};
+
+/** Whether the matching WIDX operand is subtracted rather than added. */
+static const bool WNEG[16][5] = {
+    {0, 1, 0, 0, 0}, {0, 1, 0, 0, 1}, {0, 0, 0, 1, 0}, {0, 1, 0, 1, 0},
+    {0, 0, 0, 1, 1}, {0, 1, 0, 1, 0}, {0, 1, 1, 1, 0}, {0, 1, 1, 1, 1},
+    {0, 1, 1, 0, 1}, {0, 1, 0, 1, 0}, {0, 1, 1, 1, 0}, {0, 1, 1, 1, 0},
+    {0, 0, 1, 1, 0}, {0, 0, 0, 0, 0}, {0, 1, 0, 1, 1}, {0, 1, 1, 1, 0}};
+
+template <typename V>
+ALWAYS_INLINE V S0(V x) { return (x >> 1) ^ (x << 3) ^ Rotl<4>(x) ^ Rotl<37>(x); }
+template <typename V>
+ALWAYS_INLINE V S1(V x) { return (x >> 1) ^ (x << 2) ^ Rotl<13>(x) ^ Rotl<43>(x); }
+template <typename V>
+ALWAYS_INLINE V S2(V x) { return (x >> 2) ^ (x << 1) ^ Rotl<19>(x) ^ Rotl<53>(x); }
+template <typename V>
+ALWAYS_INLINE V S3(V x) { return (x >> 2) ^ (x << 2) ^ Rotl<28>(x) ^ Rotl<59>(x); }
+template <typename V>
+ALWAYS_INLINE V S4(V x) { return (x >> 1) ^ x; }
+template <typename V>
+ALWAYS_INLINE V S5(V x) { return (x >> 2) ^ x; }
+
+template <typename V>
+ALWAYS_INLINE V S(int k, V x)
+{
+    switch (k) {
+    case 0: return S0(x);
+    case 1: return S1(x);
+    case 2: return S2(x);
+    case 3: return S3(x);
+    default: return S4(x);
+    }
+}
+
+template <typename V>
+ALWAYS_INLINE V AddElement(const V* M, const V* H, int j)
+{
+    const int a = j & 15, b = (j + 3) & 15, c = (j + 10) & 15;
+    return (RotlVar(M[a], a + 1) + RotlVar(M[b], b + 1) - RotlVar(M[c], c + 1) +
+               Splat<V>((uint64_t)(j + 16) * 0x0555555555555555ULL)) ^
+           H[(j + 7) & 15];
+}
+
+/** The BMW compression function f: (M, H) -> H'. */
+template <typename V>
+void Compress(const V* M, const V* H, V* dH)
+{
+    V q[32];
+    for (int j = 0; j < 16; j++) {
+        V w = Splat<V>(0);
+        for (int t = 0; t < 5; t++) {
+            const int k = WIDX[j][t];
+            if (WNEG[j][t])
+                w = w - (M[k] ^ H[k]);
+            else
+                w = w + (M[k] ^ H[k]);
+        }
+        q[j] = S(j % 5, w) + H[(j + 1) & 15];
+    }
+    for (int j = 16; j < 18; j++) {
+        V e = AddElement(M, H, j - 16);
+        for (int k = 0; k < 16; k++)
+            e = e + S((k + 1) & 3, q[j - 16 + k]);
+        q[j] = e;
+    }
+    for (int j = 18; j < 32; j++) {
+        V e = AddElement(M, H, j - 16);
+        e = e + q[j - 16] + Rotl<5>(q[j - 15]) + q[j - 14] + Rotl<11>(q[j - 13]);
+        e = e + q[j - 12] + Rotl<27>(q[j - 11]) + q[j - 10] + Rotl<32>(q[j - 9]);
+        e = e + q[j - 8] + Rotl<37>(q[j - 7]) + q[j - 6] + Rotl<43>(q[j - 5]);
+        e = e + q[j - 4] + Rotl<53>(q[j - 3]) + S4(q[j - 2]) + S5(q[j - 1]);
+        q[j] = e;
+    }
+
+    V xl = q[16] ^ q[17] ^ q[18] ^ q[19] ^ q[20] ^ q[21] ^ q[22] ^ q[23];
+    V xh = xl ^ q[24] ^ q[25] ^ q[26] ^ q[27] ^ q[28] ^ q[29] ^ q[30] ^ q[31];
+    dH[0] = ((xh << 5) ^ (q[16] >> 5) ^ M[0]) + (xl ^ q[24] ^ q[0]);
+    dH[1] = ((xh >> 7) ^ (q[17] << 8) ^ M[1]) + (xl ^ q[25] ^ q[1]);
+    dH[2] = ((xh >> 5) ^ (q[18] << 5) ^ M[2]) + (xl ^ q[26] ^ q[2]);
+    dH[3] = ((xh >> 1) ^ (q[19] << 5) ^ M[3]) + (xl ^ q[27] ^ q[3]);
+    dH[4] = ((xh >> 3) ^ q[20] ^ M[4]) + (xl ^ q[28] ^ q[4]);
+    dH[5] = ((xh << 6) ^ (q[21] >> 6) ^ M[5]) + (xl ^ q[29] ^ q[5]);
+    dH[6] = ((xh >> 4) ^ (q[22] << 6) ^ M[6]) + (xl ^ q[30] ^ q[6]);
+    dH[7] = ((xh >> 11) ^ (q[23] << 2) ^ M[7]) + (xl ^ q[31] ^ q[7]);
+    dH[8] = Rotl<9>(dH[4]) + (xh ^ q[24] ^ M[8]) + ((xl << 8) ^ q[23] ^ q[8]);
+    dH[9] = Rotl<10>(dH[5]) + (xh ^ q[25] ^ M[9]) + ((xl >> 6) ^ q[16] ^ q[9]);
+    dH[10] = Rotl<11>(dH[6]) + (xh ^ q[26] ^ M[10]) + ((xl << 6) ^ q[17] ^ q[10]);
+    dH[11] = Rotl<12>(dH[7]) + (xh ^ q[27] ^ M[11]) + ((xl << 4) ^ q[18] ^ q[11]);
+    dH[12] = Rotl<13>(dH[0]) + (xh ^ q[28] ^ M[12]) + ((xl >> 3) ^ q[19] ^ q[12]);
+    dH[13] = Rotl<14>(dH[1]) + (xh ^ q[29] ^ M[13]) + ((xl >> 4) ^ q[20] ^ q[13]);
+    dH[14] = Rotl<15>(dH[2]) + (xh ^ q[30] ^ M[14]) + ((xl >> 7) ^ q[21] ^ q[14]);
+    dH[15] = Rotl<16>(dH[3]) + (xh ^ q[31] ^ M[15]) + ((xl >> 2) ^ q[22] ^ q[15]);
+}
+} // namespace bmw
+
+/** BMW-512 of N 64-byte messages. */
+template <typename V>
+void Bmw512(unsigned char* const* out, const unsigned char* const* in)
+{
+    V M[16], H[16], dH[16], F[16];
+    for (int w = 0; w < 8; w++)
+        M[w] = LoadLE<V>(in, 8 * w);
+    M[8] = Splat<V>(0x80);
+    for (int w = 9; w < 15; w++)
+        M[w] = Splat<V>(0);
+    M[15] = Splat<V>(512);
+    for (int w = 0; w < 16; w++) {
+        H[w] = Splat<V>(bmw::IV[w]);
+        F[w] = Splat<V>(bmw::FINAL[w]);
+    }
+    bmw::Compress(M, H, dH);
+    bmw::Compress(dH, F, H);
+    for (int w = 0; w < 8; w++)
+        StoreLE(out, 8 * w, H[w + 8]);
+}
+
+/* ----------- JH-512 -------------------------------------------------------- */
+
+namespace jh
+{
+/** Initial state and round constants, byte-swapped for the little-endian
+ *  bitslice layout used by sph's 64-bit JH. */
+static const uint64_t IV[16] = {
+    0x17aa003e964bd16fULL, 0x43d5157a052e6a63ULL, 0x0bef970c8d5e228aULL, 0x61c3b3f2591234e9ULL,
+    0x1e806f53c1a01d89ULL, 0x806d2bea6b05a92aULL, 0xa6ba7520dbcc8e58ULL, 0xf73bf8ba763a0fa9ULL,
+    0x694ae34105e66901ULL, 0x5ae66f2e8e8ab546ULL, 0x243c84c1d0a74710ULL, 0x99c15a2db1716e3bULL,
+    0x56f8b19decf657cfULL, 0x56b116577c8806a7ULL, 0xfb1785e6dffcc2e3ULL, 0x4bdd8ccc78465a54ULL,};
+
+static const uint64_t C[168] = {
+    0x67f815dfa2ded572ULL, 0x571523b70a15847bULL, 0xf6875a4d90d6ab81ULL, 0x402bd1c3c54f9f4eULL,
+    0x9cfa455ce03a98eaULL, 0x9a99b26699d2c503ULL, 0x8a53bbf2b4960266ULL, 0x31a2db881a1456b5ULL,
+    0xdb0e199a5c5aa303ULL, 0x1044c1870ab23f40ULL, 0x1d959e848019051cULL, 0xdccde75eadeb336fULL,
+    0x416bbf029213ba10ULL, 0xd027bbf7156578dcULL, 0x5078aa3739812c0aULL, 0xd3910041d2bf1a3fULL,
+    0x907eccf60d5a2d42ULL, 0xce97c0929c9f62ddULL, 0xac442bc70ba75c18ULL, 0x23fcc663d665dfd1ULL,
+    0x1ab8e09e036c6e97ULL, 0xa8ec6c447e450521ULL, 0xfa618e5dbb03f1eeULL, 0x97818394b29796fdULL,
+    0x2f3003db37858e4aULL, 0x956a9ffb2d8d672aULL, 0x6c69b8f88173fe8aULL, 0x14427fc04672c78aULL,
+    0xc45ec7bd8f15f4c5ULL, 0x80bb118fa76f4475ULL, 0xbc88e4aeb775de52ULL, 0xf4a3a6981e00b882ULL,
+    0x1563a3a9338ff48eULL, 0x89f9b7d524565faaULL, 0xfde05a7c20edf1b6ULL, 0x362c42065ae9ca36ULL,
+    0x3d98fe4e433529ceULL, 0xa74b9a7374f93a53ULL, 0x86814e6f591ff5d0ULL, 0x9f5ad8af81ad9d0eULL,
+    0x6a6234ee670605a7ULL, 0x2717b96ebe280b8bULL, 0x3f1080c626077447ULL, 0x7b487ec66f7ea0e0ULL,
+    0xc0a4f84aa50a550dULL, 0x9ef18e979fe7e391ULL, 0xd48d605081727686ULL, 0x62b0e5f3415a9e7eULL,
+    0x7a205440ec1f9ffcULL, 0x84c9f4ce001ae4e3ULL, 0xd895fa9df594d74fULL, 0xa554c324117e2e55ULL,
+    0x286efebd2872df5bULL, 0xb2c4a50fe27ff578ULL, 0x2ed349eeef7c8905ULL, 0x7f5928eb85937e44ULL,
+    0x4a3124b337695f70ULL, 0x65e4d61df128865eULL, 0xe720b95104771bc7ULL, 0x8a87d423e843fe74ULL,
+    0xf2947692a3e8297dULL, 0xc1d9309b097acbddULL, 0xe01bdc5bfb301b1dULL, 0xbf829cf24f4924daULL,
+    0xffbf70b431bae7a4ULL, 0x48bcf8de0544320dULL, 0x39d3bb5332fcae3bULL, 0xa08b29e0c1c39f45ULL,
+    0x0f09aef7fd05c9e5ULL, 0x34f1904212347094ULL, 0x95ed44e301b771a2ULL, 0x4a982f4f368e3be9ULL,
+    0x15f66ca0631d4088ULL, 0xffaf52874b44c147ULL, 0x30c60ae2f14abb7eULL, 0xe68c6eccc5b67046ULL,
+    0x00ca4fbd56a4d5a4ULL, 0xae183ec84b849ddaULL, 0xadd1643045ce5773ULL, 0x67255c1468cea6e8ULL,
+    0x16e10ecbf28cdaa3ULL, 0x9a99949a5806e933ULL, 0x7b846fc220b2601fULL, 0x1885d1a07facced1ULL,
+    0xd319dd8da15b5932ULL, 0x46b4a5aac01c9a50ULL, 0xba6b04e467633d9fULL, 0x7eee560bab19caf6ULL,
+    0x742128a9ea79b11fULL, 0xee51363b35f7bde9ULL, 0x76d350755aac571dULL, 0x01707da3fec2463aULL,
+    0x42d8a498afc135f7ULL, 0x79676b9e20eced78ULL, 0xa8db3aea15638341ULL, 0x832c83324d3bc3faULL,
+    0xf347271c1f3b40a7ULL, 0x9a762db734f04059ULL, 0xfd4f21d26c4e3ee7ULL, 0xef5957dc398dfdb8ULL,
+    0xdaeb492b490c9b8dULL, 0x0d70f36849d7a25bULL, 0x84558d7ad0ae3b7dULL, 0x658ef8e4f0e9a5f5ULL,
+    0x533b1036f4a2b8a0ULL, 0x5aec3e759e07a80cULL, 0x4f88e85692946891ULL, 0x4cbcbaf8555cb05bULL,
+    0x7b9487f3993bbbe3ULL, 0x5d1c6b72d6f4da75ULL, 0x6db334dc28acae64ULL, 0x71db28b850a5346cULL,
+    0x2a518d10f2e261f8ULL, 0xfc75dd593364dbe3ULL, 0xa23fce43f1bcac1cULL, 0xb043e8023cd1bb67ULL,
+    0x75a12988ca5b0a33ULL, 0x5c5316b44d19347fULL, 0x1e4d790ec3943b92ULL, 0x3fafeeb6d7757479ULL,
+    0x21391abef7d4a8eaULL, 0x5127234c097ef45cULL, 0xd23c32ba5324a326ULL, 0xadd5a66d4a17a344ULL,
+    0x08c9f2afa63e1db5ULL, 0x563c6b91983d5983ULL, 0x4d608672a17cf84cULL, 0xf6c76e08cc3ee246ULL,
+    0x5e76bcb1b333982fULL, 0x2ae6c4efa566d62bULL, 0x36d4c1bee8b6f406ULL, 0x6321efbc1582ee74ULL,
+    0x69c953f40d4ec1fdULL, 0x26585806c45a7da7ULL, 0x16fae0061614c17eULL, 0x3f9d63283daf907eULL,
+    0x0cd29b00e3f2c9d2ULL, 0x300cd4b730ceaa5fULL, 0x9832e0f216512a74ULL, 0x9af8cee3d830eb0dULL,
+    0x9279f1b57b9ec54bULL, 0xd36886046ee651ffULL, 0x316796e6574d239bULL, 0x05750a17f3a6e6ccULL,
+    0xce6c3213d98176b1ULL, 0x62a205f88452173cULL, 0x47154778b3cb2bf4ULL, 0x486a9323825446ffULL,
+    0x65655e4e0758df38ULL, 0x8e5086fc897cfcf2ULL, 0x86ca0bd0442e7031ULL, 0x4e477830a20940f0ULL,
+    0x8338f7d139eea065ULL, 0xbd3a2ce437e95ef7ULL, 0x6ff8130126b29721ULL, 0xe7de9fefd1ed44a3ULL,
+    0xd992257615dfa08bULL, 0xbe42dc12f6f7853cULL, 0x7eb027ab7ceca7d8ULL, 0xdea83eaada7d8d53ULL,
+    0xd86902bd93ce25aaULL, 0xf908731afd43f65aULL, 0xa5194a17daef5fc0ULL, 0x6a21fd4c33664d97ULL,
+    0x701541db3198b435ULL, 0x9b54cdedbb0f1eeaULL, 0x72409751a163d09aULL, 0xe26f4791bf9d75f6ULL,};
+
+template <typename V>
+ALWAYS_INLINE void Sb(V& x0, V& x1, V& x2, V& x3, const V& c)
+{
+    V tmp;
+    x3 = ~x3;
+    x0 ^= c & ~x2;
+    tmp = c ^ (x0 & x1);
+    x0 ^= x2 & x3;
+    x3 ^= ~x1 & x2;
+    x1 ^= x0 & x2;
+    x2 ^= x0 & ~x3;
+    x0 ^= x1 | x3;
+    x3 ^= x1 & x2;
+    x1 ^= tmp & x0;
+    x2 ^= tmp;
+}
+
+template <typename V>
+ALWAYS_INLINE void Lb(V& x0, V& x1, V& x2, V& x3, V& x4, V& x5, V& x6, V& x7)
+{
+    x4 ^= x1;
+    x5 ^= x2;
+    x6 ^= x3 ^ x0;
+    x7 ^= x0;
+    x0 ^= x5;
+    x1 ^= x6;
+    x2 ^= x7 ^ x4;
+    x3 ^= x4;
+}
+
+template <typename V>
+ALWAYS_INLINE V Swap(V x, uint64_t mask, int n)
+{
+    const V c = Splat<V>(mask);
+    return ((x >> n) & c) | ((x & c) << n);
+}
+
+/** The round permutation W_ro applied to one 128-bit word (hi, lo). */
+template <typename V>
+ALWAYS_INLINE void W(int ro, V& hi, V& lo)
+{
+    static const uint64_t MASKS[6] = {
+        0x5555555555555555ULL, 0x3333333333333333ULL, 0x0F0F0F0F0F0F0F0FULL,
+        0x00FF00FF00FF00FFULL, 0x0000FFFF0000FFFFULL, 0x00000000FFFFFFFFULL};
+    if (ro == 6) {
+        V t = hi;
+        hi = lo;
+        lo = t;
+    } else {
+        hi = Swap(hi, MASKS[ro], 1 << ro);
+        lo = Swap(lo, MASKS[ro], 1 << ro);
+    }
+}
+
+/** The E8 permutation over the 1024-bit state h[2 * i + {0: hi, 1: lo}]. */
+template <typename V>
+void E8(V* h)
+{
+    for (int r = 0; r < 42; r++) {
+        Sb(h[0], h[4], h[8], h[12], Splat<V>(C[4 * r + 0]));
+        Sb(h[1], h[5], h[9], h[13], Splat<V>(C[4 * r + 1]));
+        Sb(h[2], h[6], h[10], h[14], Splat<V>(C[4 * r + 2]));
+        Sb(h[3], h[7], h[11], h[15], Splat<V>(C[4 * r + 3]));
+        Lb(h[0], h[4], h[8], h[12], h[2], h[6], h[10], h[14]);
+        Lb(h[1], h[5], h[9], h[13], h[3], h[7], h[11], h[15]);
+        const int ro = r % 7;
+        W(ro, h[2], h[3]);
+        W(ro, h[6], h[7]);
+        W(ro, h[10], h[11]);
+        W(ro, h[14], h[15]);
+    }
+}
+} // namespace jh
+
+/** JH-512 of N 64-byte messages. */
+template <typename V>
+void Jh512(unsigned char* const* out, const unsigned char* const* in)
+{
+    V h[16], m[8];
+    for (int w = 0; w < 16; w++)
+        h[w] = Splat<V>(jh::IV[w]);
+    for (int w = 0; w < 8; w++)
+        m[w] = LoadLE<V>(in, 8 * w);
+
+    // The message block, followed by the padding block: a single 1 bit and
+    // the 128-bit big-endian message length (512 bits).
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            m[0] = Splat<V>(0x80);
+            for (int w = 1; w < 7; w++)
+                m[w] = Splat<V>(0);
+            m[7] = Splat<V>(0x0002000000000000ULL);
+        }
+        for (int w = 0; w < 8; w++)
+            h[w] ^= m[w];
+        jh::E8(h);
+        for (int w = 0; w < 8; w++)
+            h[w + 8] ^= m[w];
+    }
+
+    for (int w = 0; w < 8; w++)
+        StoreLE(out, 8 * w, h[w + 8]);
+}
+
+/* ----------- Keccak-512 ---------------------------------------------------- */
+
+namespace keccak
+{
+static const uint64_t RC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808AULL, 0x8000000080008000ULL,
+    0x000000000000808BULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008AULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000AULL,
+    0x000000008000808BULL, 0x800000000000008BULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800AULL, 0x800000008000000AULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL};
+
+/** Keccak-f[1600] on a state of 25 lanes indexed x + 5 * y. */
+template <typename V>
+ALWAYS_INLINE void Permute(V* A)
+{
+    V B[25];
+    for (int round = 0; round < 24; round++) {
+        // theta
+        const V C0 = A[0] ^ A[5] ^ A[10] ^ A[15] ^ A[20];
+        const V C1 = A[1] ^ A[6] ^ A[11] ^ A[16] ^ A[21];
+        const V C2 = A[2] ^ A[7] ^ A[12] ^ A[17] ^ A[22];
+        const V C3 = A[3] ^ A[8] ^ A[13] ^ A[18] ^ A[23];
+        const V C4 = A[4] ^ A[9] ^ A[14] ^ A[19] ^ A[24];
+        const V D0 = C4 ^ Rotl<1>(C1);
+        const V D1 = C0 ^ Rotl<1>(C2);
+        const V D2 = C1 ^ Rotl<1>(C3);
+        const V D3 = C2 ^ Rotl<1>(C4);
+        const V D4 = C3 ^ Rotl<1>(C0);
+
+        // rho and pi
+        B[0] = A[0] ^ D0;
+        B[1] = Rotl<44>(A[6] ^ D1);
+        B[2] = Rotl<43>(A[12] ^ D2);
+        B[3] = Rotl<21>(A[18] ^ D3);
+        B[4] = Rotl<14>(A[24] ^ D4);
+        B[5] = Rotl<28>(A[3] ^ D3);
+        B[6] = Rotl<20>(A[9] ^ D4);
+        B[7] = Rotl<3>(A[10] ^ D0);
+        B[8] = Rotl<45>(A[16] ^ D1);
+        B[9] = Rotl<61>(A[22] ^ D2);
+        B[10] = Rotl<1>(A[1] ^ D1);
+        B[11] = Rotl<6>(A[7] ^ D2);
+        B[12] = Rotl<25>(A[13] ^ D3);
+        B[13] = Rotl<8>(A[19] ^ D4);
+        B[14] = Rotl<18>(A[20] ^ D0);
+        B[15] = Rotl<27>(A[4] ^ D4);
+        B[16] = Rotl<36>(A[5] ^ D0);
+        B[17] = Rotl<10>(A[11] ^ D1);
+        B[18] = Rotl<15>(A[17] ^ D2);
+        B[19] = Rotl<56>(A[23] ^ D3);
+        B[20] = Rotl<62>(A[2] ^ D2);
+        B[21] = Rotl<55>(A[8] ^ D3);
+        B[22] = Rotl<39>(A[14] ^ D4);
+        B[23] = Rotl<41>(A[15] ^ D0);
+        B[24] = Rotl<2>(A[21] ^ D1);
+
+        // chi and iota
+        A[0] = B[0] ^ (~B[1] & B[2]);
+        A[1] = B[1] ^ (~B[2] & B[3]);
+        A[2] = B[2] ^ (~B[3] & B[4]);
+        A[3] = B[3] ^ (~B[4] & B[0]);
+        A[4] = B[4] ^ (~B[0] & B[1]);
+        A[5] = B[5] ^ (~B[6] & B[7]);
+        A[6] = B[6] ^ (~B[7] & B[8]);
+        A[7] = B[7] ^ (~B[8] & B[9]);
+        A[8] = B[8] ^ (~B[9] & B[5]);
+        A[9] = B[9] ^ (~B[5] & B[6]);
+        A[10] = B[10] ^ (~B[11] & B[12]);
+        A[11] = B[11] ^ (~B[12] & B[13]);
+        A[12] = B[12] ^ (~B[13] & B[14]);
+        A[13] = B[13] ^ (~B[14] & B[10]);
+        A[14] = B[14] ^ (~B[10] & B[11]);
+        A[15] = B[15] ^ (~B[16] & B[17]);
+        A[16] = B[16] ^ (~B[17] & B[18]);
+        A[17] = B[17] ^ (~B[18] & B[19]);
+        A[18] = B[18] ^ (~B[19] & B[15]);
+        A[19] = B[19] ^ (~B[15] & B[16]);
+        A[20] = B[20] ^ (~B[21] & B[22]);
+        A[21] = B[21] ^ (~B[22] & B[23]);
+        A[22] = B[22] ^ (~B[23] & B[24]);
+        A[23] = B[23] ^ (~B[24] & B[20]);
+        A[24] = B[24] ^ (~B[20] & B[21]);
+        A[0] ^= Splat<V>(RC[round]);
+    }
+}
+} // namespace keccak
+
+/** Keccak-512 (original 0x01 padding, as in sph) of N 64-byte messages. */
+template <typename V>
+void Keccak512(unsigned char* const* out, const unsigned char* const* in)
+{
+    V A[25];
+    for (int w = 0; w < 8; w++)
+        A[w] = LoadLE<V>(in, 8 * w);
+    A[8] = Splat<V>(0x8000000000000001ULL);
+    for (int w = 9; w < 25; w++)
+        A[w] = Splat<V>(0);
+    keccak::Permute(A);
+    for (int w = 0; w < 8; w++)
+        StoreLE(out, 8 * w, A[w]);
+}
+
+/* ----------- Skein-512 ----------------------------------------------------- */
+
+namespace skein
+{
+static const uint64_t IV[8] = {
+    0x4903ADFF749C51CEULL, 0x0D95DE399746DF03ULL, 0x8FD1934127C79BCEULL, 0x9A255629FF352CB1ULL,
+    0x5DB62599DF6CA7B0ULL, 0xEABE394CA9D5C3F4ULL, 0x991112C71A75B523ULL, 0xAE18A40B660FCC33ULL};
+
+template <int n, typename V>
+ALWAYS_INLINE void Mix(V& x0, V& x1)
+{
+    x0 = x0 + x1;
+    x1 = Rotl<n>(x1) ^ x0;
+}
+
+/** Key injection s into the Threefish state p0..p7. */
+template <typename V>
+ALWAYS_INLINE void AddKey(V& p0, V& p1, V& p2, V& p3, V& p4, V& p5, V& p6, V& p7,
+    const V* k, const uint64_t* t, int s)
+{
+    p0 = p0 + k[(s + 0) % 9];
+    p1 = p1 + k[(s + 1) % 9];
+    p2 = p2 + k[(s + 2) % 9];
+    p3 = p3 + k[(s + 3) % 9];
+    p4 = p4 + k[(s + 4) % 9];
+    p5 = p5 + k[(s + 5) % 9] + Splat<V>(t[s % 3]);
+    p6 = p6 + k[(s + 6) % 9] + Splat<V>(t[(s + 1) % 3]);
+    p7 = p7 + k[(s + 7) % 9] + Splat<V>((uint64_t)s);
+}
+
+/** One UBI call: h = Threefish-512_h,(t0,t1)(m) ^ m. */
+template <typename V>
+ALWAYS_INLINE void Ubi(V* h, const V* m, uint64_t t0, uint64_t t1)
+{
+    V k[9];
+    const uint64_t t[3] = {t0, t1, t0 ^ t1};
+    k[8] = Splat<V>(0x1BD11BDAA9FC1A22ULL);
+    for (int w = 0; w < 8; w++) {
+        k[w] = h[w];
+        k[8] ^= h[w];
+    }
+    V p0 = m[0], p1 = m[1], p2 = m[2], p3 = m[3], p4 = m[4], p5 = m[5], p6 = m[6], p7 = m[7];
+    for (int s = 0; s < 18; s += 2) {
+        AddKey(p0, p1, p2, p3, p4, p5, p6, p7, k, t, s);
+        Mix<46>(p0, p1); Mix<36>(p2, p3); Mix<19>(p4, p5); Mix<37>(p6, p7);
+        Mix<33>(p2, p1); Mix<27>(p4, p7); Mix<14>(p6, p5); Mix<42>(p0, p3);
+        Mix<17>(p4, p1); Mix<49>(p6, p3); Mix<36>(p0, p5); Mix<39>(p2, p7);
+        Mix<44>(p6, p1); Mix<9>(p0, p7); Mix<54>(p2, p5); Mix<56>(p4, p3);
+        AddKey(p0, p1, p2, p3, p4, p5, p6, p7, k, t, s + 1);
+        Mix<39>(p0, p1); Mix<30>(p2, p3); Mix<34>(p4, p5); Mix<24>(p6, p7);
+        Mix<13>(p2, p1); Mix<50>(p4, p7); Mix<10>(p6, p5); Mix<17>(p0, p3);
+        Mix<25>(p4, p1); Mix<29>(p6, p3); Mix<39>(p0, p5); Mix<43>(p2, p7);
+        Mix<8>(p6, p1); Mix<35>(p0, p7); Mix<56>(p2, p5); Mix<22>(p4, p3);
+    }
+    AddKey(p0, p1, p2, p3, p4, p5, p6, p7, k, t, 18);
+    h[0] = m[0] ^ p0;
+    h[1] = m[1] ^ p1;
+    h[2] = m[2] ^ p2;
+    h[3] = m[3] ^ p3;
+    h[4] = m[4] ^ p4;
+    h[5] = m[5] ^ p5;
+    h[6] = m[6] ^ p6;
+    h[7] = m[7] ^ p7;
+}
+} // namespace skein
+
+/** Skein-512-512 of N 64-byte messages. */
+template <typename V>
+void Skein512(unsigned char* const* out, const unsigned char* const* in)
+{
+    V h[8], m[8];
+    for (int w = 0; w < 8; w++) {
+        h[w] = Splat<V>(skein::IV[w]);
+        m[w] = LoadLE<V>(in, 8 * w);
+    }
+    // Message block (type 48, first and final), then the output block.
+    skein::Ubi(h, m, 64, 0xF000000000000000ULL);
+    for (int w = 0; w < 8; w++)
+        m[w] = Splat<V>(0);
+    skein::Ubi(h, m, 8, 0xFF00000000000000ULL);
+    for (int w = 0; w < 8; w++)
+        StoreLE(out, 8 * w, h[w]);
+}
+
+} // namespace quark_lanes
+
+#undef ALWAYS_INLINE
+
+#endif // BITCOIN_CRYPTO_QUARK_LANES_H
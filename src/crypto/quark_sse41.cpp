@@ -0,0 +1,46 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This file is compiled with SSE4.1 enabled; only use it after checking for
+// CPU support (see QuarkAutoDetect).
+
+#ifdef ENABLE_SSE41
+
+#include "crypto/quark_lanes.h"
+
+namespace quark_sse41
+{
+namespace
+{
+/** 2 messages per call, one 64-bit word of each per vector. */
+typedef uint64_t Vec __attribute__((vector_size(16)));
+}
+
+void Blake512(unsigned char* const* out, const unsigned char* const* in, size_t len)
+{
+    quark_lanes::Blake512<Vec>(out, in, len);
+}
+
+void Bmw512(unsigned char* const* out, const unsigned char* const* in)
+{
+    quark_lanes::Bmw512<Vec>(out, in);
+}
+
+void Jh512(unsigned char* const* out, const unsigned char* const* in)
+{
+    quark_lanes::Jh512<Vec>(out, in);
+}
+
+void Keccak512(unsigned char* const* out, const unsigned char* const* in)
+{
+    quark_lanes::Keccak512<Vec>(out, in);
+}
+
+void Skein512(unsigned char* const* out, const unsigned char* const* in)
+{
+    quark_lanes::Skein512<Vec>(out, in);
+}
+} // namespace quark_sse41
+
+#endif
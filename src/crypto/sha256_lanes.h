@@ -0,0 +1,207 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SHA256_LANES_H
+#define BITCOIN_CRYPTO_SHA256_LANES_H
+
+/**
+ * Lane-parallel double-SHA256 of 64-byte inputs, the operation behind merkle
+ * tree levels.
+ *
+ * Word i of all N inputs lives in one GCC vector of N uint32_t, so the
+ * instruction set is chosen by the compiler flags of the translation unit
+ * that includes this header (see sha256_sse41.cpp and sha256_avx2.cpp).
+ */
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+namespace sha256_lanes
+{
+static const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul,
+    0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul,
+    0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul,
+    0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul,
+    0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul,
+    0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul,
+    0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul,
+    0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul,
+    0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+/** K + W of the padding block that follows a 64-byte message. */
+static const uint32_t PAD64_KW[64] = {
+    0xc28a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul,
+    0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul,
+    0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf374ul,
+    0x649b69c1ul, 0xf0fe4786ul, 0x0fe1edc6ul, 0x240cf254ul,
+    0x4fe9346ful, 0x6cc984beul, 0x61b9411eul, 0x16f988faul,
+    0xf2c65152ul, 0xa88e5a6dul, 0xb019fc65ul, 0xb9d99ec7ul,
+    0x9a1231c3ul, 0xe70eeaa0ul, 0xfdb1232bul, 0xc7353eb0ul,
+    0x3069bad5ul, 0xcb976d5ful, 0x5a0f118ful, 0xdc1eeefdul,
+    0x0a35b689ul, 0xde0b7a04ul, 0x58f4ca9dul, 0xe15d5b16ul,
+    0x007f3e86ul, 0x37088980ul, 0xa507ea32ul, 0x6fab9537ul,
+    0x17406110ul, 0x0d8cd6f1ul, 0xcdaa3b6dul, 0xc0bbbe37ul,
+    0x83613bdaul, 0xdb48a363ul, 0x0b02e931ul, 0x6fd15ca7ul,
+    0x521afacaul, 0x31338431ul, 0x6ed41a95ul, 0x6d437890ul,
+    0xc39c91f2ul, 0x9eccabbdul, 0xb5c9a0e6ul, 0x532fb63cul,
+    0xd2c741c6ul, 0x07237ea3ul, 0xa4954b68ul, 0x4c191d76ul,
+};
+
+static const uint32_t INIT[8] = {
+    0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul,
+    0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+template <typename V>
+struct Lanes {
+    static const int N = sizeof(V) / sizeof(uint32_t);
+};
+
+template <typename V>
+ALWAYS_INLINE V Splat(uint32_t x)
+{
+    V v;
+    for (int i = 0; i < Lanes<V>::N; i++)
+        v[i] = x;
+    return v;
+}
+
+template <int n, typename V>
+ALWAYS_INLINE V Rotr(V x)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+template <typename V>
+ALWAYS_INLINE V Ch(V x, V y, V z) { return z ^ (x & (y ^ z)); }
+template <typename V>
+ALWAYS_INLINE V Maj(V x, V y, V z) { return (x & y) | (z & (x | y)); }
+template <typename V>
+ALWAYS_INLINE V Sigma0(V x) { return Rotr<2>(x) ^ Rotr<13>(x) ^ Rotr<22>(x); }
+template <typename V>
+ALWAYS_INLINE V Sigma1(V x) { return Rotr<6>(x) ^ Rotr<11>(x) ^ Rotr<25>(x); }
+template <typename V>
+ALWAYS_INLINE V sigma0(V x) { return Rotr<7>(x) ^ Rotr<18>(x) ^ (x >> 3); }
+template <typename V>
+ALWAYS_INLINE V sigma1(V x) { return Rotr<17>(x) ^ Rotr<19>(x) ^ (x >> 10); }
+
+/** One round of SHA-256, with the round constant already added to the message word. */
+template <typename V>
+ALWAYS_INLINE void Round(V a, V b, V c, V& d, V e, V f, V g, V& h, V kw)
+{
+    V t1 = h + Sigma1(e) + Ch(e, f, g) + kw;
+    V t2 = Sigma0(a) + Maj(a, b, c);
+    d = d + t1;
+    h = t1 + t2;
+}
+
+/** Sixteen rounds starting at round r, with kw[i] = K[r + i] + W[r + i]. */
+template <typename V>
+ALWAYS_INLINE void Round16(V* s, const V* kw)
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 16; i += 8) {
+        Round(a, b, c, d, e, f, g, h, kw[i + 0]);
+        Round(h, a, b, c, d, e, f, g, kw[i + 1]);
+        Round(g, h, a, b, c, d, e, f, kw[i + 2]);
+        Round(f, g, h, a, b, c, d, e, kw[i + 3]);
+        Round(e, f, g, h, a, b, c, d, kw[i + 4]);
+        Round(d, e, f, g, h, a, b, c, kw[i + 5]);
+        Round(c, d, e, f, g, h, a, b, kw[i + 6]);
+        Round(b, c, d, e, f, g, h, a, kw[i + 7]);
+    }
+    s[0] = a; s[1] = b; s[2] = c; s[3] = d; s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+}
+
+/** Process one block given as message words w[16] (clobbered), including the
+ *  feed-forward into s. */
+template <typename V>
+ALWAYS_INLINE void Transform(V* s, V* w)
+{
+    V t[8], kw[16];
+    for (int i = 0; i < 8; i++)
+        t[i] = s[i];
+    for (int r = 0; r < 64; r += 16) {
+        if (r) {
+            // Expand the next 16 schedule words in place.
+            for (int j = 0; j < 16; j++)
+                w[j] = w[j] + sigma1(w[(j + 14) & 15]) + w[(j + 9) & 15] + sigma0(w[(j + 1) & 15]);
+        }
+        for (int j = 0; j < 16; j++)
+            kw[j] = w[j] + Splat<V>(K[r + j]);
+        Round16(t, kw);
+    }
+    for (int i = 0; i < 8; i++)
+        s[i] = s[i] + t[i];
+}
+
+/** Process a block whose K + W values are the same in every lane. */
+template <typename V>
+ALWAYS_INLINE void TransformConst(V* s, const uint32_t* kwconst)
+{
+    V t[8], kw[16];
+    for (int i = 0; i < 8; i++)
+        t[i] = s[i];
+    for (int r = 0; r < 64; r += 16) {
+        for (int j = 0; j < 16; j++)
+            kw[j] = Splat<V>(kwconst[r + j]);
+        Round16(t, kw);
+    }
+    for (int i = 0; i < 8; i++)
+        s[i] = s[i] + t[i];
+}
+
+/** Double-SHA256 of N consecutive 64-byte inputs into N consecutive 32-byte outputs. */
+template <typename V>
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    const int N = Lanes<V>::N;
+    V s[8], w[16];
+
+    // First hash: the message block, then the constant padding block.
+    for (int i = 0; i < 16; i++)
+        for (int l = 0; l < N; l++)
+            w[i][l] = ReadBE32(in + 64 * l + 4 * i);
+    for (int i = 0; i < 8; i++)
+        s[i] = Splat<V>(INIT[i]);
+    Transform(s, w);
+    TransformConst(s, PAD64_KW);
+
+    // Second hash: the 32-byte digest, padded to one block.
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+        s[i] = Splat<V>(INIT[i]);
+    }
+    w[8] = Splat<V>(0x80000000ul);
+    for (int i = 9; i < 15; i++)
+        w[i] = Splat<V>(0);
+    w[15] = Splat<V>(0x100);
+    Transform(s, w);
+
+    for (int i = 0; i < 8; i++)
+        for (int l = 0; l < N; l++)
+            WriteBE32(out + 32 * l + 4 * i, s[i][l]);
+}
+
+} // namespace sha256_lanes
+
+#undef ALWAYS_INLINE
+
+#endif // BITCOIN_CRYPTO_SHA256_LANES_H
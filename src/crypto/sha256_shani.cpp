@@ -0,0 +1,145 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This file is compiled with SHA extensions enabled; only use it after
+// checking for CPU support (see SHA256AutoDetect).
+
+#ifdef ENABLE_SHANI
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace
+{
+/** Four rounds: two sha256rnds2 steps on message words m plus constants. */
+inline void __attribute__((always_inline)) QuadRound(__m128i& state0, __m128i& state1, __m128i m, uint64_t k1, uint64_t k0)
+{
+    const __m128i msg = _mm_add_epi32(m, _mm_set_epi64x(k1, k0));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+/** First half of the schedule update of `m0` using the words after it. */
+inline void __attribute__((always_inline)) ShiftMessageA(__m128i& m0, __m128i m1)
+{
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+}
+
+/** Second half of the schedule update of `m2` from the two words before it. */
+inline void __attribute__((always_inline)) ShiftMessageC(__m128i m0, __m128i m1, __m128i& m2)
+{
+    m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m0, m1, 4)), m0);
+}
+} // namespace
+
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i m0, m1, m2, m3, state0, state1, save0, save1;
+
+    // Load the state as ABEF / CDGH.
+    const __m128i dcba = _mm_loadu_si128((const __m128i*)s);
+    const __m128i hgfe = _mm_loadu_si128((const __m128i*)(s + 4));
+    const __m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+    const __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+    state0 = _mm_alignr_epi8(cdab, efgh, 8);
+    state1 = _mm_blend_epi16(efgh, cdab, 0xf0);
+
+    while (blocks--) {
+        save0 = state0;
+        save1 = state1;
+
+        // Rounds 0-3
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 0)), MASK);
+        QuadRound(state0, state1, m0, 0xe9b5dba5b5c0fbcfull, 0x71374491428a2f98ull);
+
+        // Rounds 4-7
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16)), MASK);
+        QuadRound(state0, state1, m1, 0xab1c5ed5923f82a4ull, 0x59f111f13956c25bull);
+        ShiftMessageA(m0, m1);
+
+        // Rounds 8-11
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 32)), MASK);
+        QuadRound(state0, state1, m2, 0x550c7dc3243185beull, 0x12835b01d807aa98ull);
+        ShiftMessageA(m1, m2);
+
+        // Rounds 12-15
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 48)), MASK);
+        QuadRound(state0, state1, m3, 0xc19bf1749bdc06a7ull, 0x80deb1fe72be5d74ull);
+        ShiftMessageC(m3, m2, m0);
+        ShiftMessageA(m2, m3);
+
+        // Rounds 16-19
+        QuadRound(state0, state1, m0, 0x240ca1cc0fc19dc6ull, 0xefbe4786e49b69c1ull);
+        ShiftMessageC(m0, m3, m1);
+        ShiftMessageA(m3, m0);
+
+        // Rounds 20-23
+        QuadRound(state0, state1, m1, 0x76f988da5cb0a9dcull, 0x4a7484aa2de92c6full);
+        ShiftMessageC(m1, m0, m2);
+        ShiftMessageA(m0, m1);
+
+        // Rounds 24-27
+        QuadRound(state0, state1, m2, 0xbf597fc7b00327c8ull, 0xa831c66d983e5152ull);
+        ShiftMessageC(m2, m1, m3);
+        ShiftMessageA(m1, m2);
+
+        // Rounds 28-31
+        QuadRound(state0, state1, m3, 0x1429296706ca6351ull, 0xd5a79147c6e00bf3ull);
+        ShiftMessageC(m3, m2, m0);
+        ShiftMessageA(m2, m3);
+
+        // Rounds 32-35
+        QuadRound(state0, state1, m0, 0x53380d134d2c6dfcull, 0x2e1b213827b70a85ull);
+        ShiftMessageC(m0, m3, m1);
+        ShiftMessageA(m3, m0);
+
+        // Rounds 36-39
+        QuadRound(state0, state1, m1, 0x92722c8581c2c92eull, 0x766a0abb650a7354ull);
+        ShiftMessageC(m1, m0, m2);
+        ShiftMessageA(m0, m1);
+
+        // Rounds 40-43
+        QuadRound(state0, state1, m2, 0xc76c51a3c24b8b70ull, 0xa81a664ba2bfe8a1ull);
+        ShiftMessageC(m2, m1, m3);
+        ShiftMessageA(m1, m2);
+
+        // Rounds 44-47
+        QuadRound(state0, state1, m3, 0x106aa070f40e3585ull, 0xd6990624d192e819ull);
+        ShiftMessageC(m3, m2, m0);
+        ShiftMessageA(m2, m3);
+
+        // Rounds 48-51
+        QuadRound(state0, state1, m0, 0x34b0bcb52748774cull, 0x1e376c0819a4c116ull);
+        ShiftMessageC(m0, m3, m1);
+        ShiftMessageA(m3, m0);
+
+        // Rounds 52-55
+        QuadRound(state0, state1, m1, 0x682e6ff35b9cca4full, 0x4ed8aa4a391c0cb3ull);
+        ShiftMessageC(m1, m0, m2);
+
+        // Rounds 56-59
+        QuadRound(state0, state1, m2, 0x8cc7020884c87814ull, 0x78a5636f748f82eeull);
+        ShiftMessageC(m2, m1, m3);
+
+        // Rounds 60-63
+        QuadRound(state0, state1, m3, 0xc67178f2bef9a3f7ull, 0xa4506ceb90befffaull);
+
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+        chunk += 64;
+    }
+
+    // Store the state back as ABCD / EFGH.
+    const __m128i feba = _mm_shuffle_epi32(state0, 0x1b);
+    const __m128i dchg = _mm_shuffle_epi32(state1, 0xb1);
+    _mm_storeu_si128((__m128i*)s, _mm_blend_epi16(feba, dchg, 0xf0));
+    _mm_storeu_si128((__m128i*)(s + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+} // namespace sha256_shani
+
+#endif
@@ -0,0 +1,26 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This file is compiled with SSE4.1 enabled; only use it after checking for
+// CPU support (see SHA256AutoDetect).
+
+#ifdef ENABLE_SSE41
+
+#include "crypto/sha256_lanes.h"
+
+namespace sha256d64_sse41
+{
+namespace
+{
+/** 4 inputs per call, one 32-bit word of each per vector. */
+typedef uint32_t Vec __attribute__((vector_size(16)));
+}
+
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    sha256_lanes::TransformD64<Vec>(out, in);
+}
+} // namespace sha256d64_sse41
+
+#endif
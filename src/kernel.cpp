@@ -154,22 +154,41 @@ bool initStakeInput(const CBlock& block, std::unique_ptr<CStakeInput>& stake, in
         // First try finding the previous transaction in database
         uint256 hashBlock;
         CTransaction txPrev;
-        if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
-            return error("%s : INFO: read txPrev failed, tx id prev: %s, block id %s",
-                         __func__, txin.prevout.hash.GetHex(), block.GetHash().GetHex());
+        CTxOut txOutPrev;
+        CPivStake* pivInput = new CPivStake();
+        stake = std::unique_ptr<CStakeInput>(pivInput);
+        if (GetTransaction(txin.prevout.hash, txPrev, hashBlock, true)) {
+            txOutPrev = txPrev.vout[txin.prevout.n];
+            pivInput->SetInput(txPrev, txin.prevout.n);
+        } else {
+            // On a pruned node the block holding it may be gone. The UTXO set of
+            // the active chain still has the output, but it only speaks for the
+            // chain of this block if the output was created where the two chains
+            // are shared. Anything else can't be resolved here, so it is rejected.
+            LOCK(cs_main);
+            const Coin& coin = pcoinsTip->AccessCoin(txin.prevout);
+            BlockMap::const_iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+            CBlockIndex* pindexFrom = NULL;
+            if (fHavePruned && !coin.IsSpent() && mi != mapBlockIndex.end() && (int)coin.nHeight <= mi->second->nHeight) {
+                pindexFrom = mi->second->GetAncestor(coin.nHeight);
+                if (pindexFrom != chainActive[coin.nHeight])
+                    pindexFrom = NULL;
+            }
+            if (!pindexFrom)
+                return error("%s : INFO: read txPrev failed, tx id prev: %s, block id %s",
+                             __func__, txin.prevout.hash.GetHex(), block.GetHash().GetHex());
+            txOutPrev = coin.out;
+            pivInput->SetInput(txin.prevout, coin.out, pindexFrom);
+        }
 
         //verify signature and script
         ScriptError serror;
-        if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0), &serror)) {
+        if (!VerifyScript(txin.scriptSig, txOutPrev.scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0), &serror)) {
             std::string strErr = "";
             if (serror && ScriptErrorString(serror))
                 strErr = strprintf("with the following error: %s", ScriptErrorString(serror));
             return error("%s : VerifyScript failed on coinstake %s %s", __func__, tx.GetHash().ToString(), strErr);
         }
-
-        CPivStake* pivInput = new CPivStake();
-        pivInput->SetInput(txPrev, txin.prevout.n);
-        stake = std::unique_ptr<CStakeInput>(pivInput);
     }
     return true;
 }
@@ -2,6 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "config/kabberry-config.h"
+#endif
+
 #include "leveldbwrapper.h"
 
 #include "util.h"
@@ -27,14 +31,26 @@ void HandleError(const leveldb::Status& status)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+bool LevelDBCompressionAvailable()
+{
+#ifdef USE_SNAPPY
+    return true;
+#else
+    return false;
+#endif
+}
+
+static leveldb::Options GetOptions(const CLevelDBProfile& profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.block_cache = leveldb::NewLRUCache(profile.nBlockCacheSize);
+    options.write_buffer_size = profile.nWriteBufferSize;
+    options.block_size = profile.nBlockSize;
+    options.filter_policy = profile.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(profile.nBloomBits) : NULL;
+    // Tables record how each block was stored, so existing uncompressed
+    // databases stay readable and get compressed as they are compacted.
+    options.compression = profile.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = profile.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,14 +59,16 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, const CLevelDBProfile& profileIn, bool fMemory, bool fWipe) : profile(profileIn)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    // Without Snappy leveldb silently stores blocks raw; report what it does.
+    profile.fCompression = profile.fCompression && LevelDBCompressionAvailable();
+    options = GetOptions(profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -61,7 +79,9 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
             leveldb::DestroyDB(path.string(), options);
         }
         TryCreateDirectory(path);
-        LogPrintf("Opening LevelDB in %s\n", path.string());
+        LogPrintf("Opening LevelDB in %s (cache %.1fMiB, write buffer %.1fMiB, %s)\n", path.string(),
+            profile.nBlockCacheSize * (1.0 / (1 << 20)), profile.nWriteBufferSize * (1.0 / (1 << 20)),
+            profile.fCompression ? "compressed" : "uncompressed");
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
@@ -80,6 +100,20 @@ CLevelDBWrapper::~CLevelDBWrapper()
     options.env = NULL;
 }
 
+bool CLevelDBWrapper::GetProperty(const std::string& strName, std::string& strValue) const
+{
+    return pdb->GetProperty("leveldb." + strName, &strValue);
+}
+
+uint64_t CLevelDBWrapper::EstimateSize() const
+{
+    // Every key we write starts with a printable type character.
+    leveldb::Range range(leveldb::Slice("", 0), leveldb::Slice("\xff\xff\xff\xff", 4));
+    uint64_t nSize = 0;
+    pdb->GetApproximateSizes(&range, 1, &nSize);
+    return nSize;
+}
+
 bool CLevelDBWrapper::WriteBatch(CLevelDBBatch& batch, bool fSync)
 {
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
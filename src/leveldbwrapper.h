@@ -24,6 +24,31 @@ public:
 
 void HandleError(const leveldb::Status& status);
 
+//! Whether the embedded leveldb was built with Snappy, so that compression takes effect
+bool LevelDBCompressionAvailable();
+
+/**
+ * Tuning of a single database. The defaults derived from a cache size match
+ * what every database used before; init adjusts them per database.
+ */
+struct CLevelDBProfile {
+    //! LRU cache of uncompressed table blocks
+    size_t nBlockCacheSize;
+    //! memtable size; up to two write buffers may be held in memory simultaneously
+    size_t nWriteBufferSize;
+    //! uncompressed size of a table block
+    size_t nBlockSize;
+    int nMaxOpenFiles;
+    //! bits per key of the bloom filter, 0 disables it
+    int nBloomBits;
+    //! Snappy compression of table blocks, cleared when opening if leveldb was built without Snappy
+    bool fCompression;
+
+    explicit CLevelDBProfile(size_t nCacheSize)
+        : nBlockCacheSize(nCacheSize / 2), nWriteBufferSize(nCacheSize / 4), nBlockSize(4096),
+          nMaxOpenFiles(64), nBloomBits(10), fCompression(true) {}
+};
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -49,6 +74,12 @@ public:
         batch.Put(slKey, slValue);
     }
 
+    //! Write a record whose key and value are already serialized.
+    void WriteRaw(const leveldb::Slice& key, const leveldb::Slice& value)
+    {
+        batch.Put(key, value);
+    }
+
     template <typename K>
     void Erase(const K& key)
     {
@@ -59,6 +90,11 @@ public:
 
         batch.Delete(slKey);
     }
+
+    void Clear()
+    {
+        batch.Clear();
+    }
 };
 
 class CLevelDBWrapper
@@ -85,10 +121,21 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! tuning the database was opened with, as in effect
+    CLevelDBProfile profile;
+
 public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, const CLevelDBProfile& profileIn, bool fMemory = false, bool fWipe = false);
     ~CLevelDBWrapper();
 
+    const CLevelDBProfile& GetProfile() const { return profile; }
+
+    //! Read one of leveldb's "leveldb.*" properties, false if it is unknown.
+    bool GetProperty(const std::string& strName, std::string& strValue) const;
+
+    //! Approximate size on disk of all keys.
+    uint64_t EstimateSize() const;
+
     template <typename K, typename V>
     bool Read(const K& key, V& value) const
     {
@@ -21,8 +21,12 @@
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "init.h"
 #include "kernel.h"
+#include "memusage.h"
 #include "masternode-budget.h"
 #include "masternode-payments.h"
 #include "masternodeman.h"
@@ -67,6 +71,7 @@
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+CBlockIndexArena blockIndexArena;
 std::map<uint256, uint256> mapProofOfStake;
 CChain chainActive;
 CBlockIndex* pindexBestHeader = NULL;
@@ -81,10 +86,13 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
+bool fHavePruned = false;
+bool fPruneMode = false;
+uint64_t nPruneTarget = 0;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 /* If the tip is older than this (in seconds), the node is considered to be in initial block download. */
@@ -108,6 +116,7 @@ std::map<uint256, COrphanTx> mapOrphanTransactions;
 std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
 std::map<uint256, int64_t> mapRejectedBlocks;
 std::map<uint256, int64_t> mapZerocoinspends; //txid, time received
+std::atomic<bool> fMempoolLoaded(false);
 
 void EraseOrphansFor(NodeId peer);
 
@@ -193,6 +202,12 @@ std::set<CBlockIndex*> setDirtyBlockIndex;
 
 /** Dirty block file entries. */
 std::set<int> setDirtyFileInfo;
+
+/** Set on startup and whenever block or undo file space grows in prune mode, to look for files to delete. */
+bool fCheckForPruning = false;
+
+/** Merkle tree of the last block served as a merkleblock. Protected by cs_main. */
+std::shared_ptr<const CMerkleTree> pFilteredBlockTree;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -618,6 +633,9 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache* pcoinsTip = NULL;
+CCoinsViewDB* pcoinsdbview = NULL;
+CRollingCoinsStats rollingCoinsStats;
+CBlockFileMapper blockFileMapper;
 CBlockTreeDB* pblocktree = NULL;
 CZerocoinDB* zerocoinDB = NULL;
 CSporkDB* pSporkDB = NULL;
@@ -865,11 +883,11 @@ int GetInputAge(CTxIn& vin)
         CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
-        const CCoins* coins = view.AccessCoins(vin.prevout.hash);
+        const Coin& coin = view.AccessCoin(vin.prevout);
 
-        if (coins) {
-            if (coins->nHeight < 0) return 0;
-            return (chainActive.Tip()->nHeight + 1) - coins->nHeight;
+        if (!coin.IsSpent()) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) return 0;
+            return (chainActive.Tip()->nHeight + 1) - (int)coin.nHeight;
         } else
             return -1;
     }
@@ -914,7 +932,9 @@ bool ContextualCheckZerocoinMint(const CTransaction& tx, const libzerocoin::Publ
         //See if this coin has already been added to the blockchain
         uint256 txid;
         int nHeight;
-        if (zerocoinDB->ReadCoinMint(coin.getValue(), txid) && IsTransactionInChain(txid, nHeight))
+        //when verifying blocks, they are reconnected without their mints being erased
+        if (zerocoinDB->ReadCoinMint(coin.getValue(), txid) && IsTransactionInChain(txid, nHeight) &&
+                (!fVerifyingBlocks || pindex->nHeight > nHeight))
             return error("%s: pubcoin %s was already accumulated in tx %s", __func__,
                          coin.getValue().GetHex().substr(0, 10),
                          txid.GetHex());
@@ -954,21 +974,27 @@ bool CheckPublicCoinSpendVersion(int version) {
     return version == CurrentPublicCoinSpendVersion();
 }
 
-bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend* spend, CBlockIndex* pindex, const uint256& hashBlock)
+/** Reject serial's that are already in the blockchain */
+static bool ContextualCheckZerocoinSpendSerial(const libzerocoin::CoinSpend* spend, const CBlockIndex* pindex)
 {
-    if(!ContextualCheckZerocoinSpendNoSerialCheck(tx, spend, pindex, hashBlock)){
-        return false;
-    }
-
-    //Reject serial's that are already in the blockchain
     int nHeightTx = 0;
-    if (IsSerialInBlockchain(spend->getCoinSerialNumber(), nHeightTx))
+    //when verifying blocks, they are reconnected without their spends being erased - the serial is recorded from this block on
+    if (IsSerialInBlockchain(spend->getCoinSerialNumber(), nHeightTx) && (!fVerifyingBlocks || pindex->nHeight > nHeightTx))
         return error("%s : sKKC spend with serial %s is already in block %d\n", __func__,
                      spend->getCoinSerialNumber().GetHex(), nHeightTx);
 
     return true;
 }
 
+bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend* spend, CBlockIndex* pindex, const uint256& hashBlock)
+{
+    if(!ContextualCheckZerocoinSpendNoSerialCheck(tx, spend, pindex, hashBlock)){
+        return false;
+    }
+
+    return ContextualCheckZerocoinSpendSerial(spend, pindex);
+}
+
 bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, CBlockIndex* pindex, const uint256& hashBlock)
 {
     //Check to see if the sKKC is properly signed
@@ -1009,6 +1035,50 @@ bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const lib
     return true;
 }
 
+bool CZerocoinSpendCheck::operator()()
+{
+    return ContextualCheckZerocoinSpendNoSerialCheck(*ptx, spend.get(), pindex, uint256());
+}
+
+bool CheckZerocoinSpendInputs(const CTransaction& tx, CValidationState& state, CBlockIndex* pindex, CAmount& nValueIn,
+                              std::vector<std::pair<libzerocoin::CoinSpend, uint256> >& vSpends, std::vector<CBlockCheck>* pvChecks)
+{
+    for (const CTxIn& txIn : tx.vin) {
+        bool isPublicSpend = txIn.IsZerocoinPublicSpend();
+        bool isPrivZerocoinSpend = txIn.IsZerocoinSpend();
+        if (!isPrivZerocoinSpend && !isPublicSpend)
+            continue;
+
+        // Check enforcement
+        if (!CheckPublicCoinSpendEnforced(pindex->nHeight, isPublicSpend)){
+            return false;
+        }
+
+        std::shared_ptr<const libzerocoin::CoinSpend> spend;
+        if (isPublicSpend) {
+            libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
+            std::shared_ptr<PublicCoinSpend> publicSpend = std::make_shared<PublicCoinSpend>(params);
+            if (!sKKCModule::ParseZerocoinPublicSpend(txIn, tx, state, *publicSpend)){
+                return false;
+            }
+            spend = publicSpend;
+        } else {
+            spend = std::make_shared<libzerocoin::CoinSpend>(TxInToZerocoinSpend(txIn));
+        }
+        nValueIn += spend->getDenomination() * COIN;
+        //queue for db write after the 'justcheck' section has concluded
+        vSpends.emplace_back(std::make_pair(*spend, tx.GetHash()));
+
+        CZerocoinSpendCheck check(spend, tx, pindex);
+        if ((!pvChecks && !check()) || !ContextualCheckZerocoinSpendSerial(spend.get(), pindex))
+            return state.DoS(100, error("%s: failed to add block %s with invalid %s", __func__, tx.GetHash().GetHex(),
+                                        isPublicSpend ? "public zc spend" : "zerocoinspend"), REJECT_INVALID);
+        if (pvChecks)
+            pvChecks->emplace_back(check);
+    }
+    return true;
+}
+
 bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, bool fFakeSerialAttack)
 {
     //max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
@@ -1151,8 +1221,40 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
     return nMinFee;
 }
 
+/** The script verification flags ConnectBlock enforces on a block whose parent is pindexPrev. */
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindexPrev)
+{
+    unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG;
+    if (pindexPrev && pindexPrev->nHeight >= Params().BIP65ActivationHeight())
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    return flags;
+}
+
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    const unsigned long nSizeBefore = pool.size();
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    std::vector<COutPoint> vNoSpendsRemaining;
+    pool.TrimToSize(limit, &vNoSpendsRemaining);
+    for (const COutPoint& removed : vNoSpendsRemaining)
+        pcoinsTip->Uncache(removed);
+
+    // Evicted and expired zerocoin spends won't be mined, forget when they came
+    if (pool.size() < nSizeBefore) {
+        for (std::map<uint256, int64_t>::iterator it = mapZerocoinspends.begin(); it != mapZerocoinspends.end();) {
+            if (pool.exists(it->first))
+                ++it;
+            else
+                mapZerocoinspends.erase(it++);
+        }
+    }
+}
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee, bool ignoreFees, bool fOverrideMempoolLimit)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1282,15 +1384,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
             CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
             view.SetBackend(viewMemPool);
 
-            // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
-
             // do all inputs exist?
-            // Note that this does not check for the presence of actual outputs (see the next check for that),
-            // only helps filling in pfMissingInputs (to determine missing vs spent).
             for (const CTxIn& txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
+                    // Are inputs missing because we already have the tx?
+                    for (size_t out = 0; out < tx.vout.size(); out++) {
+                        // Optimistically just do efficient check of cache for outputs
+                        if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                            return false;
+                    }
+                    // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                     if (pfMissingInputs)
                         *pfMissingInputs = true;
                     return false;
@@ -1355,7 +1458,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         if (!hasZcSpendInputs)
             view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1368,6 +1471,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                 return state.DoS(0, error("%s : not enough fees %s, %d < %d",
                         __func__, hash.ToString(), nFees, txMinFee), REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            // Once the pool has been full, it takes more than the relay fee to get in.
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (!fOverrideMempoolLimit && !hasZcSpendInputs && mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+                return state.DoS(0, error("%s : mempool min fee not met %s, %d < %d",
+                        __func__, hash.ToString(), nFees, mempoolRejectFee), REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (tx.HasZerocoinMintOutputs()) {
                 if(nFees < Params().Zerocoin_MintFee() * tx.GetZerocoinMintCount())
@@ -1412,6 +1521,18 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                     __func__, hash.ToString(), nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
         }
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+            return state.DoS(0, error("%s : %s %s", __func__, hash.ToString(), errString),
+                REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         bool fCLTVIsActivated = chainActive.Tip()->nHeight >= Params().BIP65ActivationHeight();
 
         // Check against previous transactions
@@ -1419,29 +1540,38 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         int flags = STANDARD_SCRIPT_VERIFY_FLAGS;
         if (fCLTVIsActivated)
             flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-        if (!CheckInputs(tx, state, view, true, flags, true)) {
+        if (!CheckInputs(tx, state, view, true, flags, true, false)) {
             return error("%s : ConnectInputs failed %s", __func__, hash.ToString());
         }
 
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
+        // Check again against the consensus-critical script verification
+        // flags of the next block, in case of bugs in the standard flags that
+        // cause transactions to pass as valid when they're actually invalid.
+        // For instance the STRICTENC flag was incorrectly allowing certain
         // CHECKSIG NOT scripts to pass, even though they were invalid.
         //
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        flags = MANDATORY_SCRIPT_VERIFY_FLAGS;
-        if (fCLTVIsActivated)
-            flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-        if (!CheckInputs(tx, state, view, true, flags, true)) {
+        //
+        // Using the block's own flags here lets ConnectBlock find the result
+        // in the script execution cache and skip the scripts entirely.
+        flags = GetBlockScriptFlags(chainActive.Tip());
+        if (!CheckInputs(tx, state, view, true, flags, true, true)) {
             return error("%s : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s",
                     __func__, hash.ToString());
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
+
+        // trim mempool and check if tx was trimmed
+        if (!fOverrideMempoolLimit) {
+            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            if (!pool.exists(hash))
+                return state.DoS(0, error("%s : mempool full, %s evicted", __func__, hash.ToString()),
+                        REJECT_INSUFFICIENTFEE, "mempool full");
+        }
     }
 
     SyncWithWallets(tx, nullptr);
@@ -1453,6 +1583,148 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
     return true;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees, bool fOverrideMempoolLimit)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectInsaneFee, ignoreFees, fOverrideMempoolLimit);
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("%s : failed to open %s. Continuing anyway.\n", __func__, path.string());
+        return false;
+    }
+
+    int64_t count = 0;
+    int64_t failed = 0;
+    int64_t expired = 0;
+    int64_t nNow = GetTime();
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("%s : unknown mempool.dat version %d. Continuing anyway.\n", __func__, version);
+            return false;
+        }
+
+        // Deltas go in first, so the transactions are judged with them as
+        // they were before the restart.
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        std::map<uint256, int64_t> mapSpendTimes;
+        file >> mapDeltas;
+        file >> mapSpendTimes;
+        for (const auto& delta : mapDeltas)
+            mempool.PrioritiseTransaction(delta.first, delta.first.ToString(), delta.second.first, delta.second.second);
+
+        uint64_t num;
+        file >> num;
+        while (num--) {
+            CTransaction tx;
+            int64_t nTime;
+            file >> tx;
+            file >> nTime;
+
+            if (nTime + nExpiryTimeout > nNow) {
+                LOCK(cs_main);
+                // Free transactions were let in once already; don't run them
+                // through the relay rate limiter again.
+                CValidationState state;
+                if (AcceptToMemoryPoolWithTime(mempool, state, tx, false, NULL, nTime)) {
+                    ++count;
+                    auto it = mapSpendTimes.find(tx.GetHash());
+                    if (it != mapSpendTimes.end() && mapZerocoinspends.count(it->first))
+                        mapZerocoinspends[it->first] = it->second;
+                } else {
+                    ++failed;
+                }
+            } else {
+                ++expired;
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s : failed to deserialize mempool data on disk: %s. Continuing anyway.\n", __func__, e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, expired);
+    return true;
+}
+
+bool DumpMempool()
+{
+    // The periodic dump, savemempool and shutdown may run at the same time.
+    // One dump at a time keeps them off each other's mempool.dat.new, and
+    // the snapshot taken last is the one renamed last.
+    static CCriticalSection cs_dump;
+    LOCK(cs_dump);
+
+    int64_t nStart = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::map<uint256, int64_t> mapSpendTimes;
+    std::vector<std::pair<CTransaction, int64_t> > vTx;
+    {
+        LOCK2(cs_main, mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        for (const auto& spend : mapZerocoinspends) {
+            if (mempool.mapTx.count(spend.first))
+                mapSpendTimes.insert(spend);
+        }
+
+        // Parents before children, so that every transaction finds its
+        // inputs when the file is loaded.
+        std::vector<CTxMemPool::txiter> vEntries;
+        vEntries.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            vEntries.push_back(it);
+        std::sort(vEntries.begin(), vEntries.end(), [](const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) {
+            if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+                return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+            return a->GetTime() < b->GetTime();
+        });
+        vTx.reserve(vEntries.size());
+        for (CTxMemPool::txiter it : vEntries)
+            vTx.push_back(std::make_pair(it->GetTx(), it->GetTime()));
+    }
+
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        FILE* filestr = fopen(pathTmp.string().c_str(), "wb");
+        if (!filestr)
+            return error("%s : failed to open %s", __func__, pathTmp.string());
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+        file << mapDeltas;
+        file << mapSpendTimes;
+        file << (uint64_t)vTx.size();
+        for (const auto& entry : vTx) {
+            file << entry.first;
+            file << entry.second;
+        }
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+            return error("%s : failed to rename %s", __func__, pathTmp.string());
+    } catch (const std::exception& e) {
+        return error("%s : failed to dump mempool: %s", __func__, e.what());
+    }
+
+    int64_t nLast = GetTimeMicros();
+    LogPrint("mempool", "Dumped %u mempool transactions: %.2fms to copy, %.2fms to dump\n", vTx.size(), 0.001 * (nMid - nStart), 0.001 * (nLast - nMid));
+    return true;
+}
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool isDSTX)
 {
     AssertLockHeld(cs_main);
@@ -1516,15 +1788,16 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
             CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
             view.SetBackend(viewMemPool);
 
-            // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
-
             // do all inputs exist?
-            // Note that this does not check for the presence of actual outputs (see the next check for that),
-            // only helps filling in pfMissingInputs (to determine missing vs spent).
             for (const CTxIn& txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
+                    // Are inputs missing because we already have the tx?
+                    for (size_t out = 0; out < tx.vout.size(); out++) {
+                        // Optimistically just do efficient check of cache for outputs
+                        if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                            return false;
+                    }
+                    // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                     if (pfMissingInputs)
                         *pfMissingInputs = true;
                     return false;
@@ -1628,7 +1901,7 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
         int flags = STANDARD_SCRIPT_VERIFY_FLAGS;
         if (fCLTVIsActivated)
             flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-        if (!CheckInputs(tx, state, view, false, flags, true)) {
+        if (!CheckInputs(tx, state, view, false, flags, true, false)) {
             return error("AcceptableInputs: : ConnectInputs failed %s", hash.ToString());
         }
 
@@ -1642,7 +1915,7 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
         // for any real tx this will be checked on AcceptToMemoryPool anyway
-        //        if (!CheckInputs(tx, state, view, false, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        //        if (!CheckInputs(tx, state, view, false, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false))
         //        {
         //            return error("AcceptableInputs: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         //        }
@@ -1710,9 +1983,9 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
             int nHeight = -1;
             {
                 CCoinsViewCache& view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                const Coin& coin = AccessByTxid(view, hash);
+                if (!coin.IsSpent())
+                    nHeight = coin.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
@@ -1762,18 +2035,68 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
+/** Check the magic of a block record and extract the size of the block that follows it. */
+static bool ParseBlockRecordHeader(const char* pchHeader, unsigned int& nSize)
+{
+    if (memcmp(pchHeader, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return false;
+    nSize = ReadLE32((const unsigned char*)pchHeader + MESSAGE_START_SIZE);
+    return nSize <= MAX_SIZE;
+}
+
+bool ReadRawBlockFromDisk(CRawBlockData& raw, const CDiskBlockPos& pos)
+{
+    // Each block is preceded by the network magic and its serialized size,
+    // written by WriteBlockToDisk; pos points just past them.
+    static const unsigned int HEADER_SIZE = MESSAGE_START_SIZE + sizeof(uint32_t);
+    if (pos.IsNull() || pos.nPos < HEADER_SIZE)
+        return error("%s : invalid block position %s", __func__, pos.ToString());
+
+    // Only files that are no longer appended to are mapped.
+    bool fFinalized;
+    {
+        LOCK(cs_LastBlockFile);
+        fFinalized = pos.nFile < nLastBlockFile;
+    }
+    unsigned int nSize;
+    if (fFinalized) {
+        std::shared_ptr<const CMappedFile> mapping = blockFileMapper.Get(pos.nFile, GetBlockPosFilename(pos, "blk"));
+        if (mapping && pos.nPos <= mapping->size() &&
+            ParseBlockRecordHeader(mapping->data() + pos.nPos - HEADER_SIZE, nSize) &&
+            nSize <= mapping->size() - pos.nPos) {
+            raw.SetMapped(mapping, pos.nPos, nSize);
+            return true;
+        }
+        // Not mappable or inconsistent with the mapping; let the file read below report it.
+    }
+
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - HEADER_SIZE), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed for %s", __func__, pos.ToString());
+    try {
+        char pchHeader[HEADER_SIZE];
+        filein.read(pchHeader, HEADER_SIZE);
+        if (!ParseBlockRecordHeader(pchHeader, nSize))
+            return error("%s : no block record at %s", __func__, pos.ToString());
+        filein.read(raw.SetBuffer(nSize), nSize);
+    } catch (const std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+    CRawBlockData raw;
+    if (!ReadRawBlockFromDisk(raw, pos))
+        return error("ReadBlockFromDisk : ReadRawBlockFromDisk failed");
 
-    // Read block
+    // Read block straight from the mapped or buffered bytes
     try {
-        filein >> block;
+        CMemoryReader reader(raw.data(), raw.size(), SER_DISK, CLIENT_VERSION);
+        reader >> block;
     } catch (const std::exception& e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
@@ -2273,14 +2596,26 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
     if (!tx.IsCoinBase() && !tx.HasZerocoinSpendInputs()) {
         txundo.vprevout.reserve(tx.vin.size());
         for (const CTxIn& txin : tx.vin) {
-            txundo.vprevout.push_back(CTxInUndo());
-            bool ret = inputs.ModifyCoins(txin.prevout.hash)->Spend(txin.prevout, txundo.vprevout.back());
-            assert(ret);
+            txundo.vprevout.emplace_back();
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
+}
+
+/** Account for tx, whose spent coins are in txundo, in the UTXO set statistics. */
+static void UpdateRollingStats(CRollingCoinsStats& stats, const CTransaction& tx, const CTxUndo& txundo, int nHeight)
+{
+    for (size_t j = 0; j < txundo.vprevout.size(); j++)
+        stats.RemoveCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+    const uint256& txid = tx.GetHash();
+    for (size_t o = 0; o < tx.vout.size(); o++) {
+        if (!tx.vout[o].scriptPubKey.IsUnspendable())
+            stats.AddCoin(COutPoint(txid, o), Coin(tx.vout[o], nHeight, tx.IsCoinBase(), tx.IsCoinStake()));
+    }
 }
 
 bool CScriptCheck::operator()()
@@ -2365,18 +2700,51 @@ CAmount GetInvalidUTXOValue()
     for (auto out : invalid_out::setInvalidOutPoints) {
         bool fSpent = false;
         CCoinsViewCache cache(pcoinsTip);
-        const CCoins *coins = cache.AccessCoins(out.hash);
-        if(!coins || !coins->IsAvailable(out.n))
+        const Coin& coin = cache.AccessCoin(out);
+        if(!coin.IsAvailable())
             fSpent = true;
 
         if (!fSpent)
-            nValue += coins->vout[out.n].nValue;
+            nValue += coin.out.nValue;
     }
 
     return nValue;
 }
 
-bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck>* pvChecks)
+namespace
+{
+/**
+ * Transactions whose scripts all passed under a set of verification flags,
+ * so that a block including a transaction we already accepted to the mempool
+ * does not run its scripts a second time. Entries are
+ * SHA256(nonce || txid || flags); the txid commits to the spent outpoints and
+ * so to the scripts being run. Protected by cs_main.
+ */
+CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+uint256 scriptExecutionCacheNonce(GetRandHash());
+CValidationCacheStats scriptExecutionCacheStats;
+} // anon namespace
+
+void InitScriptExecutionCache()
+{
+    // nMaxCacheSize is unsigned. If -sigcachesize is set to zero,
+    // setup_bytes creates the minimum possible cache (2 elements).
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-sigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    scriptExecutionCacheStats = CValidationCacheStats();
+    scriptExecutionCacheStats.nCapacity = nElems;
+    scriptExecutionCacheStats.nBytes = nElems * sizeof(uint256);
+    LogPrintf("Using %zu MiB out of %zu requested for script execution cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+}
+
+CValidationCacheStats GetScriptExecutionCacheStats()
+{
+    LOCK(cs_main);
+    return scriptExecutionCacheStats;
+}
+
+bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, std::vector<CScriptCheck>* pvChecks)
 {
     if (!tx.IsCoinBase() && !tx.HasZerocoinSpendInputs()) {
         if (pvChecks)
@@ -2395,20 +2763,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         CAmount nFees = 0;
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             const COutPoint& prevout = tx.vin[i].prevout;
-            const CCoins* coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase() || coins->IsCoinStake()) {
-                if (nSpendHeight - coins->nHeight < Params().COINBASE_MATURITY())
+            if (coin.IsCoinBase() || coin.IsCoinStake()) {
+                if (nSpendHeight - (int)coin.nHeight < Params().COINBASE_MATURITY())
                     return state.Invalid(
-                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - coins->nHeight, coins->IsCoinStake()),
+                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - (int)coin.nHeight, coin.IsCoinStake()),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs() : txin values out of range"),
                     REJECT_INVALID, "bad-txns-inputvalues-outofrange");
         }
@@ -2437,16 +2805,26 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // Skip the scripts if they already passed under these flags. Block
+            // validation does not store, so its hits are not needed again.
+            AssertLockHeld(cs_main);
+            uint256 hashCacheEntry;
+            CSHA256().Write(scriptExecutionCacheNonce.begin(), 32).Write(tx.GetHash().begin(), 32).Write((const unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+            if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+                scriptExecutionCacheStats.nHits++;
+                return true;
+            }
+            scriptExecutionCacheStats.nMisses++;
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint& prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out, tx, i, flags, cacheSigStore);
                 if (pvChecks) {
-                    pvChecks->push_back(CScriptCheck());
-                    check.swap(pvChecks->back());
+                    pvChecks->emplace_back(check);
                 } else if (!check()) {
                     if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
                         // Check whether the failure was caused by a
@@ -2455,8 +2833,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
-                            flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                        CScriptCheck check(coin.out, tx, i,
+                            flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -2470,6 +2848,14 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                     return state.DoS(100, false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+
+            if (cacheFullScriptStore && !pvChecks) {
+                // We executed all of the provided scripts, and were told to
+                // cache the result. Do so now.
+                scriptExecutionCacheStats.nInserts++;
+                if (scriptExecutionCache.insert(hashCacheEntry))
+                    scriptExecutionCacheStats.nEvictions++;
+            }
         }
     }
 
@@ -2519,7 +2905,7 @@ void DataBaseAccChecksum(CBlockIndex* pindex, bool fWrite)
     }
 }
 
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CRollingCoinsStats* pstats, bool fJustCheck)
 {
     if (pindex->GetBlockHash() != view.GetBestBlock())
         LogPrintf("%s : pindex=%s view=%s\n", __func__, pindex->GetBlockHash().GetHex(), view.GetBestBlock().GetHex());
@@ -2546,7 +2932,8 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 
         /** UNDO ZEROCOIN DATABASING
          * note we only undo zerocoin databasing in the following statement, value to and from Kabberry
-         * addresses should still be handled by the typical bitcoin based undo code
+         * addresses should still be handled by the typical bitcoin based undo code.
+         * When only checking, the zerocoin database and the wallet are left as they are.
          * */
         if (tx.ContainsZerocoins()) {
             if (tx.HasZerocoinSpendInputs()) {
@@ -2568,6 +2955,8 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                             serial = spend.getCoinSerialNumber();
                         }
 
+                        if (fJustCheck)
+                            continue;
                         if (!zerocoinDB->EraseCoinSpend(serial))
                             return error("failed to erase spent zerocoin in block");
 
@@ -2593,7 +2982,7 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                     if (!TxOutToPublicCoin(txout, pubCoin, state))
                         return error("DisconnectBlock(): TxOutToPublicCoin() failed");
 
-                    if (!zerocoinDB->EraseCoinMint(pubCoin.getValue()))
+                    if (!fJustCheck && !zerocoinDB->EraseCoinMint(pubCoin.getValue()))
                         return error("DisconnectBlock(): Failed to erase coin mint");
                 }
             }
@@ -2602,61 +2991,54 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         uint256 hash = tx.GetHash();
 
         // Check that all outputs are available and match the outputs in the block itself
-        // exactly. Note that transactions with only provably unspendable outputs won't
-        // have outputs available even in the block itself, so we handle that case
-        // specially with outsEmpty.
-        {
-            CCoins outsEmpty;
-            CCoinsModifier outs = view.ModifyCoins(hash);
-            outs->ClearUnspendable();
-
-            CCoins outsBlock(tx, pindex->nHeight);
-            // The CCoins serialization does not serialize negative numbers.
-            // No network rules currently depend on the version here, so an inconsistency is harmless
-            // but it must be corrected before txout nversion ever influences a network rule.
-            if (outsBlock.nVersion < 0)
-                outs->nVersion = outsBlock.nVersion;
-            if (*outs != outsBlock)
-                fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
-
-            // remove outputs
-            outs->Clear();
+        // exactly.
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || (unsigned int)pindex->nHeight != coin.nHeight ||
+                    tx.IsCoinBase() != (bool)coin.fCoinBase || tx.IsCoinStake() != (bool)coin.fCoinStake)
+                    fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
+                if (is_spent && pstats)
+                    pstats->RemoveCoin(out, coin);
+            }
         }
 
         // restore inputs
         if (!tx.IsCoinBase() && !tx.HasZerocoinSpendInputs()) { // not coinbases or zerocoinspend because they dont have traditional inputs
-            const CTxUndo& txundo = blockUndo.vtxundo[i - 1];
+            CTxUndo& txundo = blockUndo.vtxundo[i - 1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock() : transaction and undo data inconsistent - txundo.vprevout.siz=%d tx.vin.siz=%d", txundo.vprevout.size(), tx.vin.size());
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint& out = tx.vin[j].prevout;
-                const CTxInUndo& undo = txundo.vprevout[j];
-                CCoinsModifier coins = view.ModifyCoins(out.hash);
-                if (undo.nHeight != 0) {
-                    // undo data contains height: this is the last output of the prevout tx being spent
-                    if (!coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
-                    coins->Clear();
-                    coins->fCoinBase = undo.fCoinBase;
-                    coins->nHeight = undo.nHeight;
-                    coins->nVersion = undo.nVersion;
-                } else {
-                    if (coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
-                }
-                if (coins->IsAvailable(out.n))
+                Coin& undo = txundo.vprevout[j];
+                if (view.HaveCoin(out))
                     fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
-                if (coins->vout.size() < out.n + 1)
-                    coins->vout.resize(out.n + 1);
-                coins->vout[out.n] = undo.txout;
+                if (undo.nHeight == 0) {
+                    // Missing undo metadata (height, coinbase and coinstake). Older versions included this
+                    // information only in undo records for the last spend of a transaction's outputs.
+                    // This implies that it must be present for some other output of the same tx.
+                    const Coin& alternate = AccessByTxid(view, out.hash);
+                    if (alternate.IsSpent())
+                        return error("DisconnectBlock() : undo data adding output to missing transaction");
+                    undo.nHeight = alternate.nHeight;
+                    undo.fCoinBase = alternate.fCoinBase;
+                    undo.fCoinStake = alternate.fCoinStake;
+                }
+                if (pstats && !undo.out.scriptPubKey.IsUnspendable())
+                    pstats->AddCoin(out, undo);
+                view.AddCoin(out, std::move(undo), true);
             }
         }
     }
 
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
+    if (pstats)
+        pstats->hashBlock = pindex->pprev->GetBlockHash();
 
-    if (pindex->nHeight >= Params().Zerocoin_Block_V2_Start() && pindex->nHeight <= Params().Zerocoin_Block_Last_Checkpoint()) {
+    if (!fJustCheck && pindex->nHeight >= Params().Zerocoin_Block_V2_Start() && pindex->nHeight <= Params().Zerocoin_Block_Last_Checkpoint()) {
         // Legacy Zerocoin DB: If Accumulators Checkpoint is changed, remove changed checksums
         DataBaseAccChecksum(pindex, false);
     }
@@ -2694,7 +3076,7 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CBlockCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck()
 {
@@ -2961,7 +3343,7 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked, CRollingCoinsStats* pstats)
 {
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
@@ -2978,6 +3360,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // (its coinbase is unspendable)
     if (block.GetHash() == Params().HashGenesisBlock()) {
         view.SetBestBlock(pindex->GetBlockHash());
+        if (pstats)
+            pstats->hashBlock = pindex->GetBlockHash();
         return true;
     }
 
@@ -2991,13 +3375,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
 
-    // If scripts won't be checked anyways, don't bother seeing if CLTV is activated
-    bool fCLTVIsActivated = false;
-    if (fScriptChecks && pindex->pprev) {
-        fCLTVIsActivated = pindex->pprev->nHeight >= Params().BIP65ActivationHeight();
-    }
+    unsigned int flags = GetBlockScriptFlags(pindex->pprev);
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    // Zerocoin spends are checked below the checkpoints as well.
+    CCheckQueueControl<CBlockCheck> control(nScriptCheckThreads ? &scriptcheckqueue : nullptr);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -3014,7 +3395,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CAmount nValueIn = 0;
     unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
     std::vector<uint256> vSpendsInBlock;
-    uint256 hashBlock = block.GetHash();
     for (unsigned int i = 0; i < block.vtx.size(); i++) {
         const CTransaction& tx = block.vtx[i];
 
@@ -3027,10 +3407,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         // See BIP30 and http://r6.ca/blog/20120206T005236Z.html for more information.
         // This logic is not necessary for memory pool transactions, as AcceptToMemoryPool
         // already refuses previously-known transaction ids entirely.
-        const CCoins* coins = view.AccessCoins(tx.GetHash());
-        if (coins && !coins->IsPruned())
-            return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
-                             REJECT_INVALID, "bad-txns-BIP30");
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
+                                 REJECT_INVALID, "bad-txns-BIP30");
+        }
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
@@ -3055,38 +3436,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             }
 
             //Check for double spending of serial #'s
-            std::set<CBigNum> setSerials;
-            for (const CTxIn& txIn : tx.vin) {
-                bool isPublicSpend = txIn.IsZerocoinPublicSpend();
-                bool isPrivZerocoinSpend = txIn.IsZerocoinSpend();
-                if (!isPrivZerocoinSpend && !isPublicSpend)
-                    continue;
-
-                // Check enforcement
-                if (!CheckPublicCoinSpendEnforced(pindex->nHeight, isPublicSpend)){
-                    return false;
-                }
-
-                if (isPublicSpend) {
-                    libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
-                    PublicCoinSpend publicSpend(params);
-                    if (!sKKCModule::ParseZerocoinPublicSpend(txIn, tx, state, publicSpend)){
-                        return false;
-                    }
-                    nValueIn += publicSpend.getDenomination() * COIN;
-                    //queue for db write after the 'justcheck' section has concluded
-                    vSpends.emplace_back(std::make_pair(publicSpend, tx.GetHash()));
-                    if (!ContextualCheckZerocoinSpend(tx, &publicSpend, pindex, hashBlock))
-                        return state.DoS(100, error("%s: failed to add block %s with invalid public zc spend", __func__, tx.GetHash().GetHex()), REJECT_INVALID);
-                } else {
-                    libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
-                    nValueIn += spend.getDenomination() * COIN;
-                    //queue for db write after the 'justcheck' section has concluded
-                    vSpends.emplace_back(std::make_pair(spend, tx.GetHash()));
-                    if (!ContextualCheckZerocoinSpend(tx, &spend, pindex, hashBlock))
-                        return state.DoS(100, error("%s: failed to add block %s with invalid zerocoinspend", __func__, tx.GetHash().GetHex()), REJECT_INVALID);
-                }
-            }
+            std::vector<CBlockCheck> vChecks;
+            if (!CheckZerocoinSpendInputs(tx, state, pindex, nValueIn, vSpends, nScriptCheckThreads ? &vChecks : NULL))
+                return false;
+            control.Add(vChecks);
 
             // Check that sKKC mints are not already known
             if (tx.HasZerocoinMintOutputs()) {
@@ -3145,12 +3498,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 nFees += view.GetValueIn(tx) - tx.GetValueOut();
             nValueIn += view.GetValueIn(tx);
 
-            std::vector<CScriptCheck> vChecks;
-            unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG;
-            if (fCLTVIsActivated)
-                flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
+            std::vector<CBlockCheck> vChecks;
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, false, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
         }
@@ -3160,7 +3509,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (i > 0) {
             blockundo.vtxundo.emplace_back();
         }
-        UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        CTxUndo& txundo = i == 0 ? undoDummy : blockundo.vtxundo.back();
+        UpdateCoins(tx, state, view, txundo, pindex->nHeight);
+        if (pstats)
+            UpdateRollingStats(*pstats, tx, txundo, pindex->nHeight);
 
         vPos.emplace_back(tx.GetHash(), pos);
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
@@ -3269,6 +3621,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
+    if (pstats)
+        pstats->hashBlock = pindex->GetBlockHash();
 
     int64_t nTime3 = GetTimeMicros();
     nTimeIndex += nTime3 - nTime2;
@@ -3305,6 +3659,81 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     return true;
 }
 
+/**
+ * Blocks that a reorg could still disconnect are kept, and nothing is pruned
+ * before the last accumulator checkpoint, as accumulators are computed from
+ * the blocks up to there.
+ */
+int GetLastBlockWeCanPrune()
+{
+    AssertLockHeld(cs_main);
+    const int nKeep = std::max((int)MIN_BLOCKS_TO_KEEP, (int)GetArg("-maxreorg", Params().MaxReorganizationDepth()));
+    if (chainActive.Tip() == NULL || chainActive.Height() <= Params().Zerocoin_Block_Last_Checkpoint() + nKeep)
+        return -1;
+    return chainActive.Height() - nKeep;
+}
+
+/** Mark the block files holding only blocks up to nManualPruneHeight as pruned, for pruneblockchain */
+void static FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight)
+{
+    assert(fPruneMode && nManualPruneHeight > 0);
+
+    LOCK2(cs_main, cs_LastBlockFile);
+    const int nLastBlockWeCanPrune = std::min(nManualPruneHeight, GetLastBlockWeCanPrune());
+    if (nLastBlockWeCanPrune < 0)
+        return;
+
+    int nPruned = 0;
+    for (int nFile = 0; nFile < nLastBlockFile; nFile++) {
+        if (vinfoBlockFile[nFile].nSize == 0 || (int)vinfoBlockFile[nFile].nHeightLast > nLastBlockWeCanPrune)
+            continue;
+        PruneOneBlockFile(nFile);
+        setFilesToPrune.insert(nFile);
+        nPruned++;
+    }
+    LogPrintf("Prune (Manual): prune_height=%d removed %d blk/rev pairs\n", nLastBlockWeCanPrune, nPruned);
+}
+
+/**
+ * Pick the oldest block files to delete until block and undo files fit in
+ * nPruneTarget again, and mark them pruned in the block index.
+ */
+void static FindFilesToPrune(std::set<int>& setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (nPruneTarget == 0 || nPruneTarget == std::numeric_limits<uint64_t>::max())
+        return;
+    const int nLastBlockWeCanPrune = GetLastBlockWeCanPrune();
+    if (nLastBlockWeCanPrune < 0)
+        return;
+
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    // Leave room for the next chunks to be allocated, so we do not prune again right away.
+    const uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    int nPruned = 0;
+    if (nCurrentUsage + nBuffer >= nPruneTarget) {
+        for (int nFile = 0; nFile < nLastBlockFile; nFile++) {
+            const uint64_t nBytesToPrune = vinfoBlockFile[nFile].nSize + vinfoBlockFile[nFile].nUndoSize;
+            if (vinfoBlockFile[nFile].nSize == 0)
+                continue;
+            if (nCurrentUsage + nBuffer < nPruneTarget)
+                break;
+            // Files are mostly in height order, but one may still hold a recent block.
+            if ((int)vinfoBlockFile[nFile].nHeightLast > nLastBlockWeCanPrune)
+                continue;
+
+            PruneOneBlockFile(nFile);
+            setFilesToPrune.insert(nFile);
+            nCurrentUsage -= nBytesToPrune;
+            nPruned++;
+        }
+    }
+
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
+        nPruneTarget / 1024 / 1024, nCurrentUsage / 1024 / 1024,
+        ((int64_t)nPruneTarget - (int64_t)nCurrentUsage) / 1024 / 1024, nLastBlockWeCanPrune, nPruned);
+}
+
 enum FlushStateMode {
     FLUSH_STATE_IF_NEEDED,
     FLUSH_STATE_PERIODIC,
@@ -3313,23 +3742,46 @@ enum FlushStateMode {
 
 /**
  * Update the on-disk chain state.
- * The caches and indexes are flushed if either they're too large, forceWrite is set, or
- * fast is not set and it's been a while since the last write.
+ * The caches and indexes are written if either they're too large, forceWrite is set, or
+ * fast is not set and it's been a while since the last write. The coins cache stays
+ * warm across writes; it is only trimmed back once it grows past its memory budget.
  */
-bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
+bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode, int nManualPruneHeight = 0)
 {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
+    std::set<int> setFilesToPrune;
+    bool fFlushForPrune = false;
     try {
-        if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
-            (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
-            // Typical CCoins structures on disk are around 100 bytes in size.
+        if (fPruneMode && (fCheckForPruning || nManualPruneHeight > 0) && !fReindex) {
+            if (nManualPruneHeight > 0) {
+                FindFilesToPruneManual(setFilesToPrune, nManualPruneHeight);
+            } else {
+                FindFilesToPrune(setFilesToPrune);
+                fCheckForPruning = false;
+            }
+            if (!setFilesToPrune.empty()) {
+                fFlushForPrune = true;
+                if (!fHavePruned) {
+                    pblocktree->WriteFlag("prunedblockfiles", true);
+                    fHavePruned = true;
+                }
+            }
+        }
+        size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        // The cache is close to its limit, and we are between blocks so there is time to write now.
+        bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > nCoinCacheUsage / 10 * 9;
+        // The cache is over the limit, we have to write now.
+        bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nCoinCacheUsage;
+        // It's been a while since we wrote the block index to disk.
+        bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000;
+        if (mode == FLUSH_STATE_ALWAYS || fCacheLarge || fCacheCritical || fPeriodicWrite || fFlushForPrune) {
+            // Typical Coin structures on disk are around 48 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
             // an overestimation, as most will delete an existing entry or
             // overwrite one. Still, use a conservative safety factor of 2.
-            if (!CheckDiskSpace(100 * 2 * 2 * pcoinsTip->GetCacheSize()))
+            if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // First make sure all block and undo data is flushed to disk.
             FlushBlockFile();
@@ -3351,9 +3803,20 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                     return AbortNode(state, "Files to write to block index database");
                 }
             }
-            // Finally flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Only delete files once the block index no longer refers to them.
+            if (fFlushForPrune)
+                UnlinkPrunedFiles(setFilesToPrune);
+            // Finally write the chainstate (which may refer to block index entries).
+            // All modified coins go out together so the database stays consistent
+            // with its best block; the cache keeps them as clean entries. The UTXO
+            // set statistics are written along with the best block they belong to.
+            pcoinsdbview->SetRollingStats(rollingCoinsStats);
+            if (!pcoinsTip->Sync())
                 return AbortNode(state, "Failed to write to coin database");
+            // Drop the coldest clean entries, so that only what the next blocks
+            // modify has to be written next time.
+            if (fCacheLarge || fCacheCritical)
+                pcoinsTip->Trim(nCoinCacheUsage / 4 * 3);
             // Update best block in wallet (so we can detect restored wallets).
             if (mode != FLUSH_STATE_IF_NEEDED) {
                 GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -3372,6 +3835,12 @@ void FlushStateToDisk()
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+void PruneBlockFilesManual(int nManualPruneHeight)
+{
+    CValidationState state;
+    FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED, nManualPruneHeight);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex* pindexNew)
 {
@@ -3387,10 +3856,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
         g_best_block_cv.notify_all();
     }
 
-    LogPrintf("UpdateTip: new best=%s  height=%d version=%d  log2_work=%.16f  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d version=%d  log2_work=%.16f  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utxo)\n",
               chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), chainActive.Tip()->nVersion, log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
               DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-              Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+              Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     // Check the version of the last 100 blocks to see if we need to upgrade:
     static bool fWarned = false;
@@ -3427,22 +3896,35 @@ bool static DisconnectTip(CValidationState& state)
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        CRollingCoinsStats stats = rollingCoinsStats;
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, &stats))
             return error("DisconnectTip() : DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        rollingCoinsStats = stats;
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
         return false;
     // Resurrect mempool transactions from the disconnected block.
+    std::vector<uint256> vHashUpdate;
     for (const CTransaction& tx : block.vtx) {
         // ignore validation errors in resurrected transactions
         std::list<CTransaction> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, false, false, true))
             mempool.remove(tx, removed, true);
-    }
+        else if (mempool.exists(tx.GetHash()))
+            vHashUpdate.push_back(tx.GetHash());
+    }
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in this
+    // block that were added back and cleans up the mempool state.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
+    // The resurrected transactions were let in regardless of the size limit.
+    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
     mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
@@ -3489,7 +3971,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked);
+        CRollingCoinsStats stats = rollingCoinsStats;
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked, &stats);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -3501,6 +3984,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
         nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        rollingCoinsStats = stats;
     }
     int64_t nTime4 = GetTimeMicros();
     nTimeFlush += nTime4 - nTime3;
@@ -3518,7 +4002,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
 
     // Remove conflicting transactions from the mempool.
     std::list<CTransaction> txConflicted;
-    mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted);
+    mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
@@ -3956,8 +4440,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.New(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3974,9 +4457,6 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         //update previous block pointer
         pindexNew->pprev->pnext = pindexNew;
 
-        // ppcoin: compute chain trust score
-        pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
-
         // ppcoin: compute stake entropy bit for stake modifier
         if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
             LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
@@ -4072,7 +4552,11 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
     }
 
     if (!fKnown) {
-        while (vinfoBlockFile[nFile].nSize + nAddSize >= MAX_BLOCKFILE_SIZE) {
+        // -fastprune keeps block files small, so that tests can prune a short chain
+        unsigned int nMaxBlockfileSize = MAX_BLOCKFILE_SIZE;
+        if (GetBoolArg("-fastprune", false))
+            nMaxBlockfileSize = std::max(FAST_PRUNE_BLOCKFILE_SIZE, nAddSize + 1);
+        while (vinfoBlockFile[nFile].nSize + nAddSize >= nMaxBlockfileSize) {
             LogPrintf("Leaving block file %i: %s\n", nFile, vinfoBlockFile[nFile].ToString());
             FlushBlockFile(true);
             nFile++;
@@ -4095,6 +4579,8 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
         unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         if (nNewChunks > nOldChunks) {
+            if (fPruneMode)
+                fCheckForPruning = true;
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
                 FILE* file = OpenBlockFile(pos);
                 if (file) {
@@ -4125,6 +4611,8 @@ bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigne
     unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     if (nNewChunks > nOldChunks) {
+        if (fPruneMode)
+            fCheckForPruning = true;
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
             FILE* file = OpenUndoFile(pos);
             if (file) {
@@ -4527,6 +5015,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex)
 {
     AssertLockHeld(cs_main);
+    CHeaderHashCallerScope hashCaller(HEADER_HASH_ACCEPT_HEADER);
     // Check for duplicate
     uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
@@ -4816,17 +5305,11 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         const CCoinsViewCache coins(pcoinsTip);
         if(!stakeTxIn.HasZerocoinSpendInputs()) {
             for (const CTxIn& in: stakeTxIn.vin) {
-                const CCoins* coin = coins.AccessCoins(in.prevout.hash);
+                const Coin& coin = coins.AccessCoin(in.prevout);
 
-                if(!coin && !isBlockFromFork){
-                    // No coins on the main chain
-                    return error("%s: coin stake inputs not available on main chain, received height %d vs current %d", __func__, nHeight, chainActive.Height());
-                }
-                if(coin && !coin->IsAvailable(in.prevout.n)){
-                    if(!isBlockFromFork){
-                        // Coins not available
-                        return error("%s: coin stake inputs already spent in main chain", __func__);
-                    }
+                if(!coin.IsAvailable() && !isBlockFromFork){
+                    // No coins on the main chain, or already spent there
+                    return error("%s: coin stake inputs not available or already spent on main chain, received height %d vs current %d", __func__, nHeight, chainActive.Height());
                 }
             }
         } else {
@@ -4925,6 +5408,8 @@ void CBlockIndex::BuildSkip()
 
 bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp)
 {
+    CHeaderHashCallerScope hashCaller(HEADER_HASH_PROCESS_BLOCK);
+
     // Preliminary checks
     int64_t nStartTime = GetTimeMillis();
 
@@ -5085,6 +5570,84 @@ boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos& pos, const char
     return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
 }
 
+uint64_t CalculateCurrentUsage()
+{
+    LOCK(cs_LastBlockFile);
+
+    uint64_t nTotal = 0;
+    for (const CBlockFileInfo& file : vinfoBlockFile)
+        nTotal += file.nSize + file.nUndoSize;
+    return nTotal;
+}
+
+void PruneOneBlockFile(int nFile)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_LastBlockFile);
+
+    for (BlockMap::value_type& entry : mapBlockIndex) {
+        CBlockIndex* pindex = entry.second;
+        if (pindex->nFile != nFile || !(pindex->nStatus & BLOCK_HAVE_MASK))
+            continue;
+        pindex->nStatus &= ~BLOCK_HAVE_MASK;
+        pindex->nFile = 0;
+        pindex->nDataPos = 0;
+        pindex->nUndoPos = 0;
+        setDirtyBlockIndex.insert(pindex);
+
+        // A block waiting for its parent can no longer be connected without its data.
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first++;
+            if (it->second == pindex)
+                mapBlocksUnlinked.erase(it);
+        }
+    }
+
+    vinfoBlockFile[nFile].SetNull();
+    setDirtyFileInfo.insert(nFile);
+}
+
+void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
+{
+    for (int nFile : setFilesToPrune) {
+        CDiskBlockPos pos(nFile, 0);
+        blockFileMapper.Forget(nFile);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, nFile);
+    }
+}
+
+void CleanupBlockRevFiles()
+{
+    std::map<std::string, boost::filesystem::path> mapBlockFiles;
+
+    // Undo files are rebuilt as blocks are connected again. Block files are
+    // only imported from blk00000.dat on until the first missing one, so
+    // anything after a gap left by pruning would be overwritten anyway.
+    LogPrintf("Removing unusable blk?????.dat and rev?????.dat files for -reindex with -prune\n");
+    boost::filesystem::path blocksdir = GetDataDir() / "blocks";
+    for (boost::filesystem::directory_iterator it(blocksdir); it != boost::filesystem::directory_iterator(); it++) {
+        const std::string strName = it->path().filename().string();
+        if (!boost::filesystem::is_regular_file(*it) || strName.length() != 12 || strName.substr(8, 4) != ".dat")
+            continue;
+        if (strName.substr(0, 3) == "blk")
+            mapBlockFiles[strName.substr(3, 5)] = it->path();
+        else if (strName.substr(0, 3) == "rev")
+            boost::filesystem::remove(it->path());
+    }
+
+    int nContigCounter = 0;
+    for (const std::pair<const std::string, boost::filesystem::path>& item : mapBlockFiles) {
+        if (atoi(item.first) == nContigCounter) {
+            nContigCounter++;
+            continue;
+        }
+        boost::filesystem::remove(item.second);
+    }
+}
+
 CBlockIndex* InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
@@ -5096,9 +5659,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw std::runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.New();
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
 
     pindexNew->phashBlock = &((*mi).first);
@@ -5106,12 +5667,57 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+CBlockIndex* InsertBlockIndex(const uint256& hash, const CDiskBlockIndex& diskindex)
+{
+    // Construct block index object
+    CBlockIndex* pindexNew = InsertBlockIndex(hash);
+    pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
+    pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
+    pindexNew->nHeight = diskindex.nHeight;
+    pindexNew->nFile = diskindex.nFile;
+    pindexNew->nDataPos = diskindex.nDataPos;
+    pindexNew->nUndoPos = diskindex.nUndoPos;
+    pindexNew->nVersion = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->nTime = diskindex.nTime;
+    pindexNew->nBits = diskindex.nBits;
+    pindexNew->nNonce = diskindex.nNonce;
+    pindexNew->nStatus = diskindex.nStatus;
+    pindexNew->nTx = diskindex.nTx;
+
+    //zerocoin
+    pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
+    pindexNew->mapZerocoinSupply = diskindex.mapZerocoinSupply;
+    pindexNew->vMintDenominationsInBlock = diskindex.vMintDenominationsInBlock;
+
+    //Proof Of Stake
+    pindexNew->nMint = diskindex.nMint;
+    pindexNew->nMoneySupply = diskindex.nMoneySupply;
+    pindexNew->nFlags = diskindex.nFlags;
+    if (!Params().IsStakeModifierV2(pindexNew->nHeight)) {
+        pindexNew->nStakeModifier = diskindex.nStakeModifier;
+    } else {
+        pindexNew->nStakeModifierV2 = diskindex.nStakeModifierV2;
+    }
+    pindexNew->prevoutStake = diskindex.prevoutStake;
+    pindexNew->nStakeTime = diskindex.nStakeTime;
+    pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
+    return pindexNew;
+}
+
+size_t BlockIndexDynamicMemoryUsage()
+{
+    return blockIndexArena.DynamicMemoryUsage() + memusage::DynamicUsage(mapBlockIndex);
+}
+
 bool static LoadBlockIndexDB(std::string& strError)
 {
+    int64_t nTimeStart = GetTimeMicros();
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
 
     boost::this_thread::interruption_point();
+    int64_t nTimeGuts = GetTimeMicros();
 
     // Calculate nChainWork
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
@@ -5127,7 +5733,8 @@ bool static LoadBlockIndexDB(std::string& strError)
 
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        // Pruned blocks keep nTx, so the chain above them still counts as having all its transactions.
+        if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -5148,6 +5755,17 @@ bool static LoadBlockIndexDB(std::string& strError)
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    int64_t nTimeChainWork = GetTimeMicros();
+    LogPrintf("%s: loaded %u entries in %.2fms, chain work and candidates %.2fms\n", __func__,
+        mapBlockIndex.size(), (nTimeGuts - nTimeStart) * 0.001, (nTimeChainWork - nTimeGuts) * 0.001);
+    const size_t nIndexUsage = BlockIndexDynamicMemoryUsage();
+    LogPrintf("%s: block index uses %.1fMiB, %u bytes per entry (%u for the entry itself)\n", __func__,
+        nIndexUsage * (1.0 / (1 << 20)), mapBlockIndex.empty() ? 0 : nIndexUsage / mapBlockIndex.size(), sizeof(CBlockIndex));
+
+    // Check whether we have ever pruned block & undo files
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -5215,85 +5833,310 @@ bool static LoadBlockIndexDB(std::string& strError)
     return true;
 }
 
-CVerifyDB::CVerifyDB()
+bool ActivateSnapshotChain(CBlockIndex* pindexBase, std::string& strError)
+{
+    AssertLockHeld(cs_main);
+
+    std::vector<CBlockIndex*> vChain;
+    for (CBlockIndex* pindex = pindexBase; pindex; pindex = pindex->pprev)
+        vChain.push_back(pindex);
+    std::reverse(vChain.begin(), vChain.end());
+    if (vChain[0] != chainActive.Genesis()) {
+        strError = "snapshot chain does not connect to the genesis block";
+        return false;
+    }
+
+    for (CBlockIndex* pindex : vChain) {
+        if (!pindex->pprev)
+            continue;
+        pindex->nChainWork = pindex->pprev->nChainWork + GetBlockProof(*pindex);
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        pindex->BuildSkip();
+        if (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex))
+            pindexBestHeader = pindex;
+        setDirtyBlockIndex.insert(pindex);
+    }
+
+    // No block below the snapshot is ever downloaded, which is what a pruned node looks like.
+    if (!pblocktree->WriteFlag("prunedblockfiles", true)) {
+        strError = "failed to write to the block index database";
+        return false;
+    }
+    fHavePruned = true;
+
+    // The coins went to the database directly, so the statistics are computed from there.
+    if (!pcoinsdbview->ComputeRollingStats(rollingCoinsStats)) {
+        strError = "failed to compute UTXO set statistics";
+        return false;
+    }
+    rollingCoinsStats.hashBlock = pindexBase->GetBlockHash();
+
+    mempool.clear();
+    pcoinsTip->SetBestBlock(pindexBase->GetBlockHash());
+    setBlockIndexCandidates.insert(pindexBase);
+    UpdateTip(pindexBase);
+    PruneBlockIndexCandidates();
+
+    // The block index goes out before the coins' best block, which makes the snapshot the chain state.
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        strError = state.GetRejectReason();
+        return false;
+    }
+    return true;
+}
+
+namespace
+{
+/** A block of the active chain for VerifyDB, copied out under cs_main so it can be read without it. */
+struct CVerifyBlock {
+    CBlockIndex* pindex;
+    uint256 hash;
+    uint256 hashPrev;
+    CDiskBlockPos pos;
+    CDiskBlockPos posUndo;
+    CBlock block;
+    std::string strError;
+};
+
+/**
+ * Read the blocks in [nBegin, nEnd) of vBatch and, from check level 2, their
+ * undo data. Only touches its own slice of vBatch, so several of these run at once.
+ */
+void ReadVerifyBlocks(std::vector<CVerifyBlock>& vBatch, size_t nBegin, size_t nEnd, int nCheckLevel)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        CVerifyBlock& item = vBatch[i];
+        // check level 0: read from disk
+        if (!ReadBlockFromDisk(item.block, item.pos) || item.block.GetHash() != item.hash) {
+            item.strError = "ReadBlockFromDisk failed";
+            continue;
+        }
+        // check level 2: verify undo validity
+        if (nCheckLevel >= 2 && !item.posUndo.IsNull()) {
+            CBlockUndo undo;
+            if (!undo.ReadFromDisk(item.posUndo, item.hashPrev))
+                item.strError = "found bad undo data";
+        }
+    }
+}
+
+/** Lets validation skip what it skips for blocks being verified while this lives; cs_main must be held. */
+class CVerifyingBlocksNow
+{
+private:
+    bool fWasVerifying;
+
+public:
+    CVerifyingBlocksNow() : fWasVerifying(fVerifyingBlocks)
+    {
+        fVerifyingBlocks = true;
+    }
+    ~CVerifyingBlocksNow()
+    {
+        fVerifyingBlocks = fWasVerifying;
+    }
+};
+} // anon namespace
+
+static CCriticalSection cs_verifyDBStatus;
+static CVerifyDBStatus verifyDBStatus;
+
+std::string CVerifyDBStatus::StateString() const
+{
+    switch (state) {
+    case NOT_STARTED:
+        return "not started";
+    case RUNNING:
+        return "running";
+    case PASSED:
+        return "passed";
+    case FAILED:
+        return "failed";
+    case INTERRUPTED:
+        return "interrupted";
+    }
+    return "";
+}
+
+CVerifyDB::CVerifyDB(bool fBackgroundIn) : fBackground(fBackgroundIn)
 {
-    uiInterface.ShowProgress(_("Verifying blocks..."), 0);
+    if (!fBackground)
+        uiInterface.ShowProgress(_("Verifying blocks..."), 0);
 }
 
 CVerifyDB::~CVerifyDB()
 {
-    uiInterface.ShowProgress("", 100);
+    if (!fBackground)
+        uiInterface.ShowProgress("", 100);
+}
+
+bool CVerifyDB::Failed(const std::string& strMessage)
+{
+    strFailure = strMessage;
+    return error("VerifyDB() : *** %s", strMessage);
+}
+
+void CVerifyDB::ShowProgress(int nPercent, int nChecked, int nTotal)
+{
+    nPercent = std::max(1, std::min(99, nPercent));
+    if (!fBackground) {
+        uiInterface.ShowProgress(_("Verifying blocks..."), nPercent);
+        return;
+    }
+    LOCK(cs_verifyDBStatus);
+    verifyDBStatus.nProgress = nPercent;
+    verifyDBStatus.nBlocksChecked = nChecked;
+    verifyDBStatus.nBlocksTotal = nTotal;
 }
 
 bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth)
 {
-    LOCK(cs_main);
-    if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
+    CBlockIndex* pindexNext;
+    int nHeightStop;
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
+            return true;
+
+        // Verify blocks in the best chain
+        if (nCheckDepth <= 0)
+            nCheckDepth = 1000000000; // suffices until the year 19000
+        if (nCheckDepth > chainActive.Height())
+            nCheckDepth = chainActive.Height();
+        nCheckLevel = std::max(0, std::min(4, nCheckLevel));
+        LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+        pindexNext = chainActive.Tip();
+        nHeightStop = std::max(1, chainActive.Height() - nCheckDepth);
+    }
+
+    // Levels 0 to 2, on batches of blocks copied out under cs_main and read
+    // by several threads without it. The chain may move on meanwhile; the
+    // blocks below the tip they started from are checked all the same.
+    const int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_VERIFYDB_READ_THREADS));
+    const int nReadShare = nCheckLevel >= 3 ? 50 : 100;
+    const int nTotal = pindexNext->nHeight - nHeightStop + 1;
+    int nChecked = 0;
+    int nHeightChecked = pindexNext->nHeight + 1;
+    std::vector<CVerifyBlock> vBatch;
+    CValidationState state;
+    while (true) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            return true;
+        vBatch.clear();
+        {
+            LOCK(cs_main);
+            for (; pindexNext && pindexNext->nHeight >= nHeightStop && vBatch.size() < VERIFYDB_READ_BATCH; pindexNext = pindexNext->pprev) {
+                if (fPruneMode && !(pindexNext->nStatus & BLOCK_HAVE_DATA)) {
+                    // If pruning, only go back as far as we have data.
+                    LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindexNext->nHeight);
+                    pindexNext = NULL;
+                    break;
+                }
+                vBatch.push_back(CVerifyBlock());
+                CVerifyBlock& item = vBatch.back();
+                item.pindex = pindexNext;
+                item.hash = pindexNext->GetBlockHash();
+                item.hashPrev = pindexNext->pprev->GetBlockHash();
+                item.pos = pindexNext->GetBlockPos();
+                item.posUndo = pindexNext->GetUndoPos();
+            }
+        }
+        if (vBatch.empty())
+            break;
+
+        const size_t nPerThread = (vBatch.size() + nThreads - 1) / nThreads;
+        {
+            boost::thread_group threads;
+            for (int t = 1; t < nThreads; t++) {
+                const size_t nBegin = std::min(vBatch.size(), t * nPerThread);
+                const size_t nEnd = std::min(vBatch.size(), nBegin + nPerThread);
+                if (nBegin < nEnd)
+                    threads.create_thread(boost::bind(&ReadVerifyBlocks, boost::ref(vBatch), nBegin, nEnd, nCheckLevel));
+            }
+            ReadVerifyBlocks(vBatch, 0, std::min(vBatch.size(), nPerThread), nCheckLevel);
+            // The readers write into vBatch, so wait for them even when interrupted.
+            boost::this_thread::disable_interruption noInterrupt;
+            threads.join_all();
+        }
+
+        for (CVerifyBlock& item : vBatch) {
+            LOCK(cs_main);
+            if (!item.strError.empty()) {
+                if (!(item.pindex->nStatus & BLOCK_HAVE_DATA)) {
+                    // Pruned after the batch was copied out.
+                    LogPrintf("VerifyDB(): block verification stopping at height %d (pruned meanwhile)\n", item.pindex->nHeight);
+                    pindexNext = NULL;
+                    break;
+                }
+                return Failed(strprintf("%s at %d, hash=%s", item.strError, item.pindex->nHeight, item.hash.ToString()));
+            }
+            // check level 1: verify block validity
+            if (nCheckLevel >= 1) {
+                CVerifyingBlocksNow verifying;
+                if (!CheckBlock(item.block, state))
+                    return Failed(strprintf("found bad block at %d, hash=%s", item.pindex->nHeight, item.hash.ToString()));
+            }
+            nChecked++;
+            nHeightChecked = item.pindex->nHeight;
+        }
+        ShowProgress(nChecked * nReadShare / nTotal, nChecked, nTotal);
+    }
+    if (nCheckLevel < 3 || nChecked == 0) {
+        LogPrintf("No block database inconsistencies in last %i blocks\n", nChecked);
         return true;
+    }
 
-    // Verify blocks in the best chain
-    if (nCheckDepth <= 0)
-        nCheckDepth = 1000000000; // suffices until the year 19000
-    if (nCheckDepth > chainActive.Height())
-        nCheckDepth = chainActive.Height();
-    nCheckLevel = std::max(0, std::min(4, nCheckLevel));
-    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+    // Levels 3 and 4 work on the coins of the current tip, so cs_main is held throughout.
+    LOCK(cs_main);
+    CVerifyingBlocksNow verifying;
     CCoinsViewCache coins(coinsview);
+    const int nSteps = std::max(1, (chainActive.Height() - nHeightChecked + 1) * (nCheckLevel >= 4 ? 2 : 1));
+    int nStep = 0;
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
-    CValidationState state;
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev) {
+    // check level 3: check for inconsistencies during memory-only disconnect of tip blocks. Only the
+    // coins view is touched: the zerocoin database, the wallet and the block index stay as they are,
+    // as the node may be live.
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex->pprev && pindex->nHeight >= nHeightChecked; pindex = pindex->pprev) {
         boost::this_thread::interruption_point();
-        uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
-        if (pindex->nHeight < chainActive.Height() - nCheckDepth)
+        ShowProgress(nReadShare + (100 - nReadShare) * nStep++ / nSteps, nChecked, nChecked);
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) > nCoinCacheUsage)
             break;
         CBlock block;
-        // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
-            return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
-            return error("VerifyDB() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!undo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB() : *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-        }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
-            bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
-                return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            pindexState = pindex->pprev;
-            if (!fClean) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else
-                nGoodTransactions += block.vtx.size();
-        }
+            return Failed(strprintf("ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString()));
+        bool fClean = true;
+        if (!DisconnectBlock(block, state, pindex, coins, &fClean, NULL, true))
+            return Failed(strprintf("irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString()));
+        pindexState = pindex->pprev;
+        if (!fClean) {
+            nGoodTransactions = 0;
+            pindexFailure = pindex;
+        } else
+            nGoodTransactions += block.vtx.size();
         if (ShutdownRequested())
             return true;
     }
     if (pindexFailure)
-        return error("VerifyDB() : *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
+        return Failed(strprintf("coin database inconsistencies found (last %i blocks, %i good transactions before that)", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions));
 
-    // check level 4: try reconnecting blocks
+    // check level 4: try reconnecting blocks, again in memory only. Spends and mints found in the
+    // zerocoin database are accepted from the reconnected block on, as level 3 left them there.
     if (nCheckLevel >= 4) {
         CBlockIndex* pindex = pindexState;
         while (pindex != chainActive.Tip()) {
             boost::this_thread::interruption_point();
-            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
+            ShowProgress(nReadShare + (100 - nReadShare) * nStep++ / nSteps, nChecked, nChecked);
             pindex = chainActive.Next(pindex);
             CBlock block;
             if (!ReadBlockFromDisk(block, pindex))
-                return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!ConnectBlock(block, state, pindex, coins, false))
-                return error("VerifyDB() : *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                return Failed(strprintf("ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString()));
+            if (!ConnectBlock(block, state, pindex, coins, true, true))
+                return Failed(strprintf("found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString()));
+            coins.SetBestBlock(pindex->GetBlockHash());
         }
     }
 
@@ -5302,6 +6145,67 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
     return true;
 }
 
+static void ThreadVerifyDB()
+{
+    int nCheckLevel, nCheckDepth;
+    {
+        LOCK(cs_verifyDBStatus);
+        nCheckLevel = verifyDBStatus.nCheckLevel;
+        nCheckDepth = verifyDBStatus.nCheckDepth;
+    }
+
+    CVerifyDBStatus::State result = CVerifyDBStatus::PASSED;
+    std::string strError;
+    try {
+        CVerifyDB verify(true);
+        if (!verify.VerifyDB(pcoinsTip, nCheckLevel, nCheckDepth)) {
+            result = CVerifyDBStatus::FAILED;
+            strError = verify.GetFailure();
+        } else if (ShutdownRequested()) {
+            result = CVerifyDBStatus::INTERRUPTED;
+        }
+    } catch (const boost::thread_interrupted&) {
+        LOCK(cs_verifyDBStatus);
+        verifyDBStatus.state = CVerifyDBStatus::INTERRUPTED;
+        verifyDBStatus.nTimeEnd = GetTime();
+        throw;
+    } catch (const std::exception& e) {
+        result = CVerifyDBStatus::FAILED;
+        strError = e.what();
+    }
+
+    {
+        LOCK(cs_verifyDBStatus);
+        verifyDBStatus.state = result;
+        verifyDBStatus.strError = strError;
+        verifyDBStatus.nTimeEnd = GetTime();
+        if (result == CVerifyDBStatus::PASSED)
+            verifyDBStatus.nProgress = 100;
+    }
+    if (result == CVerifyDBStatus::FAILED)
+        AbortNode("Corrupted block database detected: " + strError,
+            _("Corrupted block database detected. Restart with -reindex to rebuild it."));
+}
+
+void StartVerifyDB(boost::thread_group& threadGroup, int nCheckLevel, int nCheckDepth)
+{
+    {
+        LOCK(cs_verifyDBStatus);
+        verifyDBStatus = CVerifyDBStatus();
+        verifyDBStatus.state = CVerifyDBStatus::RUNNING;
+        verifyDBStatus.nCheckLevel = nCheckLevel;
+        verifyDBStatus.nCheckDepth = nCheckDepth;
+        verifyDBStatus.nTimeStart = GetTime();
+    }
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "verifydb", &ThreadVerifyDB));
+}
+
+CVerifyDBStatus GetVerifyDBStatus()
+{
+    LOCK(cs_verifyDBStatus);
+    return verifyDBStatus;
+}
+
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
@@ -5325,10 +6229,21 @@ void UnloadBlockIndex()
     setDirtyFileInfo.clear();
     mapNodeState.clear();
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
+    rollingCoinsStats = CRollingCoinsStats();
+}
+
+bool LoadRollingCoinsStats()
+{
+    if (pcoinsdbview->ReadRollingStats(rollingCoinsStats) && rollingCoinsStats.hashBlock == pcoinsdbview->GetBestBlock())
+        return true;
+    LogPrintf("Computing UTXO set statistics...\n");
+    int64_t nStart = GetTimeMillis();
+    if (!pcoinsdbview->ComputeRollingStats(rollingCoinsStats))
+        return false;
+    LogPrintf("Computed UTXO set statistics, %u outputs, in %dms\n", rollingCoinsStats.nTransactionOutputs, GetTimeMillis() - nStart);
+    return true;
 }
 
 bool LoadBlockIndex(std::string& strError)
@@ -5487,6 +6402,7 @@ void static CheckBlockIndex()
     }
 
     LOCK(cs_main);
+    CHeaderHashCallerScope hashCaller(HEADER_HASH_CHECK_INDEX);
 
     // During a reindex, we read the genesis block and call CheckBlockIndex before ActivateBestChain,
     // so we have the genesis block in mapBlockIndex but no active chain.  (A few of the tests when
@@ -5688,7 +6604,8 @@ bool static AlreadyHave(const CInv& inv)
         bool txInMap = false;
         txInMap = mempool.exists(inv.hash);
         return txInMap || mapOrphanTransactions.count(inv.hash) ||
-               pcoinsTip->HaveCoins(inv.hash);
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
     }
     case MSG_DSTX:
         return mapObfuscationBroadcastTxes.count(inv.hash);
@@ -5781,17 +6698,26 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    if (inv.type == MSG_BLOCK) {
+                        // Send the block bytes from disk as they are; blocks are
+                        // stored in their network serialization.
+                        CRawBlockData raw;
+                        if (!ReadRawBlockFromDisk(raw, mi->second->GetBlockPos()))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", raw);
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
-                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                            // Filtering peers tend to ask for the same recent blocks, so
+                            // keep the last tree rather than rehashing the block each time.
+                            if (!pFilteredBlockTree || pFilteredBlockTree->GetLeafCount() != block.vtx.size() ||
+                                pFilteredBlockTree->GetRoot() != block.hashMerkleRoot)
+                                pFilteredBlockTree = std::make_shared<const CMerkleTree>(BlockMerkleTree(block));
+                            CMerkleBlock merkleBlock(block, *pFilteredBlockTree, *pfrom->pfilter);
                             pfrom->PushMessage("merkleblock", merkleBlock);
                             // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
                             // This avoids hurting performance by pointlessly requiring a round-trip
@@ -6498,6 +7424,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
     else if (strCommand == "headers" && Params().HeadersFirstSyncingActive() && !fImporting && !fReindex) // Ignore headers received while importing
     {
+        CHeaderHashCallerScope hashCaller(HEADER_HASH_HEADERS_MSG);
         std::vector<CBlockHeader> headers;
 
         // Bypass the normal CBlock deserialization, as we don't want to risk deserializing 2000 full blocks.
@@ -6513,6 +7440,11 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hash all headers up front, outside cs_main; the results are memoized
+        // in the headers and reused by AcceptBlockHeader below.
+        std::vector<uint256> vHeaderHashes;
+        GetBlockHeaderHashes(headers, vHeaderHashes);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -7250,10 +8182,8 @@ public:
     ~CMainCleanup()
     {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
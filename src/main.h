@@ -17,6 +17,7 @@
 #endif
 
 #include "amount.h"
+#include "blockfilemap.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "coins.h"
@@ -37,8 +38,10 @@
 #include "undo.h"
 
 #include <algorithm>
+#include <atomic>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -51,10 +54,12 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CZerocoinDB;
 class CSporkDB;
 class CBloomFilter;
 class CInv;
+class CBlockCheck;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -76,16 +81,44 @@ static const unsigned int MAX_ZEROCOIN_TX_SIZE = 150000;
 static const unsigned int MAX_P2SH_SIGOPS = 15;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool, whether to save the mempool on shutdown and load it on restart */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Seconds between dumps of the mempool to mempool.dat while running */
+static const int64_t MEMPOOL_DUMP_INTERVAL = 15 * 60;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 251;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 251;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
+/** The maximum size of a blk?????.dat file with -fastprune (only for testing) */
+static const unsigned int FAST_PRUNE_BLOCKFILE_SIZE = 0x10000; // 64 KiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** -mapblockfiles default, number of finalized blk?????.dat files kept memory mapped */
+static const unsigned int DEFAULT_MAPPED_BLOCK_FILES = sizeof(void*) > 4 ? 8 : 0;
+/** Block files holding a block within this many blocks of the tip (or of -maxreorg, if larger) are never pruned */
+static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** Smallest -prune target accepted, in bytes of block and undo files */
+static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads reading blocks for VerifyDB */
+static const int MAX_VERIFYDB_READ_THREADS = 4;
+/** Blocks VerifyDB reads ahead of checking them */
+static const unsigned int VERIFYDB_READ_BATCH = 64;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -125,6 +158,7 @@ extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+extern CBlockIndexArena blockIndexArena;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -139,9 +173,15 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+/** True if any block files have ever been pruned. */
+extern bool fHavePruned;
+/** True if we're running in -prune mode. */
+extern bool fPruneMode;
+/** Number of bytes of block and undo files to aim for when pruning. */
+extern uint64_t nPruneTarget;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern int64_t nMaxTipAge;
@@ -154,6 +194,8 @@ extern int64_t nReserveBalance;
 
 extern std::map<uint256, int64_t> mapRejectedBlocks;
 extern std::map<uint256, int64_t> mapZerocoinspends; //txid, time received
+//! Set once mempool.dat has been read, so a partial pool never overwrites it
+extern std::atomic<bool> fMempoolLoaded;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex* pindexBestHeader;
@@ -194,6 +236,14 @@ bool InitBlockIndex();
 bool LoadBlockIndex(std::string& strError);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Load the UTXO set statistics stored with the best block, or compute them if they are missing or stale */
+bool LoadRollingCoinsStats();
+/**
+ * Make the chain ending in pindexBase, loaded from a UTXO snapshot whose
+ * coins are already in the coins database, the active chain. The blocks
+ * below it are treated as pruned.
+ */
+bool ActivateSnapshotChain(CBlockIndex* pindexBase, std::string& strError);
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
 /** Process protocol messages received from a given node */
@@ -228,16 +278,44 @@ CAmount GetBlockValue(int nHeight);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex* InsertBlockIndex(uint256 hash);
+/** Create or update the block index entry for hash from its stored form */
+CBlockIndex* InsertBlockIndex(const uint256& hash, const CDiskBlockIndex& diskindex);
+/** Memory used by the block index entries and mapBlockIndex. */
+size_t BlockIndexDynamicMemoryUsage();
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Bytes currently used by block and undo files. */
+uint64_t CalculateCurrentUsage();
+/** Highest block whose file may be pruned, or -1 if nothing can be pruned yet. */
+int GetLastBlockWeCanPrune();
+/** Prune block files holding only blocks up to nManualPruneHeight, as far as the usual limits allow; used by pruneblockchain. */
+void PruneBlockFilesManual(int nManualPruneHeight);
+/** Mark a block file as pruned: its blocks lose their data and undo flags. */
+void PruneOneBlockFile(int nFile);
+/** Delete the block and undo files of block files marked as pruned. */
+void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune);
+/** Delete all undo files, and the block files that do not follow on from blk00000.dat; used before a -reindex. */
+void CleanupBlockRevFiles();
 
 
 /** (try to) add transaction to memory pool **/
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false, bool fOverrideMempoolLimit = false);
+
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee = false, bool ignoreFees = false, bool fOverrideMempoolLimit = false);
+
+/** Save the mempool, its prioritisation deltas and the zerocoin spend times to mempool.dat */
+bool DumpMempool();
+
+/** Load the mempool saved by DumpMempool() through AcceptToMemoryPool */
+bool LoadMempool();
+
+/** Expire old transactions from the pool and trim it to limit bytes of dynamic memory */
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age);
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
@@ -275,9 +353,16 @@ bool AreInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs)
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. A transaction whose scripts all passed under the same flags
+ * before, with cacheFullScriptStore set, skips script execution.
  */
-bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck>* pvChecks = NULL);
+bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, std::vector<CBlockCheck>* pvChecks = NULL);
+
+/** Size the script execution cache from -sigcachesize. Must be called before any transaction is validated. */
+void InitScriptExecutionCache();
+
+/** Counters of the script execution cache since startup. */
+CValidationCacheStats GetScriptExecutionCacheStats();
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
@@ -287,6 +372,14 @@ bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationSt
 bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, bool fFakeSerialAttack = false);
 bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend* spend, CBlockIndex* pindex, const uint256& hashBlock);
 bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, CBlockIndex* pindex, const uint256& hashBlock);
+/**
+ * Check the zerocoin spends of tx for the block at pindex and add them to vSpends and their
+ * value to nValueIn. Serials already in the chain are looked up at once, so spends are seen in
+ * block order. If pvChecks is not NULL, the signature and serial range checks are pushed onto it
+ * instead of being performed inline.
+ */
+bool CheckZerocoinSpendInputs(const CTransaction& tx, CValidationState& state, CBlockIndex* pindex, CAmount& nValueIn,
+                              std::vector<std::pair<libzerocoin::CoinSpend, uint256> >& vSpends, std::vector<CBlockCheck>* pvChecks = NULL);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx, CTransaction& tx);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx);
 bool IsBlockHashInChain(const uint256& hashBlock);
@@ -335,8 +428,8 @@ private:
 
 public:
     CScriptCheck() : ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) : scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-                                                                                                                                ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) : scriptPubKey(outIn.scriptPubKey),
+                                                                                                                             ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
 
     bool operator()();
 
@@ -353,11 +446,65 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the signature and serial range checks of one zerocoin
+ * spend. Whether the serial was spent before is not checked here, that has
+ * to happen in block order.
+ */
+class CZerocoinSpendCheck
+{
+private:
+    std::shared_ptr<const libzerocoin::CoinSpend> spend;
+    const CTransaction* ptx;
+    CBlockIndex* pindex;
+
+public:
+    CZerocoinSpendCheck() : ptx(0), pindex(0) {}
+    CZerocoinSpendCheck(const std::shared_ptr<const libzerocoin::CoinSpend>& spendIn, const CTransaction& txIn, CBlockIndex* pindexIn) : spend(spendIn), ptx(&txIn), pindex(pindexIn) {}
+
+    bool operator()();
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        spend.swap(check.spend);
+        std::swap(ptx, check.ptx);
+        std::swap(pindex, check.pindex);
+    }
+};
+
+/**
+ * One check of a block on the script check threads: either a script
+ * verification or the checks of a zerocoin spend.
+ */
+class CBlockCheck
+{
+private:
+    CScriptCheck scriptCheck;
+    CZerocoinSpendCheck zerocoinCheck;
+    bool fZerocoin;
+
+public:
+    CBlockCheck() : fZerocoin(false) {}
+    explicit CBlockCheck(CScriptCheck& check) : fZerocoin(false) { scriptCheck.swap(check); }
+    explicit CBlockCheck(CZerocoinSpendCheck& check) : fZerocoin(true) { zerocoinCheck.swap(check); }
+
+    bool operator()() { return fZerocoin ? zerocoinCheck() : scriptCheck(); }
+
+    void swap(CBlockCheck& check)
+    {
+        scriptCheck.swap(check.scriptCheck);
+        zerocoinCheck.swap(check.zerocoinCheck);
+        std::swap(fZerocoin, check.fZerocoin);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Get the serialized bytes of the block at pos, from a mapped file where possible */
+bool ReadRawBlockFromDisk(CRawBlockData& raw, const CDiskBlockPos& pos);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -365,15 +512,16 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified, and so may pstats, the
+ *  statistics of coins that are kept up to date if given. */
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CRollingCoinsStats* pstats = NULL, bool fJustCheck = false);
 
 /** Reprocess a number of blocks to try and get on the correct chain again **/
 bool DisconnectBlocks(int nBlocks);
 void ReprocessBlocks(int nBlocks);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false);
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins, and on its statistics pstats if given */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false, CRollingCoinsStats* pstats = NULL);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
@@ -392,15 +540,63 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** pindex, C
 bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex = NULL);
 
 
-/** RAII wrapper for VerifyDB: Verify consistency of the block and coin databases */
+/**
+ * RAII wrapper for VerifyDB: Verify consistency of the block and coin databases.
+ * Blocks and undo data are read in parallel without cs_main, which is only held
+ * to check each block and for the in-memory disconnect and reconnect of the tip.
+ */
 class CVerifyDB
 {
+private:
+    //! Report progress to the background verification status instead of the UI
+    bool fBackground;
+    std::string strFailure;
+
+    bool Failed(const std::string& strMessage);
+    void ShowProgress(int nPercent, int nChecked, int nTotal);
+
 public:
-    CVerifyDB();
+    explicit CVerifyDB(bool fBackgroundIn = false);
     ~CVerifyDB();
     bool VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth);
+    //! Why VerifyDB failed
+    const std::string& GetFailure() const { return strFailure; }
+};
+
+/** Where the block database verification started by StartVerifyDB stands */
+struct CVerifyDBStatus {
+    enum State {
+        NOT_STARTED,
+        RUNNING,
+        PASSED,
+        FAILED,
+        INTERRUPTED,
+    };
+
+    State state;
+    int nCheckLevel;
+    int nCheckDepth;
+    int nBlocksChecked;
+    int nBlocksTotal;
+    //! Percent done
+    int nProgress;
+    int64_t nTimeStart;
+    int64_t nTimeEnd;
+    std::string strError;
+
+    CVerifyDBStatus() : state(NOT_STARTED), nCheckLevel(0), nCheckDepth(0), nBlocksChecked(0), nBlocksTotal(0), nProgress(0), nTimeStart(0), nTimeEnd(0) {}
+
+    std::string StateString() const;
 };
 
+/**
+ * Verify the last nCheckDepth blocks at nCheckLevel in a thread of threadGroup,
+ * against pcoinsTip, while the node runs. Corruption shuts the node down.
+ */
+void StartVerifyDB(boost::thread_group& threadGroup, int nCheckLevel, int nCheckDepth);
+/** Status of the verification started by StartVerifyDB */
+CVerifyDBStatus GetVerifyDBStatus();
+
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
@@ -416,6 +612,15 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
+/** Global variable that points to the chainstate database below pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB* pcoinsdbview;
+
+/** Statistics of the UTXO set at chainActive's tip (protected by cs_main) */
+extern CRollingCoinsStats rollingCoinsStats;
+
+/** Mappings of finalized block files used by ReadRawBlockFromDisk */
+extern CBlockFileMapper blockFileMapper;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
@@ -0,0 +1,95 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MEMUSAGE_H
+#define BITCOIN_MEMUSAGE_H
+
+#include "support/pool.h"
+
+#include <assert.h>
+#include <map>
+#include <set>
+#include <stdlib.h>
+#include <utility>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+namespace memusage
+{
+/** Compute the total memory used by allocating alloc bytes. */
+static inline size_t MallocUsage(size_t alloc)
+{
+    // Measured on libc6 2.19 on Linux.
+    if (alloc == 0) {
+        return 0;
+    } else if (sizeof(void*) == 8) {
+        return ((alloc + 31) >> 4) << 4;
+    } else if (sizeof(void*) == 4) {
+        return ((alloc + 15) >> 3) << 3;
+    } else {
+        assert(0);
+    }
+}
+
+template <typename X>
+static inline size_t DynamicUsage(const std::vector<X>& v)
+{
+    return MallocUsage(v.capacity() * sizeof(X));
+}
+
+// A node of a std::set or std::map: the red-black tree links and colour, then the value.
+template <typename X>
+struct stl_tree_node {
+private:
+    int color;
+    void* parent;
+    void* left;
+    void* right;
+    X x;
+};
+
+template <typename X, typename Y>
+static inline size_t DynamicUsage(const std::set<X, Y>& s)
+{
+    return MallocUsage(sizeof(stl_tree_node<X>)) * s.size();
+}
+
+template <typename X, typename Y>
+static inline size_t IncrementalDynamicUsage(const std::set<X, Y>& s)
+{
+    return MallocUsage(sizeof(stl_tree_node<X>));
+}
+
+template <typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
+}
+
+template <typename X, typename Y, typename Z>
+static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
+}
+
+template <typename Key, typename T, typename Hash, typename Pred>
+static inline size_t DynamicUsage(const boost::unordered_map<Key, T, Hash, Pred>& m)
+{
+    // Each node holds the value, a link to the next node and the cached hash.
+    return MallocUsage(sizeof(std::pair<const Key, T>) + 2 * sizeof(void*)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
+/**
+ * Nodes of a pool backed map are accounted as the blocks the pool has handed
+ * out; blocks on the pool's free lists are reusable and not counted.
+ */
+template <typename Key, typename T, typename Hash, typename Pred, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const boost::unordered_map<Key, T, Hash, Pred, PoolAllocator<std::pair<const Key, T>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    return m.get_allocator().resource()->UsedBytes() + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+} // namespace memusage
+
+#endif // BITCOIN_MEMUSAGE_H
@@ -9,6 +9,7 @@
 #define BITCOIN_MERKLEBLOCK_H
 
 #include "bloom.h"
+#include "consensus/merkle.h"
 #include "primitives/block.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -70,11 +71,8 @@ protected:
         return (nTransactions + (1 << height) - 1) >> height;
     }
 
-    /** calculate the hash of a node in the merkle tree (at leaf level: the txid's themselves) */
-    uint256 CalcHash(int height, unsigned int pos, const std::vector<uint256>& vTxid);
-
     /** recursive function that traverses tree nodes, storing the data as bits and hashes */
-    void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256>& vTxid, const std::vector<bool>& vMatch);
+    void TraverseAndBuild(int height, unsigned int pos, const CMerkleTree& tree, const std::vector<bool>& vMatch);
 
     /**
      * recursive function that traverses tree nodes, consuming the bits and hashes produced by TraverseAndBuild.
@@ -110,6 +108,9 @@ public:
     /** Construct a partial merkle tree from a list of transaction id's, and a mask that selects a subset of them */
     CPartialMerkleTree(const std::vector<uint256>& vTxid, const std::vector<bool>& vMatch);
 
+    /** Construct a partial merkle tree from an already computed merkle tree, and a mask that selects a subset of its leaves */
+    CPartialMerkleTree(const CMerkleTree& tree, const std::vector<bool>& vMatch);
+
     CPartialMerkleTree();
 
     /**
@@ -142,6 +143,9 @@ public:
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter);
 
+    /** Same, with the merkle tree of the block already computed */
+    CMerkleBlock(const CBlock& block, const CMerkleTree& tree, CBloomFilter& filter);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
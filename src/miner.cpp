@@ -36,7 +36,6 @@
 
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -44,53 +43,659 @@
 // KabberryMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    std::set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+namespace {
+
+// Container for tracking updates to ancestor feerate as we include (parent)
+// transactions in a block
+struct CTxMemPoolModifiedEntry {
+    explicit CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
     {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
     }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
+/** Comparator for CTxMemPool::txiter objects: compare the addresses of the entries. */
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator()(const CTxMemPoolModifiedEntry& entry) const
+    {
+        return entry.iter;
+    }
+};
+
+/** The order of CompareTxMemPoolEntryByAncestorFee, on the modified ancestor state. */
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2)
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        return f1 > f2;
+    }
+};
+
+/** Parents go into a block before their children: sort a package by ancestor count. */
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+
+struct TxCoinAgePriorityCompare {
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b) const
+    {
+        if (a.first == b.first)
+            return CTxMemPool::CompareIteratorByHash()(b.second, a.second); // Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter>,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            // Reuse same tag from CTxMemPool's similar index
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry> > >
+    indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion {
+    explicit update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator()(CTxMemPoolModifiedEntry& e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+    }
+
+    CTxMemPool::txiter iter;
+};
+
+/**
+ * The mempool transactions chosen for the last block template. As long as
+ * the tip and the size limits stay the same and the pool has only gained
+ * transactions since, the next template starts from this selection and
+ * only looks at the new arrivals.
+ */
+struct CBlockSelection {
+    uint256 hashPrevBlock;
+    int nHeight;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockMinSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nTransactionsUpdated; //! mempool.GetTransactionsUpdated() at selection
+    int64_t nTimeSelected;             //! pool entries from this second on may not have been seen...
+    std::set<uint256> setSeenAtTime;   //! ... except these
+    std::set<uint256> setRetry;        //! non-final transactions, looked at again next time
+
+    std::vector<CTransaction> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    std::vector<CBigNum> vBlockSerials;
+    uint64_t nBlockSize;
+    int nBlockSigOps;
+    CAmount nFees;
+
+    CBlockSelection() { SetNull(); }
+
+    void SetNull()
+    {
+        hashPrevBlock.SetNull();
+        nHeight = -1;
+        nBlockMaxSize = 0;
+        nBlockMinSize = 0;
+        nBlockPrioritySize = 0;
+        nTransactionsUpdated = 0;
+        nTimeSelected = 0;
+        setSeenAtTime.clear();
+        setRetry.clear();
+        vtx.clear();
+        vTxFees.clear();
+        vTxSigOps.clear();
+        vBlockSerials.clear();
+        nBlockSize = 1000;
+        nBlockSigOps = 100;
+        nFees = 0;
+    }
+};
+
+// Guarded by mempool.cs
+CBlockSelection lastSelection;
+
+// Checks the zerocoin serials spent by tx against the chain, the block and
+// the rest of the package, and adds them to vPackageSerials.
+bool CheckZerocoinSerials(const CTransaction& tx, const std::vector<CBigNum>& vBlockSerials, std::vector<CBigNum>& vPackageSerials)
+{
+    int nHeightTx = 0;
+    if (IsTransactionInChain(tx.GetHash(), nHeightTx))
+        return false;
+
+    for (const CTxIn& txIn : tx.vin) {
+        bool isPublicSpend = txIn.IsZerocoinPublicSpend();
+        if (!txIn.IsZerocoinSpend() && !isPublicSpend)
+            continue;
+
+        CBigNum bnSerial;
+        bool fValidSerial;
+        if (isPublicSpend) {
+            libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
+            PublicCoinSpend publicSpend(params);
+            CValidationState state;
+            if (!sKKCModule::ParseZerocoinPublicSpend(txIn, tx, state, publicSpend))
+                throw std::runtime_error("Invalid public spend parse");
+            bool fUseV1Params = publicSpend.getCoinVersion() < libzerocoin::PrivateCoin::PUBKEY_VERSION;
+            fValidSerial = publicSpend.HasValidSerial(Params().Zerocoin_Params(fUseV1Params));
+            bnSerial = publicSpend.getCoinSerialNumber();
+        } else {
+            libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
+            bool fUseV1Params = spend.getCoinVersion() < libzerocoin::PrivateCoin::PUBKEY_VERSION;
+            fValidSerial = spend.HasValidSerial(Params().Zerocoin_Params(fUseV1Params));
+            bnSerial = spend.getCoinSerialNumber();
+        }
+
+        if (!fValidSerial)
+            return false;
+        if (std::count(vBlockSerials.begin(), vBlockSerials.end(), bnSerial))
+            return false;
+        if (std::count(vPackageSerials.begin(), vPackageSerials.end(), bnSerial))
+            return false;
+        vPackageSerials.push_back(bnSerial);
+    }
+    return true;
+}
+
+CTxMemPool::txiter ToTxIter(CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator it)
 {
-    bool byFee;
+    return mempool.mapTx.project<0>(it);
+}
+
+CTxMemPool::txiter ToTxIter(std::vector<CTxMemPool::txiter>::const_iterator it)
+{
+    return *it;
+}
+
+/**
+ * Adds mempool transactions to a CBlockSelection: zerocoin spends first,
+ * then free transactions by coin age priority, then packages of transactions with their unconfirmed ancestors, best
+ * ancestor feerate first. Only the chosen transactions are looked up in
+ * the coins view and script checked.
+ */
+class CBlockAssembler
+{
+private:
+    CBlockSelection& sel;
+    const int nHeight;
+    const unsigned int nBlockMaxSize;
+    const unsigned int nBlockMinSize;
+    const unsigned int nBlockPrioritySize;
+    const bool fPrintPriority;
+    const bool fZerocoinMaintenance;
+
+    CCoinsViewCache view;
+    CTxMemPool::setEntries inBlock;
 
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    int nPackagesSelected;
+    int nDescendantsUpdated;
+
+    CBlockAssembler(CBlockSelection& selIn, int nHeightIn, unsigned int nBlockMaxSizeIn, unsigned int nBlockMinSizeIn, unsigned int nBlockPrioritySizeIn) :
+        sel(selIn), nHeight(nHeightIn), nBlockMaxSize(nBlockMaxSizeIn), nBlockMinSize(nBlockMinSizeIn), nBlockPrioritySize(nBlockPrioritySizeIn),
+        fPrintPriority(GetBoolArg("-printpriority", false)),
+        fZerocoinMaintenance(sporkManager.IsSporkActive(SPORK_16_ZEROCOIN_MAINTENANCE_MODE)),
+        view(pcoinsTip), nPackagesSelected(0), nDescendantsUpdated(0)
+    {
+        // Bring the view and inBlock up to the transactions already selected.
+        for (const CTransaction& tx : sel.vtx) {
+            CValidationState state;
+            CTxUndo txundo;
+            UpdateCoins(tx, state, view, txundo, nHeight);
+            CTxMemPool::txiter it = mempool.mapTx.find(tx.GetHash());
+            assert(it != mempool.mapTx.end());
+            inBlock.insert(it);
+        }
+    }
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    void AddZerocoinSpends();
+    void AddPriorityTxs(const std::vector<CTxMemPool::txiter>& vCandidates);
+
+    template <typename Iter>
+    void AddPackageTxs(Iter mi, Iter end, indexed_modified_transaction_set& mapModifiedTx);
+
+    /** Seed mapModifiedTx with the descendants of everything in the block so far. */
+    void UpdatePackagesForBlock(indexed_modified_transaction_set& mapModifiedTx)
     {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+        nDescendantsUpdated += UpdatePackagesForAdded(inBlock, mapModifiedTx);
+    }
+
+private:
+    bool AddPackage(const std::vector<CTxMemPool::txiter>& vPackage);
+    int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx);
+
+    bool IsStillDependent(CTxMemPool::txiter it) const
+    {
+        for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+            if (!inBlock.count(parent))
+                return true;
         }
+        return false;
+    }
+
+    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set& mapModifiedTx, const CTxMemPool::setEntries& failedTx) const
+    {
+        // Zerocoin spends had their turn in AddZerocoinSpends
+        return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it) || it->GetTx().HasZerocoinSpendInputs();
     }
 };
 
+bool CBlockAssembler::AddPackage(const std::vector<CTxMemPool::txiter>& vPackage)
+{
+    CCoinsViewCache viewPackage(&view);
+    std::vector<CBigNum> vPackageSerials;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    int nPackageSigOps = 0;
+
+    for (CTxMemPool::txiter it : vPackage) {
+        const CTransaction& tx = it->GetTx();
+        if (tx.IsCoinBase() || tx.IsCoinStake())
+            return false;
+        if (!IsFinalTx(tx, nHeight)) {
+            sel.setRetry.insert(tx.GetHash());
+            return false;
+        }
+        if (fZerocoinMaintenance && tx.ContainsZerocoins())
+            return false;
+
+        bool fZerocoinSpend = tx.HasZerocoinSpendInputs();
+        if (fZerocoinSpend && !CheckZerocoinSerials(tx, sel.vBlockSerials, vPackageSerials))
+            return false;
+
+        // Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
+        for (const CTxIn& txin : tx.vin) {
+            if (!fZerocoinSpend && invalid_out::ContainsOutPoint(txin.prevout)) {
+                LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
+                return false;
+            }
+        }
+        if (!viewPackage.HaveInputs(tx))
+            return false;
+
+        // Legacy limits on sigOps:
+        unsigned int nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, viewPackage);
+        if (sel.nBlockSigOps + nPackageSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS_CURRENT)
+            return false;
+
+        CAmount nTxFees = viewPackage.GetValueIn(tx) - tx.GetValueOut();
+
+        // Note that flags: we don't want to set mempool/IsStandard()
+        // policy here, but we still have to ensure that the block we
+        // create only contains transactions that are valid in new blocks.
+        CValidationState state;
+        if (!CheckInputs(tx, state, viewPackage, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false))
+            return false;
+
+        CTxUndo txundo;
+        UpdateCoins(tx, state, viewPackage, txundo, nHeight);
+
+        vTxFees.push_back(nTxFees);
+        vTxSigOps.push_back(nTxSigOps);
+        nPackageSigOps += nTxSigOps;
+    }
+
+    // The whole package is valid, add it.
+    viewPackage.Flush();
+    for (size_t i = 0; i < vPackage.size(); i++) {
+        CTxMemPool::txiter it = vPackage[i];
+        sel.vtx.push_back(it->GetTx());
+        sel.vTxFees.push_back(vTxFees[i]);
+        sel.vTxSigOps.push_back(vTxSigOps[i]);
+        sel.nBlockSize += it->GetTxSize();
+        sel.nBlockSigOps += vTxSigOps[i];
+        sel.nFees += vTxFees[i];
+        inBlock.insert(it);
+
+        if (fPrintPriority) {
+            LogPrintf("fee %s txid %s\n",
+                CFeeRate(it->GetModifiedFee(), it->GetTxSize()).ToString(), it->GetTx().GetHash().ToString());
+        }
+    }
+    sel.vBlockSerials.insert(sel.vBlockSerials.end(), vPackageSerials.begin(), vPackageSerials.end());
+    return true;
+}
+
+int CBlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx)
+{
+    int nDescendants = 0;
+    for (const CTxMemPool::txiter it : alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        for (CTxMemPool::txiter desc : descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            ++nDescendants;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+    return nDescendants;
+}
+
+void CBlockAssembler::AddZerocoinSpends()
+{
+    // Zerocoin spends pay no fee but should make it into the next block; the
+    // ones waiting longest go first. They never have mempool parents.
+    std::vector<std::pair<int64_t, uint256> > vSpends;
+    vSpends.reserve(mapZerocoinspends.size());
+    for (const auto& spend : mapZerocoinspends)
+        vSpends.push_back(std::make_pair(spend.second, spend.first));
+    std::sort(vSpends.begin(), vSpends.end());
+
+    for (const auto& spend : vSpends) {
+        CTxMemPool::txiter it = mempool.mapTx.find(spend.second);
+        if (it == mempool.mapTx.end() || inBlock.count(it))
+            continue;
+        if (sel.nBlockSize + it->GetTxSize() >= nBlockMaxSize)
+            continue;
+        AddPackage(std::vector<CTxMemPool::txiter>(1, it));
+    }
+}
+
+void CBlockAssembler::AddPriorityTxs(const std::vector<CTxMemPool::txiter>& vCandidates)
+{
+    // How much of the block should be dedicated to high-priority transactions,
+    // included regardless of the fees they pay
+    if (nBlockPrioritySize == 0)
+        return;
+
+    std::vector<TxCoinAgePriority> vecPriority;
+    vecPriority.reserve(vCandidates.size());
+    for (CTxMemPool::txiter it : vCandidates) {
+        if (inBlock.count(it) || it->GetTx().HasZerocoinSpendInputs())
+            continue;
+        double dPriority = it->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(it->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, it));
+    }
+    TxCoinAgePriorityCompare pricomparer;
+    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+    // Children wait here until their mempool parents are in the block
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    while (!vecPriority.empty()) {
+        // Done once the priority area is full, which an extended selection
+        // may already be when it starts
+        if (sel.nBlockSize >= nBlockPrioritySize)
+            return;
+
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        CTxMemPool::txiter iter = vecPriority.back().second;
+        double actualPriority = vecPriority.back().first;
+        vecPriority.pop_back();
+
+        // The rest of the queue has no more priority than this one
+        if (!AllowFree(actualPriority))
+            return;
+        if (inBlock.count(iter))
+            continue;
+        if (IsStillDependent(iter)) {
+            waitPriMap.insert(std::make_pair(iter, actualPriority));
+            continue;
+        }
+        if (sel.nBlockSize + iter->GetTxSize() >= nBlockMaxSize)
+            continue;
+        if (!AddPackage(std::vector<CTxMemPool::txiter>(1, iter)))
+            continue;
+
+        // This tx was successfully added, so add transactions that depend
+        // on this one to the priority queue to try again
+        for (CTxMemPool::txiter child : mempool.GetMemPoolChildren(iter)) {
+            auto wpiter = waitPriMap.find(child);
+            if (wpiter != waitPriMap.end()) {
+                vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                waitPriMap.erase(wpiter);
+            }
+        }
+    }
+}
+
+template <typename Iter>
+void CBlockAssembler::AddPackageTxs(Iter mi, Iter end, indexed_modified_transaction_set& mapModifiedTx)
+{
+    // mapModifiedTx holds the packages whose ancestor state changed because
+    // some of their transactions are in the block already; failedTx the
+    // entries we tried to add but failed, which we don't try again.
+    CTxMemPool::setEntries failedTx;
+    CTxMemPool::txiter iter;
+
+    while (mi != end || !mapModifiedTx.empty()) {
+        // First try to find a new transaction in mapTx to evaluate.
+        if (mi != end && SkipMapTxEntry(ToTxIter(mi), mapModifiedTx, failedTx)) {
+            ++mi;
+            continue;
+        }
+
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from mapTx, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+
+        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+        if (mi == end) {
+            // We're out of entries in mapTx; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            // Try to compare the mapTx entry to the mapModifiedTx entry
+            iter = ToTxIter(mi);
+            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from mapTx.
+                // Switch which transaction (package) to consider
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                // Increment mi for the next loop iteration.
+                ++mi;
+            }
+        }
+
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+        }
+
+        // Skip low-fee packages once past the minimum block size; everything
+        // else we might consider has a lower fee rate.
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && sel.nBlockSize + packageSize >= nBlockMinSize)
+            return;
+
+        if (sel.nBlockSize + packageSize >= nBlockMaxSize) {
+            if (fUsingModified) {
+                // Since we always look at the best entry in mapModifiedTx,
+                // we must erase failed entries so that we can consider the
+                // next best entry on the next loop iteration
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+                failedTx.insert(iter);
+            }
+            continue;
+        }
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        for (CTxMemPool::setEntries::iterator ait = ancestors.begin(); ait != ancestors.end();) {
+            if (inBlock.count(*ait))
+                ancestors.erase(ait++);
+            else
+                ++ait;
+        }
+        ancestors.insert(iter);
+
+        std::vector<CTxMemPool::txiter> sortedEntries(ancestors.begin(), ancestors.end());
+        std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+
+        if (!AddPackage(sortedEntries)) {
+            if (fUsingModified)
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+            failedTx.insert(iter);
+            continue;
+        }
+        ++nPackagesSelected;
+
+        for (CTxMemPool::txiter added : sortedEntries)
+            mapModifiedTx.erase(added);
+
+        // Update transactions that depend on each of these
+        nDescendantsUpdated += UpdatePackagesForAdded(ancestors, mapModifiedTx);
+    }
+}
+
+/**
+ * Fills lastSelection for a block on top of pindexPrev. Returns true if the
+ * previous selection was extended with the nNew transactions that entered
+ * the pool since, false if it was built from the whole pool.
+ */
+bool SelectTransactions(const CBlockIndex* pindexPrev, unsigned int nBlockMaxSize, unsigned int nBlockMinSize,
+                        unsigned int nBlockPrioritySize, unsigned int& nNew, int& nPackages, int& nDescendants)
+{
+    AssertLockHeld(mempool.cs);
+    CBlockSelection& sel = lastSelection;
+    const int nHeight = pindexPrev->nHeight + 1;
+    const unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    const int64_t nNow = GetTime();
+
+    std::vector<CTxMemPool::txiter> vNew;
+    bool fExtend = sel.hashPrevBlock == pindexPrev->GetBlockHash() && sel.nHeight == nHeight &&
+                   sel.nBlockMaxSize == nBlockMaxSize && sel.nBlockMinSize == nBlockMinSize &&
+                   sel.nBlockPrioritySize == nBlockPrioritySize && nNow >= sel.nTimeSelected;
+    if (fExtend) {
+        // The newest entries come last in entry time order. Every addition to
+        // the pool counts as one update; if anything else happened, the
+        // numbers won't match and the selection is built afresh.
+        typedef CTxMemPool::indexed_transaction_set::index<entry_time>::type::reverse_iterator timeriter;
+        for (timeriter rit = mempool.mapTx.get<entry_time>().rbegin();
+             rit != mempool.mapTx.get<entry_time>().rend() && rit->GetTime() >= sel.nTimeSelected; ++rit) {
+            if (!sel.setSeenAtTime.count(rit->GetTx().GetHash()))
+                vNew.push_back(mempool.mapTx.find(rit->GetTx().GetHash()));
+        }
+        fExtend = vNew.size() == nTransactionsUpdated - sel.nTransactionsUpdated;
+    }
+    if (!fExtend) {
+        sel.SetNull();
+        vNew.clear();
+    } else {
+        // Non-final transactions may have become final.
+        for (const uint256& hash : sel.setRetry) {
+            CTxMemPool::txiter it = mempool.mapTx.find(hash);
+            if (it != mempool.mapTx.end())
+                vNew.push_back(it);
+        }
+        sel.setRetry.clear();
+    }
+    nNew = vNew.size();
+
+    CBlockAssembler assembler(sel, nHeight, nBlockMaxSize, nBlockMinSize, nBlockPrioritySize);
+    assembler.AddZerocoinSpends();
+    if (fExtend) {
+        assembler.AddPriorityTxs(vNew);
+    } else {
+        std::vector<CTxMemPool::txiter> vAll;
+        vAll.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            vAll.push_back(it);
+        assembler.AddPriorityTxs(vAll);
+    }
+
+    indexed_modified_transaction_set mapModifiedTx;
+    assembler.UpdatePackagesForBlock(mapModifiedTx);
+    if (fExtend) {
+        std::sort(vNew.begin(), vNew.end(), [](const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) {
+            return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+        });
+        std::vector<CTxMemPool::txiter>::const_iterator begin = vNew.begin(), end = vNew.end();
+        assembler.AddPackageTxs(begin, end, mapModifiedTx);
+    } else {
+        assembler.AddPackageTxs(mempool.mapTx.get<ancestor_score>().begin(), mempool.mapTx.get<ancestor_score>().end(), mapModifiedTx);
+    }
+    nPackages = assembler.nPackagesSelected;
+    nDescendants = assembler.nDescendantsUpdated;
+
+    sel.hashPrevBlock = pindexPrev->GetBlockHash();
+    sel.nHeight = nHeight;
+    sel.nBlockMaxSize = nBlockMaxSize;
+    sel.nBlockMinSize = nBlockMinSize;
+    sel.nBlockPrioritySize = nBlockPrioritySize;
+    sel.nTransactionsUpdated = nTransactionsUpdated;
+    sel.nTimeSelected = nNow;
+    sel.setSeenAtTime.clear();
+    typedef CTxMemPool::indexed_transaction_set::index<entry_time>::type::reverse_iterator timeriter;
+    for (timeriter rit = mempool.mapTx.get<entry_time>().rbegin();
+         rit != mempool.mapTx.get<entry_time>().rend() && rit->GetTime() >= nNow; ++rit)
+        sel.setSeenAtTime.insert(rit->GetTx().GetHash());
+
+    return fExtend;
+}
+
+} // anon namespace
+
+bool SelectBlockTransactions(const CBlockIndex* pindexPrev, unsigned int nBlockMaxSize, unsigned int nBlockMinSize,
+                             unsigned int nBlockPrioritySize, std::vector<CTransaction>& vtx)
+{
+    unsigned int nNew = 0;
+    int nPackages = 0, nDescendants = 0;
+    bool fExtended = SelectTransactions(pindexPrev, nBlockMaxSize, nBlockMinSize, nBlockPrioritySize, nNew, nPackages, nDescendants);
+    vtx = lastSelection.vtx;
+    return fExtended;
+}
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -114,6 +719,7 @@ CBlockIndex* GetChainTip()
 std::pair<int, std::pair<uint256, uint256> > pCheckpointCache;
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake)
 {
+    int64_t nTimeStart = GetTimeMicros();
     CReserveKey reservekey(pwallet);
 
     // Create new block
@@ -160,6 +766,8 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         pblock->vtx.push_back(CTransaction(txCoinStake));
     }
 
+    int64_t nTimeStake = GetTimeMicros();
+
     // Largest block you're willing to create:
     unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
     // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
@@ -181,263 +789,18 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
     {
         LOCK2(cs_main, mempool.cs);
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        std::list<COrphan> vOrphan; // list memory doesn't move
-        std::map<uint256, std::vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        std::vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (std::map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-            if(sporkManager.IsSporkActive(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins()){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            uint256 txid = tx.GetHash();
-            bool hasZerocoinSpends = tx.HasZerocoinSpendInputs();
-            if (hasZerocoinSpends)
-                nTotalIn = tx.GetZerocoinSpent();
-
-            for (const CTxIn& txin : tx.vin) {
-                //zerocoinspend has special vin
-                if (hasZerocoinSpends) {
-                    //Give a high priority to zerocoinspends to get into the next block
-                    //Priority = (age^6+100000)*amount - gives higher priority to skkcs that have been in mempool long
-                    //and higher priority to skkcs that are large in value
-                    int64_t nTimeSeen = GetAdjustedTime();
-                    double nConfs = 100000;
-
-                    auto it = mapZerocoinspends.find(txid);
-                    if (it != mapZerocoinspends.end()) {
-                        nTimeSeen = it->second;
-                    } else {
-                        //for some reason not in map, add it
-                        mapZerocoinspends[txid] = nTimeSeen;
-                    }
-
-                    double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
-
-                    // sKKC spends can have very large priority, use non-overflowing safe functions
-                    dPriority = double_safe_addition(dPriority, (nTimePriority * nConfs));
-                    dPriority = double_safe_multiplication(dPriority, nTotalIn);
-
-                    continue;
-                }
-
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-
-                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
-                if (invalid_out::ContainsOutPoint(txin.prevout)) {
-                    LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
-                    fMissingInputs = true;
-                    break;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                // sKKC spends can have very large priority, use non-overflowing safe functions
-                dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        std::vector<CBigNum> vBlockSerials;
-        std::vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (!tx.HasZerocoinSpendInputs() && fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            // double check that there are no double spent sKKC spends in this block or tx
-            if (tx.HasZerocoinSpendInputs()) {
-                int nHeightTx = 0;
-                if (IsTransactionInChain(tx.GetHash(), nHeightTx))
-                    continue;
-
-                bool fDoubleSerial = false;
-                for (const CTxIn& txIn : tx.vin) {
-                    bool isPublicSpend = txIn.IsZerocoinPublicSpend();
-                    if (txIn.IsZerocoinSpend() || isPublicSpend) {
-                        libzerocoin::CoinSpend* spend;
-                        if (isPublicSpend) {
-                            libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
-                            PublicCoinSpend publicSpend(params);
-                            CValidationState state;
-                            if (!sKKCModule::ParseZerocoinPublicSpend(txIn, tx, state, publicSpend)){
-                                throw std::runtime_error("Invalid public spend parse");
-                            }
-                            spend = &publicSpend;
-                        } else {
-                            libzerocoin::CoinSpend spendObj = TxInToZerocoinSpend(txIn);
-                            spend = &spendObj;
-                        }
-
-                        bool fUseV1Params = spend->getCoinVersion() < libzerocoin::PrivateCoin::PUBKEY_VERSION;
-                        if (!spend->HasValidSerial(Params().Zerocoin_Params(fUseV1Params)))
-                            fDoubleSerial = true;
-                        if (std::count(vBlockSerials.begin(), vBlockSerials.end(), spend->getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (std::count(vTxSerials.begin(), vTxSerials.end(), spend->getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (fDoubleSerial)
-                            break;
-                        vTxSerials.emplace_back(spend->getCoinSerialNumber());
-                    }
-                }
-                //This sKKC serial has already been included in the block, do not add this tx.
-                if (fDoubleSerial)
-                    continue;
-            }
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            for (const CBigNum& bnSerial : vTxSerials)
-                vBlockSerials.emplace_back(bnSerial);
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                for (COrphan* porphan : mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        int64_t nTimeSelect = GetTimeMicros();
+        unsigned int nNew = 0;
+        int nPackages = 0, nDescendants = 0;
+        bool fExtended = SelectTransactions(pindexPrev, nBlockMaxSize, nBlockMinSize, nBlockPrioritySize, nNew, nPackages, nDescendants);
+        const CBlockSelection& sel = lastSelection;
+        pblock->vtx.insert(pblock->vtx.end(), sel.vtx.begin(), sel.vtx.end());
+        pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), sel.vTxFees.begin(), sel.vTxFees.end());
+        pblocktemplate->vTxSigOps.insert(pblocktemplate->vTxSigOps.end(), sel.vTxSigOps.begin(), sel.vTxSigOps.end());
+        nFees = sel.nFees;
+        uint64_t nBlockTx = sel.vtx.size();
+        uint64_t nBlockSize = sel.nBlockSize;
+        int64_t nTimeSelected = GetTimeMicros();
 
         if (!fProofOfStake) {
             //Masternode and general budget payments
@@ -483,12 +846,24 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
             }
         }
 
+        int64_t nTimeHeader = GetTimeMicros();
+
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
             LogPrintf("CreateNewBlock() : TestBlockValidity failed\n");
             mempool.clear();
+            lastSelection.SetNull();
             return nullptr;
         }
+        int64_t nTimeValidity = GetTimeMicros();
+
+        LogPrint("bench", "CreateNewBlock() %s: %u txs, %u new, %d packages, %d updated descendants\n",
+            fExtended ? "extended" : "built", nBlockTx, nNew, nPackages, nDescendants);
+        LogPrint("bench", "    - Stake: %.2fms\n", 0.001 * (nTimeStake - nTimeStart));
+        LogPrint("bench", "    - Select: %.2fms\n", 0.001 * (nTimeSelected - nTimeSelect));
+        LogPrint("bench", "    - Payee and header: %.2fms\n", 0.001 * (nTimeHeader - nTimeSelected));
+        LogPrint("bench", "    - Validity: %.2fms\n", 0.001 * (nTimeValidity - nTimeHeader));
+        LogPrint("bench", "    - Total: %.2fms\n", 0.001 * (nTimeValidity - nTimeStart));
     }
 
     return pblocktemplate.release();
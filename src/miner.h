@@ -11,6 +11,7 @@
 #include "primitives/block.h"
 
 #include <stdint.h>
+#include <vector>
 
 class CBlock;
 class CBlockHeader;
@@ -29,6 +30,13 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Check mined block */
 void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
+/**
+ * Choose the mempool transactions for a block on top of pindexPrev, as
+ * CreateNewBlock does, and return them in vtx. Returns true if the previous
+ * selection was only extended. Requires cs_main and mempool.cs.
+ */
+bool SelectBlockTransactions(const CBlockIndex* pindexPrev, unsigned int nBlockMaxSize, unsigned int nBlockMinSize,
+                             unsigned int nBlockPrioritySize, std::vector<CTransaction>& vtx);
 
 #ifdef ENABLE_WALLET
     /** Run the miner threads */
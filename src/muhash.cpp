@@ -0,0 +1,52 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include "crypto/chacha20.h"
+#include "crypto/sha256.h"
+
+#include <string.h>
+
+namespace
+{
+const CBigNum& Modulus()
+{
+    static const CBigNum bnModulus = CBigNum(2).pow(3072) - CBigNum(1103717);
+    return bnModulus;
+}
+
+CBigNum ToNum3072(const std::vector<unsigned char>& vchElement)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(vchElement.data(), vchElement.size()).Finalize(key);
+    // Little endian, with a last zero byte that keeps the number positive.
+    std::vector<unsigned char> vch(CMuHash3072::BYTE_SIZE + 1, 0);
+    ChaCha20(key, sizeof(key)).Output(vch.data(), CMuHash3072::BYTE_SIZE);
+    CBigNum bn;
+    bn.setvch(vch);
+    return bn % Modulus();
+}
+} // anon namespace
+
+void CMuHash3072::Insert(const std::vector<unsigned char>& vchElement)
+{
+    numerator = numerator.mul_mod(ToNum3072(vchElement), Modulus());
+}
+
+void CMuHash3072::Remove(const std::vector<unsigned char>& vchElement)
+{
+    denominator = denominator.mul_mod(ToNum3072(vchElement), Modulus());
+}
+
+uint256 CMuHash3072::Finalize() const
+{
+    const CBigNum bnSet = numerator.mul_mod(denominator.inverse(Modulus()), Modulus());
+    std::vector<unsigned char> vch = bnSet.getvch();
+    // Drop the sign byte, or pad to the full width.
+    vch.resize(BYTE_SIZE, 0);
+    uint256 hash;
+    CSHA256().Write(vch.data(), vch.size()).Finalize(hash.begin());
+    return hash;
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MUHASH_H
+#define BITCOIN_MUHASH_H
+
+#include "libzerocoin/bignum.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stddef.h>
+#include <vector>
+
+/**
+ * MuHash3072, a hash of a set that is updated one element at a time.
+ *
+ * Each element is expanded to a 3072-bit number by ChaCha20, keyed with the
+ * element's SHA256, and the set hashes to the product of these numbers
+ * modulo the prime 2^3072 - 1103717. Removed elements are multiplied into a
+ * separate denominator, so that updates need no modular inversion; only
+ * Finalize() does one. The result does not depend on the order of updates.
+ */
+class CMuHash3072
+{
+private:
+    CBigNum numerator;
+    CBigNum denominator;
+
+public:
+    static const size_t BYTE_SIZE = 384;
+
+    CMuHash3072() : numerator(1), denominator(1) {}
+
+    void Insert(const std::vector<unsigned char>& vchElement);
+    void Remove(const std::vector<unsigned char>& vchElement);
+
+    //! SHA256 of the set's 3072-bit product, little endian.
+    uint256 Finalize() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(numerator);
+        READWRITE(denominator);
+    }
+};
+
+#endif // BITCOIN_MUHASH_H
@@ -7,6 +7,8 @@
 
 #include "primitives/block.h"
 
+#include "crypto/common.h"
+#include "crypto/quark.h"
 #include "hash.h"
 #include "script/standard.h"
 #include "script/sign.h"
@@ -14,10 +16,138 @@
 #include "utilstrencodings.h"
 #include "util.h"
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+// The hashed header fields are contiguous, without padding.
+static_assert(offsetof(CBlockHeader, hashPrevBlock) == offsetof(CBlockHeader, nVersion) + 4, "unexpected CBlockHeader layout");
+static_assert(offsetof(CBlockHeader, hashMerkleRoot) == offsetof(CBlockHeader, hashPrevBlock) + 32, "unexpected CBlockHeader layout");
+static_assert(offsetof(CBlockHeader, nTime) == offsetof(CBlockHeader, hashMerkleRoot) + 32, "unexpected CBlockHeader layout");
+static_assert(offsetof(CBlockHeader, nBits) == offsetof(CBlockHeader, nTime) + 4, "unexpected CBlockHeader layout");
+static_assert(offsetof(CBlockHeader, nNonce) == offsetof(CBlockHeader, nBits) + 4, "unexpected CBlockHeader layout");
+static_assert(offsetof(CBlockHeader, nAccumulatorCheckpoint) == offsetof(CBlockHeader, nNonce) + 4, "unexpected CBlockHeader layout");
+
+namespace
+{
+//! nVersion through nNonce, as hashed by Quark
+const size_t QUARK_HEADER_SIZE = 80;
+//! Number of Quark hashes kept, and the number of separately locked parts they are spread over
+const size_t QUARK_HASH_TABLE_SIZE = 4096;
+const size_t QUARK_HASH_TABLE_SHARDS = 16;
+
+static_assert(offsetof(CBlockHeader, nNonce) + 4 - offsetof(CBlockHeader, nVersion) == QUARK_HEADER_SIZE, "unexpected CBlockHeader layout");
+
+typedef std::array<unsigned char, QUARK_HEADER_SIZE> QuarkHeaderBytes;
+static_assert(sizeof(QuarkHeaderBytes) == QUARK_HEADER_SIZE, "QuarkHashBatch reads the headers back to back");
+
+/**
+ * Quark hashes of recently hashed headers, by the header bytes. The same
+ * header is hashed on several code paths and arrives from several peers;
+ * only the first one pays for Quark.
+ */
+class CQuarkHashTable
+{
+private:
+    struct Shard {
+        std::mutex cs;
+        std::map<QuarkHeaderBytes, uint256> mapHashes;
+    };
+    Shard vShards[QUARK_HASH_TABLE_SHARDS];
+
+    Shard& GetShard(const QuarkHeaderBytes& header)
+    {
+        // The first bytes of hashPrevBlock, random enough to spread the headers.
+        return vShards[ReadLE64(header.data() + 4) % QUARK_HASH_TABLE_SHARDS];
+    }
+
+public:
+    bool Get(const QuarkHeaderBytes& header, uint256& hash)
+    {
+        Shard& shard = GetShard(header);
+        std::lock_guard<std::mutex> lock(shard.cs);
+        std::map<QuarkHeaderBytes, uint256>::const_iterator it = shard.mapHashes.find(header);
+        if (it == shard.mapHashes.end())
+            return false;
+        hash = it->second;
+        return true;
+    }
+
+    void Put(const QuarkHeaderBytes& header, const uint256& hash)
+    {
+        Shard& shard = GetShard(header);
+        std::lock_guard<std::mutex> lock(shard.cs);
+        if (shard.mapHashes.size() >= QUARK_HASH_TABLE_SIZE / QUARK_HASH_TABLE_SHARDS) {
+            // Entries are ordered by hashPrevBlock, so the neighbour is as good as a random victim.
+            std::map<QuarkHeaderBytes, uint256>::iterator it = shard.mapHashes.upper_bound(header);
+            shard.mapHashes.erase(it == shard.mapHashes.end() ? shard.mapHashes.begin() : it);
+        }
+        shard.mapHashes.emplace(header, hash);
+    }
+};
+
+// Chain parameters hash their genesis blocks during static initialization.
+CQuarkHashTable& GetQuarkHashTable()
+{
+    static CQuarkHashTable table;
+    return table;
+}
+
+std::atomic<uint64_t> nQuarkHashes[HEADER_HASH_CALLER_COUNT];
+std::atomic<uint64_t> nHashCacheHits(0);
+thread_local HeaderHashCaller currentCaller = HEADER_HASH_OTHER;
+
+const char* const HEADER_HASH_CALLER_NAMES[HEADER_HASH_CALLER_COUNT] = {
+    "other",
+    "acceptblockheader",
+    "processnewblock",
+    "checkblockindex",
+    "headers",
+};
+} // namespace
+
+CHeaderHashCallerScope::CHeaderHashCallerScope(HeaderHashCaller caller) : prevCaller(currentCaller)
+{
+    currentCaller = caller;
+}
+
+CHeaderHashCallerScope::~CHeaderHashCallerScope()
+{
+    currentCaller = prevCaller;
+}
+
+const char* GetHeaderHashCallerName(HeaderHashCaller caller)
+{
+    return HEADER_HASH_CALLER_NAMES[caller];
+}
+
+uint64_t GetQuarkHashCount(HeaderHashCaller caller)
+{
+    return nQuarkHashes[caller];
+}
+
+uint64_t GetHeaderHashCacheHits()
+{
+    return nHashCacheHits;
+}
+
 uint256 CBlockHeader::GetHash() const
 {
-    if (nVersion < 4)
-        return HashQuark(BEGIN(nVersion), END(nNonce));
+    if (nVersion < 4) {
+        QuarkHeaderBytes header;
+        memcpy(header.data(), BEGIN(nVersion), QUARK_HEADER_SIZE);
+        uint256 hash;
+        if (GetQuarkHashTable().Get(header, hash)) {
+            nHashCacheHits++;
+            return hash;
+        }
+        nQuarkHashes[currentCaller]++;
+        hash = HashQuark(header.begin(), header.end());
+        GetQuarkHashTable().Put(header, hash);
+        return hash;
+    }
 
     if (nVersion < 7)
         return Hash(BEGIN(nVersion), END(nAccumulatorCheckpoint));
@@ -25,6 +155,41 @@ uint256 CBlockHeader::GetHash() const
     return Hash(BEGIN(nVersion), END(nNonce));
 }
 
+void GetBlockHeaderHashes(const std::vector<CBlockHeader>& vHeaders, std::vector<uint256>& vHashes)
+{
+    vHashes.resize(vHeaders.size());
+
+    // Pack the Quark headers not hashed before back to back and hash them in one batch
+    std::vector<size_t> vQuark;
+    std::vector<QuarkHeaderBytes> vData;
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        const CBlockHeader& header = vHeaders[i];
+        if (header.nVersion >= 4) {
+            vHashes[i] = header.GetHash();
+            continue;
+        }
+        QuarkHeaderBytes data;
+        memcpy(data.data(), BEGIN(header.nVersion), QUARK_HEADER_SIZE);
+        if (GetQuarkHashTable().Get(data, vHashes[i])) {
+            nHashCacheHits++;
+            continue;
+        }
+        vQuark.push_back(i);
+        vData.push_back(data);
+    }
+    if (vQuark.empty())
+        return;
+
+    std::vector<unsigned char> vOut(vQuark.size() * QUARK_OUTPUT_SIZE);
+    QuarkHashBatch(&vOut[0], vData[0].data(), QUARK_HEADER_SIZE, vQuark.size());
+    nQuarkHashes[currentCaller] += vQuark.size();
+    for (size_t j = 0; j < vQuark.size(); j++) {
+        uint256& hash = vHashes[vQuark[j]];
+        memcpy(hash.begin(), &vOut[j * QUARK_OUTPUT_SIZE], QUARK_OUTPUT_SIZE);
+        GetQuarkHashTable().Put(vData[j], hash);
+    }
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
@@ -71,6 +71,9 @@ public:
         return (nBits == 0);
     }
 
+    /** Hash of the header. Quark hashes (version < 4) are memoized in a
+     *  process-wide table keyed by the hashed header bytes, so mutating the
+     *  fields simply looks up a different entry. */
     uint256 GetHash() const;
 
     int64_t GetBlockTime() const
@@ -79,6 +82,40 @@ public:
     }
 };
 
+/** Compute GetHash() of many headers at once. Quark hashes (version < 4) are
+ *  computed in parallel lanes when the CPU supports it. The results are also
+ *  memoized like those of GetHash(). */
+void GetBlockHeaderHashes(const std::vector<CBlockHeader>& vHeaders, std::vector<uint256>& vHashes);
+
+/** Code paths whose Quark header hash evaluations are counted separately. */
+enum HeaderHashCaller {
+    HEADER_HASH_OTHER = 0,
+    HEADER_HASH_ACCEPT_HEADER,
+    HEADER_HASH_PROCESS_BLOCK,
+    HEADER_HASH_CHECK_INDEX,
+    HEADER_HASH_HEADERS_MSG,
+    HEADER_HASH_CALLER_COUNT
+};
+
+/** Attributes the header hashes computed by this thread to `caller` for the
+ *  lifetime of the object. Scopes nest; the innermost one wins. */
+class CHeaderHashCallerScope
+{
+private:
+    HeaderHashCaller prevCaller;
+
+public:
+    explicit CHeaderHashCallerScope(HeaderHashCaller caller);
+    ~CHeaderHashCallerScope();
+};
+
+/** Name of a caller as reported by getblockchaininfo. */
+const char* GetHeaderHashCallerName(HeaderHashCaller caller);
+/** Number of Quark header hashes computed on behalf of `caller`. */
+uint64_t GetQuarkHashCount(HeaderHashCaller caller);
+/** Number of Quark header hashes answered from the memoized hashes. */
+uint64_t GetHeaderHashCacheHits();
+
 
 class CBlock : public CBlockHeader
 {
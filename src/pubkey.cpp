@@ -6,6 +6,12 @@
 
 #include "pubkey.h"
 
+#include "crypto/common.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
 
@@ -13,6 +19,74 @@ namespace
 {
 /* Global secp256k1_context object used for verification. */
 secp256k1_context* secp256k1_context_verify = nullptr;
+
+/** Number of public keys kept in parsed form. */
+const size_t PUBKEY_TABLE_SIZE = 4096;
+
+/** Number of keys remembered as seen once. */
+const size_t PUBKEY_SEEN_SLOTS = 16384;
+
+/** Number of independently locked parts of the table. */
+const size_t PUBKEY_TABLE_SHARDS = 16;
+
+/** Number of lookups answered from the table. */
+std::atomic<uint64_t> nPubKeyTableHits(0);
+
+/**
+ * Public keys that were verified against more than once recently, in parsed
+ * form. A key is only added when it shows up a second time while still
+ * remembered in vSeen, so one-off keys don't push out the hot ones.
+ *
+ * Script check threads all verify through here, so the table is split by
+ * the low bits of the key's x coordinate into shards with a lock each.
+ */
+class CPubKeyTable
+{
+private:
+    struct Shard {
+        std::mutex cs;
+        std::map<CPubKey, secp256k1_pubkey> mapParsed;
+        //! Part of the x coordinate of keys seen once, indexed by the same bits.
+        uint64_t vSeen[PUBKEY_SEEN_SLOTS / PUBKEY_TABLE_SHARDS];
+
+        Shard() : vSeen() {}
+    };
+    Shard vShards[PUBKEY_TABLE_SHARDS];
+
+public:
+    bool Get(const CPubKey& key, secp256k1_pubkey& parsed)
+    {
+        const uint64_t nFingerprint = ReadLE64(key.begin() + 1);
+        Shard& shard = vShards[nFingerprint % PUBKEY_TABLE_SHARDS];
+        {
+            std::lock_guard<std::mutex> lock(shard.cs);
+            std::map<CPubKey, secp256k1_pubkey>::const_iterator it = shard.mapParsed.find(key);
+            if (it != shard.mapParsed.end()) {
+                parsed = it->second;
+                nPubKeyTableHits++;
+                return true;
+            }
+        }
+        if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &parsed, key.begin(), key.size()))
+            return false;
+
+        std::lock_guard<std::mutex> lock(shard.cs);
+        uint64_t& nSeen = shard.vSeen[(nFingerprint / PUBKEY_TABLE_SHARDS) % (PUBKEY_SEEN_SLOTS / PUBKEY_TABLE_SHARDS)];
+        if (nSeen != nFingerprint) {
+            nSeen = nFingerprint;
+            return true;
+        }
+        if (shard.mapParsed.size() >= PUBKEY_TABLE_SIZE / PUBKEY_TABLE_SHARDS) {
+            // Keys are random points, so the neighbour is as good as a random victim.
+            std::map<CPubKey, secp256k1_pubkey>::iterator it = shard.mapParsed.upper_bound(key);
+            shard.mapParsed.erase(it == shard.mapParsed.end() ? shard.mapParsed.begin() : it);
+        }
+        shard.mapParsed.emplace(key, parsed);
+        return true;
+    }
+};
+
+CPubKeyTable pubkeyTable;
 } // namespace
 
 /** This function is taken from the libsecp256k1 distribution and implements
@@ -167,22 +241,44 @@ static int ecdsa_signature_parse_der_lax(const secp256k1_context* ctx, secp256k1
     return 1;
 }
 
+/** Verify a DER signature against an already parsed public key. */
+static bool VerifyParsed(const secp256k1_pubkey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig)
+{
+    secp256k1_ecdsa_signature sig;
+    if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, vchSig.data(), vchSig.size())) {
+        return false;
+    }
+    /* libsecp256k1's ECDSA verification requires lower-S signatures, which have
+     * not historically been enforced in Bitcoin, so normalize them first. */
+    secp256k1_ecdsa_signature_normalize(secp256k1_context_verify, &sig, &sig);
+    return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), &pubkey);
+}
+
 bool CPubKey::Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const
 {
     if (!IsValid())
         return false;
     secp256k1_pubkey pubkey;
-    secp256k1_ecdsa_signature sig;
     if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
         return false;
     }
-    if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, vchSig.data(), vchSig.size())) {
+    return VerifyParsed(pubkey, hash, vchSig);
+}
+
+uint64_t GetPubKeyTableHits()
+{
+    return nPubKeyTableHits;
+}
+
+bool CPubKey::VerifyCached(const uint256& hash, const std::vector<unsigned char>& vchSig) const
+{
+    if (!IsValid())
+        return false;
+    secp256k1_pubkey pubkey;
+    if (!pubkeyTable.Get(*this, pubkey)) {
         return false;
     }
-    /* libsecp256k1's ECDSA verification requires lower-S signatures, which have
-     * not historically been enforced in Bitcoin, so normalize them first. */
-    secp256k1_ecdsa_signature_normalize(secp256k1_context_verify, &sig, &sig);
-    return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), &pubkey);
+    return VerifyParsed(pubkey, hash, vchSig);
 }
 
 bool CPubKey::RecoverCompact(const uint256& hash, const std::vector<unsigned char>& vchSig)
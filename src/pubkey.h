@@ -186,6 +186,15 @@ public:
      */
     bool Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
 
+    /**
+     * Verify a DER signature like Verify(). Keys that keep coming back (stakers,
+     * masternodes) are held in parsed form in a small shared table, so verifying
+     * against them again skips decoding and decompressing the point.
+     * Compact signatures don't go through here: RecoverCompact() derives the
+     * key from the signature and never parses a known one.
+     */
+    bool VerifyCached(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
+
     /**
      * Check whether a signature is normalized (lower-S).
      */
@@ -253,6 +262,9 @@ struct CExtPubKey {
     }
 };
 
+/** Number of CPubKey::VerifyCached() calls that found the key already parsed. */
+uint64_t GetPubKeyTableHits();
+
 /** Users of this module must hold an ECCVerifyHandle. The constructor and
  *  destructor of these are not allowed to run in parallel, though. */
 class ECCVerifyHandle
@@ -293,11 +293,11 @@ QString TransactionDesc::toHTML(CWallet* wallet, CWalletTx& wtx, TransactionReco
         for (const CTxIn& txin : wtx.vin) {
             COutPoint prevout = txin.prevout;
 
-            CCoins prev;
-            if (pcoinsTip->GetCoins(prevout.hash, prev)) {
-                if (prevout.n < prev.vout.size()) {
+            Coin prev;
+            if (pcoinsTip->GetCoin(prevout, prev)) {
+                {
                     strHTML += "<li>";
-                    const CTxOut& vout = prev.vout[prevout.n];
+                    const CTxOut& vout = prev.out;
                     CTxDestination address;
                     if (ExtractDestination(vout.scriptPubKey, address)) {
                         if (wallet->mapAddressBook.count(address) && !wallet->mapAddressBook[address].name.empty())
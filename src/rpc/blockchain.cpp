@@ -12,10 +12,13 @@
 #include "kernel.h"
 #include "main.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
+#include "sporkdb.h"
 #include "sync.h"
 #include "txdb.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utxosnapshot.h"
 #include "wallet/wallet.h"
 #include "skkc/skkcmodule.h"
 #include "skkcchain.h"
@@ -369,9 +372,8 @@ UniValue mempoolToJSON(bool fVerbose = false)
     if (fVerbose) {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        for (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry : mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+        for (const CTxMemPoolEntry& e : mempool.mapTx) {
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -379,6 +381,12 @@ UniValue mempoolToJSON(bool fVerbose = false)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
             const CTransaction& tx = e.GetTx();
             std::set<std::string> setDepends;
             for (const CTxIn& txin : tx.vin) {
@@ -432,6 +440,12 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) fees in satoshis, including prioritisetransaction deltas, of in-mempool descendants (including this one)\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) fees in satoshis, including prioritisetransaction deltas, of in-mempool ancestors (including this one)\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -547,16 +561,20 @@ UniValue getblock(const UniValue& params, bool fHelp)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if (!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
     if (!fVerbose) {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        // The block is stored in its network serialization
+        CRawBlockData raw;
+        if (!ReadRawBlockFromDisk(raw, pblockindex->GetBlockPos()))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        return HexStr(raw.data(), raw.data() + raw.size());
     }
 
+    if (!ReadBlockFromDisk(block, pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
     return blockToJSON(block, pblockindex);
 }
 
@@ -614,30 +632,52 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time with hash_type \"hash_serialized_2\".\n"
+
+            "\nArguments:\n"
+            "1. \"hash_type\"   (string, optional, default=\"muhash\") Which UTXO set hash to return:\n"
+            "                 \"muhash\" from statistics kept up to date with the chain, or \"hash_serialized_2\"\n"
+            "                 from a pass over the whole set, which also counts its transactions.\n"
 
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions, with hash_type \"hash_serialized_2\"\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"muhash\": \"hash\",       (string) The rolling set hash, with hash_type \"muhash\"\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash of the coins, one record per output, with hash_type \"hash_serialized_2\"\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
 
             "\nExamples:\n" +
-            HelpExampleCli("gettxoutsetinfo", "") + HelpExampleRpc("gettxoutsetinfo", ""));
+            HelpExampleCli("gettxoutsetinfo", "") + HelpExampleCli("gettxoutsetinfo", "\"hash_serialized_2\"") +
+            HelpExampleRpc("gettxoutsetinfo", ""));
+
+    const std::string strHashType = params.size() > 0 ? params[0].get_str() : "muhash";
+    if (strHashType != "muhash" && strHashType != "hash_serialized_2")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid hash_type, expected \"muhash\" or \"hash_serialized_2\"");
 
     LOCK(cs_main);
 
     UniValue ret(UniValue::VOBJ);
 
+    if (strHashType == "muhash") {
+        const CRollingCoinsStats& stats = rollingCoinsStats;
+        ret.push_back(Pair("height", (int64_t)chainActive.Height()));
+        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
+        ret.push_back(Pair("muhash", stats.muhash.Finalize().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        return ret;
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
@@ -646,12 +686,106 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
 }
 
+static UniValue SnapshotToJSON(const boost::filesystem::path& path, const CUTXOSnapshotHeader& header, const CCoinsStats& stats, const uint256& hashSnapshot)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("height", (int64_t)header.nHeight));
+    ret.push_back(Pair("bestblock", header.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    ret.push_back(Pair("snapshot_hash", hashSnapshot.GetHex()));
+    return ret;
+}
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites a snapshot of the unspent transaction output set, the zerocoin database and the\n"
+            "block index of the active chain to a file, from which a new node can start with loadtxoutset.\n"
+            "Note this call may take some time.\n"
+
+            "\nArguments:\n"
+            "1. \"path\"      (string, required) The file to write, relative to the data directory if not absolute.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",         (string) The file written\n"
+            "  \"height\":n,             (numeric) The height of the snapshot block\n"
+            "  \"bestblock\": \"hex\",     (string) The hash of the snapshot block\n"
+            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"txouts\": n,            (numeric) The number of output transactions\n"
+            "  \"hash_serialized_2\": \"hash\",   (string) The serialized hash, as gettxoutsetinfo reports it at this block\n"
+            "  \"total_amount\": x.xxx,         (numeric) The total amount\n"
+            "  \"snapshot_hash\": \"hash\"      (string) The hash of the whole snapshot, which loadtxoutset checks\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("dumptxoutset", "\"utxo.dat\"") + HelpExampleRpc("dumptxoutset", "\"utxo.dat\""));
+
+    const boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    CUTXOSnapshotHeader header;
+    CCoinsStats stats;
+    uint256 hashSnapshot;
+    std::string strError;
+    if (!DumpTxOutSet(path, header, stats, hashSnapshot, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    return SnapshotToJSON(path, header, stats, hashSnapshot);
+}
+
+UniValue loadtxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw std::runtime_error(
+            "loadtxoutset \"path\" \"snapshot_hash\"\n"
+            "\nMakes a snapshot written by dumptxoutset the chain state of this node, which then continues\n"
+            "validating from the snapshot block instead of from the genesis block. Only possible with -prune\n"
+            "before the first block is connected. The blocks below the snapshot are never downloaded, so\n"
+            "the wallet does not see transactions before it.\n"
+            "Note this call may take some time, during which the node does not process blocks.\n"
+
+            "\nArguments:\n"
+            "1. \"path\"             (string, required) The snapshot file, relative to the data directory if not absolute.\n"
+            "2. \"snapshot_hash\"    (string, required) The snapshot_hash that dumptxoutset reports for the snapshot block on a\n"
+            "                       node you trust. The snapshot is only loaded if its block index, coins and zerocoin\n"
+            "                       records match it.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",         (string) The file loaded\n"
+            "  \"height\":n,             (numeric) The height of the snapshot block\n"
+            "  \"bestblock\": \"hex\",     (string) The hash of the snapshot block\n"
+            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"txouts\": n,            (numeric) The number of output transactions\n"
+            "  \"hash_serialized_2\": \"hash\",   (string) The serialized hash\n"
+            "  \"total_amount\": x.xxx,         (numeric) The total amount\n"
+            "  \"snapshot_hash\": \"hash\"      (string) The hash of the whole snapshot\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"hash\"") + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"hash\""));
+
+    const boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    uint256 hashExpected = ParseHashV(params[1], "snapshot_hash");
+    CUTXOSnapshotHeader header;
+    CCoinsStats stats;
+    uint256 hashSnapshot;
+    std::string strError;
+    if (!LoadTxOutSet(path, hashExpected, header, stats, hashSnapshot, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    return SnapshotToJSON(path, header, stats, hashSnapshot);
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -679,7 +813,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -702,33 +835,33 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: this should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n < 0 || (unsigned int)n >= coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex* pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", pindex->nHeight - (int)coin.nHeight + 1));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -749,18 +882,52 @@ UniValue verifychain(const UniValue& params, bool fHelp)
             "\nExamples:\n" +
             HelpExampleCli("verifychain", "") + HelpExampleRpc("verifychain", ""));
 
-    LOCK(cs_main);
-
     int nCheckLevel = 4;
     int nCheckDepth = GetArg("-checkblocks", 288);
     if (params.size() > 0)
         nCheckDepth = params[0].get_int();
 
-    fVerifyingBlocks = true;
-    bool fVerified = CVerifyDB().VerifyDB(pcoinsTip, nCheckLevel, nCheckDepth);
-    fVerifyingBlocks = false;
+    // VerifyDB takes cs_main as it needs it.
+    return CVerifyDB().VerifyDB(pcoinsTip, nCheckLevel, nCheckDepth);
+}
+
+UniValue getverifyprogress(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getverifyprogress\n"
+            "\nReturns the progress of the block database verification run in the background after startup (see -checkblocks).\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"status\": \"xxxx\",          (string) not started, running, passed, failed or interrupted\n"
+            "  \"checklevel\": n,           (numeric) The check level\n"
+            "  \"checkblocks\": n,          (numeric) The number of blocks to check, 0 for all\n"
+            "  \"blocks_checked\": n,       (numeric) The number of blocks read and checked so far\n"
+            "  \"blocks_total\": n,         (numeric) The number of blocks to read and check\n"
+            "  \"progress\": n,             (numeric) Percent done, including the disconnect and reconnect of the tip blocks\n"
+            "  \"start_time\": ttt,         (numeric) When the verification started, in seconds since epoch (Jan 1 1970 GMT)\n"
+            "  \"end_time\": ttt,           (numeric, optional) When it ended, in seconds since epoch (Jan 1 1970 GMT)\n"
+            "  \"error\": \"xxxx\"            (string, optional) What was found to be corrupted\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getverifyprogress", "") + HelpExampleRpc("getverifyprogress", ""));
 
-    return fVerified;
+    const CVerifyDBStatus status = GetVerifyDBStatus();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("status", status.StateString()));
+    ret.push_back(Pair("checklevel", status.nCheckLevel));
+    ret.push_back(Pair("checkblocks", status.nCheckDepth));
+    ret.push_back(Pair("blocks_checked", status.nBlocksChecked));
+    ret.push_back(Pair("blocks_total", status.nBlocksTotal));
+    ret.push_back(Pair("progress", status.nProgress));
+    ret.push_back(Pair("start_time", status.nTimeStart));
+    if (status.nTimeEnd)
+        ret.push_back(Pair("end_time", status.nTimeEnd));
+    if (!status.strError.empty())
+        ret.push_back(Pair("error", status.strError));
+    return ret;
 }
 
 /** Implementation of IsSuperMajority with better feedback */
@@ -807,6 +974,8 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
+            "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -819,7 +988,13 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "        },\n"
             "        \"reject\": { ... }      (object) progress toward rejecting pre-softfork blocks (same fields as \"enforce\")\n"
             "     }, ...\n"
-            "  ]\n"
+            "  ],\n"
+            "  \"headerhashes\": {         (object) block header hashing statistics since startup\n"
+            "     \"cachehits\": xxxxx,     (numeric) Quark header hashes answered from the memoized hashes\n"
+            "     \"quark\": {              (object) Quark header hashes computed, by code path\n"
+            "        \"acceptblockheader\": xxxx, \"processnewblock\": xxxx, \"checkblockindex\": xxxx, \"headers\": xxxx, \"other\": xxxx\n"
+            "     }\n"
+            "  }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -835,10 +1010,27 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("difficulty", (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress", Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork", chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("pruned", fPruneMode));
     CBlockIndex* tip = chainActive.Tip();
+    if (fPruneMode) {
+        CBlockIndex* block = tip;
+        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+            block = block->pprev;
+        obj.push_back(Pair("pruneheight", block->nHeight));
+    }
     UniValue softforks(UniValue::VARR);
     softforks.push_back(SoftForkDesc("bip65", 5, tip));
     obj.push_back(Pair("softforks",             softforks));
+
+    UniValue headerhashes(UniValue::VOBJ);
+    headerhashes.push_back(Pair("cachehits", GetHeaderHashCacheHits()));
+    UniValue quark(UniValue::VOBJ);
+    for (int i = 0; i < HEADER_HASH_CALLER_COUNT; i++) {
+        HeaderHashCaller caller = (HeaderHashCaller)i;
+        quark.push_back(Pair(GetHeaderHashCallerName(caller), GetQuarkHashCount(caller)));
+    }
+    headerhashes.push_back(Pair("quark", quark));
+    obj.push_back(Pair("headerhashes", headerhashes));
     return obj;
 }
 
@@ -990,7 +1182,10 @@ UniValue mempoolInfoToJSON()
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
-    //ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
 
     return ret;
 }
@@ -1006,6 +1201,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum feerate (KKC per KB) for tx to be accepted\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -1014,6 +1212,190 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue pruneblockchain(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw std::runtime_error(
+            "pruneblockchain height\n"
+            "\nDeletes the block and undo files holding only blocks up to the given height.\n"
+            "Blocks within the last 288 (or -maxreorg) of the tip are always kept, as are all blocks\n"
+            "until the chain is past the last accumulator checkpoint.\n"
+
+            "\nArguments:\n"
+            "1. height       (numeric, required) The block height to prune up to.\n"
+
+            "\nResult:\n"
+            "n    (numeric) Height of the last block that is allowed to be pruned.\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("pruneblockchain", "1000") + HelpExampleRpc("pruneblockchain", "1000"));
+
+    if (!fPruneMode)
+        throw JSONRPCError(RPC_MISC_ERROR, "Cannot prune blocks because node is not in prune mode.");
+
+    LOCK(cs_main);
+
+    int nHeight = params[0].get_int();
+    if (nHeight < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative block height.");
+    if (nHeight > chainActive.Height())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Blockchain is shorter than the attempted prune height.");
+
+    const int nLastBlockWeCanPrune = GetLastBlockWeCanPrune();
+    if (nLastBlockWeCanPrune < 0)
+        throw JSONRPCError(RPC_MISC_ERROR, "Blockchain is too short for pruning.");
+    if (nHeight > nLastBlockWeCanPrune) {
+        LogPrint("rpc", "Attempt to prune blocks close to the tip.  Retaining the minimum number of blocks.\n");
+        nHeight = nLastBlockWeCanPrune;
+    }
+
+    PruneBlockFilesManual(nHeight);
+    return nHeight;
+}
+
+UniValue savemempool(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "savemempool\n"
+            "\nDumps the mempool to disk. It will fail until the previous dump is fully loaded.\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("savemempool", "") + HelpExampleRpc("savemempool", ""));
+
+    if (!fMempoolLoaded)
+        throw JSONRPCError(RPC_MISC_ERROR, "The mempool was not loaded yet");
+
+    if (!DumpMempool())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to dump mempool to disk");
+
+    return NullUniValue;
+}
+
+static UniValue ValidationCacheStatsToJSON(const CValidationCacheStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    obj.push_back(Pair("inserts", stats.nInserts));
+    obj.push_back(Pair("evictions", stats.nEvictions));
+    obj.push_back(Pair("capacity", (uint64_t)stats.nCapacity));
+    obj.push_back(Pair("bytes", (uint64_t)stats.nBytes));
+    return obj;
+}
+
+UniValue getvalidationcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getvalidationcacheinfo\n"
+            "\nReturns usage statistics of the caches used to skip repeated validation work.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"signatures\": {            (json object) the signature cache\n"
+            "    \"hits\": xxxxx,           (numeric) lookups that found a cached valid signature\n"
+            "    \"misses\": xxxxx,         (numeric) lookups that had to verify the signature\n"
+            "    \"inserts\": xxxxx,        (numeric) valid signatures added to the cache\n"
+            "    \"evictions\": xxxxx,      (numeric) cached signatures dropped to make room for new ones\n"
+            "    \"capacity\": xxxxx,       (numeric) number of entries the cache can hold\n"
+            "    \"bytes\": xxxxx           (numeric) memory used by the cache entries\n"
+            "  },\n"
+            "  \"scripts\": {               (json object) the script execution cache, same fields as above\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getvalidationcacheinfo", "") + HelpExampleRpc("getvalidationcacheinfo", ""));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("signatures", ValidationCacheStatsToJSON(GetSignatureCacheStats())));
+    ret.push_back(Pair("scripts", ValidationCacheStatsToJSON(GetScriptExecutionCacheStats())));
+    return ret;
+}
+
+static UniValue LevelDBStatsToJSON(const CLevelDBWrapper& db, bool fVerbose)
+{
+    const CLevelDBProfile& profile = db.GetProfile();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("size_on_disk", (uint64_t)db.EstimateSize()));
+
+    std::string strValue;
+    if (db.GetProperty("approximate-memory-usage", strValue))
+        ret.push_back(Pair("memory_usage", (uint64_t)atoi64(strValue)));
+    UniValue files(UniValue::VARR);
+    for (int nLevel = 0; db.GetProperty(strprintf("num-files-at-level%d", nLevel), strValue); nLevel++)
+        files.push_back(atoi(strValue));
+    ret.push_back(Pair("files_per_level", files));
+
+    UniValue config(UniValue::VOBJ);
+    config.push_back(Pair("block_cache", (uint64_t)profile.nBlockCacheSize));
+    config.push_back(Pair("write_buffer", (uint64_t)profile.nWriteBufferSize));
+    config.push_back(Pair("block_size", (uint64_t)profile.nBlockSize));
+    config.push_back(Pair("max_open_files", profile.nMaxOpenFiles));
+    config.push_back(Pair("bloom_bits", profile.nBloomBits));
+    config.push_back(Pair("compression", profile.fCompression));
+    ret.push_back(Pair("config", config));
+
+    if (fVerbose) {
+        if (db.GetProperty("stats", strValue))
+            ret.push_back(Pair("compactions", strValue));
+        if (db.GetProperty("sstables", strValue))
+            ret.push_back(Pair("sstables", strValue));
+    }
+    return ret;
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw std::runtime_error(
+            "getdbstats ( verbose )\n"
+            "\nReturns leveldb statistics for each database of the node.\n"
+
+            "\nArguments:\n"
+            "1. verbose    (boolean, optional, default=false) include the compaction and table reports\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {              (json object) the UTXO database; also \"blockindex\", \"zerocoin\" and \"sporks\"\n"
+            "    \"size_on_disk\": xxxxx,     (numeric) approximate size of the tables in bytes\n"
+            "    \"memory_usage\": xxxxx,     (numeric) memory held by memtables and the block cache\n"
+            "    \"files_per_level\": [n,...],(array) number of table files at each level\n"
+            "    \"config\": {                (json object) the tuning the database was opened with\n"
+            "      \"block_cache\": xxxxx,    (numeric) block cache size in bytes\n"
+            "      \"write_buffer\": xxxxx,   (numeric) write buffer size in bytes\n"
+            "      \"block_size\": xxxxx,     (numeric) table block size in bytes\n"
+            "      \"max_open_files\": n,     (numeric) table files kept open\n"
+            "      \"bloom_bits\": n,         (numeric) bloom filter bits per key, 0 if disabled\n"
+            "      \"compression\": true|false (boolean) whether new tables are Snappy compressed; false if the build has no Snappy\n"
+            "    },\n"
+            "    \"compactions\": \"...\",    (string, verbose only) leveldb's compaction report\n"
+            "    \"sstables\": \"...\"        (string, verbose only) leveldb's list of table files\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getdbstats", "") + HelpExampleCli("getdbstats", "true") + HelpExampleRpc("getdbstats", "true"));
+
+    bool fVerbose = params.size() > 0 && params[0].get_bool();
+
+    LOCK(cs_main);
+
+    UniValue ret(UniValue::VOBJ);
+    if (pcoinsdbview)
+        ret.push_back(Pair("chainstate", LevelDBStatsToJSON(pcoinsdbview->GetDB(), fVerbose)));
+    if (pblocktree)
+        ret.push_back(Pair("blockindex", LevelDBStatsToJSON(*pblocktree, fVerbose)));
+    if (zerocoinDB)
+        ret.push_back(Pair("zerocoin", LevelDBStatsToJSON(*zerocoinDB, fVerbose)));
+    if (pSporkDB)
+        ret.push_back(Pair("sporks", LevelDBStatsToJSON(*pSporkDB, fVerbose)));
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
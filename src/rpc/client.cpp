@@ -59,6 +59,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"getbalance", 1},
         {"getbalance", 2},
         {"getblockhash", 0},
+        {"pruneblockchain", 0},
         { "waitforblockheight", 0 },
         { "waitforblockheight", 1 },
         { "waitforblock", 1 },
@@ -102,6 +103,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"signrawtransaction", 2},
         {"sendrawtransaction", 1},
         {"sendrawtransaction", 2},
+        {"getdbstats", 0},
         {"gettxout", 1},
         {"gettxout", 2},
         {"lockunspent", 0},
@@ -8,6 +8,8 @@
 
 #include "base58.h"
 #include "clientversion.h"
+#include "crypto/quark.h"
+#include "crypto/sha256.h"
 #include "init.h"
 #include "main.h"
 #include "masternode-sync.h"
@@ -65,6 +67,8 @@ UniValue getinfo(const UniValue& params, bool fHelp)
             "  \"proxy\": \"host:port\",       (string, optional) the proxy used by the server\n"
             "  \"difficulty\": xxxxxx,         (numeric) the current difficulty\n"
             "  \"testnet\": true|false,        (boolean) if the server is using testnet or not\n"
+            "  \"sha256\": \"name\",          (string) the SHA-256 implementation in use\n"
+            "  \"quark\": \"name\",           (string) the Quark implementation in use\n"
             "  \"moneysupply\" : \"supply\"    (numeric) The money supply when this block was added to the blockchain\n"
             "  \"sKKCsupply\" :\n"
             "  {\n"
@@ -136,6 +140,8 @@ UniValue getinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("proxy", (proxy.IsValid() ? proxy.proxy.ToStringIPPort() : std::string())));
     obj.push_back(Pair("difficulty", (double)GetDifficulty()));
     obj.push_back(Pair("testnet", Params().TestnetToBeDeprecatedFieldRPC()));
+    obj.push_back(Pair("sha256", SHA256Implementation()));
+    obj.push_back(Pair("quark", QuarkImplementation()));
 
     // During inital block verification chainActive.Tip() might be not yet initialized
     if (chainActive.Tip() == NULL) {
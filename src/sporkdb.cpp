@@ -6,7 +6,7 @@
 #include "sporkdb.h"
 #include "spork.h"
 
-CSporkDB::CSporkDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "sporks", nCacheSize, fMemory, fWipe) {}
+CSporkDB::CSporkDB(const CLevelDBProfile& profile, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "sporks", profile, fMemory, fWipe) {}
 
 bool CSporkDB::WriteSpork(const SporkId nSporkId, const CSporkMessage& spork)
 {
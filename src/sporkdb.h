@@ -13,7 +13,7 @@
 class CSporkDB : public CLevelDBWrapper
 {
 public:
-    CSporkDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CSporkDB(const CLevelDBProfile& profile, bool fMemory = false, bool fWipe = false);
 
 private:
     CSporkDB(const CSporkDB&);
@@ -15,32 +15,44 @@
 bool CPivStake::SetInput(CTransaction txPrev, unsigned int n)
 {
     this->txFrom = txPrev;
-    this->nPosition = n;
+    this->prevoutFrom = COutPoint(txPrev.GetHash(), n);
+    this->txOutFrom = txPrev.vout[n];
+    return true;
+}
+
+bool CPivStake::SetInput(const COutPoint& prevout, const CTxOut& txOut, CBlockIndex* pindexFromIn)
+{
+    this->txFrom = CTransaction();
+    this->prevoutFrom = prevout;
+    this->txOutFrom = txOut;
+    this->pindexFrom = pindexFromIn;
     return true;
 }
 
 bool CPivStake::GetTxFrom(CTransaction& tx) const
 {
+    if (txFrom.IsNull())
+        return false;
     tx = txFrom;
     return true;
 }
 
 bool CPivStake::CreateTxIn(CWallet* pwallet, CTxIn& txIn, uint256 hashTxOut)
 {
-    txIn = CTxIn(txFrom.GetHash(), nPosition);
+    txIn = CTxIn(prevoutFrom.hash, prevoutFrom.n);
     return true;
 }
 
 CAmount CPivStake::GetValue() const
 {
-    return txFrom.vout[nPosition].nValue;
+    return txOutFrom.nValue;
 }
 
 bool CPivStake::CreateTxOuts(CWallet* pwallet, std::vector<CTxOut>& vout, CAmount nTotal)
 {
     std::vector<valtype> vSolutions;
     txnouttype whichType;
-    CScript scriptPubKeyKernel = txFrom.vout[nPosition].scriptPubKey;
+    CScript scriptPubKeyKernel = txOutFrom.scriptPubKey;
     if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
         return error("%s: failed to parse kernel", __func__);
 
@@ -88,7 +100,7 @@ CDataStream CPivStake::GetUniqueness() const
 {
     //The unique identifier for a KKC stake is the outpoint
     CDataStream ss(SER_NETWORK, 0);
-    ss << nPosition << txFrom.GetHash();
+    ss << prevoutFrom.n << prevoutFrom.hash;
     return ss;
 }
 
@@ -97,9 +109,20 @@ CBlockIndex* CPivStake::GetIndexFrom()
 {
     if (pindexFrom)
         return pindexFrom;
+    {
+        // An output that can still be staked is unspent, so the UTXO set has
+        // the height it was included at, even once its block has been pruned.
+        LOCK(cs_main);
+        const Coin& coin = pcoinsTip->AccessCoin(prevoutFrom);
+        if (!coin.IsSpent() && coin.out == txOutFrom && chainActive[coin.nHeight])
+            pindexFrom = chainActive[coin.nHeight];
+    }
+    if (pindexFrom)
+        return pindexFrom;
+    // Spent outputs (e.g. of stakes already in the chain) are looked up by transaction
     uint256 hashBlock = 0;
     CTransaction tx;
-    if (GetTransaction(txFrom.GetHash(), tx, hashBlock, true)) {
+    if (GetTransaction(prevoutFrom.hash, tx, hashBlock, true)) {
         // If the index is in the chain, then set it as the "index from"
         if (mapBlockIndex.count(hashBlock)) {
             CBlockIndex* pindex = mapBlockIndex.at(hashBlock);
@@ -107,7 +130,7 @@ CBlockIndex* CPivStake::GetIndexFrom()
                 pindexFrom = pindex;
         }
     } else {
-        LogPrintf("%s : failed to find tx %s\n", __func__, txFrom.GetHash().GetHex());
+        LogPrintf("%s : failed to find tx %s\n", __func__, prevoutFrom.hash.GetHex());
     }
 
     return pindexFrom;
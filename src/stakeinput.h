@@ -34,13 +34,16 @@ public:
 class CPivStake : public CStakeInput
 {
 private:
-    CTransaction txFrom;
-    unsigned int nPosition;
+    CTransaction txFrom; //! null if only the staked output is known
+    COutPoint prevoutFrom;
+    CTxOut txOutFrom;
 
 public:
     CPivStake(){}
 
     bool SetInput(CTransaction txPrev, unsigned int n);
+    //! Stake an output known only from the UTXO set, e.g. because its block has been pruned.
+    bool SetInput(const COutPoint& prevout, const CTxOut& txOut, CBlockIndex* pindexFromIn);
 
     CBlockIndex* GetIndexFrom() override;
     bool GetTxFrom(CTransaction& tx) const override;
@@ -0,0 +1,180 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_POOL_H
+#define BITCOIN_SUPPORT_POOL_H
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * Memory resource that carves small blocks out of large chunks.
+ *
+ * Requests of up to MAX_BLOCK_SIZE_BYTES are rounded up to a multiple of
+ * ALIGN_BYTES and served from one free list per rounded size; freed blocks go
+ * back on their list and are reused, chunks are only released when the
+ * resource is destroyed. Anything larger falls through to ::operator new.
+ *
+ * Node based containers allocate one equally sized node per element, so this
+ * removes most of the per-element malloc overhead and heap fragmentation.
+ * Not thread safe.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ALIGN_BYTES >= sizeof(void*), "a free block must be able to hold a free list link");
+    static_assert(ALIGN_BYTES <= alignof(std::max_align_t), "chunks are only aligned to max_align_t");
+
+    struct ListNode {
+        ListNode* next;
+    };
+
+    static const std::size_t NUM_FREELISTS = MAX_BLOCK_SIZE_BYTES / ALIGN_BYTES + 1;
+
+    const std::size_t nChunkSizeBytes;
+    std::vector<char*> vChunks;
+    std::array<ListNode*, NUM_FREELISTS> freeLists;
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+    std::size_t nUsedBytes;
+
+    static std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ALIGN_BYTES - 1) / ALIGN_BYTES + (bytes == 0);
+    }
+
+    static bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PushFree(std::size_t nIndex, void* p)
+    {
+        ListNode* node = static_cast<ListNode*>(p);
+        node->next = freeLists[nIndex];
+        freeLists[nIndex] = node;
+    }
+
+    void AllocateChunk()
+    {
+        // Keep the unused tail of the current chunk on its free list.
+        if (pAvailableBegin != pAvailableEnd)
+            PushFree((pAvailableEnd - pAvailableBegin) / ALIGN_BYTES, pAvailableBegin);
+
+        char* chunk = static_cast<char*>(::operator new(nChunkSizeBytes));
+        vChunks.push_back(chunk);
+        pAvailableBegin = chunk;
+        pAvailableEnd = chunk + nChunkSizeBytes;
+    }
+
+public:
+    explicit PoolResource(std::size_t nChunkSizeBytesIn = 1 << 18)
+        : nChunkSizeBytes(nChunkSizeBytesIn), pAvailableBegin(nullptr), pAvailableEnd(nullptr), nUsedBytes(0)
+    {
+        assert(nChunkSizeBytes >= MAX_BLOCK_SIZE_BYTES && nChunkSizeBytes % ALIGN_BYTES == 0);
+        freeLists.fill(nullptr);
+    }
+
+    ~PoolResource()
+    {
+        for (char* chunk : vChunks)
+            ::operator delete(chunk);
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment))
+            return ::operator new(bytes);
+
+        const std::size_t nIndex = NumElemAlignBytes(bytes);
+        const std::size_t nBlockBytes = nIndex * ALIGN_BYTES;
+        nUsedBytes += nBlockBytes;
+        if (freeLists[nIndex] != nullptr) {
+            ListNode* node = freeLists[nIndex];
+            freeLists[nIndex] = node->next;
+            return node;
+        }
+        if (static_cast<std::size_t>(pAvailableEnd - pAvailableBegin) < nBlockBytes)
+            AllocateChunk();
+        void* p = pAvailableBegin;
+        pAvailableBegin += nBlockBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        const std::size_t nIndex = NumElemAlignBytes(bytes);
+        nUsedBytes -= nIndex * ALIGN_BYTES;
+        PushFree(nIndex, p);
+    }
+
+    /** Bytes currently handed out from the pool (excluding ::operator new fallbacks). */
+    std::size_t UsedBytes() const { return nUsedBytes; }
+    std::size_t NumAllocatedChunks() const { return vChunks.size(); }
+    std::size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+};
+
+/**
+ * Standard allocator that forwards to a PoolResource. Copies (including
+ * rebound ones) share the resource, which must outlive the container.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(void*)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType* resourceIn) noexcept : pResource(resourceIn) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : pResource(other.resource()) {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(pResource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        pResource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return pResource; }
+
+private:
+    ResourceType* pResource;
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_POOL_H
@@ -85,6 +85,7 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
             DoConsensusVote(tx, nBlockHeight);
 
             mapTxLockReq.insert(std::make_pair(tx.GetHash(), tx));
+            mempool.SetProtected(tx.GetHash(), true);
 
             LogPrintf("%s : Transaction Lock Request: %s %s : accepted %s\n", __func__,
                     pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
@@ -455,6 +456,7 @@ void CleanTransactionLocksList()
 
                 mapTxLockReq.erase(it->second.txHash);
                 mapTxLockReqRejected.erase(it->second.txHash);
+                mempool.SetProtected(it->second.txHash, false);
 
                 for (CConsensusVote& v : it->second.vecConsensusVotes)
                     mapTxLockVote.erase(v.GetHash());
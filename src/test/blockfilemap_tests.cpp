@@ -0,0 +1,121 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_kabberry.h"
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, BasicTestingSetup)
+
+static boost::filesystem::path WriteTempFile(const boost::filesystem::path& dir, int n, const std::string& strData)
+{
+    boost::filesystem::path path = dir / strprintf("blk%05u.dat", n);
+    boost::filesystem::ofstream file(path, std::ios::binary);
+    file.write(strData.data(), strData.size());
+    return path;
+}
+
+BOOST_AUTO_TEST_CASE(mapper_lru)
+{
+    boost::filesystem::path dir = GetTempPath() / strprintf("test_blockfilemap_%lu_%i", (unsigned long)GetTime(), (int)InsecureRandRange(100000));
+    boost::filesystem::create_directories(dir);
+    for (int i = 0; i < 3; i++)
+        WriteTempFile(dir, i, strprintf("file %d contents", i));
+
+    CBlockFileMapper mapper;
+    BOOST_CHECK(!mapper.Get(0, dir / "blk00000.dat")); // disabled by default
+
+    mapper.SetMaxFiles(2);
+    std::shared_ptr<const CMappedFile> file0 = mapper.Get(0, dir / "blk00000.dat");
+    BOOST_REQUIRE(file0);
+    BOOST_CHECK_EQUAL(std::string(file0->data(), file0->size()), "file 0 contents");
+    BOOST_CHECK(mapper.Get(0, dir / "blk00000.dat") == file0);
+    BOOST_CHECK(!mapper.Get(3, dir / "blk00003.dat")); // missing file
+
+    // Mapping a third file evicts the least recently used one, but a reader
+    // holding on to it can still use it.
+    BOOST_CHECK(mapper.Get(1, dir / "blk00001.dat"));
+    BOOST_CHECK(mapper.Get(0, dir / "blk00000.dat") == file0);
+    std::shared_ptr<const CMappedFile> file1 = mapper.Get(1, dir / "blk00001.dat");
+    BOOST_CHECK(mapper.Get(2, dir / "blk00002.dat"));
+    BOOST_CHECK(mapper.Get(1, dir / "blk00001.dat") == file1);
+    BOOST_CHECK(mapper.Get(0, dir / "blk00000.dat") != file0);
+    BOOST_CHECK_EQUAL(std::string(file0->data(), file0->size()), "file 0 contents");
+
+    // Forgotten files are mapped afresh, e.g. after being rewritten.
+    WriteTempFile(dir, 1, "rewritten");
+    mapper.Forget(1);
+    std::shared_ptr<const CMappedFile> file1b = mapper.Get(1, dir / "blk00001.dat");
+    BOOST_REQUIRE(file1b);
+    BOOST_CHECK_EQUAL(std::string(file1b->data(), file1b->size()), "rewritten");
+
+    file0.reset();
+    file1.reset();
+    file1b.reset();
+    mapper.SetMaxFiles(0);
+    boost::filesystem::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(memory_reader)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << genesis << 42;
+
+    CMemoryReader reader(&ss[0], ss.size(), SER_DISK, CLIENT_VERSION);
+    CBlock block;
+    int n;
+    reader >> block;
+    BOOST_CHECK_EQUAL(reader.GetPosition(), ::GetSerializeSize(genesis, SER_DISK, CLIENT_VERSION));
+    reader >> n;
+    BOOST_CHECK(reader.eof());
+    BOOST_CHECK(block.GetHash() == genesis.GetHash());
+    BOOST_CHECK_EQUAL(n, 42);
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_disk_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(read_raw_block)
+{
+    // InitBlockIndex wrote the genesis block to blk00000.dat.
+    const CBlock& genesis = Params().GenesisBlock();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << genesis;
+
+    CRawBlockData raw;
+    BOOST_REQUIRE(ReadRawBlockFromDisk(raw, chainActive.Genesis()->GetBlockPos()));
+    BOOST_CHECK(!raw.IsMapped()); // still the file being appended to
+    BOOST_CHECK_EQUAL(std::string(raw.data(), raw.size()), ss.str());
+
+    // Raw blocks serialize to exactly what a CBlock would send.
+    CDataStream ssRaw(SER_NETWORK, PROTOCOL_VERSION);
+    ssRaw << raw;
+    CDataStream ssNet(SER_NETWORK, PROTOCOL_VERSION);
+    ssNet << genesis;
+    BOOST_CHECK_EQUAL(ssRaw.str(), ssNet.str());
+
+    CBlock block;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, chainActive.Genesis()));
+    BOOST_CHECK(block.GetHash() == genesis.GetHash());
+
+    // Positions that do not follow a block record header are rejected.
+    CDiskBlockPos pos = chainActive.Genesis()->GetBlockPos();
+    pos.nPos += 1;
+    BOOST_CHECK(!ReadRawBlockFromDisk(raw, pos));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,158 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "test/test_kabberry.h"
+#include "utiltime.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+namespace
+{
+std::atomic<unsigned int> nChecksRun(0);
+
+/** Counts itself, burns a few cycles and fails if told to. */
+struct FakeCheck {
+    bool fOk;
+    unsigned int nWork;
+
+    FakeCheck(bool fOkIn = true, unsigned int nWorkIn = 0) : fOk(fOkIn), nWork(nWorkIn) {}
+
+    bool operator()()
+    {
+        volatile unsigned int x = 0;
+        for (unsigned int i = 0; i < nWork; i++)
+            x = x + i;
+        nChecksRun++;
+        return fOk;
+    }
+
+    void swap(FakeCheck& check)
+    {
+        std::swap(fOk, check.fOk);
+        std::swap(nWork, check.nWork);
+    }
+};
+
+typedef CCheckQueue<FakeCheck> FakeCheckQueue;
+
+void StartThreads(FakeCheckQueue& queue, boost::thread_group& threads, int nThreads)
+{
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&FakeCheckQueue::Thread, &queue));
+}
+
+void StopThreads(boost::thread_group& threads)
+{
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+/** Add nChecks checks in batches of nBatch, with a failure at position nFail. */
+bool RunChecks(FakeCheckQueue& queue, unsigned int nChecks, unsigned int nBatch, unsigned int nWork, unsigned int nFail = (unsigned int)-1)
+{
+    CCheckQueueControl<FakeCheck> control(&queue);
+    std::vector<FakeCheck> vChecks;
+    for (unsigned int i = 0; i < nChecks; i++) {
+        vChecks.push_back(FakeCheck(i != nFail, nWork));
+        if (vChecks.size() == nBatch) {
+            control.Add(vChecks);
+            vChecks.clear();
+        }
+    }
+    control.Add(vChecks);
+    return control.Wait();
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_run)
+{
+    FakeCheckQueue queue(128);
+    boost::thread_group threads;
+    StartThreads(queue, threads, 3);
+
+    for (unsigned int nChecks : {0U, 1U, 7U, 1000U, 25000U}) {
+        nChecksRun = 0;
+        BOOST_CHECK(RunChecks(queue, nChecks, 50, 0));
+        BOOST_CHECK_EQUAL(nChecksRun, nChecks);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    StopThreads(threads);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_master_only)
+{
+    // Without worker threads the master does everything in Wait().
+    FakeCheckQueue queue(128);
+    nChecksRun = 0;
+    BOOST_CHECK(RunChecks(queue, 5000, 100, 0));
+    BOOST_CHECK_EQUAL(nChecksRun, 5000U);
+    BOOST_CHECK(!RunChecks(queue, 5000, 100, 0, 10));
+    BOOST_CHECK(RunChecks(queue, 10, 100, 0));
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure_aborts)
+{
+    FakeCheckQueue queue(16);
+    boost::thread_group threads;
+    StartThreads(queue, threads, 3);
+
+    for (unsigned int nFail : {0U, 1U, 999U, 19999U}) {
+        nChecksRun = 0;
+        BOOST_CHECK(!RunChecks(queue, 20000, 20, 0, nFail));
+        BOOST_CHECK(queue.IsIdle());
+        // The result is reset for the next block.
+        BOOST_CHECK(RunChecks(queue, 100, 20, 0));
+    }
+
+    // An early failure stops most of the remaining work.
+    nChecksRun = 0;
+    BOOST_CHECK(!RunChecks(queue, 20000, 20, 1000, 0));
+    BOOST_CHECK(nChecksRun < 20000U);
+
+    StopThreads(threads);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_steal_failure)
+{
+    // A single batch lands in a single deque, so the other threads only get
+    // work by stealing from it. The master joins last, in Wait().
+    FakeCheckQueue queue(20);
+    boost::thread_group threads;
+    StartThreads(queue, threads, 3);
+
+    for (unsigned int nFail : {0U, 5000U, 19999U}) {
+        nChecksRun = 0;
+        {
+            CCheckQueueControl<FakeCheck> control(&queue);
+            std::vector<FakeCheck> vChecks;
+            for (unsigned int i = 0; i < 20000; i++)
+                vChecks.push_back(FakeCheck(i != nFail, 100));
+            control.Add(vChecks);
+            for (int i = 0; i < 1000 && nChecksRun == 0; i++)
+                MilliSleep(1);
+            BOOST_CHECK(nChecksRun > 0);
+            BOOST_CHECK(!control.Wait());
+        }
+        BOOST_CHECK(queue.IsIdle());
+        BOOST_CHECK(nChecksRun <= 20000U);
+
+        // Nothing of the failed block is left behind for the next one.
+        nChecksRun = 0;
+        BOOST_CHECK(RunChecks(queue, 1000, 20, 0));
+        BOOST_CHECK_EQUAL(nChecksRun, 1000U);
+    }
+
+    StopThreads(threads);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,9 +4,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "coins.h"
+#include "script/script.h"
 #include "script/standard.h"
 #include "uint256.h"
+#include "undo.h"
 #include "utilstrencodings.h"
 #include "test/test_kabberry.h"
 
@@ -20,42 +23,39 @@ namespace
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && InsecureRandBool() == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && InsecureRandBool() == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
-    {
-        CCoins coins;
-        return GetCoins(txid, coins);
-    }
-
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true)
     {
-        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
-            map_[it->first] = it->second.coins;
-            if (it->second.coins.IsPruned() && InsecureRandRange(3) == 0) {
-                // Randomly delete empty entries on write.
-                map_.erase(it->first);
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = fErase ? mapCoins.erase(it) : std::next(it)) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                // Same optimization used in CCoinsViewDB is to only write dirty entries.
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && InsecureRandRange(3) == 0) {
+                    // Randomly delete empty entries on write.
+                    map_.erase(it->first);
+                }
             }
-            mapCoins.erase(it++);
         }
-        mapCoins.clear();
+        if (fErase)
+            mapCoins.clear();
         hashBestBlock_ = hashBlock;
         return true;
     }
@@ -71,7 +71,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -83,13 +83,16 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool uncached_an_entry = false;
+    bool synced_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -107,36 +110,59 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[InsecureRandRange(txids.size())]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (InsecureRandRange(5) == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (InsecureRandRange(500) == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (InsecureRandRange(5) == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = InsecureRand32();
+                newcoin.nHeight = 1;
+                bool fOverwrite = !coin.IsSpent() || InsecureRandBool();
+                if (InsecureRandRange(16) == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + InsecureRandBits(6), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    newcoin.out.scriptPubKey.assign(InsecureRandBits(6), 0);
+                    (coin.IsSpent() ? added_an_entry : updated_an_entry) = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = InsecureRand32();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = InsecureRand32();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), std::move(newcoin), fOverwrite);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
+        // Once every 10 iterations, remove a random entry from the cache
+        if (InsecureRandRange(10) == 0) {
+            COutPoint out(txids[InsecureRandRange(txids.size())], 0);
+            stack[InsecureRandRange(stack.size())]->Uncache(out);
+            uncached_an_entry = true;
+        }
+
+        // Once every 50 iterations, write out a random cache but keep it, dropping some clean entries.
+        if (InsecureRandRange(50) == 0) {
+            CCoinsViewCache* cache = stack[InsecureRandRange(stack.size())];
+            BOOST_CHECK(cache->Sync());
+            cache->Trim(InsecureRandBool() ? 0 : cache->DynamicMemoryUsage() / 2);
+            synced_a_cache = true;
+        }
+
         // Once every 1000 iterations and at the end, verify the full cache.
         if (InsecureRandRange(1000) == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
         }
@@ -173,63 +199,160 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(uncached_an_entry);
+    BOOST_CHECK(synced_a_cache);
 }
 
-BOOST_AUTO_TEST_CASE(ccoins_serialization)
+BOOST_AUTO_TEST_CASE(coins_add_spend)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    mtx.vout.resize(3);
+    mtx.vout[0].nValue = 10;
+    mtx.vout[1].nValue = 20;
+    mtx.vout[1].scriptPubKey = CScript() << OP_RETURN;
+    mtx.vout[2].nValue = 30;
+    const CTransaction tx(mtx);
+    const uint256 txid = tx.GetHash();
+
+    AddCoins(cache, tx, 100);
+    BOOST_CHECK(cache.HaveCoin(COutPoint(txid, 0)));
+    BOOST_CHECK(!cache.HaveCoin(COutPoint(txid, 1))); // unspendable outputs are never added
+    BOOST_CHECK(cache.HaveCoin(COutPoint(txid, 2)));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2U);
+    BOOST_CHECK_EQUAL(AccessByTxid(cache, txid).out.nValue, 10);
+
+    // Spending hands out the coin and leaves the rest of the transaction alone.
+    Coin spent;
+    BOOST_CHECK(cache.SpendCoin(COutPoint(txid, 0), &spent));
+    BOOST_CHECK_EQUAL(spent.out.nValue, 10);
+    BOOST_CHECK_EQUAL(spent.nHeight, 100U);
+    BOOST_CHECK(!cache.HaveCoin(COutPoint(txid, 0)));
+    BOOST_CHECK_EQUAL(AccessByTxid(cache, txid).out.nValue, 30);
+
+    // Both outputs were FRESH, so spending them leaves nothing to write.
+    BOOST_CHECK(cache.SpendCoin(COutPoint(txid, 2)));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(AccessByTxid(cache, txid).IsSpent());
+
+    // Re-adding an unspent coin without possible_overwrite is a logic error.
+    cache.AddCoin(COutPoint(txid, 0), Coin(spent), false);
+    BOOST_CHECK_THROW(cache.AddCoin(COutPoint(txid, 0), Coin(spent), false), std::logic_error);
+    cache.AddCoin(COutPoint(txid, 0), Coin(spent), true);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(cache.HaveCoin(COutPoint(txid, 0)));
+}
+
+BOOST_AUTO_TEST_CASE(coins_sync_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+    const size_t nEmptyUsage = cache.DynamicMemoryUsage();
+
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 10; i++) {
+        outpoints.push_back(COutPoint(InsecureRand256(), i));
+        Coin coin;
+        coin.out.nValue = i + 1;
+        coin.out.scriptPubKey.assign(50, OP_TRUE);
+        coin.nHeight = 1;
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+    }
+    BOOST_CHECK(cache.DynamicMemoryUsage() > nEmptyUsage + 10 * 50);
+
+    // Modified entries survive any trim.
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 10U);
+
+    // Sync writes everything through but keeps the entries.
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 10U);
+    Coin coin;
+    BOOST_CHECK(base.GetCoin(outpoints[3], coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 4);
+
+    // Spent entries go away on the next sync.
+    BOOST_CHECK(cache.SpendCoin(outpoints[9]));
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 9U);
+
+    // Entries not touched since before the last sync are evicted first.
+    BOOST_CHECK(cache.HaveCoin(outpoints[0]));
+    BOOST_CHECK(cache.Sync());
+    cache.Trim(cache.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 8U);
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[0]));
+
+    // Trimming to nothing leaves only the map's own overhead, and evicted
+    // coins are read back from the base.
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nEmptyUsage + memusage::MallocUsage(sizeof(void*) * 64));
+    BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[3]).out.nValue, 4);
+    BOOST_CHECK(!cache.HaveCoin(outpoints[9]));
+}
+
+BOOST_AUTO_TEST_CASE(coin_serialization)
 {
     // Good example
-    CDataStream ss1(ParseHex("0108835800816115944e077fe7c803cfa57f29b36bf87c1d35b4934b"), SER_DISK, CLIENT_VERSION);
-    CCoins cc1;
+    CDataStream ss1(ParseHex("b0e578835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin cc1;
     ss1 >> cc1;
-    BOOST_CHECK_EQUAL(cc1.nVersion, 1);
     BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
-    BOOST_CHECK_EQUAL(cc1.nHeight, 870987);
-    BOOST_CHECK_EQUAL(cc1.vout.size(), 2);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(0), false);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(1), true);
-    BOOST_CHECK_EQUAL(cc1.vout[1].nValue, 60000000000ULL);
-    BOOST_CHECK_EQUAL(HexStr(cc1.vout[1].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+    BOOST_CHECK_EQUAL(cc1.fCoinStake, false);
+    BOOST_CHECK_EQUAL(cc1.nHeight, 203998U);
+    BOOST_CHECK_EQUAL(cc1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(cc1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
 
-    // Good example
-    CDataStream ss2(ParseHex("0111044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa482d21f"), SER_DISK, CLIENT_VERSION);
-    CCoins cc2;
+    // Good example, coinbase
+    CDataStream ss2(ParseHex("9cc06ebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    Coin cc2;
     ss2 >> cc2;
-    BOOST_CHECK_EQUAL(cc2.nVersion, 1);
     BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
-    BOOST_CHECK_EQUAL(cc2.nHeight, 59807);
-    BOOST_CHECK_EQUAL(cc2.vout.size(), 17);
-    for (int i = 0; i < 17; i++) {
-        BOOST_CHECK_EQUAL(cc2.IsAvailable(i), i == 4 || i == 16);
-    }
-    BOOST_CHECK_EQUAL(cc2.vout[4].nValue, 234925952);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[4].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
-    BOOST_CHECK_EQUAL(cc2.vout[16].nValue, 110397);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[16].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+    BOOST_CHECK_EQUAL(cc2.fCoinStake, false);
+    BOOST_CHECK_EQUAL(cc2.nHeight, 120891U);
+    BOOST_CHECK_EQUAL(cc2.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(cc2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
 
-    // Smallest possible example
-    CDataStream ssx(SER_DISK, CLIENT_VERSION);
-    BOOST_CHECK_EQUAL(HexStr(ssx.begin(), ssx.end()), "");
-
-    CDataStream ss3(ParseHex("0004000600"), SER_DISK, CLIENT_VERSION);
-    CCoins cc3;
+    // Good example, coinstake
+    CDataStream ss3(ParseHex("80d3d12d86ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4ee"), SER_DISK, CLIENT_VERSION);
+    Coin cc3;
     ss3 >> cc3;
-    BOOST_CHECK_EQUAL(cc3.nVersion, 0);
     BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
-    BOOST_CHECK_EQUAL(cc3.nHeight, 0);
-    BOOST_CHECK_EQUAL(cc3.vout.size(), 1);
-    BOOST_CHECK_EQUAL(cc3.IsAvailable(0), true);
-    BOOST_CHECK_EQUAL(cc3.vout[0].nValue, 0);
-    BOOST_CHECK_EQUAL(cc3.vout[0].scriptPubKey.size(), 0);
+    BOOST_CHECK_EQUAL(cc3.fCoinStake, true);
+    BOOST_CHECK_EQUAL(cc3.nHeight, 870987U);
+    BOOST_CHECK_EQUAL(cc3.out.nValue, 234925952);
+    BOOST_CHECK_EQUAL(HexStr(cc3.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
+
+    // Round trip
+    CDataStream ssr(SER_DISK, CLIENT_VERSION);
+    ssr << cc3;
+    BOOST_CHECK_EQUAL(HexStr(ssr.begin(), ssr.end()), "80d3d12d86ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4ee");
+    BOOST_CHECK_EQUAL(cc3.GetSerializeSize(SER_DISK, CLIENT_VERSION), ssr.size());
+
+    // Smallest possible example
+    CDataStream ss4(ParseHex("000006"), SER_DISK, CLIENT_VERSION);
+    Coin cc4;
+    ss4 >> cc4;
+    BOOST_CHECK_EQUAL(cc4.fCoinBase, false);
+    BOOST_CHECK_EQUAL(cc4.nHeight, 0U);
+    BOOST_CHECK_EQUAL(cc4.out.nValue, 0);
+    BOOST_CHECK_EQUAL(cc4.out.scriptPubKey.size(), 0U);
 
     // scriptPubKey that ends beyond the end of the stream
-    CDataStream ss4(ParseHex("0004000800"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss5(ParseHex("000007"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc4;
-        ss4 >> cc4;
+        Coin cc5;
+        ss5 >> cc5;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
@@ -239,13 +362,79 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     uint64_t x = 3000000000ULL;
     tmp << VARINT(x);
     BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
-    CDataStream ss5(ParseHex("0002008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss6(ParseHex("00008a95c0bb00"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc5;
-        ss5 >> cc5;
+        Coin cc6;
+        ss6 >> cc6;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(txundo_serialization)
+{
+    // Undo records written before the per-output UTXO set: the first carries
+    // metadata and a transaction version, the second (a non-final spend) none.
+    CDataStream ss(ParseHex("02" "b0e57801835800816115944e077fe7c803cfa57f29b36bf87c1d35" "00bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    CTxUndo undo;
+    ss >> undo;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK_EQUAL(undo.vprevout.size(), 2U);
+    BOOST_CHECK_EQUAL(undo.vprevout[0].nHeight, 203998U);
+    BOOST_CHECK_EQUAL(undo.vprevout[0].out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(undo.vprevout[1].nHeight, 0U);
+    BOOST_CHECK_EQUAL(undo.vprevout[1].out.nValue, 110397);
+
+    // The version is written back as a zero, so older versions can still read it.
+    CDataStream ssOut(SER_DISK, CLIENT_VERSION);
+    ssOut << undo;
+    BOOST_CHECK_EQUAL(HexStr(ssOut.begin(), ssOut.end()), "02" "b0e57800835800816115944e077fe7c803cfa57f29b36bf87c1d35" "00bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4");
+    BOOST_CHECK_EQUAL(undo.GetSerializeSize(SER_DISK, CLIENT_VERSION), ssOut.size());
+}
+
+BOOST_AUTO_TEST_CASE(rolling_stats)
+{
+    std::vector<std::pair<COutPoint, Coin> > coins;
+    for (int i = 0; i < 4; i++) {
+        CScript script = CScript() << ToByteVector(InsecureRand256()) << OP_CHECKSIG;
+        coins.push_back(std::make_pair(COutPoint(InsecureRand256(), i), Coin(CTxOut(1000 * (i + 1), script), 100 + i, i == 0, i == 1)));
+    }
+
+    // Updates commute, and a removal undoes an insertion.
+    CRollingCoinsStats stats1, stats2, empty;
+    for (int i = 0; i < 4; i++)
+        stats1.AddCoin(coins[i].first, coins[i].second);
+    stats1.RemoveCoin(coins[2].first, coins[2].second);
+    for (int i = 3; i >= 0; i--) {
+        if (i != 2)
+            stats2.AddCoin(coins[i].first, coins[i].second);
+    }
+    BOOST_CHECK(stats1.muhash.Finalize() == stats2.muhash.Finalize());
+    BOOST_CHECK(stats1.muhash.Finalize() != empty.muhash.Finalize());
+    BOOST_CHECK_EQUAL(stats1.nTransactionOutputs, 3U);
+    BOOST_CHECK_EQUAL(stats1.nTotalAmount, 7000);
+    BOOST_CHECK_EQUAL(stats1.nSerializedSize, stats2.nSerializedSize);
+    for (int i = 0; i < 4; i++) {
+        if (i != 2)
+            stats2.RemoveCoin(coins[i].first, coins[i].second);
+    }
+    BOOST_CHECK(stats2.muhash.Finalize() == empty.muhash.Finalize());
+    BOOST_CHECK_EQUAL(stats2.nSerializedSize, 0U);
+
+    // Another height makes another coin.
+    CRollingCoinsStats stats3;
+    stats3.AddCoin(coins[0].first, Coin(coins[0].second.out, 99, true, false));
+    CRollingCoinsStats stats4;
+    stats4.AddCoin(coins[0].first, coins[0].second);
+    BOOST_CHECK(stats3.muhash.Finalize() != stats4.muhash.Finalize());
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << stats1;
+    CRollingCoinsStats stats5;
+    ss >> stats5;
+    BOOST_CHECK(stats5.muhash.Finalize() == stats1.muhash.Finalize());
+    BOOST_CHECK_EQUAL(stats5.nTransactionOutputs, stats1.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats5.nTotalAmount, stats1.nTotalAmount);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,127 @@
+// Copyright (c) 2016 Jeremy Rubin
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "test/test_kabberry.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+/** Test Suite for CuckooCache
+ *
+ *  1) All tests should have a deterministic result (using the insecure rand
+ *  with deterministic seeds)
+ *  2) Some test methods are templated to allow for easier testing
+ *  against new versions / comparing
+ *  3) Results should be treated as a regression test, i.e., did the behavior
+ *  change significantly from what was expected. This can be OK, depending on
+ *  the nature of the change, but requires updating the tests to reflect the new
+ *  expected behavior. For example improving the hit rate may cause some tests
+ *  using BOOST_CHECK_CLOSE to fail.
+ *
+ */
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+/** Hashes a uint256 by slicing it into eight 32-bit words. */
+class TestHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+typedef CuckooCache::cache<uint256, TestHasher> test_cache;
+
+/** Fill a vector of n random 256-bit keys. */
+static std::vector<uint256> RandomKeys(size_t n)
+{
+    std::vector<uint256> keys(n);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = InsecureRand256();
+    return keys;
+}
+
+/* Test that no values not inserted into the cache are read out of it.
+ *
+ * There are no repeats in the first 200000 InsecureRand256() calls
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_no_fakes)
+{
+    SeedInsecureRand(true);
+    test_cache cc;
+    cc.setup_bytes(32 << 20);
+    std::vector<uint256> keys = RandomKeys(200000);
+    for (size_t i = 0; i < 100000; i++)
+        cc.insert(keys[i]);
+    for (size_t i = 100000; i < keys.size(); i++)
+        BOOST_CHECK(!cc.contains(keys[i], false));
+}
+
+/** Insert load * capacity keys, then return the fraction that can still be found. */
+static double HitRate(double load, size_t megabytes, std::vector<uint256>& keys, uint64_t& nEvictions)
+{
+    test_cache cc;
+    uint32_t n = cc.setup_bytes(megabytes << 20);
+    keys = RandomKeys(n * load);
+    nEvictions = 0;
+    for (size_t i = 0; i < keys.size(); i++)
+        nEvictions += cc.insert(keys[i]);
+    size_t count = 0;
+    for (size_t i = 0; i < keys.size(); i++)
+        count += cc.contains(keys[i], false);
+    return double(count) / double(keys.size());
+}
+
+/* Check the hit rate on loads ranging from 0.1 to 1.6, and that the
+ * evictions reported by insert account for the missing entries. */
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate_ok)
+{
+    SeedInsecureRand(true);
+    std::vector<uint256> keys;
+    for (double load = 0.1; load < 2; load *= 2) {
+        uint64_t nEvictions;
+        double hits = HitRate(load, 1, keys, nEvictions);
+        // Below 90% load (the epoch target) practically everything fits.
+        BOOST_CHECK(hits > (load < 0.9 ? 0.99 : 0.45));
+        BOOST_CHECK(nEvictions <= keys.size() - hits * keys.size());
+    }
+}
+
+/* Keys looked up with erase = true are the first to make room for new ones. */
+BOOST_AUTO_TEST_CASE(cuckoocache_erase_ok)
+{
+    SeedInsecureRand(true);
+    test_cache cc;
+    uint32_t n = cc.setup_bytes(1 << 20);
+    std::vector<uint256> keys = RandomKeys(n * 2);
+    const size_t half = n / 2;
+
+    for (size_t i = 0; i < half; i++)
+        cc.insert(keys[i]);
+    // Erase the first half of what was inserted...
+    for (size_t i = 0; i < half / 2; i++)
+        BOOST_CHECK(cc.contains(keys[i], true));
+    // ...which must still answer lookups until overwritten.
+    BOOST_CHECK(cc.contains(keys[0], false));
+    // Fill up the rest of the table.
+    for (size_t i = half; i < n; i++)
+        cc.insert(keys[i]);
+
+    size_t nErasedFound = 0, nKeptFound = 0;
+    for (size_t i = 0; i < half / 2; i++)
+        nErasedFound += cc.contains(keys[i], false);
+    for (size_t i = half / 2; i < half; i++)
+        nKeptFound += cc.contains(keys[i], false);
+    BOOST_CHECK(nKeptFound > 2 * nErasedFound);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
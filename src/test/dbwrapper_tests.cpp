@@ -0,0 +1,119 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "leveldbwrapper.h"
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+#include "uint256.h"
+#include "test/test_kabberry.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(dbwrapper_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(dbwrapper_profiles)
+{
+    const CDBProfiles profiles(8 << 20, 2 << 20, true, 100);
+
+    // The cache budgets split as every database used to
+    BOOST_CHECK_EQUAL(profiles.coins.nBlockCacheSize, 4U << 20);
+    BOOST_CHECK_EQUAL(profiles.coins.nWriteBufferSize, 2U << 20);
+    BOOST_CHECK_EQUAL(profiles.blockTree.nBlockCacheSize, 1U << 20);
+    BOOST_CHECK_EQUAL(profiles.blockTree.nWriteBufferSize, 512U << 10);
+
+    // Point lookups keep small blocks and the bloom filter, scans get larger blocks
+    BOOST_CHECK_EQUAL(profiles.coins.nBlockSize, 4096U);
+    BOOST_CHECK_EQUAL(profiles.coins.nBloomBits, 10);
+    BOOST_CHECK_EQUAL(profiles.blockTree.nBlockSize, 16U * 1024);
+    BOOST_CHECK_EQUAL(profiles.zerocoin.nBloomBits, 10);
+    BOOST_CHECK_EQUAL(profiles.spork.nBloomBits, 0);
+
+    // -dbmaxopenfiles applies to the large databases only
+    BOOST_CHECK_EQUAL(profiles.coins.nMaxOpenFiles, 100);
+    BOOST_CHECK_EQUAL(profiles.blockTree.nMaxOpenFiles, 100);
+    BOOST_CHECK_EQUAL(profiles.zerocoin.nMaxOpenFiles, 16);
+    BOOST_CHECK_EQUAL(profiles.spork.nMaxOpenFiles, 16);
+    BOOST_CHECK_EQUAL(CDBProfiles(8 << 20, 2 << 20, true, 1).coins.nMaxOpenFiles, 16);
+
+    // Compression is only selected when the build can compress
+    for (const CLevelDBProfile* profile : {&profiles.coins, &profiles.blockTree, &profiles.zerocoin, &profiles.spork})
+        BOOST_CHECK_EQUAL(profile->fCompression, LevelDBCompressionAvailable());
+    const CDBProfiles uncompressed(8 << 20, 2 << 20, false, 100);
+    for (const CLevelDBProfile* profile : {&uncompressed.coins, &uncompressed.blockTree, &uncompressed.zerocoin, &uncompressed.spork})
+        BOOST_CHECK(!profile->fCompression);
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_compression)
+{
+    CLevelDBProfile profile(1 << 20);
+    profile.fCompression = true;
+    CLevelDBWrapper db("dbwrapper_tests", profile, true);
+
+    // The profile reports what leveldb actually does
+    BOOST_CHECK_EQUAL(db.GetProfile().fCompression, LevelDBCompressionAvailable());
+
+    uint256 in = GetRandHash();
+    uint256 out;
+    BOOST_CHECK(db.Write('k', in));
+    BOOST_CHECK(db.Read('k', out));
+    BOOST_CHECK(in == out);
+}
+
+BOOST_FIXTURE_TEST_CASE(dbwrapper_load_block_index, TestingSetup)
+{
+    CBlockTreeDB db(CLevelDBProfile(1 << 20), true);
+
+    // More than one chunk; every other entry is a v3 block without undo data,
+    // which leaves the stored position and zerocoin fields out.
+    const size_t nEntries = BLOCK_INDEX_LOAD_CHUNK + 4096;
+    std::vector<uint256> vHashes;
+    for (size_t i = 0; i < nEntries; i++) {
+        CDiskBlockIndex diskindex;
+        const bool fNew = i % 2 == 0;
+        diskindex.nHeight = Params().LAST_POW_BLOCK() + 1 + i;
+        diskindex.nVersion = fNew ? 4 : 3;
+        diskindex.nNonce = i;
+        diskindex.nTx = 1;
+        diskindex.nFile = 1;
+        diskindex.nDataPos = 8 + i;
+        diskindex.nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA;
+        if (fNew) {
+            diskindex.nStatus |= BLOCK_HAVE_UNDO;
+            diskindex.nUndoPos = 8 + i;
+            diskindex.nAccumulatorCheckpoint = GetRandHash();
+            diskindex.mapZerocoinSupply.at(libzerocoin::ZQ_ONE) = i;
+            diskindex.vMintDenominationsInBlock.push_back(libzerocoin::ZQ_TEN);
+        }
+        BOOST_CHECK(db.WriteBlockIndex(diskindex));
+        vHashes.push_back(diskindex.GetBlockHash());
+    }
+
+    LOCK(cs_main);
+    BOOST_CHECK(db.LoadBlockIndexGuts());
+    const CBlockIndex indexNull;
+    for (size_t i = 0; i < nEntries; i++) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(vHashes[i]);
+        BOOST_REQUIRE(mi != mapBlockIndex.end());
+        const CBlockIndex* pindex = mi->second;
+        BOOST_CHECK_EQUAL(pindex->nHeight, Params().LAST_POW_BLOCK() + 1 + (int)i);
+        BOOST_CHECK_EQUAL(pindex->nDataPos, 8 + i);
+        if (i % 2 == 0) {
+            BOOST_CHECK_EQUAL(pindex->nVersion, 4);
+            BOOST_CHECK_EQUAL(pindex->nUndoPos, 8 + i);
+            BOOST_CHECK_EQUAL(pindex->mapZerocoinSupply.at(libzerocoin::ZQ_ONE), (int64_t)i);
+            BOOST_CHECK_EQUAL(pindex->vMintDenominationsInBlock.size(), 1U);
+        } else {
+            BOOST_CHECK_EQUAL(pindex->nVersion, 3);
+            BOOST_CHECK_EQUAL(pindex->nUndoPos, indexNull.nUndoPos);
+            BOOST_CHECK(pindex->nAccumulatorCheckpoint == indexNull.nAccumulatorCheckpoint);
+            BOOST_CHECK_EQUAL(pindex->mapZerocoinSupply.at(libzerocoin::ZQ_ONE), 0);
+            BOOST_CHECK(pindex->vMintDenominationsInBlock.empty());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,7 +2,11 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
+#include "crypto/quark.h"
 #include "hash.h"
+#include "primitives/block.h"
+#include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "test/test_kabberry.h"
 
@@ -46,4 +50,114 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(quark_batch)
+{
+    BOOST_TEST_MESSAGE("Using the '" + QuarkAutoDetect() + "' Quark implementation");
+
+    // Batches that do and do not fill whole lane groups and internal chunks,
+    // for empty input, 64-byte states, 80-byte headers, the largest single
+    // BLAKE block and inputs longer than that.
+    const size_t lengths[] = {0, 1, 64, 80, 111, 112, 200};
+    const size_t counts[] = {1, 2, 3, 4, 5, 7, 8, 9, 63, 64, 65, 130};
+    for (size_t len : lengths) {
+        for (size_t count : counts) {
+            std::vector<unsigned char> in = InsecureRandBytes(len * count);
+            std::vector<unsigned char> out(QUARK_OUTPUT_SIZE * count);
+            QuarkHashBatch(out.data(), in.data(), len, count);
+            for (size_t i = 0; i < count; i++) {
+                const unsigned char* msg = in.data() + i * len;
+                uint256 expected = HashQuark(msg, msg + len);
+                BOOST_CHECK_MESSAGE(memcmp(expected.begin(), &out[i * QUARK_OUTPUT_SIZE], QUARK_OUTPUT_SIZE) == 0,
+                    strprintf("len=%u count=%u i=%u", len, count, i));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(block_header_hashes)
+{
+    // Known answer: the main network genesis block is a Quark header
+    const CBlock& genesis = Params().GenesisBlock();
+    std::vector<CBlockHeader> vHeaders(1, genesis.GetBlockHeader());
+    std::vector<uint256> vHashes;
+    GetBlockHeaderHashes(vHeaders, vHashes);
+    BOOST_CHECK_EQUAL(vHashes.size(), 1U);
+    BOOST_CHECK(vHashes[0] == Params().HashGenesisBlock());
+
+    // Mixed Quark and SHA-256 headers keep their order
+    vHeaders.clear();
+    for (int i = 0; i < 50; i++) {
+        CBlockHeader header;
+        header.nVersion = 1 + InsecureRandRange(CBlockHeader::CURRENT_VERSION);
+        header.hashPrevBlock = InsecureRand256();
+        header.hashMerkleRoot = InsecureRand256();
+        header.nTime = InsecureRand32();
+        header.nBits = InsecureRand32();
+        header.nNonce = InsecureRand32();
+        header.nAccumulatorCheckpoint = InsecureRand256();
+        vHeaders.push_back(header);
+    }
+    GetBlockHeaderHashes(vHeaders, vHashes);
+    BOOST_CHECK_EQUAL(vHashes.size(), vHeaders.size());
+    for (size_t i = 0; i < vHeaders.size(); i++)
+        BOOST_CHECK(vHashes[i] == vHeaders[i].GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(block_header_hash_cache)
+{
+    CBlockHeader header;
+    header.nVersion = 3;
+    header.hashPrevBlock = InsecureRand256();
+    header.hashMerkleRoot = InsecureRand256();
+    header.nTime = InsecureRand32();
+    const uint256 hash = HashQuark(BEGIN(header.nVersion), END(header.nNonce));
+
+    // A memoized hash does not evaluate Quark again, for copies either
+    {
+        CHeaderHashCallerScope hashCaller(HEADER_HASH_ACCEPT_HEADER);
+        const uint64_t nQuark = GetQuarkHashCount(HEADER_HASH_ACCEPT_HEADER);
+        const uint64_t nHits = GetHeaderHashCacheHits();
+        CBlockHeader fresh = header;
+        BOOST_CHECK(fresh.GetHash() == hash);
+        BOOST_CHECK(fresh.GetHash() == hash);
+        BOOST_CHECK(CBlock(fresh).GetHash() == hash);
+        BOOST_CHECK(header.GetHash() == hash);
+        BOOST_CHECK_EQUAL(GetQuarkHashCount(HEADER_HASH_ACCEPT_HEADER), nQuark + 1);
+        BOOST_CHECK(GetHeaderHashCacheHits() >= nHits + 3);
+    }
+
+    // Nor after GetBlockHeaderHashes
+    {
+        CHeaderHashCallerScope hashCaller(HEADER_HASH_HEADERS_MSG);
+        CBlockHeader other = header;
+        other.nNonce = InsecureRand32();
+        std::vector<CBlockHeader> vHeaders(1, other);
+        std::vector<uint256> vHashes;
+        GetBlockHeaderHashes(vHeaders, vHashes);
+        const uint64_t nQuark = GetQuarkHashCount(HEADER_HASH_HEADERS_MSG);
+        BOOST_CHECK(other.GetHash() == vHashes[0]);
+        BOOST_CHECK_EQUAL(GetQuarkHashCount(HEADER_HASH_HEADERS_MSG), nQuark);
+    }
+
+    // Every mutation gets the hash of the new fields
+    header.nNonce++;
+    BOOST_CHECK(header.GetHash() != hash);
+    header.nNonce--;
+    BOOST_CHECK(header.GetHash() == hash);
+    header.hashMerkleRoot = InsecureRand256();
+    BOOST_CHECK(header.GetHash() != hash);
+    header.nVersion = 4;
+    BOOST_CHECK(header.GetHash() == Hash(BEGIN(header.nVersion), END(header.nAccumulatorCheckpoint)));
+
+    CBlockHeader v7;
+    v7.nTime = 1;
+    const uint256 hash7 = v7.GetHash();
+    v7.nVersion = 6;
+    v7.nAccumulatorCheckpoint = InsecureRand256();
+    BOOST_CHECK(v7.GetHash() != hash7);
+    v7.SetNull();
+    v7.nTime = 1;
+    BOOST_CHECK(v7.GetHash() == hash7);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -188,4 +188,66 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("1f4f304f1b05599f88bc517819f6d43c69503baea5f253c55ea2d791394f7ce0de4f23c0d4c1f4d7a89bf130fed755201d22581911a8a44cf594014794231d325a"));
 }
 
+BOOST_AUTO_TEST_CASE(pubkey_verify_cached)
+{
+    std::vector<CKey> vKeys(4);
+    for (CKey& key : vKeys)
+        key.MakeNewKey(InsecureRandBool());
+
+    // Repeat each key a few times so it makes it into the table.
+    for (int i = 0; i < 3; i++) {
+        for (const CKey& key : vKeys) {
+            const CPubKey pubkey = key.GetPubKey();
+            const CPubKey other = vKeys[(&key - &vKeys[0] + 1) % vKeys.size()].GetPubKey();
+            uint256 hash = InsecureRand256();
+            std::vector<unsigned char> vchSig;
+            BOOST_CHECK(key.Sign(hash, vchSig));
+
+            BOOST_CHECK(pubkey.VerifyCached(hash, vchSig));
+            BOOST_CHECK(!other.VerifyCached(hash, vchSig));
+            BOOST_CHECK(!pubkey.VerifyCached(InsecureRand256(), vchSig));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(pubkey_verify_cached_table)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CPubKey pubkey = key.GetPubKey();
+    uint256 hash = InsecureRand256();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    // A key is parsed on its first two uses, and only held from the second on.
+    const uint64_t nHits = GetPubKeyTableHits();
+    BOOST_CHECK(pubkey.VerifyCached(hash, vchSig));
+    BOOST_CHECK_EQUAL(GetPubKeyTableHits(), nHits);
+    BOOST_CHECK(pubkey.VerifyCached(hash, vchSig));
+    BOOST_CHECK_EQUAL(GetPubKeyTableHits(), nHits);
+    BOOST_CHECK(pubkey.VerifyCached(hash, vchSig));
+    BOOST_CHECK_EQUAL(GetPubKeyTableHits(), nHits + 1);
+
+    // A held key still rejects signatures that don't match.
+    BOOST_CHECK(!pubkey.VerifyCached(InsecureRand256(), vchSig));
+    BOOST_CHECK_EQUAL(GetPubKeyTableHits(), nHits + 2);
+
+    // Verify() leaves the table alone.
+    BOOST_CHECK(pubkey.Verify(hash, vchSig));
+    BOOST_CHECK_EQUAL(GetPubKeyTableHits(), nHits + 2);
+
+    // Keys that don't parse are never held.
+    std::vector<unsigned char> vchInvalid(pubkey.begin(), pubkey.end());
+    vchInvalid[0] = 0x02;
+    vchInvalid[1] ^= 0xff;
+    CPubKey invalid(vchInvalid);
+    while (invalid.IsFullyValid()) {
+        vchInvalid[32]++;
+        invalid = CPubKey(vchInvalid);
+    }
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK(!invalid.VerifyCached(hash, vchSig));
+    BOOST_CHECK_EQUAL(GetPubKeyTableHits(), nHits + 2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 #include "main.h"
 #include "txmempool.h"
 #include "util.h"
+#include "test/test_kabberry.h"
 
 #include <boost/test/unit_test.hpp>
 #include <list>
@@ -99,4 +100,242 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolPackageTest)
+{
+    // Chain of three transactions: tx1 <- tx2 <- tx3, plus an unrelated tx4.
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_11;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_11;
+    tx2.vin[0].prevout.hash = tx1.GetHash();
+    tx2.vin[0].prevout.n = 0;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 9 * COIN;
+
+    CMutableTransaction tx3;
+    tx3.vin.resize(1);
+    tx3.vin[0].scriptSig = CScript() << OP_11;
+    tx3.vin[0].prevout.hash = tx2.GetHash();
+    tx3.vin[0].prevout.n = 0;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 8 * COIN;
+
+    CMutableTransaction tx4;
+    tx4.vin.resize(1);
+    tx4.vin[0].scriptSig = CScript() << OP_12;
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx4.vout[0].nValue = 5 * COIN;
+
+    CTxMemPool pool(CFeeRate(0));
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 1000, 1, 0.0, 1));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 2000, 2, 0.0, 1));
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 30000, 3, 0.0, 1));
+    pool.addUnchecked(tx4.GetHash(), CTxMemPoolEntry(tx4, 5000, 4, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+
+    CTxMemPool::txiter it1 = pool.mapTx.find(tx1.GetHash());
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx2.GetHash());
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    CTxMemPool::txiter it4 = pool.mapTx.find(tx4.GetHash());
+    BOOST_CHECK_EQUAL(it1->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(it1->GetModFeesWithDescendants(), 33000);
+    BOOST_CHECK_EQUAL(it1->GetSizeWithDescendants(), it1->GetTxSize() + it2->GetTxSize() + it3->GetTxSize());
+    BOOST_CHECK_EQUAL(it2->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 33000);
+    BOOST_CHECK_EQUAL(it4->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it4->GetCountWithDescendants(), 1);
+
+    // Package limits are enforced against the in-mempool ancestors.
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(CTxMemPoolEntry(tx3, 0, 0, 0.0, 1), setAncestors, 2, 1000000, 25, 1000000, errString));
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(CTxMemPoolEntry(tx3, 0, 0, 0.0, 1), setAncestors, 3, 1000000, 25, 1000000, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 2);
+
+    // The descendant score index puts the cheapest package first; the
+    // ancestor score index puts the best package to mine first, which is
+    // tx3 together with its two ancestors.
+    BOOST_CHECK(pool.mapTx.get<descendant_score>().begin()->GetTx().GetHash() == tx4.GetHash());
+    BOOST_CHECK(pool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash() == tx3.GetHash());
+    BOOST_CHECK(pool.mapTx.get<entry_time>().begin()->GetTx().GetHash() == tx1.GetHash());
+
+    // Prioritising the child raises every ancestor's package fee.
+    pool.PrioritiseTransaction(tx3.GetHash(), tx3.GetHash().ToString(), 0.0, 1000);
+    BOOST_CHECK_EQUAL(it1->GetModFeesWithDescendants(), 34000);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 34000);
+
+    // Mining tx1 leaves tx2 and tx3 behind with their state reduced.
+    std::vector<CTransaction> vtx;
+    vtx.push_back(tx1);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 2, conflicts);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK_EQUAL(it2->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 2000 + 31000);
+    BOOST_CHECK_EQUAL(it2->GetCountWithDescendants(), 2);
+
+    // Removing tx3 on its own updates its parent.
+    std::list<CTransaction> removed;
+    pool.remove(tx3, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(it2->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(it2->GetSizeWithDescendants(), it2->GetTxSize());
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithDescendants(), 2000);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 1, 0.0, 1));
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 50000LL, 1, 0.0, 1));
+
+    // A zerocoin spend pays no fee and is evicted like any other transaction.
+    CMutableTransaction tx3;
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout.hash = 0;
+    tx3.vin[0].scriptSig = CScript() << OP_ZEROCOINSPEND;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 0LL, 1, 0.0, 1));
+    BOOST_CHECK(CTransaction(tx3).HasZerocoinSpendInputs());
+
+    // A protected transaction (one with a SwiftX lock request) and its parent
+    // pay no fee either, but go only once nothing else is left.
+    CMutableTransaction tx4;
+    tx4.vin.resize(1);
+    tx4.vin[0].scriptSig = CScript() << OP_4;
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    tx4.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx4.GetHash(), CTxMemPoolEntry(tx4, 0LL, 1, 0.0, 1));
+
+    CMutableTransaction tx5;
+    tx5.vin.resize(1);
+    tx5.vin[0].prevout = COutPoint(tx4.GetHash(), 0);
+    tx5.vin[0].scriptSig = CScript() << OP_5;
+    tx5.vout.resize(1);
+    tx5.vout[0].scriptPubKey = CScript() << OP_5 << OP_EQUAL;
+    tx5.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx5.GetHash(), CTxMemPoolEntry(tx5, 0LL, 1, 0.0, 1));
+    pool.SetProtected(tx5.GetHash(), true);
+    BOOST_CHECK(pool.mapTx.find(tx5.GetHash())->IsProtected());
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx4.GetHash())->GetProtectedWithDescendants(), 1U);
+    BOOST_CHECK(pool.mapTx.get<descendant_score>().rbegin()->GetProtectedWithDescendants() != 0);
+
+    // Nothing to do while the pool fits.
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    // The cheapest unprotected package goes first and sets the rolling minimum fee.
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx3.GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 1000);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    CFeeRate evicted(10000LL, ::GetSerializeSize(tx1, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), evicted.GetFeePerK() + 1000);
+
+    // A higher feerate does not keep tx2 in over the protected package.
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+    BOOST_CHECK(pool.exists(tx4.GetHash()));
+    BOOST_CHECK(pool.exists(tx5.GetHash()));
+
+    // Expiry removes old transactions but keeps the protected package.
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 1, 0.0, 1));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 50000LL, 5, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.Expire(2), 1);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    // Once it is no longer protected, neither is its parent.
+    pool.SetProtected(tx5.GetHash(), false);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx4.GetHash())->GetProtectedWithDescendants(), 0U);
+    pool.SetProtected(tx5.GetHash(), true);
+
+    // Protection does not put the pool over its limit.
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+
+    // Once a block arrives the minimum fee decays, and drops to zero when it
+    // falls below half the relay fee.
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    CAmount nMinFee = pool.GetMinFee(1).GetFeePerK();
+    SetMockTime(42);
+    pool.removeForBlock(vtx, 1, conflicts);
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFee / 2);
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE * 20);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+    SetMockTime(0);
+}
+
+BOOST_FIXTURE_TEST_CASE(MempoolLimitForgetsZerocoinSpends, TestingSetup)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, GetTime(), 0.0, 1));
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout.hash = 0;
+    tx2.vin[0].scriptSig = CScript() << OP_ZEROCOINSPEND;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 0LL, GetTime(), 0.0, 1));
+
+    LOCK(cs_main);
+    mapZerocoinspends[tx2.GetHash()] = GetTime();
+
+    // Nothing left the pool: the spend is remembered
+    LimitMempoolSize(pool, pool.DynamicMemoryUsage(), 3600);
+    BOOST_CHECK(mapZerocoinspends.count(tx2.GetHash()));
+
+    // Evicted, it is forgotten with it
+    LimitMempoolSize(pool, pool.DynamicMemoryUsage() - 1, 3600);
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!mapZerocoinspends.count(tx2.GetHash()));
+    mapZerocoinspends.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,9 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "consensus/merkle.h"
+#include "merkleblock.h"
+#include "streams.h"
+#include "version.h"
 #include "test/test_kabberry.h"
 
 #include <boost/test/unit_test.hpp>
@@ -116,6 +119,10 @@ BOOST_AUTO_TEST_CASE(merkle_test)
             BOOST_CHECK((newRoot == uint256()) == (ntx == 0));
             BOOST_CHECK(oldMutated == newMutated);
             BOOST_CHECK(newMutated == !!mutate);
+            // The materialized tree must agree with both.
+            CMerkleTree tree(BlockMerkleLeaves(block));
+            BOOST_CHECK(tree.GetRoot() == oldRoot);
+            BOOST_CHECK(tree.IsMutated() == oldMutated);
             // If no mutation was done (once for every ntx value), try up to 16 branches.
             if (mutate == 0) {
                 for (int loop = 0; loop < std::min(ntx, 16); loop++) {
@@ -134,4 +141,42 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(merkle_tree_reuse)
+{
+    CBlock block;
+    for (int j = 0; j < 37; j++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = j;
+        block.vtx.push_back(mtx);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    const CMerkleTree tree = BlockMerkleTree(block);
+    BOOST_CHECK(tree.GetRoot() == block.hashMerkleRoot);
+    BOOST_CHECK_EQUAL(tree.GetLeafCount(), 37u);
+    BOOST_CHECK_EQUAL(tree.GetHeight(), 6);
+    for (int height = 0; height <= tree.GetHeight(); height++) {
+        BOOST_CHECK_EQUAL(tree.GetWidth(height), (37u + (1 << height) - 1) >> height);
+    }
+
+    // A merkleblock built from a tree computed earlier matches one that
+    // hashes the block itself.
+    CBloomFilter filter(10, 0.000001, 0, BLOOM_UPDATE_ALL);
+    filter.insert(block.vtx[3].GetHash());
+    filter.insert(block.vtx[36].GetHash());
+    CBloomFilter filter2(filter);
+    CMerkleBlock merkleBlock(block, filter);
+    CMerkleBlock merkleBlockShared(block, tree, filter2);
+    BOOST_CHECK_EQUAL(merkleBlockShared.vMatchedTxn.size(), 2u);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION), ssShared(SER_NETWORK, PROTOCOL_VERSION);
+    ss << merkleBlock;
+    ssShared << merkleBlockShared;
+    BOOST_CHECK(ss.str() == ssShared.str());
+
+    // Branches sliced out of the tree match the ones computed from the block.
+    for (uint32_t pos = 0; pos < block.vtx.size(); pos++) {
+        BOOST_CHECK(tree.GetBranch(pos) == BlockMerkleBranch(block, pos));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
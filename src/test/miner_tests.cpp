@@ -4,269 +4,298 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#include "init.h"
-#include "consensus/merkle.h"
+#include "libzerocoin/Coin.h"
+#include "libzerocoin/Denominations.h"
 #include "main.h"
 #include "miner.h"
-#include "pubkey.h"
+#include "random.h"
+#include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
+#include "utiltime.h"
+#include "skkc/skkcmodule.h"
+#include "skkc/zerocoin.h"
 
-#include "test/test_bitcoin.h"
+#include "test/test_kabberry.h"
 
-#include <boost/test/unit_test.hpp>
+#include <algorithm>
 
-BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
-
-static
-struct {
-    unsigned char extranonce;
-    unsigned int nonce;
-} blockinfo[] = {
-    {4, 0xa4a3e223}, {2, 0x15c32f9e}, {1, 0x0375b547}, {1, 0x7004a8a5},
-    {2, 0xce440296}, {2, 0x52cfe198}, {1, 0x77a72cd0}, {2, 0xbb5d6f84},
-    {2, 0x83f30c2c}, {1, 0x48a73d5b}, {1, 0xef7dcd01}, {2, 0x6809c6c4},
-    {2, 0x0883ab3c}, {1, 0x087bbbe2}, {2, 0x2104a814}, {2, 0xdffb6daa},
-    {1, 0xee8a0a08}, {2, 0xba4237c1}, {1, 0xa70349dc}, {1, 0x344722bb},
-    {3, 0xd6294733}, {2, 0xec9f5c94}, {2, 0xca2fbc28}, {1, 0x6ba4f406},
-    {2, 0x015d4532}, {1, 0x6e119b7c}, {2, 0x43e8f314}, {2, 0x27962f38},
-    {2, 0xb571b51b}, {2, 0xb36bee23}, {2, 0xd17924a8}, {2, 0x6bc212d9},
-    {1, 0x630d4948}, {2, 0x9a4c4ebb}, {2, 0x554be537}, {1, 0xd63ddfc7},
-    {2, 0xa10acc11}, {1, 0x759a8363}, {2, 0xfb73090d}, {1, 0xe82c6a34},
-    {1, 0xe33e92d7}, {3, 0x658ef5cb}, {2, 0xba32ff22}, {5, 0x0227a10c},
-    {1, 0xa9a70155}, {5, 0xd096d809}, {1, 0x37176174}, {1, 0x830b8d0f},
-    {1, 0xc6e3910e}, {2, 0x823f3ca8}, {1, 0x99850849}, {1, 0x7521fb81},
-    {1, 0xaacaabab}, {1, 0xd645a2eb}, {5, 0x7aea1781}, {5, 0x9d6e4b78},
-    {1, 0x4ce90fd8}, {1, 0xabdc832d}, {6, 0x4a34f32a}, {2, 0xf2524c1c},
-    {2, 0x1bbeb08a}, {1, 0xad47f480}, {1, 0x9f026aeb}, {1, 0x15a95049},
-    {2, 0xd1cb95b2}, {2, 0xf84bbda5}, {1, 0x0fa62cd1}, {1, 0xe05f9169},
-    {1, 0x78d194a9}, {5, 0x3e38147b}, {5, 0x737ba0d4}, {1, 0x63378e10},
-    {1, 0x6d5f91cf}, {2, 0x88612eb8}, {2, 0xe9639484}, {1, 0xb7fabc9d},
-    {2, 0x19b01592}, {1, 0x5a90dd31}, {2, 0x5bd7e028}, {2, 0x94d00323},
-    {1, 0xa9b9c01a}, {1, 0x3a40de61}, {1, 0x56e7eec7}, {5, 0x859f7ef6},
-    {1, 0xfd8e5630}, {1, 0x2b0c9f7f}, {1, 0xba700e26}, {1, 0x7170a408},
-    {1, 0x70de86a8}, {1, 0x74d64cd5}, {1, 0x49e738a1}, {2, 0x6910b602},
-    {0, 0x643c565f}, {1, 0x54264b3f}, {2, 0x97ea6396}, {2, 0x55174459},
-    {2, 0x03e8779a}, {1, 0x98f34d8f}, {1, 0xc07b2b07}, {1, 0xdfe29668},
-    {1, 0x3141c7c1}, {1, 0xb3b595f4}, {1, 0x735abf08}, {5, 0x623bfbce},
-    {2, 0xd351e722}, {1, 0xf4ca48c9}, {1, 0x5b19c670}, {1, 0xa164bf0e},
-    {2, 0xbbbeb305}, {2, 0xfe1c810a},
-};
+#include <boost/test/unit_test.hpp>
 
-// NOTE: These tests rely on CreateNewBlock doing its own self-validation!
-BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
-{
-    CScript scriptPubKey = CScript() << ParseHex("04678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5f") << OP_CHECKSIG;
-    CBlockTemplate *pblocktemplate;
-    CMutableTransaction tx,tx2;
-    CScript script;
-    uint256 hash;
-
-    LOCK(cs_main);
-    Checkpoints::fEnabled = false;
-
-    // Simple block creation, nothing special yet:
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-
-    // We can't make transactions until we have inputs
-    // Therefore, load 100 blocks :)
-    std::vector<CTransaction*>txFirst;
-    for (unsigned int i = 0; i < sizeof(blockinfo)/sizeof(*blockinfo); ++i)
+struct MinerTestingSetup : public TestingSetup {
+    MinerTestingSetup()
     {
-        CBlock *pblock = &pblocktemplate->block; // pointer for convenience
-        pblock->nVersion = 1;
-        pblock->nTime = chainActive.Tip()->GetMedianTimePast()+1;
-        CMutableTransaction txCoinbase(pblock->vtx[0]);
-        txCoinbase.vin[0].scriptSig = CScript();
-        txCoinbase.vin[0].scriptSig.push_back(blockinfo[i].extranonce);
-        txCoinbase.vin[0].scriptSig.push_back(chainActive.Height());
-        txCoinbase.vout[0].scriptPubKey = CScript();
-        pblock->vtx[0] = CTransaction(txCoinbase);
-        if (txFirst.size() < 2)
-            txFirst.push_back(new CTransaction(pblock->vtx[0]));
-        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
-        pblock->nNonce = blockinfo[i].nonce;
-        CValidationState state;
-        BOOST_CHECK(ProcessNewBlock(state, NULL, pblock));
-        BOOST_CHECK(state.IsValid());
-        pblock->hashPrevBlock = pblock->GetHash();
+        // Entries are stamped with the time they enter the pool; keep it still.
+        SetMockTime(GetTime());
+        // Clearing counts as a change of the pool: the first selection starts over.
+        mempool.clear();
     }
-    delete pblocktemplate;
-
-    // Just to make sure we can still make simple blocks
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
-
-    // block sigops > limit: 1000 CHECKMULTISIG + 1
-    tx.vin.resize(1);
-    // NOTE: OP_NOP is used to force 20 SigOps for the CHECKMULTISIG
-    tx.vin[0].scriptSig = CScript() << OP_0 << OP_0 << OP_0 << OP_NOP << OP_CHECKMULTISIG << OP_1;
-    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
-    tx.vin[0].prevout.n = 0;
-    tx.vout.resize(1);
-    tx.vout[0].nValue = 5000000000LL;
-    for (unsigned int i = 0; i < 1001; ++i)
+
+    ~MinerTestingSetup()
     {
-        tx.vout[0].nValue -= 1000000;
-        hash = tx.GetHash();
-        mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-        tx.vin[0].prevout.hash = hash;
+        mempool.clear();
+        mapZerocoinspends.clear();
+        SetMockTime(0);
     }
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
+};
+
+BOOST_FIXTURE_TEST_SUITE(miner_tests, MinerTestingSetup)
+
+// Selection limits that make the outcome depend on the fees only
+static const unsigned int nMaxSize = DEFAULT_BLOCK_MAX_SIZE;
+static const unsigned int nMinSize = 0;
+static const unsigned int nPrioritySize = 0;
+
+// A coin of 1 KKC in the chain state, spendable by anyone
+static COutPoint AddCoin()
+{
+    COutPoint outpoint(GetRandHash(), 0);
+    pcoinsTip->AddCoin(outpoint, Coin(CTxOut(COIN, CScript() << OP_TRUE), 1, false, false), false);
+    return outpoint;
+}
+
+static CTransaction Spend(const COutPoint& prevout, CAmount nValueIn, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(prevout));
+    tx.vout.push_back(CTxOut(nValueIn - nFee, CScript() << OP_TRUE));
+    return tx;
+}
+
+static void AddToMempool(const CTransaction& tx, CAmount nFee, double dPriority = 0.0)
+{
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, GetTime(), dPriority, chainActive.Height()));
+}
+
+static bool Select(std::vector<CTransaction>& vtx, const CBlockIndex* pindexPrev = nullptr, unsigned int nPriority = nPrioritySize)
+{
+    LOCK2(cs_main, mempool.cs);
+    return SelectBlockTransactions(pindexPrev ? pindexPrev : chainActive.Tip(), nMaxSize, nMinSize, nPriority, vtx);
+}
+
+static int Position(const std::vector<CTransaction>& vtx, const CTransaction& tx)
+{
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (vtx[i].GetHash() == tx.GetHash())
+            return i;
+    }
+    return -1;
+}
+
+BOOST_AUTO_TEST_CASE(miner_package_selection)
+{
+    std::vector<CTransaction> vtx;
+
+    // A parent below the relay fee, pulled in by its child
+    CTransaction txParent = Spend(AddCoin(), COIN, 0);
+    CTransaction txChild = Spend(COutPoint(txParent.GetHash(), 0), COIN, 100000);
+    CTransaction txMedium = Spend(AddCoin(), COIN, 20000);
+    CTransaction txFree = Spend(AddCoin(), COIN, 0);
+    AddToMempool(txParent, 0);
+    AddToMempool(txChild, 100000);
+    AddToMempool(txMedium, 20000);
+    AddToMempool(txFree, 0);
+
+    BOOST_CHECK(!Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 3U);
+    BOOST_CHECK_EQUAL(Position(vtx, txParent), 0);
+    BOOST_CHECK_EQUAL(Position(vtx, txChild), 1);
+    BOOST_CHECK_EQUAL(Position(vtx, txMedium), 2);
+    BOOST_CHECK_EQUAL(Position(vtx, txFree), -1);
+
+    // A child paying less than the medium transaction puts its parent after it
     mempool.clear();
+    AddToMempool(txParent, 0);
+    AddToMempool(txMedium, 20000);
+    CTransaction txPoorChild = Spend(COutPoint(txParent.GetHash(), 0), COIN, 30000);
+    AddToMempool(txPoorChild, 30000);
+
+    BOOST_CHECK(!Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 3U);
+    BOOST_CHECK_EQUAL(Position(vtx, txMedium), 0);
+    BOOST_CHECK_EQUAL(Position(vtx, txParent), 1);
+    BOOST_CHECK_EQUAL(Position(vtx, txPoorChild), 2);
+}
 
-    // block size > limit
-    tx.vin[0].scriptSig = CScript();
-    // 18 * (520char + DROP) + OP_1 = 9433 bytes
-    std::vector<unsigned char> vchData(520);
-    for (unsigned int i = 0; i < 18; ++i)
-        tx.vin[0].scriptSig << vchData << OP_DROP;
-    tx.vin[0].scriptSig << OP_1;
-    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
-    tx.vout[0].nValue = 5000000000LL;
-    for (unsigned int i = 0; i < 128; ++i)
+BOOST_AUTO_TEST_CASE(miner_extend_selection)
+{
+    std::vector<CTransaction> vtx;
+
+    CTransaction tx1 = Spend(AddCoin(), COIN, 20000);
+    AddToMempool(tx1, 20000);
+    BOOST_CHECK(!Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 1U);
+
+    // Nothing changed, or transactions were only added: extend
+    BOOST_CHECK(Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 1U);
+
+    CTransaction tx2 = Spend(AddCoin(), COIN, 50000);
+    CTransaction tx3 = Spend(COutPoint(tx1.GetHash(), 0), COIN - 20000, 30000);
+    AddToMempool(tx2, 50000);
+    AddToMempool(tx3, 30000);
+    BOOST_CHECK(Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 3U);
+    BOOST_CHECK_EQUAL(Position(vtx, tx1), 0);
+    BOOST_CHECK(Position(vtx, tx3) > 0);
+
+    // A prioritisation changes the order: start over
+    mempool.PrioritiseTransaction(tx3.GetHash(), tx3.GetHash().ToString(), 0, 1000000);
+    BOOST_CHECK(!Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 3U);
+    BOOST_CHECK_EQUAL(Position(vtx, tx1), 0);
+    BOOST_CHECK_EQUAL(Position(vtx, tx3), 1);
+    BOOST_CHECK_EQUAL(Position(vtx, tx2), 2);
+    BOOST_CHECK(Select(vtx));
+
+    // A removal, even with an addition after it: start over
+    std::list<CTransaction> removed;
+    mempool.remove(tx1, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2U);
+    CTransaction tx4 = Spend(AddCoin(), COIN, 40000);
+    AddToMempool(tx4, 40000);
+    BOOST_CHECK(!Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(Position(vtx, tx1), -1);
+    BOOST_CHECK_EQUAL(Position(vtx, tx3), -1);
+    BOOST_CHECK(Select(vtx));
+
+    // A new tip: start over, and again when back on the old one
+    uint256 hashOther = GetRandHash();
+    CBlockIndex indexOther;
+    indexOther.phashBlock = &hashOther;
+    indexOther.nHeight = chainActive.Height();
+    BOOST_CHECK(!Select(vtx, &indexOther));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+    BOOST_CHECK(Select(vtx, &indexOther));
+    BOOST_CHECK(!Select(vtx));
+    BOOST_CHECK(Select(vtx));
+
+    // Other limits: start over
     {
-        tx.vout[0].nValue -= 10000000;
-        hash = tx.GetHash();
-        mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-        tx.vin[0].prevout.hash = hash;
+        LOCK2(cs_main, mempool.cs);
+        BOOST_CHECK(!SelectBlockTransactions(chainActive.Tip(), nMaxSize - 1000, nMinSize, nPrioritySize, vtx));
     }
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
-    mempool.clear();
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+}
 
-    // orphan in mempool
-    hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
-    mempool.clear();
+BOOST_AUTO_TEST_CASE(miner_extend_priority)
+{
+    std::vector<CTransaction> vtx;
+    const double dHighPriority = AllowFreeThreshold() * 10;
 
-    // child with higher priority than parent
-    tx.vin[0].scriptSig = CScript() << OP_1;
-    tx.vin[0].prevout.hash = txFirst[1]->GetHash();
-    tx.vout[0].nValue = 4900000000LL;
-    hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-    tx.vin[0].prevout.hash = hash;
-    tx.vin.resize(2);
-    tx.vin[1].scriptSig = CScript() << OP_1;
-    tx.vin[1].prevout.hash = txFirst[0]->GetHash();
-    tx.vin[1].prevout.n = 0;
-    tx.vout[0].nValue = 5900000000LL;
-    hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
-    mempool.clear();
+    // Free transactions only get in by priority
+    CTransaction txHigh = Spend(AddCoin(), COIN, 0);
+    CTransaction txLow = Spend(AddCoin(), COIN, 0);
+    CTransaction txFee = Spend(AddCoin(), COIN, 20000);
+    AddToMempool(txHigh, 0, dHighPriority);
+    AddToMempool(txLow, 0);
+    AddToMempool(txFee, 20000);
 
-    // coinbase in mempool
-    tx.vin.resize(1);
-    tx.vin[0].prevout.SetNull();
-    tx.vin[0].scriptSig = CScript() << OP_0 << OP_1;
-    tx.vout[0].nValue = 0;
-    hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
-    mempool.clear();
+    // A low priority free transaction is left out, even with room to spare
+    const unsigned int nLargeArea = nMaxSize / 2;
+    BOOST_CHECK(!Select(vtx, nullptr, nLargeArea));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(Position(vtx, txHigh), 0);
+    BOOST_CHECK_EQUAL(Position(vtx, txLow), -1);
 
-    // invalid (pre-p2sh) txn in mempool
-    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
-    tx.vin[0].prevout.n = 0;
-    tx.vin[0].scriptSig = CScript() << OP_1;
-    tx.vout[0].nValue = 4900000000LL;
-    script = CScript() << OP_0;
-    tx.vout[0].scriptPubKey = GetScriptForDestination(CScriptID(script));
-    hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-    tx.vin[0].prevout.hash = hash;
-    tx.vin[0].scriptSig = CScript() << (std::vector<unsigned char>)script;
-    tx.vout[0].nValue -= 1000000;
-    hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
+    // An area that ends just past the 1000 bytes kept for the coinbase,
+    // full after the first transaction
     mempool.clear();
+    AddToMempool(txHigh, 0, dHighPriority);
+    AddToMempool(txFee, 20000);
+    const unsigned int nSmallArea = 1000 + 1;
+    BOOST_CHECK(!Select(vtx, nullptr, nSmallArea));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
 
-    // double spend txn pair in mempool
-    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
-    tx.vin[0].scriptSig = CScript() << OP_1;
-    tx.vout[0].nValue = 4900000000LL;
-    tx.vout[0].scriptPubKey = CScript() << OP_1;
-    hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-    tx.vout[0].scriptPubKey = CScript() << OP_2;
-    hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
-    mempool.clear();
+    // Free transactions arriving after the area is full stay out of the
+    // extended selection, as they would out of a fresh one
+    CTransaction txHigh2 = Spend(AddCoin(), COIN, 0);
+    AddToMempool(txLow, 0);
+    AddToMempool(txHigh2, 0, dHighPriority);
+    BOOST_CHECK(Select(vtx, nullptr, nSmallArea));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(Position(vtx, txLow), -1);
+    BOOST_CHECK_EQUAL(Position(vtx, txHigh2), -1);
+}
 
-    // subsidy changing
-    int nHeight = chainActive.Height();
-    chainActive.Tip()->nHeight = 209999;
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
-    chainActive.Tip()->nHeight = 210000;
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    delete pblocktemplate;
-    chainActive.Tip()->nHeight = nHeight;
-
-    // non-final txs in mempool
-    SetMockTime(chainActive.Tip()->GetMedianTimePast()+1);
-
-    // height locked
-    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
-    tx.vin[0].scriptSig = CScript() << OP_1;
-    tx.vin[0].nSequence = 0;
-    tx.vout[0].nValue = 4900000000LL;
-    tx.vout[0].scriptPubKey = CScript() << OP_1;
-    tx.nLockTime = chainActive.Tip()->nHeight+1;
-    hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
-    BOOST_CHECK(!IsFinalTx(tx, chainActive.Tip()->nHeight + 1));
-
-    // time locked
-    tx2.vin.resize(1);
-    tx2.vin[0].prevout.hash = txFirst[1]->GetHash();
-    tx2.vin[0].prevout.n = 0;
-    tx2.vin[0].scriptSig = CScript() << OP_1;
-    tx2.vin[0].nSequence = 0;
-    tx2.vout.resize(1);
-    tx2.vout[0].nValue = 4900000000LL;
-    tx2.vout[0].scriptPubKey = CScript() << OP_1;
-    tx2.nLockTime = chainActive.Tip()->GetMedianTimePast()+1;
-    hash = tx2.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx2, 11, GetTime(), 111.0, 11));
-    BOOST_CHECK(!IsFinalTx(tx2));
-
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-
-    // Neither tx should have make it into the template.
-    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
-    delete pblocktemplate;
-
-    // However if we advance height and time by one, both will.
-    chainActive.Tip()->nHeight++;
-    SetMockTime(chainActive.Tip()->GetMedianTimePast()+2);
-
-    BOOST_CHECK(IsFinalTx(tx, chainActive.Tip()->nHeight + 1));
-    BOOST_CHECK(IsFinalTx(tx2));
-
-    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
-    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
-    delete pblocktemplate;
-
-    chainActive.Tip()->nHeight--;
-    SetMockTime(0);
-    mempool.clear();
+BOOST_AUTO_TEST_CASE(miner_retry_nonfinal)
+{
+    std::vector<CTransaction> vtx;
+
+    CMutableTransaction txLocked = Spend(AddCoin(), COIN, 20000);
+    txLocked.nLockTime = GetTime() + 600;
+    txLocked.vin[0].nSequence = 0;
+    CTransaction txFinal = Spend(AddCoin(), COIN, 10000);
+    AddToMempool(txLocked, 20000);
+    AddToMempool(txFinal, 10000);
+
+    BOOST_CHECK(!Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(Position(vtx, txFinal), 0);
+
+    // Still locked: left out again, but looked at
+    SetMockTime(txLocked.nLockTime - 1);
+    BOOST_CHECK(Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 1U);
+
+    // Final now: the extended selection picks it up
+    SetMockTime(txLocked.nLockTime + 1);
+    BOOST_CHECK(Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(Position(vtx, CTransaction(txLocked)), 1);
+}
+
+BOOST_AUTO_TEST_CASE(miner_zerocoin_spends)
+{
+    std::vector<CTransaction> vtx;
+    libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
+
+    // A v2 coin, minted by a transaction in the pool
+    libzerocoin::PrivateCoin privCoin(params, libzerocoin::CoinDenomination::ZQ_ONE, true);
+    CPrivKey privKey = privCoin.getPrivKey();
+    CZerocoinMint mint(privCoin.getPublicCoin().getDenomination(), privCoin.getPublicCoin().getValue(),
+                       privCoin.getRandomness(), privCoin.getSerialNumber(), false, privCoin.getVersion(), &privKey);
+
+    CMutableTransaction txMint;
+    CScript scriptMint = CScript() << OP_ZEROCOINMINT << privCoin.getPublicCoin().getValue().getvch().size() << privCoin.getPublicCoin().getValue().getvch();
+    txMint.vout.push_back(CTxOut(libzerocoin::ZerocoinDenominationToAmount(libzerocoin::CoinDenomination::ZQ_ONE), scriptMint));
+    mint.SetOutputIndex(0);
+    mint.SetTxHash(txMint.GetHash());
+    AddToMempool(txMint, 0);
+
+    // Two public spends of the same coin
+    std::vector<CTransaction> vSpends;
+    for (CAmount nValue : {1 * CENT, 2 * CENT}) {
+        CMutableTransaction txSpend;
+        txSpend.vout.push_back(CTxOut(nValue, CScript() << OP_TRUE));
+        CTxIn in;
+        BOOST_CHECK(sKKCModule::createInput(in, mint, txSpend.GetHash(), 4));
+        txSpend.vin.push_back(in);
+        vSpends.push_back(txSpend);
+    }
+
+    CTransaction txFee = Spend(AddCoin(), COIN, 100000);
+    AddToMempool(txFee, 100000);
+    for (size_t i = 0; i < vSpends.size(); i++) {
+        AddToMempool(vSpends[i], 0);
+        mapZerocoinspends[vSpends[i].GetHash()] = GetTime() + i;
+    }
 
-    for (CTransaction *tx : txFirst)
-        delete tx;
+    // The spend received first goes first, ahead of any fee; the other
+    // spends the same serial.
+    BOOST_CHECK(!Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(Position(vtx, vSpends[0]), 0);
+    BOOST_CHECK_EQUAL(Position(vtx, txFee), 1);
+    BOOST_CHECK_EQUAL(Position(vtx, vSpends[1]), -1);
 
-    Checkpoints::fEnabled = true;
+    // Once the first is gone, the second takes its place
+    std::list<CTransaction> removed;
+    mempool.remove(vSpends[0], removed);
+    BOOST_CHECK(!Select(vtx));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(Position(vtx, vSpends[1]), 0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,250 @@
+// Copyright (c) 2011-2015 The Bitcoin Core developers
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "policy/fees.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <boost/test/unit_test.hpp>
+#include <list>
+
+BOOST_AUTO_TEST_SUITE(policyestimator_tests)
+
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
+{
+    CTxMemPool mpool(CFeeRate(1000));
+    CAmount basefee(2000);
+    double basepri = 1e9;
+    CAmount deltaFee(100);
+    std::vector<CAmount> feeV[2];
+    std::vector<double> priV[2];
+
+    // Populate vectors of increasing fees or priorities; priorities are
+    // two priority buckets apart
+    for (int j = 0; j < 10; j++) {
+        //V[0] is for fee transactions
+        feeV[0].push_back(basefee * (j + 1));
+        priV[0].push_back(0);
+        //V[1] is for priority transactions
+        feeV[1].push_back(CAmount(0));
+        priV[1].push_back(basepri * pow(4, j));
+    }
+
+    // Store the hashes of transactions that have been
+    // added to the mempool by their associate fee/pri
+    // txHashes[j] is populated with transactions either of
+    // fee = basefee * (j+1)  OR  pri = basepri * 4^j
+    std::vector<uint256> txHashes[10];
+
+    // Create a transaction template
+    CScript garbage;
+    for (unsigned int i = 0; i < 128; i++)
+        garbage.push_back('X');
+    CMutableTransaction tx;
+    std::list<CTransaction> dummyConflicted;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = garbage;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 0LL;
+    CFeeRate baseRate(basefee, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+
+    // Create a fake block
+    std::vector<CTransaction> block;
+    int blocknum = 0;
+
+    // Loop through 200 blocks
+    // At a decay .998 and 4 fee transactions per block
+    // This makes the tx count about 1.33 per bucket, above the 1 threshold
+    while (blocknum < 200) {
+        for (int j = 0; j < 10; j++) {    // For each fee/pri multiple
+            for (int k = 0; k < 5; k++) { // add 4 fee txs for every priority tx
+                tx.vin[0].prevout.n = 10000 * blocknum + 100 * j + k; // make transaction unique
+                uint256 hash = tx.GetHash();
+                mpool.addUnchecked(hash, CTxMemPoolEntry(tx, feeV[k / 4][j], GetTime(), priV[k / 4][j], blocknum));
+                txHashes[j].push_back(hash);
+            }
+        }
+        //Create blocks where higher fee/pri txs are included more often
+        for (int h = 0; h <= blocknum % 10; h++) {
+            // 10/10 blocks add highest fee/pri transactions
+            // 9/10 blocks add 2nd highest and so on until ...
+            // 1/10 blocks add lowest fee/pri transactions
+            while (txHashes[9 - h].size()) {
+                CTransaction btx;
+                if (mpool.lookup(txHashes[9 - h].back(), btx))
+                    block.push_back(btx);
+                txHashes[9 - h].pop_back();
+            }
+        }
+        mpool.removeForBlock(block, ++blocknum, dummyConflicted);
+        block.clear();
+        if (blocknum == 30) {
+            // At this point we should need to combine 5 buckets to get enough data points
+            // So estimateFee(1) should fail and estimateFee(4), which all of the top 5
+            // feerates nearly always make, should return their median, somewhere around
+            // 8*baserate
+            BOOST_CHECK(mpool.estimateFee(1) == CFeeRate(0));
+            BOOST_CHECK(mpool.estimateFee(4).GetFeePerK() < 8 * baseRate.GetFeePerK() + deltaFee);
+            BOOST_CHECK(mpool.estimateFee(4).GetFeePerK() > 8 * baseRate.GetFeePerK() - deltaFee);
+        }
+    }
+
+    std::vector<CAmount> origFeeEst;
+    std::vector<double> origPriEst;
+    // Highest feerate is 10*baseRate and gets in all blocks,
+    // second highest feerate is 9*baseRate and gets in 9/10 blocks = 90%,
+    // third highest feerate is 8*base rate, and gets in 8/10 blocks = 80%,
+    // so estimateFee(1) should return 10*baseRate.
+    // Second highest feerate has 100% chance of being included by 2 blocks,
+    // so estimateFee(2) should return 9*baseRate etc...
+    for (int i = 1; i < 10; i++) {
+        origFeeEst.push_back(mpool.estimateFee(i).GetFeePerK());
+        origPriEst.push_back(mpool.estimatePriority(i));
+        if (i > 1) { // Fee estimates should be monotonically decreasing
+            BOOST_CHECK(origFeeEst[i - 1] <= origFeeEst[i - 2]);
+            BOOST_CHECK(origPriEst[i - 1] <= origPriEst[i - 2]);
+        }
+        BOOST_CHECK(origFeeEst[i - 1] < (11 - i) * baseRate.GetFeePerK() + deltaFee);
+        BOOST_CHECK(origFeeEst[i - 1] > (11 - i) * baseRate.GetFeePerK() - deltaFee);
+        BOOST_CHECK_CLOSE(origPriEst[i - 1], priV[1][10 - i], 1);
+    }
+
+    // Mine 50 more blocks with no transactions happening, estimates shouldn't change
+    // We haven't decayed the moving average enough so we still have enough data points in every bucket
+    while (blocknum < 250)
+        mpool.removeForBlock(block, ++blocknum, dummyConflicted);
+
+    for (int i = 1; i < 10; i++) {
+        BOOST_CHECK(mpool.estimateFee(i).GetFeePerK() < origFeeEst[i - 1] + deltaFee);
+        BOOST_CHECK(mpool.estimateFee(i).GetFeePerK() > origFeeEst[i - 1] - deltaFee);
+        BOOST_CHECK_CLOSE(mpool.estimatePriority(i), origPriEst[i - 1], 1);
+    }
+
+    // Mine 15 more blocks with lots of transactions happening and not getting mined
+    // Estimates should go up
+    while (blocknum < 265) {
+        for (int j = 0; j < 10; j++) {    // For each fee/pri multiple
+            for (int k = 0; k < 5; k++) { // add 4 fee txs for every priority tx
+                tx.vin[0].prevout.n = 10000 * blocknum + 100 * j + k;
+                uint256 hash = tx.GetHash();
+                mpool.addUnchecked(hash, CTxMemPoolEntry(tx, feeV[k / 4][j], GetTime(), priV[k / 4][j], blocknum));
+                txHashes[j].push_back(hash);
+            }
+        }
+        mpool.removeForBlock(block, ++blocknum, dummyConflicted);
+    }
+
+    for (int i = 1; i < 10; i++) {
+        BOOST_CHECK(mpool.estimateFee(i) == CFeeRate(0) || mpool.estimateFee(i).GetFeePerK() > origFeeEst[i - 1] - deltaFee);
+        BOOST_CHECK(mpool.estimatePriority(i) == -1 || mpool.estimatePriority(i) > origPriEst[i - 1] * 0.99);
+    }
+
+    // Mine all those transactions
+    // Estimates should still not be below original
+    for (int j = 0; j < 10; j++) {
+        while (txHashes[j].size()) {
+            CTransaction btx;
+            if (mpool.lookup(txHashes[j].back(), btx))
+                block.push_back(btx);
+            txHashes[j].pop_back();
+        }
+    }
+    mpool.removeForBlock(block, 265, dummyConflicted);
+    block.clear();
+    for (int i = 1; i < 10; i++) {
+        BOOST_CHECK(mpool.estimateFee(i) == CFeeRate(0) || mpool.estimateFee(i).GetFeePerK() > origFeeEst[i - 1] - deltaFee);
+        BOOST_CHECK(mpool.estimatePriority(i) == -1 || mpool.estimatePriority(i) > origPriEst[i - 1] * 0.99);
+    }
+
+    // Mine 200 more blocks where everything is mined every block
+    // Estimates should be below original estimates (not possible for last estimate)
+    while (blocknum < 465) {
+        for (int j = 0; j < 10; j++) {    // For each fee/pri multiple
+            for (int k = 0; k < 5; k++) { // add 4 fee txs for every priority tx
+                tx.vin[0].prevout.n = 10000 * blocknum + 100 * j + k;
+                uint256 hash = tx.GetHash();
+                mpool.addUnchecked(hash, CTxMemPoolEntry(tx, feeV[k / 4][j], GetTime(), priV[k / 4][j], blocknum));
+                CTransaction btx;
+                if (mpool.lookup(hash, btx))
+                    block.push_back(btx);
+            }
+        }
+        mpool.removeForBlock(block, ++blocknum, dummyConflicted);
+        block.clear();
+    }
+    for (int i = 1; i < 9; i++) {
+        BOOST_CHECK(mpool.estimateFee(i).GetFeePerK() < origFeeEst[i - 1] - deltaFee);
+        BOOST_CHECK(mpool.estimatePriority(i) < origPriEst[i - 1] * 0.99);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesSkipDependentTxs)
+{
+    // A child of an unconfirmed parent is mined with its parent, not for its
+    // own fee, so it must not count towards the estimates.
+    CTxMemPool mpool(CFeeRate(1000));
+    std::list<CTransaction> dummyConflicted;
+
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vin[0].scriptSig = CScript() << OP_11;
+    parent.vout.resize(1);
+    parent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    parent.vout[0].nValue = 10 * COIN;
+
+    for (int blocknum = 0; blocknum < 100; blocknum++) {
+        parent.vin[0].prevout.n = blocknum;
+        CMutableTransaction child;
+        child.vin.resize(1);
+        child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+        child.vin[0].scriptSig = CScript() << OP_11;
+        child.vout.resize(1);
+        child.vout[0].nValue = 10 * COIN - 100000;
+
+        mpool.addUnchecked(parent.GetHash(), CTxMemPoolEntry(parent, 0, GetTime(), 0, blocknum));
+        mpool.addUnchecked(child.GetHash(), CTxMemPoolEntry(child, 100000, GetTime(), 0, blocknum));
+
+        // Only the child pays; mine both right away
+        std::vector<CTransaction> block;
+        block.push_back(parent);
+        block.push_back(child);
+        mpool.removeForBlock(block, blocknum + 1, dummyConflicted);
+    }
+    BOOST_CHECK_EQUAL(mpool.size(), 0U);
+    for (int i = 1; i <= (int)MAX_BLOCK_CONFIRMS; i++)
+        BOOST_CHECK(mpool.estimateFee(i) == CFeeRate(0));
+}
+
+BOOST_AUTO_TEST_CASE(FeeEstimatesFileVersion)
+{
+    CTxMemPool mpool(CFeeRate(1000));
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(mpool.WriteFeeEstimates(file));
+
+    // Releases up to 3.0.0 read fee samples and must see the file as too new
+    int nVersionRequired, nVersionThatWrote;
+    rewind(file.Get());
+    file >> nVersionRequired >> nVersionThatWrote;
+    BOOST_CHECK(nVersionRequired > 3000000);
+    BOOST_CHECK_EQUAL(nVersionThatWrote, CLIENT_VERSION);
+
+    // ... while this version reads it back
+    rewind(file.Get());
+    CTxMemPool mpoolRead(CFeeRate(1000));
+    BOOST_CHECK(mpoolRead.ReadFeeEstimates(file));
+
+    // Files of the sample format are ignored, files of a later format rejected
+    for (int nVersion : {120000, std::max(CLIENT_VERSION, nVersionRequired) + 1}) {
+        CAutoFile other(tmpfile(), SER_DISK, CLIENT_VERSION);
+        other << nVersion << CLIENT_VERSION;
+        rewind(other.Get());
+        BOOST_CHECK(!mpoolRead.ReadFeeEstimates(other));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,7 +4,9 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "main.h"
+#include "streams.h"
 #include "util.h"
 #include "test/test_kabberry.h"
 
@@ -101,4 +103,58 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(zerocoin_supply_serialization)
+{
+    // The inline supply is stored the way the old std::map was.
+    std::map<libzerocoin::CoinDenomination, int64_t> mapSupply;
+    CZerocoinSupply supply;
+    int64_t n = 3;
+    for (auto denom : libzerocoin::zerocoinDenomList) {
+        mapSupply[denom] = n;
+        supply.at(denom) = n;
+        n *= 7;
+    }
+    CDataStream ssMap(SER_DISK, CLIENT_VERSION);
+    ssMap << mapSupply;
+    CDataStream ssSupply(SER_DISK, CLIENT_VERSION);
+    ssSupply << supply;
+    BOOST_CHECK_EQUAL(ssSupply.str(), ssMap.str());
+    BOOST_CHECK_EQUAL(ssSupply.size(), ::GetSerializeSize(supply, SER_DISK, CLIENT_VERSION));
+
+    CZerocoinSupply supply2;
+    ssMap >> supply2;
+    BOOST_CHECK(supply2 == supply);
+
+    // Missing denominations read as 0.
+    mapSupply.erase(libzerocoin::ZQ_FIFTY);
+    CDataStream ssPartial(SER_DISK, CLIENT_VERSION);
+    ssPartial << mapSupply;
+    ssPartial >> supply2;
+    BOOST_CHECK_EQUAL(supply2.at(libzerocoin::ZQ_FIFTY), 0);
+    BOOST_CHECK_EQUAL(supply2.at(libzerocoin::ZQ_FIVE), supply.at(libzerocoin::ZQ_FIVE));
+
+    BOOST_CHECK_THROW(supply.at(libzerocoin::ZQ_ERROR), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_arena)
+{
+    CBlockIndexArena arena(4);
+    std::vector<CBlockIndex*> vIndex;
+    for (int i = 0; i < 10; i++) {
+        vIndex.push_back(arena.New());
+        vIndex.back()->nHeight = i;
+        BOOST_CHECK_EQUAL(vIndex.back()->GetZcMints(libzerocoin::ZQ_ONE), 0);
+    }
+    BOOST_CHECK_EQUAL(arena.Size(), 10U);
+    BOOST_CHECK(arena.DynamicMemoryUsage() >= 3 * 4 * sizeof(CBlockIndex));
+    // Entries in a chunk are contiguous and keep their values as more are added.
+    BOOST_CHECK(vIndex[1] == vIndex[0] + 1);
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK_EQUAL(vIndex[i]->nHeight, i);
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.Size(), 0U);
+    BOOST_CHECK_EQUAL(arena.DynamicMemoryUsage(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,8 +8,11 @@
 
 #include "test_kabberry.h"
 
+#include "crypto/quark.h"
+#include "crypto/sha256.h"
 #include "main.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "guiinterface.h"
 #include "util.h"
@@ -31,9 +34,13 @@ extern void noui_connect();
 
 BasicTestingSetup::BasicTestingSetup()
 {
+        SHA256AutoDetect();
+        QuarkAutoDetect();
         RandomInit();
         ECC_Start();
         SetupEnvironment();
+        InitSignatureCache();
+        InitScriptExecutionCache();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::MAIN);
@@ -52,9 +59,10 @@ TestingSetup::TestingSetup()
         pathTemp = GetTempPath() / strprintf("test_kabberry_%lu_%i", (unsigned long)GetTime(), (int)(InsecureRandRange(100000)));
         boost::filesystem::create_directories(pathTemp);
         mapArgs["-datadir"] = pathTemp.string();
-        pblocktree = new CBlockTreeDB(1 << 20, true);
-        pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+        pblocktree = new CBlockTreeDB(CLevelDBProfile(1 << 20), true);
+        pcoinsdbview = new CCoinsViewDB(CLevelDBProfile(1 << 23), true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        zerocoinDB = new CZerocoinDB(CLevelDBProfile(1 << 20), true);
         InitBlockIndex();
 #ifdef ENABLE_WALLET
         bool fFirstRun;
@@ -82,6 +90,8 @@ TestingSetup::~TestingSetup()
         delete pcoinsTip;
         delete pcoinsdbview;
         delete pblocktree;
+        delete zerocoinDB;
+        zerocoinDB = NULL;
 #ifdef ENABLE_WALLET
         bitdb.Flush(true);
         bitdb.Reset();
@@ -0,0 +1,99 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "main.h"
+#include "script/script.h"
+#include "txdb.h"
+#include "util.h"
+#include "utxosnapshot.h"
+#include "test/test_kabberry.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(utxosnapshot_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(dump_and_load)
+{
+    std::vector<COutPoint> vOutpoints;
+    for (int i = 0; i < 2; i++) {
+        const uint256 txid = InsecureRand256();
+        for (uint32_t n = 0; n < 3; n++) {
+            vOutpoints.push_back(COutPoint(txid, n));
+            pcoinsTip->AddCoin(vOutpoints.back(), Coin(CTxOut(1000 * (n + 1), CScript() << OP_TRUE), 1, i == 0, false), false);
+        }
+    }
+    const uint256 hashPubcoin = InsecureRand256();
+    const uint256 hashTx = InsecureRand256();
+    BOOST_REQUIRE(zerocoinDB->Write(std::make_pair('m', hashPubcoin), hashTx));
+    FlushStateToDisk();
+    CCoinsStats statsDB;
+    BOOST_REQUIRE(pcoinsTip->GetStats(statsDB));
+
+    const boost::filesystem::path path = GetDataDir() / "utxo.dat";
+    CUTXOSnapshotHeader header;
+    CCoinsStats stats;
+    uint256 hashSnapshot, hashLoaded;
+    std::string strError;
+    BOOST_REQUIRE(DumpTxOutSet(path, header, stats, hashSnapshot, strError));
+    BOOST_CHECK(header.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK(stats.hashSerialized == statsDB.hashSerialized);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 2U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 6U);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 12000);
+    BOOST_CHECK(!DumpTxOutSet(path, header, stats, hashLoaded, strError)); // never overwritten
+
+    // Loading needs prune mode and an empty chain state.
+    BOOST_CHECK(!LoadTxOutSet(path, hashSnapshot, header, stats, hashLoaded, strError));
+    fPruneMode = true;
+    BOOST_CHECK(!LoadTxOutSet(path, hashSnapshot, header, stats, hashLoaded, strError));
+    for (const COutPoint& outpoint : vOutpoints)
+        pcoinsTip->SpendCoin(outpoint);
+    BOOST_REQUIRE(zerocoinDB->Erase(std::make_pair('m', hashPubcoin)));
+    FlushStateToDisk();
+
+    // Neither another snapshot, nor a truncated one, nor one whose zerocoin
+    // records were changed is loaded; hash_serialized_2 alone does not vouch for it.
+    BOOST_CHECK(!LoadTxOutSet(path, InsecureRand256(), header, stats, hashLoaded, strError));
+    BOOST_CHECK(!LoadTxOutSet(path, statsDB.hashSerialized, header, stats, hashLoaded, strError));
+    const boost::filesystem::path pathTruncated = GetDataDir() / "truncated.dat";
+    boost::filesystem::copy_file(path, pathTruncated);
+    boost::filesystem::resize_file(pathTruncated, boost::filesystem::file_size(path) - 8);
+    BOOST_CHECK(!LoadTxOutSet(pathTruncated, hashSnapshot, header, stats, hashLoaded, strError));
+    const boost::filesystem::path pathTampered = GetDataDir() / "tampered.dat";
+    {
+        boost::filesystem::ifstream filein(path, std::ios::binary);
+        std::string strData((std::istreambuf_iterator<char>(filein)), std::istreambuf_iterator<char>());
+        size_t nPos = strData.find(std::string(hashTx.begin(), hashTx.end()));
+        BOOST_REQUIRE(nPos != std::string::npos);
+        strData[nPos] ^= 1;
+        boost::filesystem::ofstream fileout(pathTampered, std::ios::binary);
+        fileout << strData;
+    }
+    BOOST_CHECK(!LoadTxOutSet(pathTampered, hashSnapshot, header, stats, hashLoaded, strError));
+    BOOST_CHECK(stats.hashSerialized == statsDB.hashSerialized);
+    BOOST_CHECK(hashLoaded != hashSnapshot);
+    BOOST_CHECK(!pcoinsTip->HaveCoin(vOutpoints[0]));
+
+    BOOST_REQUIRE(LoadTxOutSet(path, hashSnapshot, header, stats, hashLoaded, strError));
+    BOOST_CHECK(hashLoaded == hashSnapshot);
+    for (const COutPoint& outpoint : vOutpoints)
+        BOOST_CHECK(pcoinsTip->HaveCoin(outpoint));
+    uint256 hashTxRead;
+    BOOST_CHECK(zerocoinDB->ReadCoinMint(hashPubcoin, hashTxRead) && hashTxRead == hashTx);
+    CCoinsStats statsLoaded;
+    BOOST_REQUIRE(pcoinsTip->GetStats(statsLoaded));
+    BOOST_CHECK(statsLoaded.hashSerialized == statsDB.hashSerialized);
+    BOOST_CHECK(fHavePruned);
+
+    fPruneMode = false;
+    fHavePruned = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "libzerocoin/Coin.h"
 #include "libzerocoin/CoinRandomnessSchnorrSignature.h"
 #include "amount.h"
+#include "checkqueue.h"
 #include "chainparams.h"
 #include "coincontrol.h"
 #include "main.h"
@@ -15,7 +16,9 @@
 #include "txdb.h"
 #include "skkc/skkcmodule.h"
 #include "test/test_kabberry.h"
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 #include <iostream>
 
 
@@ -287,4 +290,106 @@ BOOST_AUTO_TEST_CASE(zerocoin_public_spend_test)
 
 }
 
+BOOST_AUTO_TEST_CASE(zerocoin_spend_block_checks_test)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    libzerocoin::ZerocoinParams *ZCParams_v2 = Params().Zerocoin_Params(false);
+
+    // a v2 coin, minted by a transaction in the mempool
+    libzerocoin::PrivateCoin privCoin(ZCParams_v2, libzerocoin::CoinDenomination::ZQ_ONE, true);
+    CPrivKey privKey = privCoin.getPrivKey();
+    CZerocoinMint mint = CZerocoinMint(
+            privCoin.getPublicCoin().getDenomination(),
+            privCoin.getPublicCoin().getValue(),
+            privCoin.getRandomness(),
+            privCoin.getSerialNumber(),
+            false,
+            privCoin.getVersion(),
+            &privKey);
+
+    CMutableTransaction mintTx;
+    CScript scriptSerializedCoin = CScript()
+    << OP_ZEROCOINMINT << privCoin.getPublicCoin().getValue().getvch().size() << privCoin.getPublicCoin().getValue().getvch();
+    mintTx.vout.push_back(CTxOut(libzerocoin::ZerocoinDenominationToAmount(privCoin.getPublicCoin().getDenomination()), scriptSerializedCoin));
+    mint.SetOutputIndex(0);
+    mint.SetTxHash(mintTx.GetHash());
+    mempool.addUnchecked(mintTx.GetHash(), CTxMemPoolEntry(mintTx, 0, GetTime(), 0.0, chainActive.Height()));
+
+    // a valid spend, and one whose signature covers other outputs
+    CMutableTransaction validTx, invalidTx;
+    validTx.vout.push_back(CTxOut(1*CENT, CScript() << OP_TRUE));
+    invalidTx.vout.push_back(CTxOut(2*CENT, CScript() << OP_TRUE));
+    CTxIn in;
+    BOOST_CHECK(sKKCModule::createInput(in, mint, validTx.GetHash(), 4));
+    validTx.vin.push_back(in);
+    invalidTx.vin.push_back(in);
+
+    CBlockIndex index;
+    index.nHeight = std::max(Params().Zerocoin_Block_V2_Start(), Params().Zerocoin_Block_Public_Spend_Enabled());
+
+    CCheckQueue<CBlockCheck> queue(128);
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CBlockCheck>::Thread, &queue));
+
+    // the valid spend passes, on the check threads and inline
+    {
+        CValidationState state;
+        CAmount nValueIn = 0;
+        std::vector<std::pair<libzerocoin::CoinSpend, uint256> > vSpends;
+        std::vector<CBlockCheck> vChecks;
+        BOOST_CHECK(CheckZerocoinSpendInputs(validTx, state, &index, nValueIn, vSpends, &vChecks));
+        BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+        BOOST_CHECK_EQUAL(vSpends.size(), 1U);
+        BOOST_CHECK_EQUAL(nValueIn, COIN);
+        CCheckQueueControl<CBlockCheck> control(&queue);
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK(CheckZerocoinSpendInputs(validTx, state, &index, nValueIn, vSpends));
+    }
+
+    // the invalid spend fails its queued check, and inline
+    {
+        CValidationState state;
+        CAmount nValueIn = 0;
+        std::vector<std::pair<libzerocoin::CoinSpend, uint256> > vSpends;
+        std::vector<CBlockCheck> vChecks;
+        BOOST_CHECK(CheckZerocoinSpendInputs(validTx, state, &index, nValueIn, vSpends, &vChecks));
+        BOOST_CHECK(CheckZerocoinSpendInputs(invalidTx, state, &index, nValueIn, vSpends, &vChecks));
+        BOOST_CHECK_EQUAL(vChecks.size(), 2U);
+        CCheckQueueControl<CBlockCheck> control(&queue);
+        control.Add(vChecks);
+        BOOST_CHECK(!control.Wait());
+        BOOST_CHECK(!CheckZerocoinSpendInputs(invalidTx, state, &index, nValueIn, vSpends));
+        BOOST_CHECK_EQUAL(state.GetRejectCode(), REJECT_INVALID);
+    }
+
+    // once the serial is spent in the chain, the valid spend is rejected
+    // before anything is queued; make the genesis coinbase the earlier spend
+    {
+        LOCK(cs_main);
+        CBlock genesis;
+        BOOST_CHECK(ReadBlockFromDisk(genesis, chainActive.Genesis()));
+        std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+        vPos.push_back(std::make_pair(genesis.vtx[0].GetHash(), CDiskTxPos(chainActive.Genesis()->GetBlockPos(), GetSizeOfCompactSize(genesis.vtx.size()))));
+        BOOST_CHECK(pblocktree->WriteTxIndex(vPos));
+        std::vector<std::pair<libzerocoin::CoinSpend, uint256> > vSpent;
+        vSpent.push_back(std::make_pair(sKKCModule::parseCoinSpend(in), genesis.vtx[0].GetHash()));
+        BOOST_CHECK(zerocoinDB->WriteCoinSpendBatch(vSpent));
+    }
+    {
+        CValidationState state;
+        CAmount nValueIn = 0;
+        std::vector<std::pair<libzerocoin::CoinSpend, uint256> > vSpends;
+        std::vector<CBlockCheck> vChecks;
+        BOOST_CHECK(!CheckZerocoinSpendInputs(validTx, state, &index, nValueIn, vSpends, &vChecks));
+        BOOST_CHECK(vChecks.empty());
+        BOOST_CHECK_EQUAL(state.GetRejectCode(), REJECT_INVALID);
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,40 +7,127 @@
 
 #include "txdb.h"
 
+#include "guiinterface.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
 #include "uint256.h"
+#include "util.h"
 
+#include <algorithm>
+#include <iterator>
+#include <map>
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+static const char DB_COIN = 'C';
+static const char DB_COINS = 'c';
+static const char DB_ROLLING_STATS = 'S';
+
+namespace
 {
-    if (coins.IsPruned())
-        batch.Erase(std::make_pair('c', hash));
-    else
-        batch.Write(std::make_pair('c', hash), coins);
-}
+/** Key of a 'C' record: the outpoint, with its index as a VARINT. */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+/**
+ * A 'c' record of the per-transaction format used before the UTXO set was
+ * stored per output. Only read, by CCoinsViewDB::Upgrade().
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode), where bit 1 is the coinbase flag, bit 2 the coinstake
+ *   flag, bits 4 and 8 mark vout[0] and vout[1] unspent, and the higher bits
+ *   count the non-zero bytes of the bitvector that follows
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ */
+struct CCoinsLegacy {
+    bool fCoinBase;
+    bool fCoinStake;
+    std::vector<CTxOut> vout;
+    int nHeight;
+
+    CCoinsLegacy() : fCoinBase(false), fCoinStake(false), nHeight(0) {}
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned int nCode = 0;
+        int nTxVersion = 0;
+        ::Unserialize(s, VARINT(nTxVersion), nType, nVersion);
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        fCoinStake = (nCode & 2) != 0;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 4) != 0;
+        vAvail[1] = (nCode & 8) != 0;
+        unsigned int nMaskCode = (nCode / 16) + ((nCode & 12) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++)
+                vAvail.push_back((chAvail & (1 << p)) != 0);
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
+} // anon namespace
 
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
 {
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CDBProfiles::CDBProfiles(size_t nCoinDBCache, size_t nBlockTreeDBCache, bool fCompression, int nMaxOpenFiles)
+    : coins(nCoinDBCache), blockTree(nBlockTreeDBCache), zerocoin(1 << 21), spork(1 << 20)
+{
+    blockTree.nBlockSize = 16 * 1024;
+    spork.nBloomBits = 0;
+    for (CLevelDBProfile* profile : {&coins, &blockTree, &zerocoin, &spork})
+        profile->fCompression = fCompression && LevelDBCompressionAvailable();
+    coins.nMaxOpenFiles = blockTree.nMaxOpenFiles = std::max(16, nMaxOpenFiles);
+    zerocoin.nMaxOpenFiles = spork.nMaxOpenFiles = 16;
+}
+
+CCoinsViewDB::CCoinsViewDB(const CLevelDBProfile& profile, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", profile, fMemory, fWipe)
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
+bool CCoinsViewDB::GetCoin(const COutPoint& outpoint, Coin& coin) const
 {
-    return db.Read(std::make_pair('c', txid), coins);
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256& txid) const
+bool CCoinsViewDB::HaveCoin(const COutPoint& outpoint) const
 {
-    return db.Exists(std::make_pair('c', txid));
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
@@ -51,28 +138,35 @@ uint256 CCoinsViewDB::GetBestBlock() const
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
 {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = fErase ? mapCoins.erase(it) : std::next(it)) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
+            else
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
-    if (hashBlock != uint256(0))
+    if (hashBlock != uint256(0)) {
         BatchWriteHashBestChain(batch, hashBlock);
+        if (statsPending.hashBlock == hashBlock)
+            batch.Write(DB_ROLLING_STATS, statsPending);
+        else
+            batch.Erase(DB_ROLLING_STATS);
+    }
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
+CBlockTreeDB::CBlockTreeDB(const CLevelDBProfile& profile, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", profile, fMemory, fWipe)
 {
 }
 
@@ -105,58 +199,169 @@ bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
     return Read('l', nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
+void ApplyStats(CCoinsStats& stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 4 + (outputs.begin()->second.fCoinBase ? 2 : 0) + (outputs.begin()->second.fCoinStake ? 1 : 0));
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.out;
+        stats.nTransactionOutputs++;
+        stats.nSerializedSize += 32 + ::GetSerializeSize(output.second, SER_DISK, CLIENT_VERSION);
+        stats.nTotalAmount += output.second.out.nValue;
+    }
+    ss << VARINT(0);
+}
+
+leveldb::Iterator* CCoinsViewDB::NewCoinsCursor() const
 {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    leveldb::Iterator* pcursor = const_cast<CLevelDBWrapper*>(&db)->NewIterator();
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << DB_COIN;
+    pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
+    return pcursor;
+}
 
+bool CCoinsViewDB::ReadNextTx(leveldb::Iterator* pcursor, uint256& hash, std::map<uint32_t, Coin>& outputs)
+{
+    outputs.clear();
+    // Outputs of one transaction are adjacent, as the key starts with its hash.
+    while (pcursor->Valid()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        ssKey >> chType;
+        if (chType != DB_COIN)
+            break;
+        COutPoint outpoint;
+        ssKey >> outpoint.hash;
+        if (!outputs.empty() && outpoint.hash != hash)
+            break;
+        ssKey >> VARINT(outpoint.n);
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        hash = outpoint.hash;
+        ssValue >> outputs[outpoint.n];
+        pcursor->Next();
+    }
+    return !outputs.empty();
+}
+
+bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewCoinsCursor());
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+    uint256 hash;
+    std::map<uint32_t, Coin> outputs;
+    try {
+        while (ReadNextTx(pcursor.get(), hash, outputs)) {
+            boost::this_thread::interruption_point();
+            ApplyStats(stats, ss, hash, outputs);
+        }
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
+    stats.hashSerialized = ss.GetHash();
+    return true;
+}
+
+bool CCoinsViewDB::ReadRollingStats(CRollingCoinsStats& stats) const
+{
+    return db.Read(DB_ROLLING_STATS, stats);
+}
+
+bool CCoinsViewDB::ComputeRollingStats(CRollingCoinsStats& stats) const
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewCoinsCursor());
+    stats = CRollingCoinsStats();
+    stats.hashBlock = GetBestBlock();
+    uint256 hash;
+    std::map<uint32_t, Coin> outputs;
+    try {
+        while (ReadNextTx(pcursor.get(), hash, outputs)) {
+            boost::this_thread::interruption_point();
+            for (const auto& output : outputs)
+                stats.AddCoin(COutPoint(hash, output.first), output.second);
+        }
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CCoinsViewDB::Upgrade()
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << DB_COINS;
+    pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
+    if (!pcursor->Valid() || pcursor->key()[0] != DB_COINS)
+        return true;
+
+    LogPrintf("Upgrading UTXO database to per-output records...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database..."), 0);
+    CLevelDBBatch batch;
+    size_t nRecords = 0;
+    size_t nBatched = 0;
+    int nReportDone = 0;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
         try {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+            if (chType != DB_COINS)
+                break;
+            uint256 txid;
+            ssKey >> txid;
+            // Keys are sorted by the txid's first byte, which gives a fair progress estimate.
+            int nPercentageDone = (int)(*txid.begin() * 100.0 / 256.0 + 0.5);
+            if (nPercentageDone > nReportDone) {
+                uiInterface.ShowProgress(_("Upgrading UTXO database..."), nPercentageDone);
+                nReportDone = nPercentageDone;
+            }
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoinsLegacy old;
+            ssValue >> old;
+            COutPoint outpoint(txid, 0);
+            for (size_t i = 0; i < old.vout.size(); ++i) {
+                if (!old.vout[i].IsNull() && !old.vout[i].scriptPubKey.IsUnspendable()) {
+                    outpoint.n = i;
+                    batch.Write(CoinEntry(&outpoint), Coin(std::move(old.vout[i]), old.nHeight, old.fCoinBase, old.fCoinStake));
+                    nBatched++;
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+            }
+            batch.Erase(std::make_pair(DB_COINS, txid));
+            nRecords++;
+            if (nBatched >= 100000) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch.Clear();
+                nBatched = 0;
             }
             pcursor->Next();
         } catch (const std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
-    return true;
+    if (!db.WriteBatch(batch))
+        return false;
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("Upgraded %u transaction records of the UTXO database%s\n", (unsigned int)nRecords, ShutdownRequested() ? " (interrupted)" : "");
+    return !ShutdownRequested();
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -208,6 +413,49 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
+namespace
+{
+/** A block index record parsed off the main thread, waiting to be linked into mapBlockIndex. */
+struct CParsedBlockIndex {
+    CDiskBlockIndex diskindex;
+    uint256 hash;
+};
+
+/**
+ * Deserialize the records in [nBegin, nEnd), hash their headers in batches
+ * and check proof of work where it applies. Only touches its own slice of
+ * vParsed, so several of these run at once.
+ */
+void ParseBlockIndexRecords(const std::vector<std::string>& vRecords, std::vector<CParsedBlockIndex>& vParsed,
+                            size_t nBegin, size_t nEnd, std::string& strError)
+{
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<uint256> vHashes;
+    try {
+        for (size_t nBatch = nBegin; nBatch < nEnd; nBatch += BLOCK_INDEX_HASH_BATCH) {
+            const size_t nBatchEnd = std::min(nEnd, nBatch + BLOCK_INDEX_HASH_BATCH);
+            vHeaders.clear();
+            for (size_t i = nBatch; i < nBatchEnd; i++) {
+                CMemoryReader reader(vRecords[i].data(), vRecords[i].size(), SER_DISK, CLIENT_VERSION);
+                reader >> vParsed[i].diskindex;
+                vHeaders.push_back(vParsed[i].diskindex.GetBlockHeader());
+            }
+            GetBlockHeaderHashes(vHeaders, vHashes);
+            for (size_t i = nBatch; i < nBatchEnd; i++) {
+                vParsed[i].hash = vHashes[i - nBatch];
+                if (vParsed[i].diskindex.nHeight <= Params().LAST_POW_BLOCK() &&
+                    !CheckProofOfWork(vParsed[i].hash, vParsed[i].diskindex.nBits)) {
+                    strError = strprintf("CheckProofOfWork failed: %s", vParsed[i].hash.ToString());
+                    return;
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Deserialize or I/O error - %s", e.what());
+    }
+}
+} // anon namespace
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -216,73 +464,79 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     ssKeySet << std::make_pair('b', uint256(0));
     pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
-    uint256 nPreviousCheckpoint;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
-                pindexNew->nHeight = diskindex.nHeight;
-                pindexNew->nFile = diskindex.nFile;
-                pindexNew->nDataPos = diskindex.nDataPos;
-                pindexNew->nUndoPos = diskindex.nUndoPos;
-                pindexNew->nVersion = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime = diskindex.nTime;
-                pindexNew->nBits = diskindex.nBits;
-                pindexNew->nNonce = diskindex.nNonce;
-                pindexNew->nStatus = diskindex.nStatus;
-                pindexNew->nTx = diskindex.nTx;
-
-                //zerocoin
-                pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
-                pindexNew->mapZerocoinSupply = diskindex.mapZerocoinSupply;
-                pindexNew->vMintDenominationsInBlock = diskindex.vMintDenominationsInBlock;
-
-                //Proof Of Stake
-                pindexNew->nMint = diskindex.nMint;
-                pindexNew->nMoneySupply = diskindex.nMoneySupply;
-                pindexNew->nFlags = diskindex.nFlags;
-                if (!Params().IsStakeModifierV2(pindexNew->nHeight)) {
-                    pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                } else {
-                    pindexNew->nStakeModifierV2 = diskindex.nStakeModifierV2;
-                }
-                pindexNew->prevoutStake = diskindex.prevoutStake;
-                pindexNew->nStakeTime = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
-                if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
+    // Load mapBlockIndex. The database can only be walked by one thread, so
+    // records are copied out in chunks; parsing and hashing a chunk is split
+    // across threads, then a single thread links the entries together.
+    const int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    std::vector<std::string> vRecords;
+    std::vector<CParsedBlockIndex> vParsed;
+    int64_t nTimeRead = 0, nTimeParse = 0, nTimeLink = 0;
+    size_t nLoaded = 0;
+    bool fDone = false;
+    while (!fDone) {
+        int64_t nTimeStart = GetTimeMicros();
+        vRecords.clear();
+        while (vRecords.size() < BLOCK_INDEX_LOAD_CHUNK) {
+            boost::this_thread::interruption_point();
+            if (!pcursor->Valid()) {
+                fDone = true;
+                break;
+            }
+            try {
+                leveldb::Slice slKey = pcursor->key();
+                CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                ssKey >> chType;
+                if (chType != 'b') {
+                    fDone = true;
+                    break; // if shutdown requested or finished loading block index
                 }
-
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+            } catch (const std::exception& e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
-        } catch (const std::exception& e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            leveldb::Slice slValue = pcursor->value();
+            vRecords.push_back(std::string(slValue.data(), slValue.size()));
+            pcursor->Next();
+        }
+        int64_t nTimeRecords = GetTimeMicros();
+        nTimeRead += nTimeRecords - nTimeStart;
+
+        // Fresh entries for every chunk: a record only carries the fields its
+        // version and status call for, the rest must stay at their defaults.
+        vParsed.assign(vRecords.size(), CParsedBlockIndex());
+        const size_t nPerThread = (vRecords.size() + nThreads - 1) / nThreads;
+        std::vector<std::string> vErrors(nThreads);
+        {
+            boost::thread_group threads;
+            for (int t = 1; t < nThreads; t++) {
+                const size_t nBegin = std::min(vRecords.size(), t * nPerThread);
+                const size_t nEnd = std::min(vRecords.size(), nBegin + nPerThread);
+                threads.create_thread(boost::bind(&ParseBlockIndexRecords, boost::cref(vRecords), boost::ref(vParsed), nBegin, nEnd, boost::ref(vErrors[t])));
+            }
+            ParseBlockIndexRecords(vRecords, vParsed, 0, std::min(vRecords.size(), nPerThread), vErrors[0]);
+            threads.join_all();
+        }
+        for (const std::string& strError : vErrors) {
+            if (!strError.empty())
+                return error("LoadBlockIndex() : %s", strError);
+        }
+        int64_t nTimeParsed = GetTimeMicros();
+        nTimeParse += nTimeParsed - nTimeRecords;
+
+        mapBlockIndex.reserve(mapBlockIndex.size() + vParsed.size());
+        for (const CParsedBlockIndex& parsed : vParsed) {
+            InsertBlockIndex(parsed.hash, parsed.diskindex);
         }
+        nTimeLink += GetTimeMicros() - nTimeParsed;
+        nLoaded += vParsed.size();
     }
 
+    LogPrintf("%s: %u entries, read %.2fms, parse and hash %.2fms (%d threads), link %.2fms\n", __func__,
+        nLoaded, nTimeRead * 0.001, nTimeParse * 0.001, nThreads, nTimeLink * 0.001);
     return true;
 }
 
-CZerocoinDB::CZerocoinDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "zerocoin", nCacheSize, fMemory, fWipe)
+CZerocoinDB::CZerocoinDB(const CLevelDBProfile& profile, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "zerocoin", profile, fMemory, fWipe)
 {
 }
 
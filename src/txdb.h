@@ -17,7 +17,6 @@
 #include <utility>
 #include <vector>
 
-class CCoins;
 class uint256;
 
 //! -dbcache default (MiB)
@@ -26,6 +25,16 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -dbcompression default
+static const bool fDefaultDbCompression = true;
+//! -dbmaxopenfiles default (per database)
+static const int nDefaultDbMaxOpenFiles = 64;
+//! block index records whose hashes are computed together while loading
+static const size_t BLOCK_INDEX_HASH_BATCH = 1024;
+//! block index records read from the database before they are parsed in parallel
+static const size_t BLOCK_INDEX_LOAD_CHUNK = 64 * 1024;
+//! maximum number of threads parsing block index records at startup
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
 
 	struct CDiskTxPos : public CDiskBlockPos {
     unsigned int nTxOffset; // after header
@@ -55,27 +64,50 @@ static const int64_t nMinDbCache = 4;
     }
 };
 
+/** Add the outputs of one transaction to stats, and to ss which computes its hashSerialized. */
+void ApplyStats(CCoinsStats& stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs);
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
+    //! Statistics to store along with the best block, once it is statsPending.hashBlock
+    CRollingCoinsStats statsPending;
 
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(const CLevelDBProfile& profile, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Rewrite the per-transaction records of older versions as per-output ones.
+    bool Upgrade();
+
+    //! Read the UTXO set statistics stored with the best block; their hashBlock tells whether they are current.
+    bool ReadRollingStats(CRollingCoinsStats& stats) const;
+    //! Compute the UTXO set statistics with a pass over the whole database.
+    bool ComputeRollingStats(CRollingCoinsStats& stats) const;
+    //! Store stats with the best block when it is written as stats.hashBlock; any other best block drops the stored ones.
+    void SetRollingStats(const CRollingCoinsStats& stats) { statsPending = stats; }
+
+    //! Cursor at the first coin record; it reads the set as it is now, later writes are not seen through it.
+    leveldb::Iterator* NewCoinsCursor() const;
+
+    //! Read the outputs of the next transaction from a coins cursor; false past the last one. Throws on corrupt records.
+    static bool ReadNextTx(leveldb::Iterator* pcursor, uint256& hash, std::map<uint32_t, Coin>& outputs);
+
+    const CLevelDBWrapper& GetDB() const { return db; }
 };
 
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(const CLevelDBProfile& profile, bool fMemory = false, bool fWipe = false);
 
 private:
     CBlockTreeDB(const CBlockTreeDB&);
@@ -101,7 +133,7 @@ public:
 class CZerocoinDB : public CLevelDBWrapper
 {
 public:
-    CZerocoinDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CZerocoinDB(const CLevelDBProfile& profile, bool fMemory = false, bool fWipe = false);
 
 private:
     CZerocoinDB(const CZerocoinDB&);
@@ -127,4 +159,20 @@ public:
     bool WipeAccChecksums();
 };
 
+/**
+ * leveldb tuning of the databases init opens. The chainstate is read by point
+ * lookups of mostly missing keys, so it keeps small blocks and its bloom
+ * filter. The block index is scanned in full at startup and otherwise only
+ * hit by txindex lookups, so it uses larger blocks, which compress better.
+ * The zerocoin and spork databases are small and get a fixed budget.
+ */
+struct CDBProfiles {
+    CLevelDBProfile coins;
+    CLevelDBProfile blockTree;
+    CLevelDBProfile zerocoin;
+    CLevelDBProfile spork;
+
+    CDBProfiles(size_t nCoinDBCache, size_t nBlockTreeDBCache, bool fCompression, int nMaxOpenFiles);
+};
+
 #endif // BITCOIN_TXDB_H
@@ -9,6 +9,10 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "amount.h"
 #include "coins.h"
@@ -16,6 +20,9 @@
 #include "sync.h"
 #include "random.h"
 
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -31,11 +38,18 @@ inline bool AllowFree(double dPriority)
 }
 
 
-/** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
-static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
+/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8); fits Coin's 30-bit height */
+static const unsigned int MEMPOOL_HEIGHT = 0x3FFFFFFF;
 
 /**
  * CTxMemPool stores these:
+ *
+ * Besides the transaction, an entry keeps the count, size and modified fees
+ * (fees plus any PrioritiseTransaction delta) of itself together with all its
+ * in-mempool descendants, and likewise with all its in-mempool ancestors.
+ * It also counts how many of itself and its descendants are protected from
+ * eviction (see CTxMemPool::SetProtected).
+ * CTxMemPool keeps them up to date as transactions enter and leave the pool.
  */
 class CTxMemPoolEntry
 {
@@ -44,9 +58,25 @@ private:
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and total memory usage
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount feeDelta;     //! Fee delta set by PrioritiseTransaction
+    bool fProtected;      //! Evicted only after all unprotected packages
+
+    // Information about descendants of this transaction that are in the
+    // mempool; if we remove this transaction we must remove all of these
+    // descendants as well.
+    uint64_t nCountWithDescendants;  //! number of descendant transactions, including this one
+    uint64_t nSizeWithDescendants;   //! ... and size
+    CAmount nModFeesWithDescendants; //! ... and total modified fees
+    uint64_t nProtectedWithDescendants; //! ... and how many of them are protected
+
+    // Analogous statistics for ancestor transactions
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
@@ -59,9 +89,179 @@ public:
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    CAmount GetModifiedFee() const { return nFee + feeDelta; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
+    bool IsProtected() const { return fProtected; }
+
+    // Adjusts the descendant state
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int64_t modifyProtected);
+    // Marks this transaction protected or not, adjusting the descendant state
+    void SetProtected(bool fProtectedIn);
+    // Adjusts the ancestor state
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    // Updates the fee delta used for mining priority score, and the
+    // modified fees with descendants and ancestors.
+    void UpdateFeeDelta(CAmount feeDelta);
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+    uint64_t GetProtectedWithDescendants() const { return nProtectedWithDescendants; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+};
+
+// Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
+struct update_descendant_state {
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount, int64_t _modifyProtected = 0) : modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount), modifyProtected(_modifyProtected)
+    {
+    }
+
+    void operator()(CTxMemPoolEntry& e)
+    {
+        e.UpdateDescendantState(modifySize, modifyFee, modifyCount, modifyProtected);
+    }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+    int64_t modifyProtected;
+};
+
+struct update_ancestor_state {
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) : modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {
+    }
+
+    void operator()(CTxMemPoolEntry& e)
+    {
+        e.UpdateAncestorState(modifySize, modifyFee, modifyCount);
+    }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_protected {
+    update_protected(bool _fProtected) : fProtected(_fProtected) {}
+
+    void operator()(CTxMemPoolEntry& e) { e.SetProtected(fProtected); }
+
+private:
+    bool fProtected;
+};
+
+struct update_fee_delta {
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) {}
+
+    void operator()(CTxMemPoolEntry& e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
+};
+
+// extracts a transaction hash from CTxMempoolEntry or CTransaction
+struct mempoolentry_txid {
+    typedef uint256 result_type;
+    result_type operator()(const CTxMemPoolEntry& entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
+};
+
+/**
+ * Sort an entry by max(feerate of entry's tx, feerate with all descendants),
+ * lowest first; the entries at the start are the first to evict. Entries
+ * whose removal would take a protected transaction with them come after all
+ * others.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fAProtected = a.GetProtectedWithDescendants() != 0;
+        bool fBProtected = b.GetProtectedWithDescendants() != 0;
+        if (fAProtected != fBProtected)
+            return fBProtected;
+
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+
+        if (f1 == f2) {
+            // Newer entries go first, then break ties by hash.
+            if (a.GetTime() != b.GetTime())
+                return a.GetTime() > b.GetTime();
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        }
+        return f1 < f2;
+    }
+
+    // Calculate which score to use for an entry (avoiding division).
+    bool UseDescendantScore(const CTxMemPoolEntry& a) const
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/** Sort by entry time, oldest first. */
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
 };
 
-class CMinerPolicyEstimator;
+/**
+ * Sort by feerate of the entry together with all its ancestors, highest
+ * first; a transaction can only be mined with its ancestors.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double aFees = a.GetModFeesWithAncestors();
+        double aSize = a.GetSizeWithAncestors();
+
+        double bFees = b.GetModFeesWithAncestors();
+        double bSize = b.GetSizeWithAncestors();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+// Multi_index tag names
+struct descendant_score {};
+struct entry_time {};
+struct ancestor_score {};
+
+class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
 class CInPoint
@@ -93,20 +293,99 @@ public:
  * are added to the pool: if a new transaction double-spends
  * an input of a transaction in the pool, it is dropped,
  * as are non-standard transactions.
+ *
+ * mapTx is a boost::multi_index that sorts the mempool on 4 criteria:
+ * - transaction hash
+ * - feerate with descendants, lowest first (see CompareTxMemPoolEntryByDescendantScore)
+ * - time in mempool
+ * - feerate with ancestors, highest first (see CompareTxMemPoolEntryByAncestorFee)
+ *
+ * mapLinks holds the in-mempool parents and children of each entry. The
+ * ancestor and descendant state of the entries is kept up to date when
+ * transactions are added, removed or prioritised:
+ * - a new transaction is assumed to have no in-mempool children, so only its
+ *   ancestors' descendant state changes;
+ * - removing a transaction together with its descendants only changes the
+ *   descendant state of the ancestors left behind;
+ * - removing a transaction mined in a block leaves its descendants, whose
+ *   ancestor state is updated as well.
+ * Transactions of a disconnected block that return to the mempool may have
+ * children there already; UpdateTransactionsFromBlock links them up.
+ *
+ * Zerocoin spends have no outpoint inputs, so they never have in-mempool parents.
  */
 class CTxMemPool
 {
 private:
     bool fSanityCheck; //! Normally false, true if -checkmempool or -regtest
     unsigned int nTransactionsUpdated;
-    CMinerPolicyEstimator* minerPolicyEstimator;
+    CBlockPolicyEstimator* minerPolicyEstimator;
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    void trackPackageRemoved(const CFeeRate& rate);
 
 public:
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            // sorted by txid
+            boost::multi_index::ordered_unique<mempoolentry_txid>,
+            // sorted by fee rate with descendants
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore>,
+            // sorted by entry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime>,
+            // sorted by fee rate with ancestors
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee> > >
+        indexed_transaction_set;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+
+    struct CompareIteratorByHash {
+        bool operator()(const txiter& a, const txiter& b) const
+        {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+    const setEntries& GetMemPoolParents(txiter entry) const;
+    const setEntries& GetMemPoolChildren(txiter entry) const;
+
+private:
+    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
+
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+
+public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
@@ -122,18 +401,62 @@ public:
     void check(const CCoinsViewCache* pcoins) const;
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
-    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
+    // addUnchecked must update the state of all ancestors of the entry being
+    // added; setAncestors is what CalculateMemPoolAncestors found for it. The
+    // variant without it calculates the ancestors without any limits.
+    // fCurrentEstimate is false while the chain is still syncing, when the
+    // fee estimator should not count the transaction.
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, setEntries& setAncestors, bool fCurrentEstimate = true);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, bool fCurrentEstimate = true);
     void remove(const CTransaction& tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
-    void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts);
+    void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
     void getTransactions(std::set<uint256>& setTxid);
-    void pruneSpent(const uint256& hash, CCoins& coins);
+    bool isSpent(const COutPoint& outpoint);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
 
+    /**
+     * Remove a set of transactions from the mempool. If a transaction is in
+     * this set, then all in-mempool descendants must also be in the set,
+     * unless this transaction is being removed for being in a block, in which
+     * case updateDescendants brings the state of the descendants left behind
+     * up to date.
+     */
+    void RemoveStaged(setEntries& stage, bool updateDescendants);
+
+    /**
+     * When adding transactions from a disconnected block back to the mempool,
+     * new mempool entries may have children in the mempool (which is generally
+     * not the case when otherwise adding transactions). UpdateTransactionsFromBlock
+     * updates the descendants and their ancestor state for the transactions
+     * in vHashesToUpdate, which were added back in this order.
+     */
+    void UpdateTransactionsFromBlock(const std::vector<uint256>& vHashesToUpdate);
+
+    /**
+     * Try to calculate all in-mempool ancestors of entry.
+     * (these are all calculated including the tx itself)
+     * limitAncestorCount = max number of ancestors
+     * limitAncestorSize = max size of ancestors
+     * limitDescendantCount = max number of descendants any ancestor can have
+     * limitDescendantSize = max size of descendants any ancestor can have
+     * errString = populated with error reason if any limits are hit
+     * fSearchForParents = whether to search a tx's vin for in-mempool parents, or
+     *   look up parents from mapLinks. Must be true for entries not in the mempool
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const;
+
+    /**
+     * Populate setDescendants with all in-mempool descendants of hash.
+     * Assumes that setDescendants includes all in-mempool descendants of anything
+     * already in it.
+     */
+    void CalculateDescendants(txiter it, setEntries& setDescendants) const;
+
     /** Affect CreateNewBlock prioritisation of transactions */
     void PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta);
     void ApplyDeltas(const uint256 hash, double& dPriorityDelta, CAmount& nFeeDelta);
@@ -158,6 +481,80 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+    /**
+     * The minimum fee to get into the mempool, which may itself not be
+     * enough for larger-sized transactions. It is raised to the feerate of
+     * the last package evicted by TrimToSize and then halves every
+     * ROLLING_FEE_HALFLIFE once a block has been connected, faster while
+     * the pool is well below sizelimit.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /**
+     * Protect a transaction in the pool (one with a SwiftX lock request) from
+     * eviction, or stop protecting it. A package that contains a protected
+     * transaction is only evicted once no other package is left, and is
+     * never expired.
+     */
+    void SetProtected(const uint256& hash, bool fProtected);
+
+    /**
+     * Remove transactions from the mempool until its dynamic size is <= sizelimit,
+     * evicting the packages with the lowest descendant feerate first, and
+     * protected packages after all others.
+     * pvNoSpendsRemaining, if set, will be populated with the outpoints of
+     * transactions not in the mempool which are no longer spent by it.
+     */
+    void TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining = NULL);
+
+    /** Expire all transactions (and their dependencies) in the mempool older
+     * than time, except those whose removal would take a protected transaction
+     * with them. Return the number of removed transactions. */
+    int Expire(int64_t time);
+
+    size_t DynamicMemoryUsage() const;
+
+private:
+    /**
+     * UpdateForDescendants is used by UpdateTransactionsFromBlock to update
+     * the descendants for a single transaction that has been added to the
+     * mempool but may have child transactions in the mempool, eg during a
+     * chain reorg. setExclude is the set of descendant transactions in the
+     * mempool that must not be accounted for (because any descendants in
+     * setExclude were added to the mempool after the transaction being
+     * updated and hence their state is already reflected in the parent
+     * state).
+     *
+     * cachedDescendants will be updated with the descendants of the transaction
+     * being updated, so that future invocations don't need to walk the
+     * same transaction again, if encountered in another transaction chain.
+     */
+    void UpdateForDescendants(txiter updateIt, cacheMap& cachedDescendants, const std::set<uint256>& setExclude);
+    /** Update ancestors of hash to add/remove it as a descendant transaction. */
+    void UpdateAncestorsOf(bool add, txiter hash, setEntries& setAncestors);
+    /** Set ancestor state for an entry */
+    void UpdateEntryForAncestors(txiter it, const setEntries& setAncestors);
+    /**
+     * For each transaction being removed, update ancestors and any direct
+     * children. If updateDescendants is true, then also update in-mempool
+     * descendants' ancestor state.
+     */
+    void UpdateForRemoveFromMempool(const setEntries& entriesToRemove, bool updateDescendants);
+    /** Sever link between specified transaction and direct children. */
+    void UpdateChildrenForRemoval(txiter entry);
+    /**
+     * Before calling removeUnchecked for a given transaction,
+     * UpdateForRemoveFromMempool must be called on the entire (dependent) set
+     * of transactions being removed at the same time. We use each
+     * CTxMemPoolEntry's setMemPoolParents in order to walk ancestors of a
+     * given transaction that is removed, so we can't remove intermediate
+     * transactions in a chain before we've updated all the state for the
+     * removal.
+     */
+    void removeUnchecked(txiter entry);
+
+public:
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
@@ -180,8 +577,8 @@ protected:
 
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, CTxMemPool& mempoolIn);
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
 };
 
 #endif // BITCOIN_TXMEMPOOL_H
@@ -357,6 +357,11 @@ static void inline HashFinal(uint32_t& a, uint32_t& b, uint32_t& c)
 }
 
 uint64_t uint256::GetHash(const uint256& salt) const
+{
+    return GetHash(salt, 0);
+}
+
+uint64_t uint256::GetHash(const uint256& salt, uint32_t extra) const
 {
     uint32_t a, b, c;
     a = b = c = 0xdeadbeef + (WIDTH << 2);
@@ -371,6 +376,7 @@ uint64_t uint256::GetHash(const uint256& salt) const
     HashMix(a, b, c);
     a += pn[6] ^ salt.pn[6];
     b += pn[7] ^ salt.pn[7];
+    c += extra;
     HashFinal(a, b, c);
 
     return ((((uint64_t)b) << 32) | c);
@@ -0,0 +1,395 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "utxosnapshot.h"
+
+#include "chainparams.h"
+#include "checkpoints.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "hash.h"
+#include "main.h"
+#include "pow.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <map>
+#include <string.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+static const char UTXO_SNAPSHOT_MAGIC[5] = {'u', 't', 'x', 'o', (char)0xff};
+
+void CUTXOSnapshotHeader::SetNull()
+{
+    memset(pchMagic, 0, sizeof(pchMagic));
+    nVersion = 0;
+    memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    hashBlock = 0;
+    nHeight = 0;
+}
+
+void CUTXOSnapshotHeader::Init(const uint256& hashBlockIn, int nHeightIn)
+{
+    memcpy(pchMagic, UTXO_SNAPSHOT_MAGIC, sizeof(pchMagic));
+    nVersion = UTXO_SNAPSHOT_VERSION;
+    memcpy(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart));
+    hashBlock = hashBlockIn;
+    nHeight = nHeightIn;
+}
+
+bool CUTXOSnapshotHeader::IsValid(std::string& strError) const
+{
+    if (memcmp(pchMagic, UTXO_SNAPSHOT_MAGIC, sizeof(pchMagic)) != 0) {
+        strError = "not a UTXO snapshot";
+        return false;
+    }
+    if (nVersion != UTXO_SNAPSHOT_VERSION) {
+        strError = strprintf("unsupported snapshot version %d", nVersion);
+        return false;
+    }
+    if (memcmp(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart)) != 0) {
+        strError = "snapshot of another network";
+        return false;
+    }
+    return true;
+}
+
+namespace
+{
+void WriteStatsTrailer(CAutoFile& fileout, const CCoinsStats& stats, const uint256& hashSnapshot)
+{
+    fileout << stats.nTransactions << stats.nTransactionOutputs << stats.nTotalAmount << stats.hashSerialized << hashSnapshot;
+}
+
+/**
+ * Whether a key and value have the form of a record CZerocoinDB writes: a
+ * spent serial ('s') or a mint ('m') with the txid, or an accumulator
+ * checksum ('A') with its height.
+ */
+bool IsZerocoinRecord(const std::string& strKey, const std::string& strValue)
+{
+    switch (strKey[0]) {
+    case 's':
+    case 'm':
+        return strKey.size() == 1 + 32 && strValue.size() == 32;
+    case 'A':
+        return strKey.size() == 1 + 4 + sizeof(libzerocoin::CoinDenomination) && strValue.size() == 4;
+    default:
+        return false;
+    }
+}
+
+bool WriteSnapshot(CAutoFile& fileout, CUTXOSnapshotHeader& header, CCoinsStats& stats, uint256& hashSnapshot, std::string& strError)
+{
+    CHashWriter ssSnapshot(SER_GETHASH, PROTOCOL_VERSION);
+    boost::scoped_ptr<leveldb::Iterator> pcoinsCursor;
+    boost::scoped_ptr<leveldb::Iterator> pzerocoinCursor;
+    {
+        LOCK(cs_main);
+        // The databases have to hold the state at the tip. Their cursors keep
+        // seeing that state, so blocks can be connected while the coins are written.
+        FlushStateToDisk();
+        const CBlockIndex* pindexBase = chainActive.Tip();
+        if (pcoinsdbview->GetBestBlock() != pindexBase->GetBlockHash()) {
+            strError = "the coins database is not at the tip";
+            return false;
+        }
+        header.Init(pindexBase->GetBlockHash(), pindexBase->nHeight);
+        stats.hashBlock = header.hashBlock;
+        stats.nHeight = header.nHeight;
+        fileout << header;
+        ssSnapshot << header.hashBlock;
+        for (int nHeight = 1; nHeight <= pindexBase->nHeight; nHeight++) {
+            CDiskBlockIndex diskindex(chainActive[nHeight]);
+            // Block and undo files are not part of a snapshot.
+            diskindex.nStatus &= BLOCK_VALID_MASK;
+            fileout << diskindex;
+            ssSnapshot << diskindex;
+        }
+        pcoinsCursor.reset(pcoinsdbview->NewCoinsCursor());
+        pzerocoinCursor.reset(zerocoinDB->NewIterator());
+    }
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << stats.hashBlock;
+    uint256 hash;
+    std::map<uint32_t, Coin> outputs;
+    while (CCoinsViewDB::ReadNextTx(pcoinsCursor.get(), hash, outputs)) {
+        boost::this_thread::interruption_point();
+        ApplyStats(stats, ss, hash, outputs);
+        uint32_t nOutputs = outputs.size();
+        fileout << VARINT(nOutputs) << hash;
+        for (const auto& output : outputs) {
+            uint32_t n = output.first;
+            fileout << VARINT(n) << output.second;
+        }
+    }
+    uint32_t nEnd = 0;
+    fileout << VARINT(nEnd);
+    stats.hashSerialized = ss.GetHash();
+    ssSnapshot << stats.hashSerialized;
+
+    for (pzerocoinCursor->SeekToFirst(); pzerocoinCursor->Valid(); pzerocoinCursor->Next()) {
+        leveldb::Slice slKey = pzerocoinCursor->key();
+        leveldb::Slice slValue = pzerocoinCursor->value();
+        std::string strKey(slKey.data(), slKey.size()), strValue(slValue.data(), slValue.size());
+        if (!IsZerocoinRecord(strKey, strValue)) {
+            strError = "unknown record in the zerocoin database";
+            return false;
+        }
+        fileout << strKey << strValue;
+        ssSnapshot << strKey << strValue;
+    }
+    fileout << std::string();
+    hashSnapshot = ssSnapshot.GetHash();
+
+    WriteStatsTrailer(fileout, stats, hashSnapshot);
+    return true;
+}
+
+/**
+ * Read the snapshot at path, checking that its block index extends the
+ * genesis block and computing the stats of its coins and the hash of all
+ * its data. With fApply, the entries, coins and zerocoin records are also
+ * written to the node's databases; the caller then holds cs_main.
+ */
+bool ReadSnapshot(const boost::filesystem::path& path, bool fApply, CUTXOSnapshotHeader& header, CCoinsStats& stats, uint256& hashSnapshot, std::string& strError)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf("cannot open %s", path.string());
+        return false;
+    }
+
+    try {
+        filein >> header;
+        if (!header.IsValid(strError))
+            return false;
+        stats = CCoinsStats();
+        stats.hashBlock = header.hashBlock;
+        stats.nHeight = header.nHeight;
+        CHashWriter ssSnapshot(SER_GETHASH, PROTOCOL_VERSION);
+        ssSnapshot << header.hashBlock;
+
+        uint256 hashPrev = Params().HashGenesisBlock();
+        for (int nHeight = 1; nHeight <= header.nHeight; nHeight++) {
+            boost::this_thread::interruption_point();
+            CDiskBlockIndex diskindex;
+            filein >> diskindex;
+            ssSnapshot << diskindex;
+            const uint256 hash = diskindex.GetBlockHash();
+            if (diskindex.nHeight != nHeight || diskindex.hashPrev != hashPrev || diskindex.nTx == 0 ||
+                (diskindex.nStatus & ~BLOCK_VALID_MASK) || !diskindex.IsValid(BLOCK_VALID_SCRIPTS)) {
+                strError = strprintf("block index entry at height %d does not extend the chain", nHeight);
+                return false;
+            }
+            if (nHeight <= Params().LAST_POW_BLOCK() && !CheckProofOfWork(hash, diskindex.nBits)) {
+                strError = strprintf("CheckProofOfWork failed: %s", hash.ToString());
+                return false;
+            }
+            if (!Checkpoints::CheckBlock(nHeight, hash)) {
+                strError = strprintf("block %s at height %d does not match the checkpoint", hash.ToString(), nHeight);
+                return false;
+            }
+            if (fApply)
+                InsertBlockIndex(hash, diskindex);
+            hashPrev = hash;
+        }
+        if (hashPrev != header.hashBlock) {
+            strError = "the block index does not end at the snapshot block";
+            return false;
+        }
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << header.hashBlock;
+        CCoinsMapMemoryResource resource;
+        CCoinsMap mapCoins(0, CCoinsMap::hasher(), CCoinsMap::key_equal(), CCoinsMap::allocator_type(&resource));
+        std::map<uint32_t, Coin> outputs;
+        while (true) {
+            boost::this_thread::interruption_point();
+            uint32_t nOutputs = 0;
+            filein >> VARINT(nOutputs);
+            if (nOutputs == 0)
+                break;
+            uint256 hash;
+            filein >> hash;
+            outputs.clear();
+            for (uint32_t i = 0; i < nOutputs; i++) {
+                uint32_t n = 0;
+                filein >> VARINT(n);
+                filein >> outputs[n];
+            }
+            if (outputs.size() != nOutputs) {
+                strError = strprintf("duplicate outputs of %s", hash.ToString());
+                return false;
+            }
+            ApplyStats(stats, ss, hash, outputs);
+            if (!fApply)
+                continue;
+            for (auto& output : outputs) {
+                CCoinsCacheEntry& entry = mapCoins[COutPoint(hash, output.first)];
+                entry.coin = std::move(output.second);
+                entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            }
+            // Without a best block, the coins only take effect once the whole snapshot is in.
+            if (mapCoins.size() >= UTXO_SNAPSHOT_LOAD_BATCH && !pcoinsdbview->BatchWrite(mapCoins, uint256(0))) {
+                strError = "failed to write to the coins database";
+                return false;
+            }
+        }
+        if (!mapCoins.empty() && !pcoinsdbview->BatchWrite(mapCoins, uint256(0))) {
+            strError = "failed to write to the coins database";
+            return false;
+        }
+        stats.hashSerialized = ss.GetHash();
+        ssSnapshot << stats.hashSerialized;
+
+        CLevelDBBatch batch;
+        size_t nBatch = 0;
+        while (true) {
+            std::string strKey, strValue;
+            filein >> strKey;
+            if (strKey.empty())
+                break;
+            filein >> strValue;
+            if (!IsZerocoinRecord(strKey, strValue)) {
+                strError = "unknown record in the zerocoin data";
+                return false;
+            }
+            ssSnapshot << strKey << strValue;
+            if (!fApply)
+                continue;
+            batch.WriteRaw(strKey, strValue);
+            if (++nBatch >= UTXO_SNAPSHOT_LOAD_BATCH) {
+                if (!zerocoinDB->WriteBatch(batch)) {
+                    strError = "failed to write to the zerocoin database";
+                    return false;
+                }
+                batch.Clear();
+                nBatch = 0;
+            }
+        }
+        if (nBatch > 0 && !zerocoinDB->WriteBatch(batch)) {
+            strError = "failed to write to the zerocoin database";
+            return false;
+        }
+
+        hashSnapshot = ssSnapshot.GetHash();
+
+        CCoinsStats statsFile;
+        uint256 hashSnapshotFile;
+        filein >> statsFile.nTransactions >> statsFile.nTransactionOutputs >> statsFile.nTotalAmount >> statsFile.hashSerialized >> hashSnapshotFile;
+        if (statsFile.nTransactions != stats.nTransactions || statsFile.nTransactionOutputs != stats.nTransactionOutputs ||
+            statsFile.nTotalAmount != stats.nTotalAmount || statsFile.hashSerialized != stats.hashSerialized || hashSnapshotFile != hashSnapshot) {
+            strError = "the snapshot's totals do not match its coins";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("deserialize or I/O error - %s", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool CanLoadSnapshot(std::string& strError)
+{
+    AssertLockHeld(cs_main);
+    if (!fPruneMode) {
+        strError = "loading a UTXO snapshot requires -prune, as the blocks below it are never downloaded";
+        return false;
+    }
+    if (fReindex || chainActive.Height() != 0) {
+        strError = "a UTXO snapshot can only be loaded before the first block is connected";
+        return false;
+    }
+    boost::scoped_ptr<leveldb::Iterator> pcursor(pcoinsdbview->NewCoinsCursor());
+    uint256 hash;
+    std::map<uint32_t, Coin> outputs;
+    try {
+        if (CCoinsViewDB::ReadNextTx(pcursor.get(), hash, outputs)) {
+            strError = "the coins database is not empty";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("coins database error - %s", e.what());
+        return false;
+    }
+    return true;
+}
+} // anon namespace
+
+bool DumpTxOutSet(const boost::filesystem::path& path, CUTXOSnapshotHeader& header, CCoinsStats& stats, uint256& hashSnapshot, std::string& strError)
+{
+    if (boost::filesystem::exists(path)) {
+        strError = strprintf("%s already exists", path.string());
+        return false;
+    }
+    // Written under another name, so that a snapshot that is found is complete.
+    const boost::filesystem::path pathTemp = path.string() + ".incomplete";
+    CAutoFile fileout(fopen(pathTemp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = strprintf("cannot open %s for writing", pathTemp.string());
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    bool fOk;
+    try {
+        fOk = WriteSnapshot(fileout, header, stats, hashSnapshot, strError);
+        if (fOk)
+            FileCommit(fileout.Get());
+    } catch (const std::exception& e) {
+        strError = strprintf("deserialize or I/O error - %s", e.what());
+        fOk = false;
+    }
+    fileout.fclose();
+    if (!fOk || !RenameOver(pathTemp, path)) {
+        if (fOk)
+            strError = strprintf("cannot rename %s", pathTemp.string());
+        boost::filesystem::remove(pathTemp);
+        return false;
+    }
+    LogPrintf("Wrote UTXO snapshot of block %s at height %d, %u outputs, to %s in %dms\n",
+        header.hashBlock.ToString(), header.nHeight, stats.nTransactionOutputs, path.string(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool LoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected, CUTXOSnapshotHeader& header, CCoinsStats& stats, uint256& hashSnapshot, std::string& strError)
+{
+    {
+        LOCK(cs_main);
+        if (!CanLoadSnapshot(strError))
+            return false;
+    }
+
+    // Check the whole snapshot before the node's state is touched.
+    int64_t nStart = GetTimeMillis();
+    if (!ReadSnapshot(path, false, header, stats, hashSnapshot, strError))
+        return false;
+    if (hashSnapshot != hashExpected) {
+        strError = strprintf("the snapshot's hash %s does not match the expected %s", hashSnapshot.ToString(), hashExpected.ToString());
+        return false;
+    }
+    LogPrintf("Checked UTXO snapshot of block %s at height %d in %dms, loading it\n", header.hashBlock.ToString(), header.nHeight, GetTimeMillis() - nStart);
+
+    LOCK(cs_main);
+    if (!CanLoadSnapshot(strError))
+        return false;
+    if (!ReadSnapshot(path, true, header, stats, hashSnapshot, strError) || hashSnapshot != hashExpected) {
+        if (strError.empty())
+            strError = "the snapshot changed while it was loaded";
+        strError += "; its data may have been partly written, restart with -reindex";
+        return false;
+    }
+    BlockMap::iterator it = mapBlockIndex.find(header.hashBlock);
+    if (it == mapBlockIndex.end() || !ActivateSnapshotChain(it->second, strError))
+        return false;
+    LogPrintf("Loaded UTXO snapshot of block %s at height %d, %u outputs, in %dms\n",
+        header.hashBlock.ToString(), header.nHeight, stats.nTransactionOutputs, GetTimeMillis() - nStart);
+    return true;
+}
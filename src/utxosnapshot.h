@@ -0,0 +1,84 @@
+// Copyright (c) 2020 The Kabberry developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTXOSNAPSHOT_H
+#define BITCOIN_UTXOSNAPSHOT_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+struct CCoinsStats;
+
+//! Version of the UTXO snapshot format written by DumpTxOutSet
+static const uint16_t UTXO_SNAPSHOT_VERSION = 2;
+//! Coins or zerocoin records written to a database at once while loading a snapshot
+static const size_t UTXO_SNAPSHOT_LOAD_BATCH = 100000;
+
+/**
+ * Start of a UTXO snapshot file. It is followed by
+ * - the block index entries of the active chain from height 1 up to hashBlock,
+ *   without block file positions
+ * - the coins, grouped per transaction in database order: VARINT(number of
+ *   outputs), the txid, then VARINT(index) and the Coin of each output; a
+ *   group of 0 outputs ends them
+ * - the records of the zerocoin database as key and value strings; an empty
+ *   key ends them
+ * - the number of transactions and outputs, the total amount and the
+ *   hash_serialized_2 of the coins, as gettxoutsetinfo reports them at hashBlock
+ * - the snapshot hash: the hash of hashBlock, the block index entries as
+ *   serialized for hashing, hash_serialized_2 and the zerocoin records. Unlike
+ *   hash_serialized_2, it commits to everything a loaded snapshot writes.
+ */
+class CUTXOSnapshotHeader
+{
+public:
+    char pchMagic[5];
+    uint16_t nVersion;
+    unsigned char pchMessageStart[4];
+    uint256 hashBlock;
+    int nHeight;
+
+    CUTXOSnapshotHeader()
+    {
+        SetNull();
+    }
+
+    void SetNull();
+    //! Set the magic bytes, version and network for a snapshot of hashBlockIn.
+    void Init(const uint256& hashBlockIn, int nHeightIn);
+    //! Whether this is a snapshot of a supported version for the current network.
+    bool IsValid(std::string& strError) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn)
+    {
+        READWRITE(FLATDATA(pchMagic));
+        READWRITE(nVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+    }
+};
+
+/**
+ * Write a snapshot of the chain state at the active tip to path; stats receive
+ * what gettxoutsetinfo reports and hashSnapshot the hash of the whole snapshot.
+ */
+bool DumpTxOutSet(const boost::filesystem::path& path, CUTXOSnapshotHeader& header, CCoinsStats& stats, uint256& hashSnapshot, std::string& strError);
+
+/**
+ * Check the snapshot at path against hashExpected, the snapshot hash a
+ * trusted node reports for the snapshot block, and make it the chain state.
+ * Only possible in prune mode, before any block has been connected.
+ */
+bool LoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected, CUTXOSnapshotHeader& header, CCoinsStats& stats, uint256& hashSnapshot, std::string& strError);
+
+#endif // BITCOIN_UTXOSNAPSHOT_H
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Kabberry developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+"""
+Tests that a pruned node can stake coins whose blocks are gone.
+Two nodes, starting from the PoS cache (330 blocks):
+  - nodes[1] runs with -prune=1 -fastprune (reindexed, as the cache keeps a
+    txindex), so its blocks go to small files that can be pruned by RPC.
+  - nodes[0] stakes the chain past the blocks that have to be kept, while
+    nodes[1] only follows it: all of its coins stay in blocks up to 330.
+  - nodes[1] prunes those blocks and stakes a block of its own, spending a
+    coin from a pruned block. nodes[0] accepts it.
+"""
+
+from test_framework.authproxy import JSONRPCException
+from test_framework.test_framework import KabberryTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_greater_than,
+    assert_raises_rpc_error,
+    connect_nodes_bi,
+    set_node_times,
+    sync_blocks,
+)
+
+class PrunedStakeTest(KabberryTestFramework):
+
+    def set_test_params(self):
+        self.num_nodes = 2
+        self.extra_args = [[], ["-prune=1", "-fastprune", "-reindex"]]
+
+    def setup_chain(self):
+        # Start with PoS cache: 330 blocks
+        self._initialize_chain(toPosPhase=True)
+        self.enable_mocktime()
+
+    def setup_network(self):
+        self.setup_nodes()
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.sync_all()
+
+    def stake_one(self, node_id):
+        """ Stake a block with nodes[node_id], giving up after a bounded number of attempts """
+        for _ in range(60):
+            try:
+                self.nodes[node_id].generate(1)
+                self.mocktime += 60
+                set_node_times(self.nodes, self.mocktime)
+                return
+            except JSONRPCException as e:
+                if "Couldn't create new block" not in str(e):
+                    raise e
+                self.mocktime += 1
+                set_node_times(self.nodes, self.mocktime)
+        raise AssertionError("Node %d unable to stake" % node_id)
+
+    def run_test(self):
+        assert_equal(self.nodes[1].getblockcount(), 330)
+        assert self.nodes[1].getblockchaininfo()["pruned"]
+        assert_raises_rpc_error(-1, "Blockchain is too short for pruning", self.nodes[1].pruneblockchain, 300)
+
+        # Blocks within 288 of the tip are kept, so the tip has to reach 330 + 288
+        self.log.info("Staking 290 blocks with node 0...")
+        set_node_times(self.nodes, self.mocktime)
+        for i in range(290):
+            self.stake_one(0)
+            if i % 50 == 49:
+                sync_blocks(self.nodes)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[1].getblockcount(), 620)
+
+        # All the coins of node 1 were made in blocks that are going to be pruned
+        utxos = self.nodes[1].listunspent()
+        assert_greater_than(len(utxos), 0)
+        assert all(u["confirmations"] > 620 - 330 for u in utxos)
+
+        self.log.info("Pruning node 1...")
+        assert_equal(self.nodes[1].pruneblockchain(620), 620 - 288)
+        pruneheight = self.nodes[1].getblockchaininfo()["pruneheight"]
+        assert_greater_than(pruneheight, 330)
+        assert_raises_rpc_error(-32603, "Block not available (pruned data)",
+                                self.nodes[1].getblock, self.nodes[1].getblockhash(330))
+
+        self.log.info("Staking a block with node 1...")
+        self.stake_one(1)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[0].getblockcount(), 621)
+        assert_equal(self.nodes[0].getbestblockhash(), self.nodes[1].getbestblockhash())
+
+        # The stake input comes from a block that node 1 no longer has
+        block = self.nodes[1].getblock(self.nodes[1].getbestblockhash())
+        assert_greater_than(len(block["tx"]), 1)
+        coinstake = self.nodes[1].decoderawtransaction(self.nodes[1].gettransaction(block["tx"][1])["hex"])
+        stake_from = self.nodes[1].gettransaction(coinstake["vin"][0]["txid"])
+        stake_from_height = self.nodes[1].getblockcount() - stake_from["confirmations"] + 1
+        assert_greater_than(pruneheight, stake_from_height)
+        self.log.info("Stake input from pruned height %d accepted." % stake_from_height)
+
+
+if __name__ == '__main__':
+    PrunedStakeTest().main()
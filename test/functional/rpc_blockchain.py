@@ -7,6 +7,7 @@
 Test the following RPCs:
     - getblockchaininfo
     - gettxoutsetinfo
+    - dumptxoutset
     - getdifficulty
     - getbestblockhash
     - getblockhash
@@ -40,6 +41,7 @@ class BlockchainTest(KabberryTestFramework):
     def run_test(self):
         #self._test_getblockchaininfo()
         self._test_gettxoutsetinfo()
+        self._test_dumptxoutset()
         self._test_getblockheader()
         #self._test_getdifficulty()
         self.nodes[0].verifychain(0)
@@ -66,12 +68,36 @@ class BlockchainTest(KabberryTestFramework):
         res = node.gettxoutsetinfo()
 
         assert_equal(res['total_amount'], Decimal('50000.00000000'))
-        assert_equal(res['transactions'], 200)
         assert_equal(res['height'], 200)
         assert_equal(res['txouts'], 200)
-        assert_equal(res['bytes_serialized'], 14073),
         assert_equal(len(res['bestblock']), 64)
-        assert_equal(len(res['hash_serialized']), 64)
+        assert_equal(len(res['muhash']), 64)
+        assert 'transactions' not in res
+        assert 'hash_serialized_2' not in res
+
+        # The full pass agrees with the statistics kept up to date with the chain
+        res2 = node.gettxoutsetinfo("hash_serialized_2")
+        assert_equal(res2['transactions'], 200)
+        for key in ['total_amount', 'height', 'txouts', 'bytes_serialized', 'bestblock']:
+            assert_equal(res2[key], res[key])
+        assert_equal(len(res2['hash_serialized_2']), 64)
+        assert 'muhash' not in res2
+
+        # The hash of the old format is gone, not silently replaced
+        assert_raises_rpc_error(-8, "Invalid hash_type", node.gettxoutsetinfo, "hash_serialized")
+
+    def _test_dumptxoutset(self):
+        node = self.nodes[0]
+        res = node.dumptxoutset("utxo.dat")
+        stats = node.gettxoutsetinfo("hash_serialized_2")
+
+        assert_equal(res['height'], 200)
+        assert_equal(res['bestblock'], stats['bestblock'])
+        assert_equal(res['transactions'], stats['transactions'])
+        assert_equal(res['txouts'], stats['txouts'])
+        assert_equal(res['hash_serialized_2'], stats['hash_serialized_2'])
+        assert_equal(res['total_amount'], stats['total_amount'])
+        assert_is_hash_string(res['snapshot_hash'])
 
     def _test_getblockheader(self):
         node = self.nodes[0]
@@ -75,6 +75,7 @@ BASE_SCRIPTS= [
     'feature_proxy.py',                         # ~ 143 sec
     'feature_uacomment.py',                     # ~ 130 sec
     'mining_pos_fakestake.py',                  # ~ 123 sec
+    'mining_pos_pruned.py',
     'wallet_import_stakingaddress.py',          # ~ 123 sec
 
     # vv Tests less than 2m vv
@@ -96,6 +97,7 @@ BASE_SCRIPTS= [
     'mempool_resurrect.py',                     # ~ 51 sec
     'rpc_budget.py',                            # ~ 50 sec
     'mempool_spend_coinbase.py',                # ~ 50 sec
+    'mempool_persist.py',                       # ~ 50 sec
     'rpc_signrawtransaction.py',                # ~ 50 sec
     'rpc_decodescript.py',                      # ~ 50 sec
     'rpc_blockchain.py',                        # ~ 50 sec
@@ -111,7 +113,6 @@ BASE_SCRIPTS= [
     # 'mempool_limit.py', # We currently don't limit our mempool_reorg
     # 'interface_zmq.py',
     # 'rpc_getchaintips.py',
-    # 'mempool_persist.py',
     # 'rpc_users.py',
     # 'rpc_deprecated.py',
     # 'p2p_mempool.py',